@@ -22,7 +22,7 @@ static enum hxb_error_code read_analog(struct hxb_value* value)
 
 static const char ep_analogread_name[] PROGMEM = "Analog reader";
 ENDPOINT_DESCRIPTOR endpoint_analogread = {
-	.datatype = HXB_DTYPE_FLOAT,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_ANALOGREAD),
 	.eid = EP_ANALOGREAD,
 	.name = ep_analogread_name,
 	.read = read_analog,
@@ -37,7 +37,7 @@ static enum hxb_error_code read_lightsensor(struct hxb_value* value)
 
 static const char ep_lightsensor_name[] PROGMEM = "Lightsensor";
 ENDPOINT_DESCRIPTOR endpoint_lightsensor = {
-	.datatype = HXB_DTYPE_FLOAT,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_LIGHTSENSOR),
 	.eid = EP_LIGHTSENSOR,
 	.name = ep_lightsensor_name,
 	.read = read_lightsensor,
@@ -39,7 +39,7 @@ static enum hxb_error_code read(struct hxb_value* value)
 
 static const char ep_name[] RODATA = "Hexabus Socket Pushbutton";
 ENDPOINT_DESCRIPTOR endpoint_sysbutton = {
-	.datatype = HXB_DTYPE_BOOL,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_BUTTON),
 	.eid = EP_BUTTON,
 	.name = ep_name,
 	.read = read,
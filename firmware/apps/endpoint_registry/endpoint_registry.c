@@ -10,6 +10,32 @@
 
 struct endpoint_registry_entry* _endpoint_chain = 0;
 
+#if ENDPOINT_REGISTRY_DEBUG
+// descriptors using HXB_ENDPOINT_DATATYPE always match the registry, this catches the ones that do not
+#define HXB_ENDPOINT_TABLE_ATTR RODATA
+#include "endpoint_table.h"
+
+static uint8_t registry_datatype(uint32_t eid)
+{
+	uint16_t first = 0, last = HXB_ENDPOINT_TABLE_SIZE;
+
+	while (first < last) {
+		uint16_t mid = first + (last - first) / 2;
+		struct hxb_endpoint_table_entry entry;
+		memcpy_from_rodata(&entry, &hxb_endpoint_table[mid], sizeof(entry));
+
+		if (entry.eid == eid)
+			return entry.datatype;
+		else if (entry.eid < eid)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	return HXB_DTYPE_UNDEFINED;
+}
+#endif
+
 static uint32_t descriptor_eid(struct endpoint_registry_entry* entry)
 {
 	struct endpoint_descriptor ep = {};
@@ -63,6 +89,11 @@ void _endpoint_register(const struct endpoint_descriptor* ep, struct endpoint_re
 			syslog(LOG_DEBUG, "Endpoint %lu has no correct datatype, ignoring", ep_copy.eid);
 			return;
 	}
+
+	if (registry_datatype(ep_copy.eid) != HXB_DTYPE_UNDEFINED && registry_datatype(ep_copy.eid) != ep_copy.datatype) {
+		syslog(LOG_DEBUG, "Endpoint %lu has datatype %u, the endpoint registry says %u",
+				ep_copy.eid, ep_copy.datatype, registry_datatype(ep_copy.eid));
+	}
 #endif
 
 	chain_link->descriptor = ep;
@@ -4,10 +4,13 @@
 #include "hexabus_config.h"
 
 #include "hexabus_packet.h"
+#include "endpoint_table.h"
 
 typedef enum hxb_error_code (*endpoint_read_fn)(struct hxb_value* value);
 typedef enum hxb_error_code (*endpoint_write_fn)(const struct hxb_envelope* value);
 
+// Descriptors of endpoints in the endpoint registry take their datatype from there:
+//   .datatype = HXB_ENDPOINT_DATATYPE(EP_POWER_SWITCH),
 struct endpoint_descriptor {
 	uint8_t datatype;
 	uint32_t eid;
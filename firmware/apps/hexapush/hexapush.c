@@ -33,7 +33,7 @@ enum hxb_error_code read_clicked(struct hxb_value* value)
 }
 
 ENDPOINT_DESCRIPTOR endpoint_hexapush_pressed = {
-	.datatype = HXB_DTYPE_UINT8,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_HEXAPUSH_PRESSED),
 	.eid = EP_HEXAPUSH_PRESSED,
 	.name = ep_pressed,
 	.read = read_pressed,
@@ -41,7 +41,7 @@ ENDPOINT_DESCRIPTOR endpoint_hexapush_pressed = {
 };
 
 ENDPOINT_DESCRIPTOR endpoint_hexapush_clicked = {
-	.datatype = HXB_DTYPE_UINT8,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_HEXAPUSH_CLICKED),
 	.eid = EP_HEXAPUSH_CLICKED,
 	.name = ep_clicked,
 	.read = read_clicked,
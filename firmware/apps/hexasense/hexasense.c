@@ -21,7 +21,7 @@ enum hxb_error_code read_state(struct hxb_value* value)
 }
 
 ENDPOINT_DESCRIPTOR endpoint_hexasense_state = {
-	.datatype = HXB_DTYPE_UINT8,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_HEXASENSE_BUTTON_STATE),
 	.eid = EP_HEXASENSE_BUTTON_STATE,
 	.name = ep_state,
 	.read = read_state,
@@ -39,7 +39,7 @@ static enum hxb_error_code write_set(const struct hxb_envelope* env)
 
 static const char ep_set_name[] PROGMEM = "Hexonoff, your friendly output setter.";
 ENDPOINT_DESCRIPTOR endpoint_hexonoff_set = {
-	.datatype = HXB_DTYPE_UINT8,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_HEXONOFF_SET),
 	.eid = EP_HEXONOFF_SET,
 	.name = ep_set_name,
 	.read = read,
@@ -54,7 +54,7 @@ static enum hxb_error_code write_toggle(const struct hxb_envelope* env)
 
 static const char ep_toggle_name[] PROGMEM = "Hexonoff, your friendly output toggler.";
 ENDPOINT_DESCRIPTOR endpoint_hexonoff_toggle = {
-	.datatype = HXB_DTYPE_UINT8,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_HEXONOFF_TOGGLE),
 	.eid = EP_HEXONOFF_TOGGLE,
 	.name = ep_toggle_name,
 	.read = read,
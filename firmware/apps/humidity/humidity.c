@@ -74,7 +74,7 @@ static enum hxb_error_code read(struct hxb_value* value)
 
 static const char ep_name[] PROGMEM = "Humidity sensor";
 ENDPOINT_DESCRIPTOR endpoint_humidity = {
-	.datatype = HXB_DTYPE_FLOAT,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_HUMIDITY),
 	.eid = EP_HUMIDITY,
 	.name = ep_name,
 	.read = read,
@@ -36,7 +36,7 @@ static enum hxb_error_code read(struct hxb_value* value)
 
 static const char ep_name[] PROGMEM = "IR remote control receiver";
 ENDPOINT_DESCRIPTOR endpoint_ir_receiver = {
-	.datatype = HXB_DTYPE_UINT32,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_IR_RECEIVER),
 	.eid = EP_IR_RECEIVER,
 	.name = ep_name,
 	.read = read,
@@ -92,7 +92,7 @@ static enum hxb_error_code read_power(struct hxb_value* value)
 
 static const char ep_power_name[] PROGMEM = "Power Meter";
 ENDPOINT_DESCRIPTOR endpoint_power = {
-	.datatype = HXB_DTYPE_UINT32,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_POWER_METER),
 	.eid = EP_POWER_METER,
 	.name = ep_power_name,
 	.read = read_power,
@@ -108,7 +108,7 @@ static enum hxb_error_code read_energy_total(struct hxb_value* value)
 
 static const char ep_energy_total_name[] PROGMEM = "Energy Meter Total";
 ENDPOINT_DESCRIPTOR endpoint_energy_total = {
-	.datatype = HXB_DTYPE_FLOAT,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_ENERGY_METER_TOTAL),
 	.eid = EP_ENERGY_METER_TOTAL,
 	.name = ep_energy_total_name,
 	.read = read_energy_total,
@@ -129,7 +129,7 @@ static enum hxb_error_code write_energy(const struct hxb_envelope* value)
 
 static const char ep_energy_name[] PROGMEM = "Energy Meter";
 ENDPOINT_DESCRIPTOR endpoint_energy = {
-	.datatype = HXB_DTYPE_FLOAT,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_ENERGY_METER),
 	.eid = EP_ENERGY_METER,
 	.name = ep_energy_name,
 	.read = read_energy,
@@ -127,7 +127,7 @@ static enum hxb_error_code write(const struct hxb_envelope* env)
 
 static const char ep_name[] PROGMEM = "Presence Detector";
 ENDPOINT_DESCRIPTOR endpoint_presence_detector = {
-	.datatype = HXB_DTYPE_UINT8,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_PRESENCE_DETECTOR),
 	.eid = EP_PRESENCE_DETECTOR,
 	.name = ep_name,
 	.read = read,
@@ -65,7 +65,7 @@ static enum hxb_error_code read(struct hxb_value* value)
 
 static const char ep_name[] PROGMEM = "Barometric pressure sensor";
 ENDPOINT_DESCRIPTOR endpoint_pressure = {
-	.datatype = HXB_DTYPE_FLOAT,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_PRESSURE),
 	.eid = EP_PRESSURE,
 	.name = ep_name,
 	.read = read,
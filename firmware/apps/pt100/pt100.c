@@ -99,7 +99,7 @@ static enum hxb_error_code read_cold(struct hxb_value* value)
 
 static const char ep_hot[] PROGMEM = "Heater inflow temperature";
 ENDPOINT_DESCRIPTOR endpoint_heater_hot = {
-	.datatype = HXB_DTYPE_FLOAT,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_HEATER_HOT),
 	.eid = EP_HEATER_HOT,
 	.name = ep_hot,
 	.read = read_hot,
@@ -108,7 +108,7 @@ ENDPOINT_DESCRIPTOR endpoint_heater_hot = {
 
 static const char ep_cold[] PROGMEM = "Heater outflow temperature";
 ENDPOINT_DESCRIPTOR endpoint_heater_cold = {
-	.datatype = HXB_DTYPE_FLOAT,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_HEATER_COLD),
 	.eid = EP_HEATER_COLD,
 	.name = ep_cold,
 	.read = read_cold,
@@ -171,7 +171,7 @@ static enum hxb_error_code write(const struct hxb_envelope* env)
 
 static const char ep_name[] PROGMEM = "Main Switch";
 ENDPOINT_DESCRIPTOR endpoint_relay = {
-	.datatype = HXB_DTYPE_BOOL,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_POWER_SWITCH),
 	.eid = EP_POWER_SWITCH,
 	.name = ep_name,
 	.read = read,
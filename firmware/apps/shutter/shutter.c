@@ -40,7 +40,7 @@ static enum hxb_error_code write(const struct hxb_envelope* env)
 
 static const char ep_name[] PROGMEM = "Window Shutter";
 ENDPOINT_DESCRIPTOR endpoint_shutter = {
-	.datatype = HXB_DTYPE_UINT8,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_SHUTTER),
 	.eid = EP_SHUTTER,
 	.name = ep_name,
 	.read = read,
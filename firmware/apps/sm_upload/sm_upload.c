@@ -41,7 +41,7 @@ static enum hxb_error_code write_control(const struct hxb_envelope* env)
 
 static const char ep_control_name[] RODATA = "Statemachine Control";
 ENDPOINT_DESCRIPTOR endpoint_sm_upload_control = {
-	.datatype = HXB_DTYPE_UINT8,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_SM_CONTROL),
 	.eid = EP_SM_CONTROL,
 	.name = ep_control_name,
 	.read = read_control,
@@ -82,7 +82,7 @@ static enum hxb_error_code write_receiver(const struct hxb_envelope* env)
 
 static const char ep_receiver_name[] RODATA = "Statemachine Upload Receiver";
 ENDPOINT_DESCRIPTOR endpoint_sm_upload_receiver = {
-	.datatype = HXB_DTYPE_65BYTES,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_SM_UP_RECEIVER),
 	.eid = EP_SM_UP_RECEIVER,
 	.name = ep_receiver_name,
 	.read = read_receiver,
@@ -97,7 +97,7 @@ static enum hxb_error_code read_acknack(struct hxb_value* value)
 
 static const char ep_acknack_name[] RODATA = "Statemachine Upload ACK/NAK";
 ENDPOINT_DESCRIPTOR endpoint_sm_upload_acknack = {
-	.datatype = HXB_DTYPE_BOOL,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_SM_UP_ACKNAK),
 	.eid = EP_SM_UP_ACKNAK,
 	.name = ep_acknack_name,
 	.read = read_acknack,
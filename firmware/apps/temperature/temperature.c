@@ -58,7 +58,7 @@ static enum hxb_error_code read(struct hxb_value* value)
 
 static const char ep_name[] PROGMEM = "Temperature Sensor";
 ENDPOINT_DESCRIPTOR endpoint_temperature = {
-	.datatype = HXB_DTYPE_FLOAT,
+	.datatype = HXB_ENDPOINT_DATATYPE(EP_TEMPERATURE),
 	.eid = EP_TEMPERATURE,
 	.name = ep_name,
 	.read = read,
@@ -0,0 +1,145 @@
+# -*- mode: cmake; -*-
+# - Generate endpoint tables from the endpoint registry
+#
+# Turns the endpoint registry (libhexabus/share/endpoint_registry, INFO format) into
+#  * a C++ table for libhexabus (included by libhexabus/builtin_endpoints.hpp)
+#  * a C table and datatype macros for the firmware (shared/endpoint_table.h)
+# Both tables are sorted by EID.
+#
+# USAGE:
+#   cmake -DREGISTRY=<registry file> [-DCXX_OUTPUT=<file>] [-DC_OUTPUT=<file>] -P GenerateEndpointTables.cmake
+#
+
+if(NOT REGISTRY)
+  message(FATAL_ERROR "REGISTRY not set")
+endif()
+
+set(_types BOOL UINT8 UINT32 UINT64 FLOAT 128STRING 65BYTES 16BYTES)
+
+file(STRINGS "${REGISTRY}" _lines)
+
+set(_eids)
+set(_in_block FALSE)
+set(_lineno 0)
+foreach(_line IN LISTS _lines)
+  math(EXPR _lineno "${_lineno} + 1")
+  # comments start with ; and run to the end of the line. descriptions never contain ;
+  string(REGEX REPLACE ";.*$" "" _line "${_line}")
+  string(STRIP "${_line}" _line)
+
+  if("${_line}" STREQUAL "")
+  elseif(NOT _in_block)
+    if(NOT "${_line}" MATCHES "^eid[ \t]+([0-9]+)[ \t]*{$")
+      message(FATAL_ERROR "${REGISTRY}:${_lineno}: expected eid descriptor")
+    endif()
+    set(_eid ${CMAKE_MATCH_1})
+    list(FIND _eids ${_eid} _dup)
+    if(NOT _dup EQUAL -1)
+      message(FATAL_ERROR "${REGISTRY}:${_lineno}: duplicate descriptors for EID ${_eid}")
+    endif()
+    list(APPEND _eids ${_eid})
+    foreach(_key type description unit access function)
+      unset(_ep_${_eid}_${_key})
+    endforeach()
+    set(_in_block TRUE)
+  elseif("${_line}" STREQUAL "}")
+    foreach(_key type description access function)
+      if(NOT DEFINED _ep_${_eid}_${_key})
+        message(FATAL_ERROR "${REGISTRY}:${_lineno}: key '${_key}' not found for EID ${_eid}")
+      endif()
+    endforeach()
+    set(_in_block FALSE)
+  elseif("${_line}" MATCHES "^(description|unit)[ \t]+\"(.*)\"$")
+    set(_ep_${_eid}_${CMAKE_MATCH_1} "${CMAKE_MATCH_2}")
+  elseif("${_line}" MATCHES "^type[ \t]+([A-Z0-9]+)$")
+    list(FIND _types ${CMAKE_MATCH_1} _known)
+    if(_known EQUAL -1)
+      message(FATAL_ERROR "${REGISTRY}:${_lineno}: invalid type ${CMAKE_MATCH_1} for EID ${_eid}")
+    endif()
+    set(_ep_${_eid}_type "HXB_DTYPE_${CMAKE_MATCH_1}")
+  elseif("${_line}" MATCHES "^access[ \t]+(R|W|RW)$")
+    # matches EndpointDescriptor::Access
+    if("${CMAKE_MATCH_1}" STREQUAL "R")
+      set(_ep_${_eid}_access 1)
+    elseif("${CMAKE_MATCH_1}" STREQUAL "W")
+      set(_ep_${_eid}_access 2)
+    else()
+      set(_ep_${_eid}_access 3)
+    endif()
+  elseif("${_line}" MATCHES "^function[ \t]+(sensor|actor|infrastructure)$")
+    # matches EndpointDescriptor::Function
+    if("${CMAKE_MATCH_1}" STREQUAL "sensor")
+      set(_ep_${_eid}_function 0)
+    elseif("${CMAKE_MATCH_1}" STREQUAL "actor")
+      set(_ep_${_eid}_function 1)
+    else()
+      set(_ep_${_eid}_function 2)
+    endif()
+  else()
+    message(FATAL_ERROR "${REGISTRY}:${_lineno}: invalid line '${_line}'")
+  endif()
+endforeach()
+
+if(_in_block)
+  message(FATAL_ERROR "${REGISTRY}: unterminated descriptor for EID ${_eid}")
+endif()
+
+# list(SORT) is lexicographic, so sort by zero-padded keys
+set(_keyed)
+foreach(_eid IN LISTS _eids)
+  set(_key "${_eid}")
+  string(LENGTH "${_key}" _len)
+  while(_len LESS 10)
+    set(_key "0${_key}")
+    math(EXPR _len "${_len} + 1")
+  endwhile()
+  list(APPEND _keyed "${_key}")
+endforeach()
+list(SORT _keyed)
+set(_eids)
+foreach(_key IN LISTS _keyed)
+  math(EXPR _eid "${_key}")
+  list(APPEND _eids ${_eid})
+endforeach()
+
+get_filename_component(_registry_name "${REGISTRY}" NAME)
+
+if(CXX_OUTPUT)
+  set(_out "// Generated from ${_registry_name} by GenerateEndpointTables.cmake, do not edit.\n")
+  foreach(_eid IN LISTS _eids)
+    if(DEFINED _ep_${_eid}_unit)
+      set(_unit "\"${_ep_${_eid}_unit}\"")
+    else()
+      set(_unit "NULL")
+    endif()
+    set(_out "${_out}{ ${_eid}, ${_ep_${_eid}_type}, \"${_ep_${_eid}_description}\", ${_unit}, ${_ep_${_eid}_access}, ${_ep_${_eid}_function} },\n")
+  endforeach()
+  file(WRITE "${CXX_OUTPUT}.tmp" "${_out}")
+  execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different "${CXX_OUTPUT}.tmp" "${CXX_OUTPUT}")
+  file(REMOVE "${CXX_OUTPUT}.tmp")
+endif()
+
+if(C_OUTPUT)
+  list(LENGTH _eids _count)
+  set(_out "/* Generated from ${_registry_name} by GenerateEndpointTables.cmake, do not edit. */\n")
+  set(_out "${_out}#ifndef HXB_ENDPOINT_TABLE_H_\n#define HXB_ENDPOINT_TABLE_H_\n\n#include <stdint.h>\n\n")
+  set(_out "${_out}/* datatype of a registered endpoint, e.g. HXB_ENDPOINT_DATATYPE(EP_POWER_SWITCH). eid must expand to\n")
+  set(_out "${_out} * a literal of the form <eid>UL, eids that are not in the registry do not compile. */\n")
+  set(_out "${_out}#define HXB_ENDPOINT_DATATYPE(eid) HXB_ENDPOINT_DATATYPE_EXPAND(eid)\n")
+  set(_out "${_out}#define HXB_ENDPOINT_DATATYPE_EXPAND(eid) HXB_ENDPOINT_DATATYPE_ ## eid\n\n")
+  foreach(_eid IN LISTS _eids)
+    set(_out "${_out}#define HXB_ENDPOINT_DATATYPE_${_eid}UL ${_ep_${_eid}_type}\n")
+  endforeach()
+  set(_out "${_out}\nstruct hxb_endpoint_table_entry {\n\tuint32_t eid;\n\tuint8_t datatype;\n\tuint8_t access;\n};\n\n")
+  set(_out "${_out}#define HXB_ENDPOINT_TABLE_SIZE ${_count}\n\n#endif\n\n")
+  set(_out "${_out}/* the table itself is only defined where HXB_ENDPOINT_TABLE_ATTR is defined, e.g. as RODATA on AVR */\n")
+  set(_out "${_out}#if defined(HXB_ENDPOINT_TABLE_ATTR) && !defined(HXB_ENDPOINT_TABLE_DEFINED_)\n#define HXB_ENDPOINT_TABLE_DEFINED_\n\n")
+  set(_out "${_out}/* sorted by eid */\nstatic const struct hxb_endpoint_table_entry hxb_endpoint_table[HXB_ENDPOINT_TABLE_SIZE] HXB_ENDPOINT_TABLE_ATTR = {\n")
+  foreach(_eid IN LISTS _eids)
+    set(_out "${_out}\t{ ${_eid}UL, ${_ep_${_eid}_type}, ${_ep_${_eid}_access} },\n")
+  endforeach()
+  set(_out "${_out}};\n\n#endif\n")
+  file(WRITE "${C_OUTPUT}.tmp" "${_out}")
+  execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different "${C_OUTPUT}.tmp" "${C_OUTPUT}")
+  file(REMOVE "${C_OUTPUT}.tmp")
+endif()
@@ -0,0 +1,420 @@
+#include "data_sources.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/bind.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/property_tree/info_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+using namespace hexadaemon;
+
+ValueTable::ValueTable(size_t size)
+	: _slots(new Slot[size])
+{
+	for (size_t i = 0; i < size; i++) {
+		_slots[i].bits.store(0, std::memory_order_relaxed);
+		_slots[i].valid.store(false, std::memory_order_relaxed);
+	}
+}
+
+void ValueTable::publish(size_t slot, uint64_t bits)
+{
+	_slots[slot].bits.store(bits, std::memory_order_relaxed);
+	_slots[slot].valid.store(true, std::memory_order_release);
+}
+
+bool ValueTable::read(size_t slot, uint64_t& bits) const
+{
+	if (!_slots[slot].valid.load(std::memory_order_acquire))
+		return false;
+
+	bits = _slots[slot].bits.load(std::memory_order_relaxed);
+	return true;
+}
+
+DataSource::DataSource(uint32_t eid, const std::string& name, uint8_t datatype, Kind kind, const std::string& target)
+	: busy(false)
+	, _eid(eid)
+	, _name(name)
+	, _datatype(datatype)
+	, _kind(kind)
+	, _target(target)
+	, _interval(boost::posix_time::seconds(60))
+	, _field(0)
+	, _scale(1)
+	, _broadcast(true)
+{
+}
+
+std::string DataSource::readData() const
+{
+	std::string data;
+	char buffer[4096];
+
+	switch (_kind) {
+		case file: {
+			int fd = open(_target.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				throw hexabus::GenericException("Could not open " + _target + ": " + strerror(errno));
+
+			ssize_t len;
+			while ((len = read(fd, buffer, sizeof(buffer))) > 0 || (len < 0 && errno == EINTR)) {
+				if (len > 0)
+					data.append(buffer, len);
+			}
+			int err = errno;
+			close(fd);
+			if (len < 0)
+				throw hexabus::GenericException("Could not read " + _target + ": " + strerror(err));
+			break;
+		}
+
+		case command: {
+			FILE* out = popen(_target.c_str(), "r");
+			if (!out)
+				throw hexabus::GenericException("Could not run " + _target + ": " + strerror(errno));
+
+			size_t len;
+			while ((len = fread(buffer, 1, sizeof(buffer), out)) > 0)
+				data.append(buffer, len);
+
+			int status = pclose(out);
+			if (status != 0) {
+				std::ostringstream oss;
+				oss << "Command " << _target << " failed with status " << status;
+				throw hexabus::GenericException(oss.str());
+			}
+			break;
+		}
+
+		case unix_socket: {
+			struct sockaddr_un addr;
+			memset(&addr, 0, sizeof(addr));
+			addr.sun_family = AF_UNIX;
+			if (_target.size() >= sizeof(addr.sun_path))
+				throw hexabus::GenericException("Socket path too long: " + _target);
+			strcpy(addr.sun_path, _target.c_str());
+
+			int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if (fd < 0)
+				throw hexabus::GenericException(std::string("Could not create socket: ") + strerror(errno));
+
+			// a source that does not answer within its interval is considered broken
+			struct timeval timeout;
+			timeout.tv_sec = _interval.total_seconds();
+			timeout.tv_usec = 0;
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+			if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0
+					|| (!_request.empty() && write(fd, _request.data(), _request.size()) != (ssize_t) _request.size())) {
+				int err = errno;
+				close(fd);
+				throw hexabus::GenericException("Could not query " + _target + ": " + strerror(err));
+			}
+			shutdown(fd, SHUT_WR);
+
+			ssize_t len;
+			while ((len = read(fd, buffer, sizeof(buffer))) > 0 || (len < 0 && errno == EINTR)) {
+				if (len > 0)
+					data.append(buffer, len);
+			}
+			int err = errno;
+			close(fd);
+			if (len < 0)
+				throw hexabus::GenericException("Could not read " + _target + ": " + strerror(err));
+			break;
+		}
+	}
+
+	return data;
+}
+
+uint64_t DataSource::encode(const std::string& text) const
+{
+	std::istringstream words(text);
+	std::string word;
+
+	for (unsigned int i = 0; i <= _field; i++) {
+		if (!(words >> word)) {
+			std::ostringstream oss;
+			oss << "Field " << _field << " not found in data of " << _name;
+			throw hexabus::GenericException(oss.str());
+		}
+	}
+
+	const char* begin = word.c_str();
+	char* end;
+	errno = 0;
+
+	if (_datatype == hexabus::HXB_DTYPE_FLOAT) {
+		float value = strtod(begin, &end) * _scale;
+		uint32_t bits;
+
+		if (end == begin || *end || errno)
+			throw hexabus::GenericException("Invalid value " + word + " for " + _name);
+		memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	uint64_t value;
+	if (_scale == 1) {
+		value = strtoull(begin, &end, 10);
+	} else {
+		double scaled = strtod(begin, &end) * _scale;
+		value = scaled < 0 ? 0 : uint64_t(llround(scaled));
+	}
+	if (end == begin || *end || errno || *begin == '-')
+		throw hexabus::GenericException("Invalid value " + word + " for " + _name);
+
+	uint64_t max;
+	switch (_datatype) {
+		case hexabus::HXB_DTYPE_BOOL: max = 1; break;
+		case hexabus::HXB_DTYPE_UINT8: max = UINT8_MAX; break;
+		case hexabus::HXB_DTYPE_UINT32: max = UINT32_MAX; break;
+		default: max = UINT64_MAX; break;
+	}
+	if (value > max)
+		throw hexabus::GenericException("Value " + word + " out of range for " + _name);
+
+	return value;
+}
+
+uint64_t DataSource::poll() const
+{
+	return encode(readData());
+}
+
+std::vector<DataSource::Ptr> hexadaemon::loadDataSources(const std::string& path)
+{
+	boost::filesystem::ifstream file(path, std::ios_base::in);
+
+	if (!file.good())
+		throw hexabus::GenericException("Data source file " + path + " not found");
+
+	boost::property_tree::ptree ptree;
+
+	try {
+		read_info(file, ptree);
+	} catch (const boost::property_tree::info_parser_error& e) {
+		throw hexabus::GenericException(e.what());
+	}
+
+	std::vector<DataSource::Ptr> sources;
+	std::set<uint32_t> eids;
+
+	typedef boost::property_tree::ptree::const_iterator iterator;
+	for (iterator it = ptree.begin(), end = ptree.end(); it != end; it++) {
+		if (it->first != "source")
+			throw hexabus::GenericException("Invalid data source file " + path);
+
+		const boost::property_tree::ptree& source = it->second;
+		uint32_t eid;
+
+		try {
+			eid = source.get_value<uint32_t>();
+		} catch (...) {
+			throw hexabus::GenericException("Invalid EID " + source.get_value<std::string>());
+		}
+
+		std::ostringstream oss;
+		oss << "data source " << eid;
+		std::string where = oss.str();
+
+		if (!eids.insert(eid).second)
+			throw hexabus::GenericException("Duplicate " + where);
+
+		std::string type_str = source.get<std::string>("type", "");
+		uint8_t type;
+		if (boost::equals(type_str, "BOOL"))
+			type = hexabus::HXB_DTYPE_BOOL;
+		else if (boost::equals(type_str, "UINT8"))
+			type = hexabus::HXB_DTYPE_UINT8;
+		else if (boost::equals(type_str, "UINT32"))
+			type = hexabus::HXB_DTYPE_UINT32;
+		else if (boost::equals(type_str, "UINT64"))
+			type = hexabus::HXB_DTYPE_UINT64;
+		else if (boost::equals(type_str, "FLOAT"))
+			type = hexabus::HXB_DTYPE_FLOAT;
+		else
+			throw hexabus::GenericException("Invalid type '" + type_str + "' for " + where);
+
+		DataSource::Kind kind;
+		std::string target;
+		if (source.count("file") + source.count("command") + source.count("socket") != 1) {
+			throw hexabus::GenericException("Exactly one of file, command or socket is required for " + where);
+		} else if (source.count("file")) {
+			kind = DataSource::file;
+			target = source.get<std::string>("file");
+		} else if (source.count("command")) {
+			kind = DataSource::command;
+			target = source.get<std::string>("command");
+		} else {
+			kind = DataSource::unix_socket;
+			target = source.get<std::string>("socket");
+		}
+
+		DataSource::Ptr result(new DataSource(eid, source.get<std::string>("name", target), type, kind, target));
+
+		try {
+			int interval = source.get<int>("interval", 60);
+			if (interval <= 0)
+				throw hexabus::GenericException("Invalid interval for " + where);
+			result->interval(boost::posix_time::seconds(interval));
+			result->field(source.get<unsigned int>("field", 0));
+			result->scale(source.get<double>("scale", 1));
+			result->request(source.get<std::string>("request", ""));
+			result->broadcast(source.get<bool>("broadcast", true));
+		} catch (const boost::property_tree::ptree_error& e) {
+			throw hexabus::GenericException("Invalid " + where + ": " + e.what());
+		}
+
+		sources.push_back(result);
+	}
+
+	return sources;
+}
+
+DataSourcePoller::DataSourcePoller(boost::asio::io_service& io, const std::vector<DataSource::Ptr>& sources, size_t threads, bool debug)
+	: _sources(sources)
+	, _values(new ValueTable(sources.size()))
+	, _debug(debug)
+	, _timer(io)
+	, _pool(threads)
+{
+	// spread the first poll of every source over its own interval, so sources do not poll in lockstep
+	boost::posix_time::ptime now = boost::asio::deadline_timer::traits_type::now();
+	for (std::vector<DataSource::Ptr>::const_iterator it = _sources.begin(), end = _sources.end(); it != end; ++it) {
+		long period = (*it)->interval().total_milliseconds();
+		_nextPoll.push_back(now + boost::posix_time::milliseconds(rand() % period));
+	}
+
+	schedule();
+}
+
+DataSourcePoller::~DataSourcePoller()
+{
+	boost::system::error_code err;
+
+	_timer.cancel(err);
+}
+
+// slots hold integers as they are and floats as their bit pattern, see DataSource::encode
+template<typename TValue>
+static TValue value_from_bits(uint64_t bits)
+{
+	return TValue(bits);
+}
+
+template<>
+float value_from_bits<float>(uint64_t bits)
+{
+	uint32_t float_bits = bits;
+	float value;
+
+	memcpy(&value, &float_bits, sizeof(value));
+	return value;
+}
+
+template<typename TValue>
+void DataSourcePoller::addEndpoint(hexabus::Device& device, size_t slot)
+{
+	const DataSource::Ptr& source = _sources[slot];
+	typename hexabus::TypedEndpointFunctions<TValue>::Ptr ep(
+		new hexabus::TypedEndpointFunctions<TValue>(source->eid(), source->name(), source->broadcast()));
+
+	std::shared_ptr<ValueTable> values = _values;
+	std::string name = source->name();
+	ep->onRead([values, slot, name] () {
+		uint64_t bits;
+
+		if (!values->read(slot, bits))
+			throw hexabus::GenericException("No value for " + name + " yet");
+
+		return value_from_bits<TValue>(bits);
+	});
+
+	device.addEndpoint(ep);
+}
+
+void DataSourcePoller::addEndpoints(hexabus::Device& device)
+{
+	for (size_t i = 0; i < _sources.size(); i++) {
+		if (device.hasEndpoint(_sources[i]->eid())) {
+			std::ostringstream oss;
+			oss << "EID " << _sources[i]->eid() << " of data source " << _sources[i]->name() << " is already in use";
+			throw hexabus::GenericException(oss.str());
+		}
+
+		switch (_sources[i]->datatype()) {
+			case hexabus::HXB_DTYPE_BOOL: addEndpoint<bool>(device, i); break;
+			case hexabus::HXB_DTYPE_UINT8: addEndpoint<uint8_t>(device, i); break;
+			case hexabus::HXB_DTYPE_UINT32: addEndpoint<uint32_t>(device, i); break;
+			case hexabus::HXB_DTYPE_UINT64: addEndpoint<uint64_t>(device, i); break;
+			case hexabus::HXB_DTYPE_FLOAT: addEndpoint<float>(device, i); break;
+		}
+	}
+}
+
+void DataSourcePoller::schedule()
+{
+	if (_nextPoll.empty())
+		return;
+
+	boost::posix_time::ptime next = *std::min_element(_nextPoll.begin(), _nextPoll.end());
+
+	_timer.expires_at(next);
+	_timer.async_wait(boost::bind(&DataSourcePoller::handleTimer, this, boost::asio::placeholders::error));
+}
+
+void DataSourcePoller::handleTimer(const boost::system::error_code& error)
+{
+	if (error)
+		return;
+
+	boost::posix_time::ptime now = boost::asio::deadline_timer::traits_type::now();
+	for (size_t i = 0; i < _sources.size(); i++) {
+		if (_nextPoll[i] > now)
+			continue;
+
+		DataSource::Ptr source = _sources[i];
+		_nextPoll[i] += source->interval();
+		if (_nextPoll[i] <= now)
+			_nextPoll[i] = now + source->interval();
+
+		if (source->busy.exchange(true)) {
+			_debug && std::cerr << "Data source " << source->name() << " is still being polled, skipping" << std::endl;
+			continue;
+		}
+
+		std::shared_ptr<ValueTable> values = _values;
+		_pool.post([source, values, i] () {
+			try {
+				values->publish(i, source->poll());
+			} catch (const hexabus::GenericException& e) {
+				std::cerr << "Could not poll data source " << source->name() << ": " << e.reason() << std::endl;
+			} catch (const std::exception& e) {
+				std::cerr << "Could not poll data source " << source->name() << ": " << e.what() << std::endl;
+			}
+			source->busy.store(false);
+		});
+	}
+
+	schedule();
+}
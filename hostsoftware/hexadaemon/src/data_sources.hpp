@@ -0,0 +1,131 @@
+#ifndef _DATA_SOURCES_HPP
+#define _DATA_SOURCES_HPP
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_service.hpp>
+
+#include <libhexabus/device.hpp>
+#include <libhexabus/worker_pool.hpp>
+
+namespace hexadaemon {
+	// Latest value of every data source. Pollers publish from worker threads, endpoint read handlers
+	// read from the io_service thread, neither takes a lock.
+	class ValueTable {
+		public:
+			ValueTable(size_t size);
+
+			// values are stored as raw bits, see DataSource::encode
+			void publish(size_t slot, uint64_t bits);
+			bool read(size_t slot, uint64_t& bits) const;
+
+		private:
+			struct Slot {
+				std::atomic<uint64_t> bits;
+				std::atomic<bool> valid;
+			};
+
+			std::unique_ptr<Slot[]> _slots;
+	};
+
+	// A value that is read periodically from a file (including sysfs and procfs), the output of a
+	// command or a UNIX socket, and published as an endpoint.
+	class DataSource {
+		public:
+			typedef std::shared_ptr<DataSource> Ptr;
+
+			enum Kind {
+				file,
+				command,
+				unix_socket,
+			};
+
+			DataSource(uint32_t eid, const std::string& name, uint8_t datatype, Kind kind, const std::string& target);
+
+			uint32_t eid() const { return _eid; }
+			const std::string& name() const { return _name; }
+			uint8_t datatype() const { return _datatype; }
+			Kind kind() const { return _kind; }
+			const std::string& target() const { return _target; }
+
+			boost::posix_time::time_duration interval() const { return _interval; }
+			void interval(const boost::posix_time::time_duration& interval) { _interval = interval; }
+			// the value is the field-th whitespace separated word of the data read
+			unsigned int field() const { return _field; }
+			void field(unsigned int field) { _field = field; }
+			double scale() const { return _scale; }
+			void scale(double scale) { _scale = scale; }
+			// sent to UNIX sockets before reading the reply
+			const std::string& request() const { return _request; }
+			void request(const std::string& request) { _request = request; }
+			bool broadcast() const { return _broadcast; }
+			void broadcast(bool broadcast) { _broadcast = broadcast; }
+
+			// Read the source and return the value encoded as raw bits. Blocks, throws GenericException.
+			uint64_t poll() const;
+
+			// convert text to the raw bits of a value of the datatype of this source
+			uint64_t encode(const std::string& text) const;
+
+			// poll in progress, polls of a slow source are not queued up
+			std::atomic<bool> busy;
+
+		private:
+			std::string readData() const;
+
+			uint32_t _eid;
+			std::string _name;
+			uint8_t _datatype;
+			Kind _kind;
+			std::string _target;
+			boost::posix_time::time_duration _interval;
+			unsigned int _field;
+			double _scale;
+			std::string _request;
+			bool _broadcast;
+	};
+
+	// Load data sources from an INFO file, e.g.
+	//
+	// source 40 {                                  ; EID
+	//   name "CPU temperature"
+	//   type FLOAT                                 ; BOOL, UINT8, UINT32, UINT64 or FLOAT
+	//   file /sys/class/thermal/thermal_zone0/temp ; or: command "...", socket /path/to/socket
+	//   scale 0.001
+	//   interval 10                                ; seconds
+	// }
+	std::vector<DataSource::Ptr> loadDataSources(const std::string& path);
+
+	// Polls data sources on a worker pool, each on its own interval, and serves their endpoints from a
+	// ValueTable, so queries and broadcasts never wait for I/O.
+	class DataSourcePoller {
+		public:
+			DataSourcePoller(boost::asio::io_service& io, const std::vector<DataSource::Ptr>& sources, size_t threads = 2, bool debug = false);
+			~DataSourcePoller();
+
+			void addEndpoints(hexabus::Device& device);
+
+		private:
+			DataSourcePoller(const DataSourcePoller&);
+			DataSourcePoller& operator=(const DataSourcePoller&);
+
+			template<typename TValue>
+			void addEndpoint(hexabus::Device& device, size_t slot);
+
+			void schedule();
+			void handleTimer(const boost::system::error_code& error);
+
+			std::vector<DataSource::Ptr> _sources;
+			std::vector<boost::posix_time::ptime> _nextPoll;
+			std::shared_ptr<ValueTable> _values;
+			bool _debug;
+			boost::asio::deadline_timer _timer;
+			hexabus::WorkerPool _pool;
+	};
+}
+
+#endif // _DATA_SOURCES_HPP
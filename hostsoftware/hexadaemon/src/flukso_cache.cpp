@@ -0,0 +1,258 @@
+#include "flukso_cache.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <iostream>
+
+#include <boost/asio/placeholders.hpp>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+
+using namespace hexadaemon;
+
+namespace bf = boost::filesystem;
+
+namespace {
+	// sensor files are named by the 32 hex digit sensor id
+	bool is_sensor_name(const std::string& name)
+	{
+		if ( name.size() != 32 )
+			return false;
+
+		for ( std::string::const_iterator it = name.begin(), end = name.end(); it != end; ++it ) {
+			if ( !((*it >= '0' && *it <= '9') || (*it >= 'a' && *it <= 'f')) )
+				return false;
+		}
+
+		return true;
+	}
+}
+
+FluksoCache::FluksoCache(boost::asio::io_service& io, const std::string& path, bool debug)
+	: _path(path)
+	, _debug(debug)
+	, _inotify(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+	, _watch(-1)
+	, _events(io)
+	, _retry(io)
+{
+	if ( _inotify < 0 ) {
+		std::cerr << "Could not initialize inotify, polling " << _path << " instead: " << strerror(errno) << std::endl;
+	} else {
+		_events.assign(_inotify);
+		readEvents();
+	}
+
+	watch();
+}
+
+FluksoCache::~FluksoCache()
+{
+	boost::system::error_code err;
+
+	_retry.cancel(err);
+	_events.close(err);
+}
+
+uint32_t FluksoCache::value(const std::string& sensor_id) const
+{
+	std::map<std::string, uint32_t>::const_iterator it = _values.find(sensor_id);
+
+	return it != _values.end() ? it->second : 0;
+}
+
+FluksoCache::ParseResult FluksoCache::parse(const char* data, size_t length, uint32_t& value)
+{
+	const char* begin = data;
+	const char* p = data + length;
+
+	while ( p > begin && isspace((unsigned char) p[-1]) )
+		p--;
+	if ( p == begin || *--p != ']' )
+		return PARSE_ERROR;
+
+	// walk the pairs backwards, p points to the closing bracket of the array or the comma after a pair
+	for (;;) {
+		if ( p == begin )
+			return PARSE_ERROR;
+		char c = *--p;
+		if ( c == '[' && p == begin )
+			return NO_VALUES;
+		if ( c != ']' )
+			return PARSE_ERROR;
+
+		const char* token_end = p;
+		while ( p > begin && p[-1] != ',' && p[-1] != '[' )
+			p--;
+		if ( p == begin || p[-1] != ',' )
+			return PARSE_ERROR;
+		const char* token = p;
+
+		if ( token_end - token == 5 && memcmp(token, "\"nan\"", 5) == 0 ) {
+			// skip the timestamp and the opening bracket of the pair
+			while ( p > begin && p[-1] != '[' )
+				p--;
+			if ( p - begin < 2 )
+				return PARSE_ERROR;
+			p--;
+			if ( p[-1] == '[' && p - 1 == begin )
+				return NO_VALUES;
+			if ( p[-1] != ',' )
+				return PARSE_ERROR;
+			p--;
+			continue;
+		}
+
+		if ( token == token_end )
+			return PARSE_ERROR;
+
+		uint64_t result = 0;
+		for ( const char* d = token; d != token_end; d++ ) {
+			if ( *d < '0' || *d > '9' )
+				return PARSE_ERROR;
+			result = result * 10 + (*d - '0');
+			if ( result > UINT32_MAX )
+				return PARSE_ERROR;
+		}
+		value = result;
+		return VALUE;
+	}
+}
+
+void FluksoCache::watch()
+{
+	if ( _inotify >= 0 ) {
+		_watch = inotify_add_watch(_inotify, _path.c_str(),
+				IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF | IN_MOVE_SELF);
+		if ( _watch < 0 )
+			_debug && std::cerr << "Could not watch " << _path << ": " << strerror(errno) << std::endl;
+	}
+
+	// pick up files written before the watch was added
+	rescan();
+
+	if ( _watch < 0 )
+		retry();
+}
+
+void FluksoCache::rescan()
+{
+	bf::path p(_path);
+	boost::system::error_code err;
+
+	if ( !bf::is_directory(p, err) )
+		return;
+
+	for ( bf::directory_iterator sensors(p, err), end; !err && sensors != end; sensors.increment(err) )
+		readSensor(sensors->path().filename().string());
+}
+
+void FluksoCache::readSensor(const std::string& filename)
+{
+	if ( !is_sensor_name(filename) ) {
+		_debug && std::cout << "Ignoring file: " << filename << std::endl;
+		return;
+	}
+
+	_debug && std::cout << "Parsing file: " << filename << std::endl;
+
+	std::string path = (bf::path(_path) / filename).string();
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if ( fd < 0 )
+		return;
+
+	_fileBuffer.clear();
+	for (;;) {
+		char chunk[4096];
+		ssize_t len = read(fd, chunk, sizeof(chunk));
+		if ( len < 0 && errno == EINTR )
+			continue;
+		if ( len <= 0 )
+			break;
+		_fileBuffer.append(chunk, len);
+	}
+	close(fd);
+
+	uint32_t value = 0;
+	switch ( parse(_fileBuffer.data(), _fileBuffer.size(), value) ) {
+		case VALUE:
+			_values[filename] = value;
+			_debug && std::cout << "Updating value of " << filename << " = " << value << std::endl;
+			break;
+
+		case NO_VALUES:
+			_debug && std::cerr << "No Values " << filename << std::endl;
+			_values[filename] = 0;
+			break;
+
+		case PARSE_ERROR:
+			std::cerr << "Error parsing " << filename << std::endl;
+			_debug && std::cout << "Content of " << filename << ": \'" << _fileBuffer << "\'" << std::endl;
+			break;
+	}
+}
+
+void FluksoCache::readEvents()
+{
+	_events.async_read_some(boost::asio::buffer(_eventBuffer, sizeof(_eventBuffer)),
+			boost::bind(&FluksoCache::handleEvents, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+}
+
+void FluksoCache::handleEvents(const boost::system::error_code& error, size_t length)
+{
+	if ( error == boost::asio::error::operation_aborted )
+		return;
+
+	if ( error ) {
+		std::cerr << "Error reading inotify events for " << _path << ": " << error.message() << std::endl;
+		return;
+	}
+
+	bool overflow = false;
+	for ( size_t offset = 0; offset + sizeof(inotify_event) <= length; ) {
+		const inotify_event* ev = reinterpret_cast<const inotify_event*>(_eventBuffer + offset);
+
+		if ( ev->mask & IN_Q_OVERFLOW ) {
+			overflow = true;
+		} else if ( ev->mask & IN_IGNORED ) {
+			// the directory was removed, wait for it to reappear
+			if ( ev->wd == _watch )
+				_watch = -1;
+		} else if ( ev->len > 0 && ev->wd == _watch ) {
+			std::string name(ev->name);
+
+			if ( ev->mask & (IN_DELETE | IN_MOVED_FROM) )
+				_values.erase(name);
+			else
+				readSensor(name);
+		}
+
+		offset += sizeof(inotify_event) + ev->len;
+	}
+
+	if ( _watch < 0 )
+		retry();
+	else if ( overflow )
+		rescan();
+
+	readEvents();
+}
+
+void FluksoCache::retry()
+{
+	// without inotify we fall back to polling the directory every second
+	_retry.expires_from_now(boost::posix_time::seconds(_inotify < 0 ? 1 : 5));
+	_retry.async_wait(boost::bind(&FluksoCache::handleRetry, this, boost::asio::placeholders::error));
+}
+
+void FluksoCache::handleRetry(const boost::system::error_code& error)
+{
+	if ( error )
+		return;
+
+	watch();
+}
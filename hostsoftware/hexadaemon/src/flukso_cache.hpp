@@ -0,0 +1,58 @@
+#ifndef _FLUKSO_CACHE_HPP
+#define _FLUKSO_CACHE_HPP
+
+#include <map>
+#include <string>
+
+#include <sys/inotify.h>
+
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+
+namespace hexadaemon {
+	// Last values of the fluksod sensor files. The directory is watched with inotify, and only files that
+	// were rewritten are parsed again, so reading a value is a map lookup.
+	class FluksoCache {
+		public:
+			FluksoCache(boost::asio::io_service& io, const std::string& path = "/var/run/fluksod/sensor/", bool debug = false);
+			~FluksoCache();
+
+			// last value of a sensor, 0 if the sensor is unknown or has no values yet
+			uint32_t value(const std::string& sensor_id) const;
+
+			enum ParseResult {
+				VALUE,
+				NO_VALUES,
+				PARSE_ERROR,
+			};
+			// Find the last value that is not "nan" in the contents of a sensor file, which look like
+			// [[1400000000,123],[1400000001,124],[1400000002,"nan"]]
+			static ParseResult parse(const char* data, size_t length, uint32_t& value);
+
+		private:
+			FluksoCache(const FluksoCache&);
+			FluksoCache& operator=(const FluksoCache&);
+
+			void watch();
+			void rescan();
+			void readSensor(const std::string& filename);
+			void readEvents();
+			void handleEvents(const boost::system::error_code& error, size_t length);
+			void retry();
+			void handleRetry(const boost::system::error_code& error);
+
+			std::string _path;
+			bool _debug;
+			std::map<std::string, uint32_t> _values;
+
+			int _inotify;
+			int _watch;
+			boost::asio::posix::stream_descriptor _events;
+			boost::asio::deadline_timer _retry;
+			char _eventBuffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+			std::string _fileBuffer;
+	};
+}
+
+#endif // _FLUKSO_CACHE_HPP
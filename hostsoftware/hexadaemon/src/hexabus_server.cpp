@@ -2,14 +2,9 @@
 
 #include <syslog.h>
 
-#include <fstream>
-
-#include <boost/filesystem.hpp>
-#include <boost/regex.hpp>
 #include <boost/ref.hpp>
 
 #include <libhexabus/device.hpp>
-#include <libhexabus/endpoint_registry.hpp>
 #include "../../../shared/hexabus_definitions.h"
 
 #include "endpoints.h"
@@ -23,16 +18,21 @@ extern "C" {
 
 using namespace hexadaemon;
 
-namespace bf = boost::filesystem;
-
 #ifndef UCI_FOUND
 	std::string _device_name = "Hexadaemon";
 #endif /* UCI_FOUND */
 
-HexabusServer::HexabusServer(boost::asio::io_service& io, const std::vector<std::string>& interfaces, const std::vector<std::string>& addresses, int interval, bool debug)
+HexabusServer::HexabusServer(boost::asio::io_service& io, const std::vector<std::string>& interfaces, const std::vector<std::string>& addresses, int interval, int max_interval, bool reply_all, const std::string& sources_file, bool debug)
 	: _device(io, interfaces, addresses, interval)
 	, _debug(debug)
+	, _flukso(io, "/var/run/fluksod/sensor/", debug)
 {
+	_device.setReplyFromAllAddresses(reply_all);
+	if ( max_interval > 0 )
+		_device.setBroadcastPolicy(hexabus::BroadcastPolicy(boost::posix_time::seconds(interval), boost::posix_time::seconds(max_interval)));
+	if ( !sources_file.empty() )
+		_sources.reset(new DataSourcePoller(io, loadDataSources(sources_file), 2, debug));
+
 	_init();
 }
 
@@ -43,50 +43,32 @@ void HexabusServer::_init() {
 	_device.onWriteName(boost::bind(&HexabusServer::saveDeviceName, this, _1));
 	_device.onAsyncError(boost::bind(&HexabusServer::handleAsyncError, this, _1));
 
-	hexabus::EndpointRegistry ep_registry;
-	hexabus::EndpointRegistry::const_iterator ep_it;
-
-	ep_it = ep_registry.find(EP_POWER_METER);
-	hexabus::TypedEndpointFunctions<uint32_t>::Ptr powerEP = ep_it != ep_registry.end()
-		? hexabus::TypedEndpointFunctions<uint32_t>::fromEndpointDescriptor(ep_it->second)
-		: hexabus::TypedEndpointFunctions<uint32_t>::Ptr(new hexabus::TypedEndpointFunctions<uint32_t>(EP_POWER_METER, "HexabusPlug+ Power meter (W)"));
+	hexabus::TypedEndpointFunctions<uint32_t>::Ptr powerEP = hexabus::TypedEndpointFunctions<uint32_t>::fromBuiltinEndpoint<EP_POWER_METER>();
 	powerEP->onRead(boost::bind(&HexabusServer::get_sum, this));
 	_device.addEndpoint(powerEP);
 
-	ep_it = ep_registry.find(EP_FLUKSO_L1);
-	hexabus::TypedEndpointFunctions<uint32_t>::Ptr l1EP = ep_it != ep_registry.end()
-		? hexabus::TypedEndpointFunctions<uint32_t>::fromEndpointDescriptor(ep_it->second)
-		: hexabus::TypedEndpointFunctions<uint32_t>::Ptr(new hexabus::TypedEndpointFunctions<uint32_t>(EP_FLUKSO_L1, "Flukso Phase 1"));
+	hexabus::TypedEndpointFunctions<uint32_t>::Ptr l1EP = hexabus::TypedEndpointFunctions<uint32_t>::fromBuiltinEndpoint<EP_FLUKSO_L1>();
 	l1EP->onRead(boost::bind(&HexabusServer::get_sensor, this, 1));
 	_device.addEndpoint(l1EP);
 
-	ep_it = ep_registry.find(EP_FLUKSO_L2);
-	hexabus::TypedEndpointFunctions<uint32_t>::Ptr l2EP = ep_it != ep_registry.end()
-		? hexabus::TypedEndpointFunctions<uint32_t>::fromEndpointDescriptor(ep_it->second)
-		: hexabus::TypedEndpointFunctions<uint32_t>::Ptr(new hexabus::TypedEndpointFunctions<uint32_t>(EP_FLUKSO_L2, "Flukso Phase 2"));
+	hexabus::TypedEndpointFunctions<uint32_t>::Ptr l2EP = hexabus::TypedEndpointFunctions<uint32_t>::fromBuiltinEndpoint<EP_FLUKSO_L2>();
 	l2EP->onRead(boost::bind(&HexabusServer::get_sensor, this, 2));
 	_device.addEndpoint(l2EP);
 
-	ep_it = ep_registry.find(EP_FLUKSO_L3);
-	hexabus::TypedEndpointFunctions<uint32_t>::Ptr l3EP = ep_it != ep_registry.end()
-		? hexabus::TypedEndpointFunctions<uint32_t>::fromEndpointDescriptor(ep_it->second)
-		: hexabus::TypedEndpointFunctions<uint32_t>::Ptr(new hexabus::TypedEndpointFunctions<uint32_t>(EP_FLUKSO_L3, "Flukso Phase 3"));
+	hexabus::TypedEndpointFunctions<uint32_t>::Ptr l3EP = hexabus::TypedEndpointFunctions<uint32_t>::fromBuiltinEndpoint<EP_FLUKSO_L3>();
 	l3EP->onRead(boost::bind(&HexabusServer::get_sensor, this, 3));
 	_device.addEndpoint(l3EP);
 
-	ep_it = ep_registry.find(EP_FLUKSO_S01);
-	hexabus::TypedEndpointFunctions<uint32_t>::Ptr l4EP = ep_it != ep_registry.end()
-		? hexabus::TypedEndpointFunctions<uint32_t>::fromEndpointDescriptor(ep_it->second)
-		: hexabus::TypedEndpointFunctions<uint32_t>::Ptr(new hexabus::TypedEndpointFunctions<uint32_t>(EP_FLUKSO_S01, "Flukso S0 1"));
+	hexabus::TypedEndpointFunctions<uint32_t>::Ptr l4EP = hexabus::TypedEndpointFunctions<uint32_t>::fromBuiltinEndpoint<EP_FLUKSO_S01>();
 	l4EP->onRead(boost::bind(&HexabusServer::get_sensor, this, 4));
 	_device.addEndpoint(l4EP);
 
-	ep_it = ep_registry.find(EP_FLUKSO_S02);
-	hexabus::TypedEndpointFunctions<uint32_t>::Ptr l5EP = ep_it != ep_registry.end()
-		? hexabus::TypedEndpointFunctions<uint32_t>::fromEndpointDescriptor(ep_it->second)
-		: hexabus::TypedEndpointFunctions<uint32_t>::Ptr(new hexabus::TypedEndpointFunctions<uint32_t>(EP_FLUKSO_S02, "Flukso S0 2"));
+	hexabus::TypedEndpointFunctions<uint32_t>::Ptr l5EP = hexabus::TypedEndpointFunctions<uint32_t>::fromBuiltinEndpoint<EP_FLUKSO_S02>();
 	l5EP->onRead(boost::bind(&HexabusServer::get_sensor, this, 5));
 	_device.addEndpoint(l5EP);
+
+	if ( _sources )
+		_sources->addEndpoints(_device);
 }
 
 static const char* entry_names[6] = {
@@ -109,74 +91,21 @@ unsigned long endpoints[6] = {
 
 uint32_t HexabusServer::get_sensor(int map_idx)
 {
-	updateFluksoValues();
 	_debug && std::cout << "Reading value for " << entry_names[map_idx] << std::endl;
-	return _flukso_values[_sensor_mapping[map_idx]];
+	return _flukso.value(_sensor_mapping[map_idx]);
 }
 
 uint32_t HexabusServer::get_sum()
 {
-	updateFluksoValues();
 	int result = 0;
 
-	result += _flukso_values[_sensor_mapping[1]];
-	result += _flukso_values[_sensor_mapping[2]];
-	result += _flukso_values[_sensor_mapping[3]];
+	result += _flukso.value(_sensor_mapping[1]);
+	result += _flukso.value(_sensor_mapping[2]);
+	result += _flukso.value(_sensor_mapping[3]);
 
 	return result;
 }
 
-void HexabusServer::updateFluksoValues()
-{
-	bf::path p("/var/run/fluksod/sensor/");
-
-	if ( exists(p) && is_directory(p) )
-	{
-		for ( bf::directory_iterator sensors(p); sensors != bf::directory_iterator(); sensors++ )
-		{
-			std::string filename = (*sensors).path().filename().string();
-			boost::regex hex32("^[0-9a-f]{32}$");
-			boost::match_results<std::string::const_iterator> what;
-			if ( !boost::regex_match(filename, what, hex32) ) {
-				_debug && std::cout << "Ignoring file: " << filename << std::endl;
-				continue;
-			}
-
-			_debug && std::cout << "Parsing file: " << filename << std::endl;
-
-			std::ifstream file;
-			file.open((*sensors).path().string().c_str());
-			if ( file.fail() )
-				continue;
-
-			std::string flukso_data;
-			file >> flukso_data;
-			file.close();
-			//extract last value != "nan" from the json array
-			boost::regex r("^\\[(?:\\[[[:digit:]]*,[[:digit:]]*\\],)*\\[[[:digit:]]*,([[:digit:]]*)\\](?:,\\[[[:digit:]]*,\"nan\"\\])*\\]$");
-
-			if ( boost::regex_search(flukso_data, what, r) ) {
-				try {
-					uint32_t value = boost::lexical_cast<uint32_t>(std::string(what[1].first, what[1].second));
-					_flukso_values[filename] = value;
-					_debug && std::cout << "Updating _flukso_values[" << filename << "] = " << value << std::endl;
-				} catch ( const boost::bad_lexical_cast & ) {
-					std::cerr << "Error parsing value " << std::string(what[1].first, what[1].second) << std::endl;
-				}
-			} else {
-        boost::regex r0("^\\[(?:\\[[[:digit:]]*,\"nan\"\\],)*\\[[[:digit:]]*,\"nan\"\\]\\]$");
-        if ( boost::regex_search(flukso_data, what, r0) ) {
-          _debug && std::cerr << "No Values " << filename << std::endl;
-					_flukso_values[filename] = 0;
-				} else {
-          std::cerr << "Error parsing " << filename << std::endl;
-          _debug && std::cout << "Content of " << filename << ": \'" << flukso_data << "\'" << std::endl;
-        }
-			}
-		}
-	}
-}
-
 void HexabusServer::loadSensorMapping()
 {
 	_debug && std::cout << "loading sensor mapping" << std::endl;
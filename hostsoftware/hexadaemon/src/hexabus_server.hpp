@@ -5,11 +5,14 @@
 
 #include <libhexabus/device.hpp>
 
+#include "data_sources.hpp"
+#include "flukso_cache.hpp"
+
 namespace hexadaemon {
 	class HexabusServer {
 		public:
 			typedef boost::shared_ptr<HexabusServer> Ptr;
-			HexabusServer(boost::asio::io_service& io, const std::vector<std::string>& interfaces, const std::vector<std::string>& addresses, int interval = 60, bool debug = false);
+			HexabusServer(boost::asio::io_service& io, const std::vector<std::string>& interfaces, const std::vector<std::string>& addresses, int interval = 60, int max_interval = 0, bool reply_all = false, const std::string& sources_file = "", bool debug = false);
 			virtual ~HexabusServer() {};
 
 			uint32_t get_sensor(int map_idx);
@@ -33,11 +36,9 @@ namespace hexadaemon {
 		private:
 			hexabus::Device _device;
 			bool _debug;
-			std::map<std::string, uint32_t> _flukso_values;
+			FluksoCache _flukso;
+			std::unique_ptr<DataSourcePoller> _sources;
 			std::map<int, std::string> _sensor_mapping;
-
-			int getFluksoValue();
-			void updateFluksoValues();
 	};
 }
 
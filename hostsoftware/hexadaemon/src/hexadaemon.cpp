@@ -31,8 +31,11 @@ int main(int argc, char** argv)
     ("debug,d", "enable debug mode")
     ("logfile,l", po::value<std::string>(), "set the logfile to use")
     ("interval,i", po::value<int>(), "set the broadcast interval")
+    ("max-interval,m", po::value<int>(), "broadcast unchanged values at least this often (default: twice the broadcast interval)")
     ("interface,I", po::value<std::vector<std::string> >(), "interface to use for multicast")
     ("address,a", po::value<std::vector<std::string> >(), "address to listen on")
+    ("sources,s", po::value<std::string>(), "load additional data sources from this file")
+    ("reply-all", "answer multicast queries from every address instead of only the best matching one")
     ;
   po::variables_map vm;
 
@@ -49,6 +52,9 @@ int main(int argc, char** argv)
   bool debug = false;
   std::string logfile = "/tmp/hexadaemon.log";
   int interval = 2;
+  int max_interval = 0;
+  bool reply_all = false;
+  std::string sources_file;
   std::vector<std::string> interfaces;
   std::vector<std::string> addresses;
 
@@ -72,6 +78,20 @@ int main(int argc, char** argv)
     std::cout << "interval: " << interval << std::endl;
   }
 
+  if (vm.count("max-interval")) {
+    max_interval = vm["max-interval"].as<int>();
+    std::cout << "max interval: " << max_interval << std::endl;
+  }
+
+  if (vm.count("sources")) {
+    sources_file = vm["sources"].as<std::string>();
+    debug && std::cout << "sources: " << sources_file << std::endl;
+  }
+
+  if (vm.count("reply-all")) {
+    reply_all = true;
+  }
+
   if (vm.count("interface")) {
     interfaces = vm["interface"].as<std::vector<std::string> >();
     for (std::vector<std::string>::iterator it = interfaces.begin(); it != interfaces.end(); ++it)
@@ -100,7 +120,7 @@ int main(int argc, char** argv)
     // user.
     //udp_daytime_server server(io_service);
     hexadaemon::HexabusServer *server;
-    server = new hexadaemon::HexabusServer(io_service, interfaces, addresses, interval, debug);
+    server = new hexadaemon::HexabusServer(io_service, interfaces, addresses, interval, max_interval, reply_all, sources_file, debug);
 
     // Register signal handlers so that the daemon may be shut down. You may
     // also want to register for other signals, such as SIGHUP to trigger a
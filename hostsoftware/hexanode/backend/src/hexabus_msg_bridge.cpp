@@ -1,4 +1,12 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <queue>
+#include <thread>
 #include <unistd.h>
 
 #include <boost/program_options.hpp>
@@ -21,22 +29,42 @@
 #include <libhexabus/endpoint_registry.hpp>
 
 #include <libhexabus/logger/logger.hpp>
+#include <libhexabus/logger/segment_log.hpp>
 #include <libhexabus/common.hpp>
 
 #include "../../../shared/endpoints.h"
+#include "spool_uploader.hpp"
 
 namespace po = boost::program_options;
 
+typedef SpoolUploader<klio::MSGStore, klio::Sensor> MSGUploader;
+
 struct ReadingLogger : public hexabus::Logger {
 	private:
 		struct SensorInfo {
 			boost::posix_time::ptime last_value_received_at;
 			boost::posix_time::ptime last_name_checked_at;
 			boost::asio::ip::address_v6 address;
+			uint32_t spool_index;
+		};
+
+		// a sensor whose name is due to be checked again
+		struct NameRefresh {
+			boost::posix_time::ptime due;
+			klio::Sensor::Ptr sensor;
+
+			bool operator>(const NameRefresh& other) const { return due > other.due; }
 		};
 
-		klio::MSGStore::Ptr store;
+		boost::asio::io_service& io;
+		hexabus::SegmentLog& spool;
+		MSGUploader& uploader;
 		std::map<klio::Sensor::Ptr, SensorInfo> sensor_infos;
+		// one entry per sensor in sensor_infos, the earliest due first
+		std::priority_queue<NameRefresh, std::vector<NameRefresh>, std::greater<NameRefresh> > name_refreshes;
+		boost::posix_time::time_duration name_refresh_period;
+		unsigned name_refresh_budget;
+		boost::posix_time::time_duration upload_interval;
 		boost::asio::deadline_timer info_timer;
 		boost::asio::deadline_timer flush_timer;
 		
@@ -58,7 +86,7 @@ struct ReadingLogger : public hexabus::Logger {
 			return id.str();
 		}
 
-		const char* eid_to_unit(uint32_t eid)
+		std::string eid_to_unit(uint32_t eid)
 		{
 			std::string unit(hexabus::Logger::eid_to_unit(eid));
 
@@ -84,24 +112,49 @@ struct ReadingLogger : public hexabus::Logger {
 				return UNKNOWN_UNIT;
 		}
 
-		klio::Sensor::Ptr lookup_sensor(const std::string& id)
+		void add_sensor_info(const klio::Sensor::Ptr& sensor, SensorInfo info)
 		{
-			std::vector<klio::Sensor::Ptr> sensors = store->get_sensors_by_external_id(id);
-			
-			if (!sensors.size())
-				return klio::Sensor::Ptr();
-			
-			klio::Sensor::Ptr ptr = sensors[0];
+			info.spool_index = spool.sensor_index(sensor->external_id());
+			if (sensor_infos.insert(std::make_pair(sensor, info)).second) {
+				NameRefresh refresh = { info.last_name_checked_at + name_refresh_period, sensor };
+				name_refreshes.push(refresh);
+				uploader.register_sensor(sensor);
+			}
+		}
 
-			std::string addr_str = id.substr(0, id.find_first_of('-'));
+		// the store belongs to the uploader thread, the answer is handled on the io thread again
+		void lookup_sensor(const hexabus::SensorKey& key, const std::string& id)
+		{
+			uploader.lookup_sensor(id, [this, key] (const klio::Sensor::Ptr& sensor) {
+				io.post([this, key, sensor] () {
+					on_sensor_looked_up(key, sensor);
+				});
+			});
+		}
 
+		void on_sensor_looked_up(const hexabus::SensorKey& key, const klio::Sensor::Ptr& sensor)
+		{
+			if (sensor) {
+				SensorInfo info = {
+					boost::posix_time::second_clock::local_time(),
+					boost::posix_time::second_clock::local_time(),
+					key.address(),
+					0
+				};
+				add_sensor_info(sensor, info);
+			}
+			sensor_looked_up(key, sensor);
+		}
+
+		void preloaded_sensor_found(klio::Sensor::Ptr sensor, const boost::asio::ip::address_v6& address)
+		{
 			SensorInfo info = {
 				boost::posix_time::second_clock::local_time(),
 				boost::posix_time::second_clock::local_time(),
-				boost::asio::ip::address_v6::from_string(addr_str)
+				address,
+				0
 			};
-			sensor_infos.insert(std::make_pair(ptr, info));
-			return ptr;
+			add_sensor_info(sensor, info);
 		}
 
 		void new_sensor_found(klio::Sensor::Ptr sensor, const boost::asio::ip::address_v6& address)
@@ -109,14 +162,16 @@ struct ReadingLogger : public hexabus::Logger {
 			if (sensor->unit() == UNKNOWN_UNIT)
 				return;
 
-			store->add_sensor(sensor);
+			// from now on the uploader may rename the sensor
+			std::cout << "Created new sensor: " << sensor->str() << std::endl;
+			uploader.add_sensor(sensor);
 			SensorInfo info = {
 				boost::posix_time::second_clock::local_time(),
 				boost::posix_time::second_clock::local_time(),
-				address
+				address,
+				0
 			};
-			sensor_infos.insert(std::make_pair(sensor, info));
-			std::cout << "Created new sensor: " << sensor->str() << std::endl;
+			add_sensor_info(sensor, info);
 		}
 
 		void record_reading(klio::Sensor::Ptr sensor, klio::timestamp_t ts, double value)
@@ -124,10 +179,12 @@ struct ReadingLogger : public hexabus::Logger {
 			if (sensor->unit() == UNKNOWN_UNIT)
 				return;
 
-			sensor_infos[sensor].last_value_received_at = boost::posix_time::second_clock::local_time();
+			SensorInfo& info = sensor_infos[sensor];
+			info.last_value_received_at = boost::posix_time::second_clock::local_time();
 
+			// SegmentLog is a memory mapped file, so spooling is a memcpy that survives a crash of the bridge
 			try {
-				store->add_reading(sensor, ts, value);
+				spool.append(info.spool_index, ts, value);
 			} catch (std::exception const& ex) {
 				std::cout << "Failed to record reading: " << ex.what() << std::endl;
 				throw;
@@ -140,43 +197,40 @@ struct ReadingLogger : public hexabus::Logger {
 			info_timer.async_wait(boost::bind(&ReadingLogger::timer_expired, this, _1));
 		}
 
+		// queries the names of up to name_refresh_budget sensors that were last checked at least
+		// name_refresh_period ago
 		void timer_expired(const boost::system::error_code& err)
 		{
 			using namespace boost::posix_time;
 
 			schedule_info_update();
-			if (!err) {
-				typedef std::map<klio::Sensor::Ptr, SensorInfo>::iterator iter_t;
-
-				iter_t item = sensor_infos.end();
-				for (iter_t it = sensor_infos.begin(), end = sensor_infos.end(); it != end; it++) {
-					if (item == end
-							|| it->second.last_name_checked_at < item->second.last_name_checked_at) {
-						item = it;
-					}
-				}
-				if (item == sensor_infos.end()) {
-					return;
-				}
-
-				SensorInfo& oldest = item->second;
+			if (err)
+				return;
 
-				if (second_clock::local_time() - oldest.last_name_checked_at >= hours(1)) {
-					oldest.last_name_checked_at = second_clock::local_time();
-					interrogator.send_request(
-							oldest.address,
-							hexabus::EndpointQueryPacket(EP_DEVICE_DESCRIPTOR),
-							hexabus::filtering::IsEndpointInfo(),
-							boost::bind(&ReadingLogger::on_sensor_name_received, this, item->first, _1),
-							boost::bind(&ReadingLogger::on_sensor_error, this, item->first, _1));
-				}
+			ptime now = second_clock::local_time();
+			for (unsigned sent = 0; sent < name_refresh_budget && !name_refreshes.empty(); sent++) {
+				NameRefresh refresh = name_refreshes.top();
+				if (refresh.due > now)
+					break;
+				name_refreshes.pop();
+
+				SensorInfo& info = sensor_infos[refresh.sensor];
+				info.last_name_checked_at = now;
+				interrogator.send_request(
+						info.address,
+						hexabus::EndpointQueryPacket(EP_DEVICE_DESCRIPTOR),
+						hexabus::filtering::IsEndpointInfo(),
+						boost::bind(&ReadingLogger::on_sensor_name_received, this, refresh.sensor, _1),
+						boost::bind(&ReadingLogger::on_sensor_error, this, refresh.sensor, _1));
+
+				refresh.due = now + name_refresh_period;
+				name_refreshes.push(refresh);
 			}
 		}
 
 		void on_sensor_name_received(const klio::Sensor::Ptr& sensor, const hexabus::Packet& ep_info)
 		{
-			sensor->name(static_cast<const hexabus::EndpointInfoPacket&>(ep_info).value());
-			store->update_sensor(sensor);
+			uploader.rename_sensor(sensor, static_cast<const hexabus::EndpointInfoPacket&>(ep_info).value());
 		}
 
 		void on_sensor_error(const klio::Sensor::Ptr& sensor, const hexabus::GenericException& err)
@@ -185,16 +239,18 @@ struct ReadingLogger : public hexabus::Logger {
 
 		void schedule_flush()
 		{
-			flush_timer.expires_from_now(boost::posix_time::minutes(5));
+			flush_timer.expires_from_now(upload_interval);
 			flush_timer.async_wait(boost::bind(&ReadingLogger::force_flush, this, _1));
 		}
 
+		// hands the readings spooled since the last flush to the uploader
 		void force_flush(const boost::system::error_code& err)
 		{
 			schedule_flush();
 
 			if (!err) {
-				store->flush();
+				spool.seal();
+				uploader.upload_now();
 			}
 		}
 
@@ -205,9 +261,14 @@ struct ReadingLogger : public hexabus::Logger {
 			const std::string& sensor_timezone,
 			hexabus::DeviceInterrogator& interrogator,
 			hexabus::EndpointRegistry& registry,
-			klio::MSGStore::Ptr store)
-			: Logger(tc, sensor_factory, sensor_timezone, interrogator, registry), store(store),
-			  info_timer(io), flush_timer(io)
+			hexabus::SegmentLog& spool,
+			MSGUploader& uploader,
+			boost::posix_time::time_duration upload_interval = boost::posix_time::minutes(5),
+			boost::posix_time::time_duration name_refresh_period = boost::posix_time::hours(1),
+			unsigned name_refresh_budget = 50)
+			: Logger(tc, sensor_factory, sensor_timezone, interrogator, registry), io(io), spool(spool), uploader(uploader),
+			  name_refresh_period(name_refresh_period), name_refresh_budget(name_refresh_budget),
+			  upload_interval(upload_interval), info_timer(io), flush_timer(io)
 		{
 			schedule_info_update();
 			schedule_flush();
@@ -315,6 +376,11 @@ static ErrorCode create_new_store(const std::string&  config, const std::string&
 	return ERR_NONE;
 }
 
+static void print_registry_error(const hexabus::GenericException& e)
+{
+	std::cerr << "Could not reload endpoint registry: " << e.reason() << std::endl;
+}
+
 int main(int argc, char** argv)
 {
 	std::ostringstream oss;
@@ -326,6 +392,13 @@ int main(int argc, char** argv)
 		("version,v", "print version info and exit")
 		("config,c", po::value<std::string>()->default_value("/etc/hexabus_msg_bridge.conf"), "path to bridge configuration file (will be created if not present)")
 		("timezone,t", po::value<std::string>(), "the timezone to use for new sensors")
+		("name-refresh-period", po::value<unsigned>()->default_value(60), "minutes between two queries of the name of a sensor")
+		("name-refresh-budget", po::value<unsigned>()->default_value(50), "maximum number of name queries per minute")
+		("spool-dir", po::value<std::string>()->default_value("/var/spool/hexabus_msg_bridge"), "directory of the spool holding readings until they are uploaded")
+		("spool-size", po::value<unsigned>()->default_value(64), "maximum size of the spool in MiB, the oldest readings are dropped beyond it")
+		("upload-interval", po::value<unsigned>()->default_value(300), "seconds between two uploads")
+		("upload-batch", po::value<unsigned>()->default_value(10000), "maximum number of readings per upload request")
+		("upload-backoff", po::value<unsigned>()->default_value(3600), "maximum time in seconds between retries of a failed upload")
 		("listen,L", po::value<std::vector<std::string> >(), "listen on this interface and post measurements to mySmartGrid")
 		("create,C", po::value<std::string>()->implicit_value(""), "create a configuration and register the device to mySmartGrid")
 		("activationcode,A", "print activation code for the mySmartGrid store")
@@ -401,6 +474,11 @@ int main(int argc, char** argv)
 			std::cerr << "Could not perform heartbeat: " << strerror(errno) << std::endl;
 			return ERR_OTHER;
 		} else if (vm.count("listen")) {
+			if (!vm["upload-batch"].as<unsigned>()) {
+				std::cerr << "Upload batch size must be positive" << std::endl;
+				return ERR_PARAMETER_VALUE_INVALID;
+			}
+
 			std::string timezone;
 			if (!vm.count("timezone")) {
 				// TODO: timezone from locale?
@@ -430,11 +508,48 @@ int main(int argc, char** argv)
 
 				hexabus::DeviceInterrogator interrogator(socket);
 				hexabus::EndpointRegistry registry;
-				ReadingLogger logger(io, *tc, *sensor_factory, timezone, interrogator, registry, store);
+				registry.onReloadError(print_registry_error);
+				registry.watch();
+				// a spool segment holds at most one upload interval worth of readings, it is sealed for upload
+				// after every interval
+				hexabus::SegmentLog spool(vm["spool-dir"].as<std::string>(), 1 << 16);
+				// a store whose upload failed is replaced, dropping the readings it still buffers
+				std::function<klio::MSGStore::Ptr ()> open_store = [&store_factory, &store_config] () {
+					klio::MSGStore::Ptr store = store_factory.create_msg_store(store_config.url(), store_config.device_id(),
+							store_config.device_key(), STORE_DESCRIPTION, STORE_TYPE);
+					store->initialize();
+					return store;
+				};
+				MSGUploader uploader(store, open_store, spool, vm["upload-batch"].as<unsigned>(),
+						uintmax_t(vm["spool-size"].as<unsigned>()) << 20,
+						std::chrono::seconds(vm["upload-backoff"].as<unsigned>()));
+				// readings left over from the last run
+				uploader.upload_now();
+
+				ReadingLogger logger(io, *tc, *sensor_factory, timezone, interrogator, registry, spool, uploader,
+						boost::posix_time::seconds(vm["upload-interval"].as<unsigned>()),
+						boost::posix_time::minutes(vm["name-refresh-period"].as<unsigned>()),
+						vm["name-refresh-budget"].as<unsigned>());
+
+				// one request for all sensors instead of one per sensor when its first reading arrives
+				try {
+					logger.preload_sensors(uploader.with_store([] (klio::MSGStore::Ptr& store) {
+						return store->get_sensors();
+					}));
+				} catch (const klio::GenericException& e) {
+					std::cerr << "Could not preload sensors: " << e.reason() << std::endl;
+				}
 
 				listener.onPacketReceived(std::ref(logger));
 
+				boost::asio::signal_set terminate_handler(io, SIGINT, SIGTERM);
+				terminate_handler.async_wait(boost::bind(&boost::asio::io_service::stop, &io));
+
 				io.run();
+
+				spool.seal();
+				uploader.stop();
+				uploader.print_statistics(std::cout);
 			} catch (const hexabus::NetworkException& e) {
 				std::cerr << "Network error: " << e.code().message() << std::endl;
 				return ERR_NETWORK;
@@ -0,0 +1,431 @@
+#ifndef HEXANODE_SPOOL_UPLOADER_HPP
+#define HEXANODE_SPOOL_UPLOADER_HPP 1
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include <libhexabus/error.hpp>
+#include <libhexabus/logger/segment_log.hpp>
+
+// Uploads readings to the mySmartGrid store on a thread of its own, so packet reception never waits for the
+// server. Readings are appended to a SegmentLog, the spool, by the receiving thread; the uploader loads sealed
+// segments in batches and removes them only once the store flushed them. Failed uploads are retried with
+// exponential backoff, and the spool survives restarts of the bridge. Sealed segments are Gorilla encoded,
+// so the limit of the spool holds several times as many readings as the active segment would suggest. If the
+// spool outgrows its limit during a long outage, unreadable segments and then its oldest segments are dropped.
+//
+// Store is klio::MSGStore and Sensor klio::Sensor, or stand-ins with the same interface. A store keeps the
+// readings of a failed flush buffered, so after a failed upload the store is dropped and replaced by one
+// from open_store, and the retry sends every reading once.
+//
+// The store is used by the uploader thread only, except through with_store. Sensors handed to the uploader
+// are changed by the uploader thread only, see rename_sensor.
+template<typename Store, typename Sensor>
+class SpoolUploader {
+public:
+	typedef typename Store::Ptr StorePtr;
+	typedef typename Sensor::Ptr SensorPtr;
+	typedef std::function<void (const SensorPtr& sensor)> lookup_done_fn_t;
+
+	// failed attempts after which a sensor change is dropped
+	static const unsigned max_sensor_op_attempts = 5;
+
+	SpoolUploader(StorePtr store, std::function<StorePtr ()> open_store, hexabus::SegmentLog& spool,
+			size_t batch_size, uintmax_t spool_limit, std::chrono::seconds max_backoff)
+		: _store(store), _open_store(open_store), _spool(spool), _batch_size(batch_size), _spool_limit(spool_limit),
+		  _max_backoff(max_backoff), _stopping(false), _upload_requested(false), _uploaded(0), _uploads(0), _failures(0),
+		  _dropped(0)
+	{
+		_thread = std::thread(&SpoolUploader::run, this);
+	}
+
+	~SpoolUploader()
+	{
+		stop();
+	}
+
+	// makes sensor known to the uploader, so spooled readings of it need not be looked up in the store
+	void register_sensor(const SensorPtr& sensor)
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		_sensors[sensor->external_id()] = sensor;
+	}
+
+	// sensor changes are sent before the next batch of readings
+	void add_sensor(const SensorPtr& sensor)
+	{
+		register_sensor(sensor);
+		queue_sensor_op(sensor, true, std::string());
+	}
+
+	// the uploader thread may be sending the sensor to the store, so the name is set by that thread too
+	void rename_sensor(const SensorPtr& sensor, const std::string& name)
+	{
+		queue_sensor_op(sensor, false, name);
+	}
+
+	// looks the sensor with this external id up on the uploader thread and passes it, or an empty pointer if
+	// the store has no such sensor, to done on that thread. lookups are retried while the store cannot be
+	// reached
+	void lookup_sensor(const std::string& external_id, lookup_done_fn_t done)
+	{
+		Lookup lookup = { external_id, done };
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			_lookups.push_back(lookup);
+		}
+		_wakeup.notify_all();
+	}
+
+	// runs fn with exclusive access to the store, waiting for an upload in progress
+	template<typename Fn>
+	typename std::result_of<Fn(StorePtr&)>::type with_store(Fn fn)
+	{
+		std::lock_guard<std::mutex> lock(_store_lock);
+		if (!_store)
+			_store = _open_store();
+		return fn(_store);
+	}
+
+	// uploads sealed segments unless a failed upload is waiting for its retry
+	void upload_now()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			_upload_requested = true;
+		}
+		_wakeup.notify_all();
+	}
+
+	// makes a last attempt to upload the spool, then stops the uploader thread
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			_stopping = true;
+		}
+		_wakeup.notify_all();
+
+		if (_thread.joinable())
+			_thread.join();
+	}
+
+	uint64_t uploaded() const { return _uploaded; }
+	uint64_t uploads() const { return _uploads; }
+	uint64_t failures() const { return _failures; }
+	uint64_t dropped() const { return _dropped; }
+
+	void print_statistics(std::ostream& out) const
+	{
+		out << "Upload: " << _uploaded << " readings in "
+			<< _uploads << " uploads, "
+			<< _failures << " failed uploads, "
+			<< _dropped << " readings dropped" << std::endl;
+	}
+
+private:
+	SpoolUploader(const SpoolUploader&);
+	SpoolUploader& operator=(const SpoolUploader&);
+
+	struct SensorOp {
+		SensorPtr sensor;
+		bool add;
+		// of updates
+		std::string name;
+		unsigned failures;
+	};
+
+	struct Lookup {
+		std::string external_id;
+		lookup_done_fn_t done;
+	};
+
+	void queue_sensor_op(const SensorPtr& sensor, bool add, const std::string& name)
+	{
+		SensorOp op = { sensor, add, name, 0 };
+
+		std::lock_guard<std::mutex> lock(_lock);
+		_sensor_ops.push_back(op);
+	}
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(_lock);
+		std::chrono::seconds backoff(0);
+
+		for (;;) {
+			// lookups wait for the retry like uploads, the store is unlikely to answer them meanwhile
+			bool retry = backoff.count() != 0;
+			if (retry) {
+				_wakeup.wait_for(lock, backoff, [this] () { return _stopping; });
+			} else {
+				_wakeup.wait(lock, [this] () { return _stopping || _upload_requested || !_lookups.empty(); });
+			}
+
+			if (_stopping)
+				break;
+			bool upload_due = retry || _upload_requested;
+			_upload_requested = false;
+
+			lock.unlock();
+			bool uploaded = lookup_sensors() && (!upload_due || upload());
+			lock.lock();
+
+			if (uploaded) {
+				backoff = std::chrono::seconds(0);
+			} else {
+				backoff = std::min(std::max(2 * backoff, std::chrono::seconds(10)), _max_backoff);
+				std::cerr << "Upload failed, retrying in " << backoff.count() << " s" << std::endl;
+			}
+		}
+
+		lock.unlock();
+		upload();
+	}
+
+	// answers the queued lookups in order. returns false if the store could not be reached
+	bool lookup_sensors()
+	{
+		std::lock_guard<std::mutex> store_lock(_store_lock);
+
+		for (;;) {
+			Lookup lookup;
+			{
+				std::lock_guard<std::mutex> lock(_lock);
+				if (_lookups.empty())
+					return true;
+				lookup = _lookups.front();
+			}
+
+			SensorPtr sensor;
+			try {
+				if (!_store)
+					_store = _open_store();
+				sensor = find_sensor(lookup.external_id);
+			} catch (const std::exception& e) {
+				std::cerr << "Failed to look up sensor " << lookup.external_id << ": " << e.what() << std::endl;
+				_store.reset();
+				return false;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(_lock);
+				_lookups.pop_front();
+			}
+			lookup.done(sensor);
+		}
+	}
+
+	// returns false if the store could not be reached
+	bool upload()
+	{
+		// a spool that cannot be trimmed is still uploaded, which is what shrinks it
+		try {
+			enforce_limit();
+		} catch (const std::exception& e) {
+			std::cerr << "Failed to enforce spool limit: " << e.what() << std::endl;
+		}
+
+		std::vector<SensorOp> ops;
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			ops.assign(_sensor_ops.begin(), _sensor_ops.end());
+		}
+
+		std::lock_guard<std::mutex> store_lock(_store_lock);
+
+		try {
+			if (!_store)
+				_store = _open_store();
+
+			for (size_t i = 0; i < ops.size(); i++) {
+				try {
+					if (ops[i].add) {
+						_store->add_sensor(ops[i].sensor);
+					} else {
+						ops[i].sensor->name(ops[i].name);
+						_store->update_sensor(ops[i].sensor);
+					}
+				} catch (const std::exception& e) {
+					// a change the store keeps rejecting must not hold back the readings forever
+					std::lock_guard<std::mutex> lock(_lock);
+					if (++_sensor_ops.front().failures < max_sensor_op_attempts)
+						throw;
+					std::cerr << "Dropping change of sensor " << ops[i].sensor->external_id() << " after "
+						<< max_sensor_op_attempts << " failed attempts: " << e.what() << std::endl;
+				}
+
+				std::lock_guard<std::mutex> lock(_lock);
+				_sensor_ops.pop_front();
+			}
+
+			std::vector<boost::filesystem::path> sealed = _spool.sealed_segments();
+			std::vector<hexabus::SegmentLog::Record> records;
+			std::vector<boost::filesystem::path> batch;
+
+			for (size_t i = 0; i < sealed.size(); ) {
+				records.clear();
+				batch.clear();
+
+				for (; i < sealed.size() && records.size() < _batch_size; i++) {
+					try {
+						hexabus::SegmentLog::read_segment(sealed[i], records);
+						batch.push_back(sealed[i]);
+					} catch (const hexabus::GenericException& e) {
+						std::cerr << "Skipping spool segment: " << e.what() << std::endl;
+						boost::filesystem::path bad = sealed[i];
+						bad.replace_extension(".bad");
+						boost::system::error_code err;
+						boost::filesystem::rename(sealed[i], bad, err);
+						if (err)
+							std::cerr << "Could not move " << sealed[i] << " aside: " << err.message() << std::endl;
+					}
+				}
+
+				uint64_t count = 0;
+				for (std::vector<hexabus::SegmentLog::Record>::const_iterator r = records.begin(), end = records.end(); r != end; ++r) {
+					SensorPtr sensor = sensor_for(r->sensor);
+					if (!sensor) {
+						_dropped++;
+						continue;
+					}
+					_store->add_reading(sensor, r->timestamp, r->value);
+					count++;
+				}
+				_store->flush();
+
+				// a segment that cannot be removed is uploaded again
+				for (std::vector<boost::filesystem::path>::const_iterator it = batch.begin(), end = batch.end(); it != end; ++it) {
+					remove(*it);
+				}
+				_uploaded += count;
+				_uploads++;
+			}
+		} catch (const std::exception& e) {
+			std::cerr << "Failed to upload readings: " << e.what() << std::endl;
+			_failures++;
+			_store.reset();
+			return false;
+		}
+
+		return true;
+	}
+
+	// the sensor of a spooled reading
+	SensorPtr sensor_for(uint32_t index)
+	{
+		return find_sensor(_spool.sensor_name(index));
+	}
+
+	// sensors not registered in this run are looked up in the store
+	SensorPtr find_sensor(const std::string& name)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			typename std::map<std::string, SensorPtr>::const_iterator it = _sensors.find(name);
+			if (it != _sensors.end())
+				return it->second;
+		}
+
+		SensorPtr sensor;
+		std::vector<SensorPtr> sensors = _store->get_sensors_by_external_id(name);
+		if (sensors.size()) {
+			sensor = sensors[0];
+			register_sensor(sensor);
+		}
+		return sensor;
+	}
+
+	static uintmax_t file_size(const boost::filesystem::path& path)
+	{
+		boost::system::error_code err;
+		uintmax_t size = boost::filesystem::file_size(path, err);
+		return err ? 0 : size;
+	}
+
+	// drops segments that could not be read, then the oldest segments, until the spool fits into its limit
+	void enforce_limit()
+	{
+		std::vector<boost::filesystem::path> bad;
+		for (boost::filesystem::directory_iterator it(_spool.directory()), end; it != end; ++it) {
+			if (it->path().extension() == ".bad")
+				bad.push_back(it->path());
+		}
+		std::vector<boost::filesystem::path> sealed = _spool.sealed_segments();
+
+		uintmax_t size = 0;
+		for (std::vector<boost::filesystem::path>::const_iterator it = bad.begin(), end = bad.end(); it != end; ++it) {
+			size += file_size(*it);
+		}
+		for (std::vector<boost::filesystem::path>::const_iterator it = sealed.begin(), end = sealed.end(); it != end; ++it) {
+			size += file_size(*it);
+		}
+
+		for (std::vector<boost::filesystem::path>::const_iterator it = bad.begin(), end = bad.end(); it != end && size > _spool_limit; ++it) {
+			size -= file_size(*it);
+			if (remove(*it))
+				std::cerr << "Spool full, removed unreadable segment " << *it << std::endl;
+		}
+
+		for (std::vector<boost::filesystem::path>::const_iterator it = sealed.begin(), end = sealed.end(); it != end && size > _spool_limit; ++it) {
+			std::vector<hexabus::SegmentLog::Record> records;
+			try {
+				hexabus::SegmentLog::read_segment(*it, records);
+			} catch (const hexabus::GenericException&) {
+			}
+
+			size -= file_size(*it);
+			if (remove(*it)) {
+				_dropped += records.size();
+				std::cerr << "Spool full, dropped " << records.size() << " readings" << std::endl;
+			}
+		}
+	}
+
+	static bool remove(const boost::filesystem::path& path)
+	{
+		boost::system::error_code err;
+		boost::filesystem::remove(path, err);
+		if (err)
+			std::cerr << "Could not remove " << path << ": " << err.message() << std::endl;
+		return !err;
+	}
+
+	StorePtr _store;
+	std::function<StorePtr ()> _open_store;
+	hexabus::SegmentLog& _spool;
+	size_t _batch_size;
+	uintmax_t _spool_limit;
+	std::chrono::seconds _max_backoff;
+
+	std::mutex _store_lock;
+
+	std::mutex _lock;
+	std::condition_variable _wakeup;
+	std::deque<SensorOp> _sensor_ops;
+	std::deque<Lookup> _lookups;
+	std::map<std::string, SensorPtr> _sensors;
+	bool _stopping;
+	bool _upload_requested;
+	std::thread _thread;
+
+	std::atomic<uint64_t> _uploaded;
+	std::atomic<uint64_t> _uploads;
+	std::atomic<uint64_t> _failures;
+	std::atomic<uint64_t> _dropped;
+};
+
+#endif
@@ -0,0 +1,412 @@
+#define BOOST_TEST_MODULE spool_uploader_test
+#include <boost/test/unit_test.hpp>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+
+#include "spool_uploader.hpp"
+
+using boost::asio::ip::tcp;
+
+// Stands in for the mySmartGrid API: answers every request with 200, or with 503 while failing, and keeps
+// the lines of the accepted request bodies
+class StandInServer {
+	public:
+		StandInServer()
+			: _acceptor(_io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)), _stopping(false),
+			  _failing(false), _requests(0)
+		{
+			_thread = std::thread(&StandInServer::run, this);
+		}
+
+		~StandInServer()
+		{
+			// a last connection wakes up the accepting thread
+			_stopping = true;
+			boost::asio::io_service io;
+			tcp::socket socket(io);
+			socket.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port()));
+			_thread.join();
+		}
+
+		unsigned short port() const { return _acceptor.local_endpoint().port(); }
+		void set_failing(bool failing) { _failing = failing; }
+		unsigned requests() const { return _requests; }
+
+		std::vector<std::string> accepted()
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			return _accepted;
+		}
+
+	private:
+		void run()
+		{
+			for (;;) {
+				tcp::socket socket(_io);
+				_acceptor.accept(socket);
+				if (_stopping)
+					break;
+
+				try {
+					handle(socket);
+				} catch (const std::exception& e) {
+					std::cerr << "Stand-in server: " << e.what() << std::endl;
+				}
+			}
+		}
+
+		void handle(tcp::socket& socket)
+		{
+			boost::asio::streambuf buf;
+			size_t header_length = boost::asio::read_until(socket, buf, "\r\n\r\n");
+
+			std::string header(boost::asio::buffers_begin(buf.data()), boost::asio::buffers_begin(buf.data()) + header_length);
+			buf.consume(header_length);
+
+			size_t content_length = 0;
+			size_t pos = header.find("Content-Length: ");
+			if (pos != std::string::npos)
+				content_length = std::stoul(header.substr(pos + 16));
+			if (buf.size() < content_length)
+				boost::asio::read(socket, buf, boost::asio::transfer_exactly(content_length - buf.size()));
+
+			std::string body(boost::asio::buffers_begin(buf.data()), boost::asio::buffers_begin(buf.data()) + content_length);
+			_requests++;
+
+			bool failing = _failing;
+			if (!failing) {
+				std::lock_guard<std::mutex> lock(_lock);
+				std::istringstream lines(body);
+				std::string line;
+				while (std::getline(lines, line))
+					_accepted.push_back(line);
+			}
+
+			std::string response = failing
+				? "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+				: "HTTP/1.1 200 OK\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+			boost::asio::write(socket, boost::asio::buffer(response));
+		}
+
+		boost::asio::io_service _io;
+		tcp::acceptor _acceptor;
+		std::atomic<bool> _stopping;
+		std::atomic<bool> _failing;
+		std::atomic<unsigned> _requests;
+		std::mutex _lock;
+		std::vector<std::string> _accepted;
+		std::thread _thread;
+};
+
+struct StubSensor {
+	typedef std::shared_ptr<StubSensor> Ptr;
+
+	std::string id;
+	std::string sensor_name;
+
+	StubSensor(const std::string& id) : id(id) {}
+	const std::string& external_id() const { return id; }
+	void name(const std::string& name) { sensor_name = name; }
+};
+
+// the sensors of the stand-in server, shared by all stores opened for it
+struct StubSensors {
+	// sensors in the store before the uploader started
+	std::set<std::string> known;
+	// sensors add_sensor throws for
+	std::set<std::string> rejected;
+	// external id and name of every sensor added or updated
+	std::vector<std::string> changes;
+};
+
+// Buffers readings until they are flushed and posts them to the stand-in server, one line per reading.
+// Like the MSG store, it keeps the readings buffered if the upload fails.
+struct StubStore {
+	typedef std::shared_ptr<StubStore> Ptr;
+
+	unsigned short port;
+	StubSensors* sensors;
+	std::vector<std::string> buffer;
+
+	StubStore(unsigned short port, StubSensors* sensors = NULL) : port(port), sensors(sensors) {}
+
+	void add_sensor(const StubSensor::Ptr& sensor)
+	{
+		if (!sensors)
+			return;
+		if (sensors->rejected.count(sensor->external_id()))
+			throw std::runtime_error("sensor rejected");
+		sensors->changes.push_back("add " + sensor->external_id());
+	}
+
+	void update_sensor(const StubSensor::Ptr& sensor)
+	{
+		if (sensors)
+			sensors->changes.push_back("update " + sensor->external_id() + " " + sensor->sensor_name);
+	}
+
+	std::vector<StubSensor::Ptr> get_sensors_by_external_id(const std::string& id)
+	{
+		std::vector<StubSensor::Ptr> result;
+		if (sensors && sensors->known.count(id))
+			result.push_back(StubSensor::Ptr(new StubSensor(id)));
+		return result;
+	}
+
+	void add_reading(const StubSensor::Ptr& sensor, int64_t timestamp, double value)
+	{
+		std::ostringstream line;
+		line << sensor->external_id() << ' ' << timestamp << ' ' << value;
+		buffer.push_back(line.str());
+	}
+
+	void flush()
+	{
+		std::string body;
+		for (std::vector<std::string>::const_iterator it = buffer.begin(), end = buffer.end(); it != end; ++it)
+			body += *it + "\n";
+
+		std::ostringstream request;
+		request << "POST /sensor HTTP/1.1\r\nHost: localhost\r\nContent-Length: " << body.size()
+			<< "\r\nConnection: close\r\n\r\n" << body;
+
+		boost::asio::io_service io;
+		tcp::socket socket(io);
+		socket.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+		boost::asio::write(socket, boost::asio::buffer(request.str()));
+
+		boost::asio::streambuf response;
+		boost::asio::read_until(socket, response, "\r\n");
+		std::istream status_line(&response);
+		std::string version;
+		unsigned status;
+		status_line >> version >> status;
+		if (status != 200)
+			throw std::runtime_error("upload failed");
+
+		buffer.clear();
+	}
+};
+
+typedef SpoolUploader<StubStore, StubSensor> StubUploader;
+
+struct SpoolFixture {
+	boost::filesystem::path dir;
+	StandInServer server;
+	StubSensors sensors;
+	StubSensor::Ptr a, b;
+
+	SpoolFixture()
+		: dir(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("spooltest-%%%%-%%%%")),
+		  a(new StubSensor("a")), b(new StubSensor("b"))
+	{
+	}
+
+	~SpoolFixture()
+	{
+		boost::filesystem::remove_all(dir);
+	}
+
+	std::function<StubStore::Ptr ()> open_store()
+	{
+		unsigned short port = server.port();
+		StubSensors* sensors = &this->sensors;
+		return [port, sensors] () { return StubStore::Ptr(new StubStore(port, sensors)); };
+	}
+
+	// appends count readings, alternating between a and b, in sealed segments of segment_size readings
+	void spool_readings(size_t count, size_t segment_size)
+	{
+		hexabus::SegmentLog spool(dir, segment_size);
+		uint32_t ia = spool.sensor_index("a"), ib = spool.sensor_index("b");
+		for (size_t i = 0; i < count; i++)
+			spool.append(i % 2 ? ib : ia, 1400000000 + i, i);
+	}
+
+	uintmax_t spool_size()
+	{
+		uintmax_t size = 0;
+		for (boost::filesystem::directory_iterator it(dir), end; it != end; ++it) {
+			if (it->path().filename() != "sensors")
+				size += boost::filesystem::file_size(it->path());
+		}
+		return size;
+	}
+};
+
+template<typename Pred>
+static bool wait_until(Pred pred)
+{
+	for (int i = 0; i < 1000 && !pred(); i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	return pred();
+}
+
+BOOST_FIXTURE_TEST_CASE ( check_failed_upload_is_retried_once, SpoolFixture ) {
+	std::cout << "Checking that readings of a failed upload are uploaded exactly once." << std::endl;
+	spool_readings(1000, 100);
+
+	hexabus::SegmentLog spool(dir, 100);
+	server.set_failing(true);
+	{
+		StubUploader uploader(open_store()(), open_store(), spool, 300, 64 << 20, std::chrono::seconds(3600));
+		uploader.register_sensor(a);
+		uploader.register_sensor(b);
+
+		uploader.upload_now();
+		BOOST_REQUIRE(wait_until([&uploader] () { return uploader.failures() == 1; }));
+		BOOST_CHECK_EQUAL(server.requests(), 1u);
+
+		// the retry is waiting for its backoff, stopping makes the last attempt
+		server.set_failing(false);
+		uploader.stop();
+
+		BOOST_CHECK_EQUAL(uploader.uploaded(), 1000u);
+		BOOST_CHECK_EQUAL(uploader.uploads(), 4u);
+		BOOST_CHECK_EQUAL(uploader.dropped(), 0u);
+	}
+
+	std::vector<std::string> accepted = server.accepted();
+	std::set<std::string> unique(accepted.begin(), accepted.end());
+	BOOST_CHECK_EQUAL(accepted.size(), 1000u);
+	BOOST_CHECK_EQUAL(unique.size(), 1000u);
+	BOOST_CHECK(spool.sealed_segments().empty());
+}
+
+BOOST_FIXTURE_TEST_CASE ( check_unreadable_segments_are_set_aside, SpoolFixture ) {
+	std::cout << "Checking that an unreadable segment does not keep the others from being uploaded." << std::endl;
+	spool_readings(200, 100);
+
+	boost::filesystem::ofstream((dir / "00000000000000ff.seg")) << "not a segment";
+
+	hexabus::SegmentLog spool(dir, 100);
+	{
+		StubUploader uploader(open_store()(), open_store(), spool, 1000, 64 << 20, std::chrono::seconds(3600));
+		uploader.register_sensor(a);
+		uploader.register_sensor(b);
+		uploader.stop();
+
+		BOOST_CHECK_EQUAL(uploader.uploaded(), 200u);
+		BOOST_CHECK_EQUAL(uploader.failures(), 0u);
+	}
+
+	BOOST_CHECK_EQUAL(server.accepted().size(), 200u);
+	BOOST_CHECK(boost::filesystem::exists(dir / "00000000000000ff.bad"));
+	BOOST_CHECK(spool.sealed_segments().empty());
+}
+
+BOOST_FIXTURE_TEST_CASE ( check_spool_limit, SpoolFixture ) {
+	std::cout << "Checking that a full spool drops unreadable segments first, then the oldest readings." << std::endl;
+	spool_readings(400, 100);
+	uintmax_t segments_size = spool_size();
+
+	{
+		boost::filesystem::ofstream bad(dir / "0000000000000100.bad");
+		bad << std::string(1 << 16, 'x');
+	}
+
+	// no room for the unreadable segment and one of the others
+	hexabus::SegmentLog spool(dir, 100);
+	std::vector<boost::filesystem::path> sealed = spool.sealed_segments();
+	BOOST_REQUIRE_EQUAL(sealed.size(), 4u);
+	uintmax_t limit = segments_size - boost::filesystem::file_size(sealed[0]);
+
+	server.set_failing(true);
+	{
+		StubUploader uploader(open_store()(), open_store(), spool, 1000, limit, std::chrono::seconds(3600));
+		uploader.register_sensor(a);
+		uploader.register_sensor(b);
+		uploader.stop();
+
+		BOOST_CHECK_EQUAL(uploader.failures(), 1u);
+		BOOST_CHECK_EQUAL(uploader.dropped(), 100u);
+	}
+
+	BOOST_CHECK(!boost::filesystem::exists(dir / "0000000000000100.bad"));
+	BOOST_CHECK(!boost::filesystem::exists(sealed[0]));
+	BOOST_CHECK_EQUAL(spool.sealed_segments().size(), 3u);
+}
+
+BOOST_FIXTURE_TEST_CASE ( check_rejected_sensor_is_dropped, SpoolFixture ) {
+	std::cout << "Checking that a sensor change the store keeps rejecting is dropped after a few attempts." << std::endl;
+	spool_readings(200, 100);
+	sensors.rejected.insert("b");
+
+	hexabus::SegmentLog spool(dir, 100);
+	{
+		// no backoff, every upload_now is another attempt
+		StubUploader uploader(open_store()(), open_store(), spool, 1000, 64 << 20, std::chrono::seconds(0));
+		uploader.add_sensor(a);
+		uploader.add_sensor(b);
+		uploader.rename_sensor(a, "Kitchen");
+
+		for (unsigned attempt = 1; attempt < StubUploader::max_sensor_op_attempts; attempt++) {
+			uploader.upload_now();
+			BOOST_REQUIRE(wait_until([&uploader, attempt] () { return uploader.failures() == attempt; }));
+			BOOST_CHECK_EQUAL(uploader.uploaded(), 0u);
+		}
+
+		// the last attempt drops the change and lets the readings through
+		uploader.upload_now();
+		BOOST_REQUIRE(wait_until([&uploader] () { return uploader.uploaded() == 200; }));
+		uploader.stop();
+
+		BOOST_CHECK_EQUAL(uploader.failures(), StubUploader::max_sensor_op_attempts - 1);
+		BOOST_CHECK_EQUAL(uploader.dropped(), 0u);
+	}
+
+	// the rename queued behind the rejected sensor is applied by the uploader
+	BOOST_CHECK_EQUAL(a->sensor_name, "Kitchen");
+	BOOST_REQUIRE_EQUAL(sensors.changes.size(), 2u);
+	BOOST_CHECK_EQUAL(sensors.changes[0], "add a");
+	BOOST_CHECK_EQUAL(sensors.changes[1], "update a Kitchen");
+	BOOST_CHECK_EQUAL(server.accepted().size(), 200u);
+}
+
+BOOST_FIXTURE_TEST_CASE ( check_sensor_lookup, SpoolFixture ) {
+	std::cout << "Checking that sensors are looked up on the uploader thread without waiting for an upload." << std::endl;
+	sensors.known.insert("c");
+
+	hexabus::SegmentLog spool(dir, 100);
+	StubUploader uploader(open_store()(), open_store(), spool, 1000, 64 << 20, std::chrono::seconds(3600));
+	uploader.register_sensor(a);
+
+	std::mutex lock;
+	std::map<std::string, StubSensor::Ptr> found;
+	std::set<std::thread::id> threads;
+	for (const char* id : { "a", "c", "d" }) {
+		std::string name = id;
+		uploader.lookup_sensor(name, [&lock, &found, &threads, name] (const StubSensor::Ptr& sensor) {
+			std::lock_guard<std::mutex> guard(lock);
+			found[name] = sensor;
+			threads.insert(std::this_thread::get_id());
+		});
+	}
+
+	BOOST_REQUIRE(wait_until([&lock, &found] () {
+		std::lock_guard<std::mutex> guard(lock);
+		return found.size() == 3;
+	}));
+	uploader.stop();
+
+	// registered sensors are not looked up in the store
+	BOOST_CHECK(found["a"] == a);
+	BOOST_CHECK(found["c"] && found["c"]->external_id() == "c");
+	BOOST_CHECK(!found["d"]);
+	BOOST_CHECK_EQUAL(threads.size(), 1u);
+	BOOST_CHECK(!threads.count(std::this_thread::get_id()));
+	BOOST_CHECK_EQUAL(uploader.uploads(), 0u);
+}
@@ -8,6 +8,7 @@
 #include <libhexabus/common.hpp>
 #include <libhexabus/packet.hpp>
 #include <libhexabus/error.hpp>
+#include <libhexabus/json.hpp>
 #include <libhexabus/socket.hpp>
 #include <libhexabus/endpoint_registry.hpp>
 #include <hbt/Lang/ast.hpp>
@@ -272,82 +273,59 @@ static void printDevice(std::ostream& out, const DiscoveredDev& dev)
 	out << std::endl;
 }
 
-static bool writeDevJSON(std::ostream& out, const DiscoveredDev& dev, NameSanitizer san)
+static bool writeDevJSON(hexabus::JsonWriter& json, const DiscoveredDev& dev, NameSanitizer san)
 {
-	auto json = [] (const std::string& s) {
-		std::stringstream sbuf;
-		for (char c : s) {
-			switch (c) {
-			case '"': sbuf << "\\\"";
-			case '\n': sbuf << "\\\n";
-			case '\t': sbuf << "\\\t";
-			case '\r': sbuf << "\\\r";
-			case '\v': sbuf << "\\\v";
-			default: sbuf << c;
-			}
-		}
-		return sbuf.str();
-	};
-
 	if (dev.name.empty())
 		return false;
 
-	out
-		<< '{' << std::endl
-		<< R"(	"name": ")" << json(dev.name) << R"(",)" << std::endl
-		<< R"(	"sm_name": ")" << san.sanitizeName(dev) << R"(",)" << std::endl
-		<< R"(	"ip": ")" << dev.address << R"(",)" << std::endl
-		<< R"(	"endpoints": [)" << std::endl
-		<< R"(		)";
+	json.beginObject()
+		.member("name", dev.name)
+		.member("sm_name", san.sanitizeName(dev))
+		.member("ip", dev.address.to_string());
 
-	unsigned put = 0;
+	json.key("endpoints").beginArray();
 	for (auto& ep : dev.endpoints) {
 		if (ep.eid % 32 == 0)
 			continue;
-		if (put++)
-			out << ", ";
 
-		out
-			<< R"({)" << std::endl
-			<< R"(			"eid": )" << ep.eid << ',' << std::endl
-			<< R"(			"sm_name": ")" << san.sanitizeName(ep) << R"(",)" << std::endl
-			<< R"(			"type": ")" << hexabus::datatypeName(ep.type) << R"(",)" << std::endl;
+		json.beginObject()
+			.member("eid", ep.eid)
+			.member("sm_name", san.sanitizeName(ep))
+			.member("type", hexabus::datatypeName(ep.type));
 
 		static hexabus::EndpointRegistry epr;
-		auto epit = epr.find(ep.eid);
-		if (epit != epr.end()) {
-			out
-				<< R"(			"unit": ")" << json(epit->second.unit().get_value_or("")) << R"(",)" << std::endl
-				<< R"(			"description": ")" << json(epit->second.description()) << R"(",)" << std::endl
-				<< R"(			"function": ")";
+		auto eps = epr.snapshot();
+		auto epit = eps->find(ep.eid);
+		if (epit != eps->end()) {
+			json
+				.member("unit", epit->second.unit().get_value_or(""))
+				.member("description", epit->second.description());
 			switch (epit->second.function()) {
-			case hexabus::EndpointDescriptor::sensor: out << "sensor"; break;
-			case hexabus::EndpointDescriptor::actor: out << "actor"; break;
-			case hexabus::EndpointDescriptor::infrastructure: out << "infrastructure"; break;
+			case hexabus::EndpointDescriptor::sensor: json.member("function", "sensor"); break;
+			case hexabus::EndpointDescriptor::actor: json.member("function", "actor"); break;
+			case hexabus::EndpointDescriptor::infrastructure: json.member("function", "infrastructure"); break;
 			}
-			out << R"(")" << std::endl;
 		}
 
-		out << "		}";
+		json.endObject();
 	}
+	json.endArray();
 
-	out << ']' << std::endl << "	}";
+	json.endObject();
 
 	return true;
 }
 
 static void writeDevicesJSON(std::ostream& out, const std::vector<DiscoveredDev>& devices, NameSanitizer san)
 {
-	out << R"({"devices": [)";
+	hexabus::JsonWriter json(true);
 
-	unsigned put = 0;
-	for (auto& dev : devices) {
-		if (put++)
-			out << ", ";
-		writeDevJSON(out, dev, san);
-	}
+	json.beginObject().key("devices").beginArray();
+	for (auto& dev : devices)
+		writeDevJSON(json, dev, san);
+	json.endArray().endObject();
 
-	out << std::endl << "]}" << std::endl;
+	json.flushLine(out);
 }
 
 static std::ostream& openFile(const std::string& path, std::unique_ptr<std::ofstream>& ofPtr)
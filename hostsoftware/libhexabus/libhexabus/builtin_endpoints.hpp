@@ -0,0 +1,76 @@
+#ifndef LIBHEXABUS_BUILTIN_ENDPOINTS_HPP
+#define LIBHEXABUS_BUILTIN_ENDPOINTS_HPP 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libhexabus/endpoint_registry.hpp>
+#include <libhexabus/hexabus_types.h>
+
+namespace hexabus {
+
+	// Endpoint descriptors compiled into the library. The table is generated from the endpoint registry
+	// file at build time (see GenerateEndpointTables.cmake) and sorted by eid, so lookups are a binary
+	// search that can be evaluated at compile time.
+	struct BuiltinEndpoint {
+		uint32_t eid;
+		hxb_datatype type;
+		const char* description;
+		const char* unit;
+		uint8_t access;
+		uint8_t function;
+
+		EndpointDescriptor descriptor() const
+		{
+			return EndpointDescriptor(eid, description,
+					unit ? boost::optional<std::string>(unit) : boost::none,
+					type, EndpointDescriptor::Access(access), EndpointDescriptor::Function(function));
+		}
+	};
+
+	constexpr BuiltinEndpoint builtin_endpoints[] = {
+#include <libhexabus/endpoint_table.inc>
+	};
+
+	constexpr size_t builtin_endpoint_count = sizeof(builtin_endpoints) / sizeof(builtin_endpoints[0]);
+
+	namespace detail {
+		constexpr bool builtin_endpoints_sorted(size_t i = 0)
+		{
+			return i + 1 >= builtin_endpoint_count
+				|| (builtin_endpoints[i].eid < builtin_endpoints[i + 1].eid && builtin_endpoints_sorted(i + 1));
+		}
+
+		constexpr size_t builtin_endpoint_lower_bound(uint32_t eid, size_t first, size_t last)
+		{
+			return first == last
+				? first
+				: builtin_endpoints[first + (last - first) / 2].eid < eid
+					? builtin_endpoint_lower_bound(eid, first + (last - first) / 2 + 1, last)
+					: builtin_endpoint_lower_bound(eid, first, first + (last - first) / 2);
+		}
+	}
+
+	static_assert(detail::builtin_endpoints_sorted(), "builtin endpoint table is not sorted");
+	static_assert(EndpointDescriptor::read == 1 && EndpointDescriptor::write == 2, "access encoding changed");
+	static_assert(EndpointDescriptor::sensor == 0 && EndpointDescriptor::actor == 1
+			&& EndpointDescriptor::infrastructure == 2, "function encoding changed");
+
+	// the descriptor for eid, or NULL if eid is not in the table
+	constexpr const BuiltinEndpoint* find_builtin_endpoint(uint32_t eid)
+	{
+		return detail::builtin_endpoint_lower_bound(eid, 0, builtin_endpoint_count) < builtin_endpoint_count
+				&& builtin_endpoints[detail::builtin_endpoint_lower_bound(eid, 0, builtin_endpoint_count)].eid == eid
+			? &builtin_endpoints[detail::builtin_endpoint_lower_bound(eid, 0, builtin_endpoint_count)]
+			: NULL;
+	}
+
+	// the datatype of eid, or HXB_DTYPE_UNDEFINED if eid is not in the table
+	constexpr uint8_t builtin_endpoint_type(uint32_t eid)
+	{
+		return find_builtin_endpoint(eid) ? uint8_t(find_builtin_endpoint(eid)->type) : uint8_t(HXB_DTYPE_UNDEFINED);
+	}
+
+}
+
+#endif
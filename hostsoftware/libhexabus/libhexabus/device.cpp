@@ -19,6 +19,8 @@
  */
 #include "device.hpp"
 
+#include <algorithm>
+
 #include <boost/lexical_cast.hpp>
 
 #include <libhexabus/filtering.hpp>
@@ -34,17 +36,61 @@ bool isWrite(const Packet& packet, const boost::asio::ip::udp::endpoint& from)
 	return packet.type() == HXB_PTYPE_WRITE;
 }
 
+namespace {
+	template<typename TEntry>
+	bool eid_before(const TEntry& entry, uint32_t eid)
+	{
+		return entry.eid < eid;
+	}
+
+	bool group_before(const std::pair<uint32_t, uint32_t>& entry, uint32_t group)
+	{
+		return entry.first < group;
+	}
+
+	// How well a local address matches a remote one: link-local addresses on the interface of a
+	// link-local requester first, then addresses of the same scope, then by length of the common prefix.
+	unsigned int address_match(const boost::asio::ip::address_v6& local, const boost::asio::ip::address_v6& remote)
+	{
+		unsigned int score = 0;
+
+		if ( local.is_link_local() == remote.is_link_local() ) {
+			score += 256;
+			if ( remote.is_link_local() && local.scope_id() == remote.scope_id() )
+				score += 512;
+		}
+
+		boost::asio::ip::address_v6::bytes_type l = local.to_bytes(), r = remote.to_bytes();
+		for ( size_t i = 0; i < l.size(); i++ ) {
+			uint8_t diff = l[i] ^ r[i];
+			if ( diff ) {
+				while ( !(diff & 0x80) ) {
+					score++;
+					diff <<= 1;
+				}
+				break;
+			}
+			score += 8;
+		}
+
+		return score;
+	}
+}
+
 bool dummy_write_handler(const std::array<uint8_t, 65>& value)
 {
 	return true;
 }
 
 Device::Device(boost::asio::io_service& io, const std::vector<std::string>& interfaces, const std::vector<std::string>& addresses, int interval)
-	: _listener(io)
+	: _io(io)
+	, _listener(io)
 	, _sockets()
+	, _replyFromAll(false)
 	, _timer(io)
-	, _interval(interval)
+	, _broadcastPolicy(boost::posix_time::seconds(interval), boost::posix_time::seconds(2 * interval))
 	, _sm_state(0)
+	, _self(std::make_shared<Device*>(this))
 {
 	for (std::vector<std::string>::const_iterator it = interfaces.begin(), end = interfaces.end(); it != end; ++it) {
 		try {
@@ -58,8 +104,9 @@ Device::Device(boost::asio::io_service& io, const std::vector<std::string>& inte
 	for (std::vector<std::string>::const_iterator it = addresses.begin(), end = addresses.end(); it != end; ++it) {
 		hexabus::Socket *socket = 0;
 		try {
+			boost::asio::ip::address_v6 address = boost::asio::ip::address_v6::from_string(*it);
 			socket = new hexabus::Socket(io);
-			socket->bind(boost::asio::ip::udp::endpoint(boost::asio::ip::address_v6::from_string(*it), 61616));
+			socket->bind(boost::asio::ip::udp::endpoint(address, 61616));
 			socket->onPacketReceived(boost::bind(&Device::_handle_query, this, socket, _1, _2), filtering::isQuery() && (filtering::eid() % 32 > 0));
 			socket->onPacketReceived(boost::bind(&Device::_handle_write, this, socket, _1, _2), isWrite && (filtering::eid() % 32 > 0));
 
@@ -72,6 +119,7 @@ Device::Device(boost::asio::io_service& io, const std::vector<std::string>& inte
 
 			socket->onAsyncError(boost::bind(&Device::_handle_errors, this, _1));
 			_sockets.push_back(socket);
+			_addresses.push_back(address);
 		} catch ( const NetworkException& error ) {
 			if ( socket )
 				delete socket;
@@ -85,8 +133,6 @@ Device::Device(boost::asio::io_service& io, const std::vector<std::string>& inte
 	_listener.onPacketReceived(boost::bind(&Device::_handle_descquery, this, _1, _2), filtering::isQuery() && (filtering::eid() % 32 == 0));
 	_listener.onPacketReceived(boost::bind(&Device::_handle_descepquery, this, _1, _2), filtering::isEndpointQuery() && (filtering::eid() % 32 == 0));
 
-	_handle_broadcasts(boost::system::error_code());
-
 	TypedEndpointFunctions<uint8_t>::Ptr smcontrolEP(new TypedEndpointFunctions<uint8_t>(EP_SM_CONTROL, "Statemachine control", false));
 	smcontrolEP->onRead(boost::bind(&Device::_handle_smcontrolquery, this));
 	smcontrolEP->onWrite(boost::bind(&Device::_handle_smcontrolwrite, this, _1));
@@ -127,20 +173,146 @@ boost::signals2::connection Device::onAsyncError(const async_error_fn_t& callbac
 
 void Device::addEndpoint(const EndpointFunctions::Ptr ep)
 {
-	_endpoints.insert(std::pair<uint32_t, const EndpointFunctions::Ptr>(ep->eid(), ep));
+	endpoint_table_type::iterator it = std::lower_bound(_endpoints.begin(), _endpoints.end(), ep->eid(), eid_before<EndpointEntry>);
+	if ( it != _endpoints.end() && it->eid == ep->eid() )
+		return;
+
+	it = _endpoints.insert(it, EndpointEntry(ep));
+
+	uint32_t group = ep->eid() - ep->eid() % 32;
+	group_table_type::iterator git = std::lower_bound(_groups.begin(), _groups.end(), group, group_before);
+	if ( git == _groups.end() || git->first != group )
+		git = _groups.insert(git, std::make_pair(group, uint32_t(1)));
+	git->second |= uint32_t(1) << (ep->eid() % 32);
+	_index_endpoints();
+
+	if ( ep->broadcast() ) {
+		// start at a random phase within the first sampling period to spread broadcasts of devices started
+		// at the same time
+		long period = _broadcast_policy(*it).min_interval.total_milliseconds();
+		it->next_poll = boost::asio::deadline_timer::traits_type::now()
+			+ boost::posix_time::milliseconds(period > 0 ? rand() % period : 0);
+		_schedule_broadcasts();
+	}
+}
+
+void Device::setBroadcastPolicy(const BroadcastPolicy& policy)
+{
+	_broadcastPolicy = policy;
+}
+
+void Device::invalidate(uint32_t eid)
+{
+	const EndpointEntry* ep = _find_endpoint(eid);
+	if ( ep )
+		ep->functions->invalidate();
+}
+
+boost::optional<EndpointStatistics> Device::statistics(uint32_t eid) const
+{
+	const EndpointEntry* ep = _find_endpoint(eid);
+	if ( !ep )
+		return boost::none;
+
+	return ep->statistics;
+}
+
+// endpoints are added at startup, so the tables are simply rebuilt
+void Device::_index_endpoints()
+{
+	_endpoint_slots.clear();
+	for ( size_t i = 0; i < _endpoints.size() && _endpoints[i].eid < dense_eids; i++ ) {
+		_endpoint_slots.resize(_endpoints[i].eid + 1, 0);
+		_endpoint_slots[_endpoints[i].eid] = i + 1;
+	}
+
+	_group_slots.clear();
+	for ( size_t i = 0; i < _groups.size() && _groups[i].first < dense_eids; i++ ) {
+		_group_slots.resize(_groups[i].first / 32 + 1, 1);
+		_group_slots[_groups[i].first / 32] = _groups[i].second;
+	}
+}
+
+const Device::EndpointEntry* Device::_find_endpoint(uint32_t eid) const
+{
+	if ( eid < dense_eids ) {
+		uint32_t slot = eid < _endpoint_slots.size() ? _endpoint_slots[eid] : 0;
+		return slot ? &_endpoints[slot - 1] : NULL;
+	}
+
+	endpoint_table_type::const_iterator it = std::lower_bound(_endpoints.begin(), _endpoints.end(), eid, eid_before<EndpointEntry>);
+	if ( it == _endpoints.end() || it->eid != eid )
+		return NULL;
+
+	return &*it;
+}
+
+Device::EndpointEntry* Device::_find_endpoint(uint32_t eid)
+{
+	return const_cast<EndpointEntry*>(static_cast<const Device*>(this)->_find_endpoint(eid));
+}
+
+hexabus::Socket* Device::_reply_socket(const boost::asio::ip::udp::endpoint& to) const
+{
+	hexabus::Socket* best = _sockets.front();
+	unsigned int best_match = 0;
+
+	for ( size_t i = 0; i < _sockets.size(); i++ ) {
+		unsigned int match = address_match(_addresses[i], to.address().to_v6());
+		if ( match > best_match ) {
+			best = _sockets[i];
+			best_match = match;
+		}
+	}
+
+	return best;
+}
+
+void Device::_record_latency(HandlerStatistics& statistics, request_time start)
+{
+	std::chrono::microseconds latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+	statistics.record(boost::posix_time::microseconds(latency.count()));
+}
+
+uint32_t Device::_group_descriptor(uint32_t group) const
+{
+	if ( group < dense_eids )
+		return group / 32 < _group_slots.size() ? _group_slots[group / 32] : 1;
+
+	group_table_type::const_iterator it = std::lower_bound(_groups.begin(), _groups.end(), group, group_before);
+	if ( it == _groups.end() || it->first != group )
+		return 1;
+
+	return it->second;
 }
 
 void Device::_handle_query(hexabus::Socket* socket, const Packet& p, const boost::asio::ip::udp::endpoint& from)
 {
-	const QueryPacket* query = dynamic_cast<const QueryPacket*>(&p);
-	if ( !query ) {
+	if ( p.type() != HXB_PTYPE_QUERY ) {
 		_asyncError(GenericException("Trying to handle a query but didn't get a QueryPacket"));
 		return;
 	}
-	std::map<uint32_t, const EndpointFunctions::Ptr>::iterator it = _endpoints.find(query->eid());
+	const QueryPacket& query = static_cast<const QueryPacket&>(p);
+	EndpointEntry* ep = _find_endpoint(query.eid());
+	request_time start = std::chrono::steady_clock::now();
+
 	try {
-		if ( it != _endpoints.end() ) {
-			socket->send(*(it->second->handle_query()), from);
+		if ( ep && ep->functions->has_async_read() ) {
+			uint32_t eid = ep->eid;
+			// the io_service outlives the device, the device and its sockets may be gone by the time the reply is ready
+			boost::asio::io_service& io = _io;
+			std::weak_ptr<Device*> self = _self;
+			EndpointFunctions::Ptr functions = ep->functions;
+			functions->async_query([&io, self, functions, socket, from, eid, start] (const Packet::Ptr& reply) {
+				io.post([self, socket, from, eid, start, reply] () {
+					if ( std::shared_ptr<Device*> device = self.lock() )
+						(*device)->_complete_query(socket, from, eid, start, reply);
+				});
+			});
+		} else if ( ep ) {
+			ep->functions->send_query_reply(*socket, from);
+			_record_latency(ep->statistics.reads, start);
 		} else {
 			socket->send(ErrorPacket(HXB_ERR_UNKNOWNEID), from);
 		}
@@ -152,26 +324,57 @@ void Device::_handle_query(hexabus::Socket* socket, const Packet& p, const boost
 		std::stringstream oss;
 		oss << "An error occured when handling a query: " << error.reason();
 		_asyncError(GenericException(oss.str()));
+	} catch ( const std::exception& error ) {
+		std::stringstream oss;
+		oss << "An error occured when handling a query: " << error.what();
+		_asyncError(GenericException(oss.str()));
+	}
+}
+
+void Device::_complete_query(hexabus::Socket* socket, const boost::asio::ip::udp::endpoint& from, uint32_t eid, request_time start, const Packet::Ptr& reply)
+{
+	EndpointEntry* ep = _find_endpoint(eid);
+	if ( ep )
+		_record_latency(ep->statistics.reads, start);
+
+	if ( !reply ) {
+		std::stringstream oss;
+		oss << "An error occured when handling a query: Error reading endpoint " << eid;
+		_asyncError(GenericException(oss.str()));
+		return;
+	}
+
+	try {
+		socket->send(*reply, from);
+	} catch ( const NetworkException& error ) {
+		std::stringstream oss;
+		oss << "An error occured when replying a query: " << error.reason() << ": " << error.code().message();
+		_asyncError(GenericException(oss.str()));
 	}
 }
 
 void Device::_handle_write(hexabus::Socket* socket, const Packet& p, const boost::asio::ip::udp::endpoint& from)
 {
-	const EIDPacket* write = dynamic_cast<const EIDPacket*>(&p);
-	if ( !write ) {
-		_asyncError(GenericException("Trying to handle a write but didn't get an EIDPacket"));
+	if ( p.type() != HXB_PTYPE_WRITE ) {
+		_asyncError(GenericException("Trying to handle a write but didn't get a WritePacket"));
 		return;
 	}
-	std::map<uint32_t, const EndpointFunctions::Ptr>::iterator it = _endpoints.find(write->eid());
+	// every write packet is an EIDPacket, whatever its datatype
+	const EIDPacket& write = static_cast<const EIDPacket&>(p);
+	const EndpointEntry* ep = _find_endpoint(write.eid());
 	try {
-		if ( it != _endpoints.end() ) {
-			uint8_t res = it->second->handle_write(p);
-			if ( res != HXB_ERR_SUCCESS && res < HXB_ERR_INTERNAL ) {
-				std::stringstream oss;
-				oss << "An error occured when handling a write packet for eid " << write->eid();
-				_asyncError(GenericException(oss.str()));
-				socket->send(ErrorPacket(res), from);
-			}
+		if ( ep ) {
+			uint32_t eid = ep->eid;
+			request_time start = std::chrono::steady_clock::now();
+			boost::asio::io_service& io = _io;
+			std::weak_ptr<Device*> self = _self;
+			EndpointFunctions::Ptr functions = ep->functions;
+			functions->async_write(p, [&io, self, functions, socket, from, eid, start] (uint8_t result) {
+				io.post([self, socket, from, eid, start, result] () {
+					if ( std::shared_ptr<Device*> device = self.lock() )
+						(*device)->_complete_write(socket, from, eid, start, result);
+				});
+			});
 		} else {
 			socket->send(ErrorPacket(HXB_ERR_UNKNOWNEID), from);
 		}
@@ -186,8 +389,37 @@ void Device::_handle_write(hexabus::Socket* socket, const Packet& p, const boost
 	}
 }
 
+void Device::_complete_write(hexabus::Socket* socket, const boost::asio::ip::udp::endpoint& from, uint32_t eid, request_time start, uint8_t result)
+{
+	EndpointEntry* ep = _find_endpoint(eid);
+	if ( ep )
+		_record_latency(ep->statistics.writes, start);
+
+	if ( result == HXB_ERR_SUCCESS || result >= HXB_ERR_INTERNAL )
+		return;
+
+	std::stringstream oss;
+	oss << "An error occured when handling a write packet for eid " << eid;
+	_asyncError(GenericException(oss.str()));
+	try {
+		socket->send(ErrorPacket(result), from);
+	} catch ( const NetworkException& error ) {
+		std::stringstream oss;
+		oss << "An error occured when replying to a write packet: " << error.reason() << ": " << error.code().message();
+		_asyncError(GenericException(oss.str()));
+	}
+}
+
 void Device::_handle_epquery(const Packet& p, const boost::asio::ip::udp::endpoint& from)
 {
+	if ( _sockets.empty() )
+		return;
+
+	if ( !_replyFromAll ) {
+		_handle_epquery(_reply_socket(from), p, from);
+		return;
+	}
+
 	for ( std::vector<hexabus::Socket*>::iterator it = _sockets.begin(), end = _sockets.end(); it != end; ++it )
 	{
 		_handle_epquery(*it, p, from);
@@ -196,15 +428,15 @@ void Device::_handle_epquery(const Packet& p, const boost::asio::ip::udp::endpoi
 
 void Device::_handle_epquery(hexabus::Socket* socket, const Packet& p, const boost::asio::ip::udp::endpoint& from)
 {
-	const EIDPacket* query = dynamic_cast<const EIDPacket*>(&p);
-	if ( !query ) {
-		_asyncError(GenericException("Trying to handle an EP query but didn't get an EIDPacket"));
+	if ( p.type() != HXB_PTYPE_EPQUERY ) {
+		_asyncError(GenericException("Trying to handle an EP query but didn't get an EndpointQueryPacket"));
 		return;
 	}
-	std::map<uint32_t, const EndpointFunctions::Ptr>::iterator it = _endpoints.find(query->eid());
+	const EndpointQueryPacket& query = static_cast<const EndpointQueryPacket&>(p);
+	const EndpointEntry* ep = _find_endpoint(query.eid());
 	try {
-		if ( it != _endpoints.end() ) {
-			socket->send(EndpointInfoPacket(query->eid(), it->second->datatype(), it->second->name()), from);
+		if ( ep ) {
+			socket->send(ep->info, from);
 		} else {
 			socket->send(ErrorPacket(HXB_ERR_UNKNOWNEID), from);
 		}
@@ -217,6 +449,14 @@ void Device::_handle_epquery(hexabus::Socket* socket, const Packet& p, const boo
 
 void Device::_handle_descquery(const Packet& p, const boost::asio::ip::udp::endpoint& from)
 {
+	if ( _sockets.empty() )
+		return;
+
+	if ( !_replyFromAll ) {
+		_handle_descquery(_reply_socket(from), p, from);
+		return;
+	}
+
 	for ( std::vector<hexabus::Socket*>::iterator it = _sockets.begin(), end = _sockets.end(); it != end; ++it )
 	{
 		_handle_descquery(*it, p, from);
@@ -225,23 +465,14 @@ void Device::_handle_descquery(const Packet& p, const boost::asio::ip::udp::endp
 
 void Device::_handle_descquery(hexabus::Socket* socket, const Packet& p, const boost::asio::ip::udp::endpoint& from)
 {
-	const EIDPacket* query = dynamic_cast<const EIDPacket*>(&p);
-	if ( !query ) {
-		_asyncError(GenericException("Trying to handle an EP group query but didn't get an EIDPacket"));
+	if ( p.type() != HXB_PTYPE_QUERY ) {
+		_asyncError(GenericException("Trying to handle an EP group query but didn't get a QueryPacket"));
 		return;
 	}
-
-	uint32_t group = 1;
-	std::map<uint32_t, const EndpointFunctions::Ptr>::iterator it = _endpoints.begin();
-	while ( it->first < query->eid() && it != _endpoints.end() ) { it++; }
-	while ( it->first < ( query->eid() + 32 ) && it != _endpoints.end() )
-	{
-		group |= (1 << (it->first - query->eid()) );
-		it++;
-	}
+	const QueryPacket& query = static_cast<const QueryPacket&>(p);
 
 	try {
-		socket->send(InfoPacket<uint32_t>(query->eid(), group), from);
+		socket->send(InfoPacket<uint32_t>(query.eid(), _group_descriptor(query.eid())), from);
 	} catch ( const NetworkException& error ) {
 		std::stringstream oss;
 		oss << "An error occured when replying to an EP group query packet: " << error.reason() << ": " << error.code().message();
@@ -251,6 +482,14 @@ void Device::_handle_descquery(hexabus::Socket* socket, const Packet& p, const b
 
 void Device::_handle_descepquery(const Packet& p, const boost::asio::ip::udp::endpoint& from)
 {
+	if ( _sockets.empty() )
+		return;
+
+	if ( !_replyFromAll ) {
+		_handle_descepquery(_reply_socket(from), p, from);
+		return;
+	}
+
 	for ( std::vector<hexabus::Socket*>::iterator it = _sockets.begin(), end = _sockets.end(); it != end; ++it )
 	{
 		_handle_descepquery(*it, p, from);
@@ -259,18 +498,18 @@ void Device::_handle_descepquery(const Packet& p, const boost::asio::ip::udp::en
 
 void Device::_handle_descepquery(hexabus::Socket* socket, const Packet& p, const boost::asio::ip::udp::endpoint& from)
 {
-	const EIDPacket* query = dynamic_cast<const EIDPacket*>(&p);
-	if ( !query ) {
-		_asyncError(GenericException("Trying to handle a device description query but didn't get an EIDPacket"));
+	if ( p.type() != HXB_PTYPE_EPQUERY ) {
+		_asyncError(GenericException("Trying to handle a device description query but didn't get an EndpointQueryPacket"));
 		return;
 	}
+	const EndpointQueryPacket& query = static_cast<const EndpointQueryPacket&>(p);
 
 	std::string device_name = "";
 	if ( _read.num_slots() > 0 )
 		device_name = *_read();
 
 	try {
-		socket->send(EndpointInfoPacket(query->eid(), HXB_DTYPE_UINT32, device_name), from);
+		socket->send(EndpointInfoPacket(query.eid(), HXB_DTYPE_UINT32, device_name), from);
 	} catch ( const NetworkException& error ) {
 		std::stringstream oss;
 		oss << "An error occured when replying to a device description query packet from " << from << ": " << error.reason() << ": " << error.code().message();
@@ -291,8 +530,7 @@ bool Device::_handle_smcontrolwrite(uint8_t value)
 
 void Device::_handle_smupload(hexabus::Socket* socket, const Packet& p, const boost::asio::ip::udp::endpoint& from)
 {
-	const WritePacket<std::array<uint8_t, 65> >* write = dynamic_cast<const WritePacket<std::array<uint8_t, 65> >*>(&p);
-	if ( !write ) {
+	if ( p.type() != HXB_PTYPE_WRITE || static_cast<const TypedPacket&>(p).datatype() != HXB_DTYPE_65BYTES ) {
 		try {
 			socket->send(InfoPacket<bool>(EP_SM_UP_ACKNAK, false), from);
 		} catch ( const NetworkException& error ) {
@@ -302,7 +540,7 @@ void Device::_handle_smupload(hexabus::Socket* socket, const Packet& p, const bo
 		}
 		return;
 	}
-	const std::array<uint8_t, 65> data = write->value();
+	const std::array<uint8_t, 65> data = static_cast<const WritePacket<std::array<uint8_t, 65> >&>(p).value();
 	if ( data[0] == 0 )
 	{
 		std::string name = "";
@@ -331,47 +569,126 @@ void Device::_handle_smupload(hexabus::Socket* socket, const Packet& p, const bo
 	}
 }
 
+const BroadcastPolicy& Device::_broadcast_policy(const EndpointEntry& entry) const
+{
+	if ( entry.functions->broadcastPolicy() )
+		return *entry.functions->broadcastPolicy();
+
+	return _broadcastPolicy;
+}
+
+void Device::_broadcast(EndpointEntry& entry, const boost::posix_time::ptime& now)
+{
+	const BroadcastPolicy& policy = _broadcast_policy(entry);
+
+	// keep the phase of the endpoint unless we fell behind
+	entry.next_poll += policy.min_interval;
+	if ( entry.next_poll <= now )
+		entry.next_poll = now + policy.min_interval;
+
+	if ( !entry.functions->is_readable() )
+		return;
+
+	uint32_t eid = entry.eid;
+	request_time start = std::chrono::steady_clock::now();
+	try {
+		if ( entry.functions->has_async_read() ) {
+			boost::asio::io_service& io = _io;
+			std::weak_ptr<Device*> self = _self;
+			EndpointFunctions::Ptr functions = entry.functions;
+			functions->async_query([&io, self, functions, eid, now, start] (const Packet::Ptr& p) {
+				io.post([self, eid, now, start, p] () {
+					if ( std::shared_ptr<Device*> device = self.lock() )
+						(*device)->_complete_broadcast(eid, now, start, p);
+				});
+			});
+		} else {
+			_complete_broadcast(eid, now, start, entry.functions->handle_query());
+		}
+	} catch ( const GenericException& error ) {
+		std::stringstream oss;
+		oss << "An error occured when reading endpoint " << eid << ": " << error.reason();
+		_asyncError(GenericException(oss.str()));
+	} catch ( const std::exception& error ) {
+		std::stringstream oss;
+		oss << "An error occured when reading endpoint " << eid << ": " << error.what();
+		_asyncError(GenericException(oss.str()));
+	}
+}
+
+void Device::_complete_broadcast(uint32_t eid, const boost::posix_time::ptime& now, request_time start, const Packet::Ptr& p)
+{
+	EndpointEntry* entry = _find_endpoint(eid);
+	if ( !entry )
+		return;
+
+	_record_latency(entry->statistics.reads, start);
+
+	if ( !p || p->type() == HXB_PTYPE_ERROR ) {
+		std::stringstream oss;
+		oss << "An error occured when reading endpoint " << eid << ": Unable to generate broadcast packet";
+		if (p) {
+			ErrorPacket* pe = (ErrorPacket*) p.get();
+			oss << " (" << (int) pe->code() << ")";
+		}
+		_asyncError(GenericException(oss.str()));
+		return;
+	}
+
+	const BroadcastPolicy& policy = _broadcast_policy(*entry);
+	if ( entry->last_value
+			&& now - entry->last_broadcast < policy.max_interval
+			&& !entry->functions->value_changed(*entry->last_value, *p, policy.deadband) )
+		return;
+
+	for ( std::vector<hexabus::Socket*>::const_iterator sIt = _sockets.begin(), sEnd = _sockets.end(); sIt != sEnd; ++sIt )
+	{
+		try {
+			(*sIt)->send(*p);
+		} catch ( const NetworkException& error ) {
+			std::stringstream oss;
+			oss << "An error occured when broadcasting endpoint " << eid << ": " << error.reason() << ": " << error.code().message();
+			_asyncError(GenericException(oss.str()));
+		}
+	}
+	entry->last_value = p;
+	entry->last_broadcast = now;
+}
+
+void Device::_schedule_broadcasts()
+{
+	boost::posix_time::ptime next;
+	for ( endpoint_table_type::const_iterator it = _endpoints.begin(), end = _endpoints.end(); it != end; ++it )
+	{
+		if ( it->functions->broadcast() && (next.is_not_a_date_time() || it->next_poll < next) )
+			next = it->next_poll;
+	}
+
+	if ( next.is_not_a_date_time() || (!_next_broadcast.is_not_a_date_time() && _next_broadcast <= next) )
+		return;
+
+	_next_broadcast = next;
+	_timer.expires_at(next);
+	_timer.async_wait(boost::bind(&Device::_handle_broadcasts, this, _1));
+}
+
 void Device::_handle_broadcasts(const boost::system::error_code& error)
 {
+	if ( error == boost::asio::error::operation_aborted )
+		return;
+
 	if ( !error )
 	{
-		for ( std::map<uint32_t, const EndpointFunctions::Ptr>::iterator epIt = _endpoints.begin(), end = _endpoints.end(); epIt != end; ++epIt )
-		{
-			if ( !epIt->second->is_readable() || !epIt->second->broadcast() )
-				continue;
+		boost::posix_time::ptime now = boost::asio::deadline_timer::traits_type::now();
 
-			try {
-				Packet::Ptr p = epIt->second->handle_query();
-				if ( p && p->type() != HXB_PTYPE_ERROR )
-				{
-					for ( std::vector<hexabus::Socket*>::const_iterator sIt = _sockets.begin(), sEnd = _sockets.end(); sIt != sEnd; ++sIt )
-					{
-						try {
-							(*sIt)->send(*p);
-						} catch ( const NetworkException& error ) {
-							std::stringstream oss;
-							oss << "An error occured when broadcasting endpoint " << epIt->first << ": " << error.reason() << ": " << error.code().message();
-							_asyncError(GenericException(oss.str()));
-						}
-					}
-				} else {
-					std::stringstream oss;
-					oss << "Unable to generate broadcast packet";
-					if (p) {
-						ErrorPacket* pe = (ErrorPacket*) p.get();
-						oss << " (" << (int) pe->code() << ")";
-					}
-					throw hexabus::GenericException(oss.str());
-				}
-			} catch ( const GenericException& error ) {
-				std::stringstream oss;
-				oss << "An error occured when reading endpoint " << epIt->first << ": " << error.reason();
-				_asyncError(GenericException(oss.str()));
-			}
+		_next_broadcast = boost::posix_time::ptime();
+		for ( endpoint_table_type::iterator epIt = _endpoints.begin(), end = _endpoints.end(); epIt != end; ++epIt )
+		{
+			if ( epIt->functions->broadcast() && epIt->next_poll <= now )
+				_broadcast(*epIt, now);
 		}
 
-		_timer.expires_from_now(boost::posix_time::seconds(_interval+(rand()%_interval)));
-		_timer.async_wait(boost::bind(&Device::_handle_broadcasts, this, _1));
+		_schedule_broadcasts();
 	} else {
 		std::cerr << "handle_broadcast boost-error was set."  << std::endl;
 	}
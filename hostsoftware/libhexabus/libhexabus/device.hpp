@@ -20,26 +20,100 @@
 #ifndef LIBHEXABUS_DEVICE_HPP
 #define LIBHEXABUS_DEVICE_HPP 1
 
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <type_traits>
 
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/deadline_timer.hpp>
+#include <boost/optional.hpp>
 
+#include <libhexabus/builtin_endpoints.hpp>
 #include <libhexabus/endpoint_registry.hpp>
 #include <libhexabus/packet.hpp>
 #include <libhexabus/socket.hpp>
+#include <libhexabus/worker_pool.hpp>
 
 namespace hexabus {
+	// Controls when the value of an endpoint is broadcast. The value is sampled every min_interval and
+	// broadcast if it differs from the last broadcast value by more than deadband, or if max_interval
+	// has passed since the last broadcast. The deadband only applies to numeric endpoints, all other
+	// values are broadcast whenever they change.
+	struct BroadcastPolicy {
+		boost::posix_time::time_duration min_interval;
+		boost::posix_time::time_duration max_interval;
+		double deadband;
+
+		BroadcastPolicy(const boost::posix_time::time_duration& min_interval,
+				const boost::posix_time::time_duration& max_interval, double deadband = 0)
+			: min_interval(min_interval)
+			, max_interval(max_interval)
+			, deadband(deadband)
+		{
+			if ( min_interval <= boost::posix_time::time_duration() || max_interval < min_interval || deadband < 0 )
+				throw hexabus::GenericException("Invalid broadcast policy");
+		}
+	};
+
+	namespace detail {
+		// bool is arithmetic, but a deadband of 1 or more would hide every change of it
+		template<typename TValue>
+		struct has_deadband {
+			static const bool value = std::is_arithmetic<TValue>::value && !std::is_same<TValue, bool>::value;
+		};
+
+		template<typename TValue>
+		typename std::enable_if<has_deadband<TValue>::value, bool>::type
+		value_changed(const TValue& last, const TValue& current, double deadband)
+		{
+			return std::fabs(double(current) - double(last)) > deadband;
+		}
+
+		template<typename TValue>
+		typename std::enable_if<!has_deadband<TValue>::value, bool>::type
+		value_changed(const TValue& last, const TValue& current, double)
+		{
+			return current != last;
+		}
+	}
+
 	class EndpointFunctions {
 		public:
 			typedef std::shared_ptr<EndpointFunctions> Ptr;
+			// reply is an InfoPacket or ErrorPacket, or empty if the endpoint could not be read
+			typedef std::function<void (const Packet::Ptr& reply)> query_done_fn_t;
+			// result is a HXB_ERR_* code
+			typedef std::function<void (uint8_t result)> write_done_fn_t;
+
 			uint32_t eid() const { return _eid; }
 			std::string name() const { return _name; }
 			uint8_t datatype() const { return _datatype; }
 			bool broadcast() const { return _broadcast; }
+			// the broadcast policy for this endpoint, if it overrides the default policy of the device
+			const boost::optional<BroadcastPolicy>& broadcastPolicy() const { return _broadcastPolicy; }
+			void setBroadcastPolicy(const BroadcastPolicy& policy) { _broadcastPolicy = policy; }
+			// Values read from the endpoint are reused for max_age. A max_age of zero disables caching.
+			boost::posix_time::time_duration maxAge() const { return _maxAge; }
+			void setMaxAge(const boost::posix_time::time_duration& max_age) { _maxAge = max_age; invalidate(); }
+			// Drop the cached value, the next query reads the endpoint again.
+			virtual void invalidate() const = 0;
 
 			virtual hexabus::Packet::Ptr handle_query() const = 0;
+			// Send the current value of the endpoint to dest, or an error packet if the endpoint is not readable.
+			virtual void send_query_reply(hexabus::Socket& socket, const boost::asio::ip::udp::endpoint& dest) const = 0;
 			virtual uint8_t handle_write(const hexabus::Packet& p) const = 0;
+			// Asynchronous variants of handle_query and handle_write. done may be called from any thread,
+			// before or after the call returns. Callers keep the endpoint alive until done is called.
+			virtual void async_query(const query_done_fn_t& done) const = 0;
+			virtual void async_write(const hexabus::Packet& p, const write_done_fn_t& done) const = 0;
+			// true if reads complete asynchronously and must go through async_query
+			virtual bool has_async_read() const = 0;
+			// Compare two packets returned by handle_query(), see BroadcastPolicy.
+			virtual bool value_changed(const hexabus::Packet& last, const hexabus::Packet& current, double deadband) const = 0;
 			virtual bool is_readable() const = 0;
 			virtual bool is_writable() const = 0;
 
@@ -56,6 +130,8 @@ namespace hexabus {
 			std::string _name;
 			uint8_t _datatype;
 			bool _broadcast;
+			boost::optional<BroadcastPolicy> _broadcastPolicy;
+			boost::posix_time::time_duration _maxAge;
 	};
 
 	template<typename TValue>
@@ -64,8 +140,15 @@ namespace hexabus {
 			typedef std::shared_ptr<TypedEndpointFunctions<TValue> > Ptr;
 			typedef std::function<TValue ()> endpoint_read_fn_t;
 			typedef std::function<bool (const TValue& value)> endpoint_write_fn_t;
+			// an empty value signals a failed read
+			typedef std::function<void (const boost::optional<TValue>& value)> read_done_fn_t;
+			typedef std::function<void (bool success)> write_result_fn_t;
+			typedef std::function<void (const read_done_fn_t& done)> endpoint_async_read_fn_t;
+			typedef std::function<void (const TValue& value, const write_result_fn_t& done)> endpoint_async_write_fn_t;
 			TypedEndpointFunctions(uint32_t eid, const std::string& name, bool broadcast = true)
 				: EndpointFunctions(eid, name, calculateDatatype(), broadcast)
+				, _refreshing(false)
+				, _generation(0)
 			{}
 
 			boost::signals2::connection onRead(
@@ -80,42 +163,133 @@ namespace hexabus {
 
 				return result;
 			}
+			// Handlers that complete by calling done, possibly from another thread. Only one of them
+			// should be connected.
+			boost::signals2::connection onAsyncRead(
+					const endpoint_async_read_fn_t& callback) {
+				boost::signals2::connection result = _asyncRead.connect(callback);
+
+				return result;
+			}
+			boost::signals2::connection onAsyncWrite(
+					const endpoint_async_write_fn_t& callback) {
+				boost::signals2::connection result = _asyncWrite.connect(callback);
+
+				return result;
+			}
+			// Blocking handlers that are run on a worker pool. The pool must outlive the endpoint.
+			boost::signals2::connection onRead(
+					const endpoint_read_fn_t& callback, WorkerPool& pool) {
+				return onAsyncRead([callback, &pool] (const read_done_fn_t& done) {
+					pool.post([callback, done] () {
+						boost::optional<TValue> value;
+						try {
+							value = callback();
+						} catch ( const std::exception& ) {
+						}
+						done(value);
+					});
+				});
+			}
+			boost::signals2::connection onWrite(
+					const endpoint_write_fn_t& callback, WorkerPool& pool) {
+				return onAsyncWrite([callback, &pool] (const TValue& value, const write_result_fn_t& done) {
+					pool.post([callback, value, done] () {
+						bool success = false;
+						try {
+							success = callback(value);
+						} catch ( const std::exception& ) {
+						}
+						done(success);
+					});
+				});
+			}
 
 			virtual bool is_readable() const {
-				return _read.num_slots() > 0;
+				return _read.num_slots() > 0 || _asyncRead.num_slots() > 0;
 			}
 
 			virtual bool is_writable() const {
-				return _write.num_slots() > 0;
+				return _write.num_slots() > 0 || _asyncWrite.num_slots() > 0;
+			}
+
+			virtual bool has_async_read() const {
+				return _asyncRead.num_slots() > 0;
 			}
 
 			virtual hexabus::Packet::Ptr handle_query() const {
 				if ( !is_readable() )
 					return Packet::Ptr(new ErrorPacket(HXB_ERR_UNKNOWNEID));
 
-				boost::optional<TValue> value = _read();
-				if ( !value ) {
-					std::stringstream oss;
-					oss << "Error reading endpoint " << name() << " (" << eid() << ")";
-					throw hexabus::GenericException(oss.str());
+				return Packet::Ptr(new InfoPacket<TValue>(eid(), read_value()));
+			}
+			virtual void send_query_reply(hexabus::Socket& socket, const boost::asio::ip::udp::endpoint& dest) const {
+				if ( !is_readable() ) {
+					socket.send(ErrorPacket(HXB_ERR_UNKNOWNEID), dest);
+					return;
 				}
-				return Packet::Ptr(new InfoPacket<TValue>(eid(), *value));
+
+				socket.send(InfoPacket<TValue>(eid(), read_value()), dest);
 			}
 			virtual uint8_t handle_write(const hexabus::Packet& p) const {
-				const WritePacket<TValue>* write = dynamic_cast<const WritePacket<TValue>*>(&p);
-				if ( write != NULL ) {
+				// write packets are always deserialized into the WritePacket matching their datatype
+				if ( p.type() == HXB_PTYPE_WRITE && static_cast<const TypedPacket&>(p).datatype() == datatype() ) {
 					if ( !is_writable() ) {
 						return HXB_ERR_WRITEREADONLY;
 					}
 
-					TValue value = write->value();
-					if ( _write(value) ) {
+					if ( _write.num_slots() == 0 ) {
+						std::stringstream oss;
+						oss << "Endpoint " << name() << " (" << eid() << ") can only be written asynchronously";
+						throw hexabus::GenericException(oss.str());
+					}
+
+					const WritePacket<TValue>& write = static_cast<const WritePacket<TValue>&>(p);
+					boost::optional<bool> written = _write(write.value());
+					invalidate();
+					if ( written ) {
 						return HXB_ERR_SUCCESS;
 					}
 				}
 
 				return HXB_ERR_INTERNAL;
 			}
+			virtual void async_query(const query_done_fn_t& done) const {
+				if ( !is_readable() ) {
+					done(Packet::Ptr(new ErrorPacket(HXB_ERR_UNKNOWNEID)));
+					return;
+				}
+
+				uint32_t eid = this->eid();
+				async_read_value([eid, done] (const boost::optional<TValue>& value) {
+					done(value ? Packet::Ptr(new InfoPacket<TValue>(eid, *value)) : Packet::Ptr());
+				});
+			}
+			virtual void async_write(const hexabus::Packet& p, const write_done_fn_t& done) const {
+				if ( _asyncWrite.num_slots() == 0
+						|| p.type() != HXB_PTYPE_WRITE || static_cast<const TypedPacket&>(p).datatype() != datatype() ) {
+					done(handle_write(p));
+					return;
+				}
+
+				const WritePacket<TValue>& write = static_cast<const WritePacket<TValue>&>(p);
+				_asyncWrite(write.value(), [this, done] (bool success) {
+					invalidate();
+					done(success ? HXB_ERR_SUCCESS : HXB_ERR_INTERNAL);
+				});
+			}
+			virtual void invalidate() const {
+				std::lock_guard<std::mutex> lock(_cacheMutex);
+
+				_cachedValue.reset();
+				_generation++;
+			}
+			virtual bool value_changed(const hexabus::Packet& last, const hexabus::Packet& current, double deadband) const {
+				return detail::value_changed(
+					static_cast<const ValuePacket<TValue>&>(last).value(),
+					static_cast<const ValuePacket<TValue>&>(current).value(),
+					deadband);
+			}
 
 			static typename TypedEndpointFunctions<TValue>::Ptr fromEndpointDescriptor(const EndpointDescriptor& ep) {
 				typename TypedEndpointFunctions<TValue>::Ptr result(new TypedEndpointFunctions<TValue>(ep.eid(), ep.description()));
@@ -126,9 +300,158 @@ namespace hexabus {
 				return result;
 			}
 
+			// Create endpoint functions for an endpoint of the builtin table. Unknown endpoints and
+			// datatype mismatches are compile errors.
+			template<uint32_t EID>
+			static typename TypedEndpointFunctions<TValue>::Ptr fromBuiltinEndpoint(bool broadcast = true) {
+				static_assert(find_builtin_endpoint(EID) != NULL, "Endpoint is not in the endpoint registry");
+				static_assert(builtin_endpoint_type(EID) == datatype_of<TValue>(), "Datatype does not match the endpoint registry");
+
+				return typename TypedEndpointFunctions<TValue>::Ptr(
+					new TypedEndpointFunctions<TValue>(EID, find_builtin_endpoint(EID)->description, broadcast));
+			}
+
 		private:
 			boost::signals2::signal<TValue ()> _read;
 			boost::signals2::signal<bool (const TValue&)> _write;
+			boost::signals2::signal<void (const read_done_fn_t&)> _asyncRead;
+			boost::signals2::signal<void (const TValue&, const write_result_fn_t&)> _asyncWrite;
+
+			// value cache, see EndpointFunctions::setMaxAge
+			mutable std::mutex _cacheMutex;
+			mutable std::condition_variable _cacheRefreshed;
+			mutable boost::optional<TValue> _cachedValue;
+			mutable std::chrono::steady_clock::time_point _cachedAt;
+			mutable bool _refreshing;
+			mutable uint64_t _generation;
+			// asynchronous readers waiting for the running refresh
+			mutable std::vector<read_done_fn_t> _waiters;
+
+			bool cache_enabled() const {
+				return maxAge() > boost::posix_time::time_duration();
+			}
+
+			// requires _cacheMutex
+			bool cache_fresh() const {
+				return _cachedValue
+					&& std::chrono::steady_clock::now() - _cachedAt <= std::chrono::microseconds(maxAge().total_microseconds());
+			}
+
+			void finish_refresh(uint64_t generation, const boost::optional<TValue>& value) const {
+				std::vector<read_done_fn_t> waiters;
+
+				{
+					std::lock_guard<std::mutex> lock(_cacheMutex);
+
+					_refreshing = false;
+					// a value read before an invalidation may already be stale
+					if ( generation == _generation ) {
+						_cachedValue = value;
+						_cachedAt = std::chrono::steady_clock::now();
+					}
+					waiters.swap(_waiters);
+					_cacheRefreshed.notify_all();
+				}
+
+				for ( typename std::vector<read_done_fn_t>::const_iterator it = waiters.begin(), end = waiters.end(); it != end; ++it )
+					(*it)(value);
+			}
+
+			void start_read(const read_done_fn_t& done) const {
+				if ( _asyncRead.num_slots() > 0 ) {
+					// a handler that throws before completing fails like a blocking handler that throws.
+					// handlers must not throw after calling done
+					try {
+						_asyncRead(done);
+					} catch ( const std::exception& ) {
+						done(boost::none);
+					}
+					return;
+				}
+
+				boost::optional<TValue> value;
+				try {
+					value = _read();
+				} catch ( const std::exception& ) {
+				}
+				done(value);
+			}
+
+			void async_read_value(const read_done_fn_t& done) const {
+				if ( !cache_enabled() ) {
+					start_read(done);
+					return;
+				}
+
+				std::unique_lock<std::mutex> lock(_cacheMutex);
+				if ( cache_fresh() ) {
+					boost::optional<TValue> value = _cachedValue;
+					lock.unlock();
+					done(value);
+					return;
+				}
+
+				// only one reader refreshes the value, concurrent readers wait for its result
+				_waiters.push_back(done);
+				if ( _refreshing )
+					return;
+
+				uint64_t generation = _generation;
+				_refreshing = true;
+				lock.unlock();
+				// anything escaping here must not leave the refresh running, or later readers wait forever
+				try {
+					start_read([this, generation] (const boost::optional<TValue>& value) {
+						finish_refresh(generation, value);
+					});
+				} catch (...) {
+					finish_refresh(generation, boost::none);
+					throw;
+				}
+			}
+
+			TValue read_value() const {
+				boost::optional<TValue> value;
+
+				if ( _read.num_slots() == 0 ) {
+					std::stringstream oss;
+					oss << "Endpoint " << name() << " (" << eid() << ") can only be read asynchronously";
+					throw hexabus::GenericException(oss.str());
+				}
+
+				if ( !cache_enabled() ) {
+					value = _read();
+				} else {
+					std::unique_lock<std::mutex> lock(_cacheMutex);
+
+					// only one reader refreshes the value, concurrent readers wait for its result
+					while ( !cache_fresh() && _refreshing )
+						_cacheRefreshed.wait(lock);
+
+					if ( cache_fresh() ) {
+						value = _cachedValue;
+					} else {
+						uint64_t generation = _generation;
+
+						_refreshing = true;
+						lock.unlock();
+						try {
+							value = _read();
+						} catch (...) {
+							finish_refresh(generation, boost::none);
+							throw;
+						}
+						finish_refresh(generation, value);
+					}
+				}
+
+				if ( !value ) {
+					std::stringstream oss;
+					oss << "Error reading endpoint " << name() << " (" << eid() << ")";
+					throw hexabus::GenericException(oss.str());
+				}
+				return *value;
+			}
 
 			static uint8_t calculateDatatype()
 			{
@@ -136,14 +459,59 @@ namespace hexabus {
 			}
 	};
 
+	// Latency of the read or write handler of an endpoint, from the arrival of a request until its
+	// reply is ready.
+	struct HandlerStatistics {
+		uint64_t count;
+		boost::posix_time::time_duration total;
+		boost::posix_time::time_duration max;
+		boost::posix_time::time_duration last;
+
+		HandlerStatistics()
+			: count(0)
+		{}
+
+		void record(const boost::posix_time::time_duration& latency)
+		{
+			count++;
+			total += latency;
+			last = latency;
+			if ( latency > max )
+				max = latency;
+		}
+
+		boost::posix_time::time_duration average() const
+		{
+			return count ? boost::posix_time::microseconds(total.total_microseconds() / count) : boost::posix_time::time_duration();
+		}
+	};
+
+	struct EndpointStatistics {
+		HandlerStatistics reads;
+		HandlerStatistics writes;
+	};
+
 	class Device {
 		public:
 			typedef std::function<std::string ()> read_name_fn_t;
 			typedef std::function<void (const std::string& name)> write_name_fn_t;
 			typedef std::function<void (const GenericException& error)> async_error_fn_t;
 			Device(boost::asio::io_service& io, const std::vector<std::string>& interfaces, const std::vector<std::string>& addresses, int interval = 60);
+			// Destroy the device on the thread that runs the io_service, or while it is not running.
 			~Device();
 			void addEndpoint(const EndpointFunctions::Ptr ep);
+			bool hasEndpoint(uint32_t eid) const { return _find_endpoint(eid) != NULL; }
+			// Set the broadcast policy for all endpoints that do not have their own. The default policy
+			// samples every interval seconds and broadcasts unchanged values every 2 * interval seconds.
+			void setBroadcastPolicy(const BroadcastPolicy& policy);
+			// Drop the cached value of an endpoint, see EndpointFunctions::setMaxAge.
+			void invalidate(uint32_t eid);
+			// Handler latencies of an endpoint, or nothing if the endpoint does not exist. Statistics are
+			// updated on the io_service thread, so call this from there.
+			boost::optional<EndpointStatistics> statistics(uint32_t eid) const;
+			// Multicast queries are answered once, from the local address that best matches the requester.
+			// Set to true to answer from every address instead.
+			void setReplyFromAllAddresses(bool all) { _replyFromAll = all; }
 
 			boost::signals2::connection onReadName(
 					const read_name_fn_t& callback);
@@ -167,16 +535,69 @@ namespace hexabus {
 			void _handle_broadcasts(const boost::system::error_code& error);
 			void _handle_errors(const hexabus::GenericException& error);
 
+			struct EndpointEntry {
+				uint32_t eid;
+				EndpointFunctions::Ptr functions;
+				EndpointInfoPacket info;
+
+				// broadcast state
+				boost::posix_time::ptime next_poll;
+				boost::posix_time::ptime last_broadcast;
+				Packet::Ptr last_value;
+
+				EndpointStatistics statistics;
+
+				EndpointEntry(const EndpointFunctions::Ptr& functions)
+					: eid(functions->eid())
+					, functions(functions)
+					, info(functions->eid(), functions->datatype(), functions->name())
+				{}
+			};
+			// sorted by eid
+			typedef std::vector<EndpointEntry> endpoint_table_type;
+			// (first eid of group, descriptor bitmap), sorted by group
+			typedef std::vector<std::pair<uint32_t, uint32_t> > group_table_type;
+			// eids below this are found through tables indexed by eid, larger ones by binary search
+			static const uint32_t dense_eids = 4096;
+
+			typedef std::chrono::steady_clock::time_point request_time;
+
+			const EndpointEntry* _find_endpoint(uint32_t eid) const;
+			EndpointEntry* _find_endpoint(uint32_t eid);
+			uint32_t _group_descriptor(uint32_t group) const;
+			void _index_endpoints();
+			const BroadcastPolicy& _broadcast_policy(const EndpointEntry& entry) const;
+			void _broadcast(EndpointEntry& entry, const boost::posix_time::ptime& now);
+			void _complete_broadcast(uint32_t eid, const boost::posix_time::ptime& now, request_time start, const Packet::Ptr& p);
+			void _complete_query(hexabus::Socket* socket, const boost::asio::ip::udp::endpoint& from, uint32_t eid, request_time start, const Packet::Ptr& reply);
+			void _complete_write(hexabus::Socket* socket, const boost::asio::ip::udp::endpoint& from, uint32_t eid, request_time start, uint8_t result);
+			void _record_latency(HandlerStatistics& statistics, request_time start);
+			hexabus::Socket* _reply_socket(const boost::asio::ip::udp::endpoint& to) const;
+			void _schedule_broadcasts();
+
 			boost::signals2::signal<std::string ()> _read;
 			boost::signals2::signal<void (const std::string&)> _write;
 			boost::signals2::signal<void (const GenericException& error)> _asyncError;
 
+			boost::asio::io_service& _io;
 			hexabus::Listener _listener;
 			std::vector<hexabus::Socket*> _sockets;
+			// local address of each socket
+			std::vector<boost::asio::ip::address_v6> _addresses;
+			bool _replyFromAll;
 			boost::asio::deadline_timer _timer;
-			int _interval;
-			std::map<uint32_t, const EndpointFunctions::Ptr> _endpoints;
+			boost::posix_time::ptime _next_broadcast;
+			BroadcastPolicy _broadcastPolicy;
+			endpoint_table_type _endpoints;
+			group_table_type _groups;
+			// position + 1 in _endpoints of every eid below dense_eids, 0 if there is no such endpoint
+			std::vector<uint32_t> _endpoint_slots;
+			// descriptor of every group below dense_eids, by eid / 32
+			std::vector<uint32_t> _group_slots;
 			uint8_t _sm_state;
+			// Asynchronous handlers may complete after the device is gone, so their completions hold a
+			// weak reference to this instead of the device itself. It expires when the device is destroyed.
+			std::shared_ptr<Device*> _self;
 	};
 }
 
@@ -1,10 +1,24 @@
 #include "libhexabus/endpoint_registry.hpp"
 
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/crc.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/info_parser.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/scope_exit.hpp>
 
 #include "private/paths.hpp"
 #include "error.hpp"
@@ -23,18 +37,240 @@ static boost::filesystem::path path_from_env_or_default()
 	}
 }
 
+// the registry is usually installed into a directory the user cannot write to, so the default cache lives in
+// the user's cache directory. registries at different paths get different caches.
+static boost::filesystem::path cache_path_from_env_or_default(const boost::filesystem::path& path)
+{
+	const char* from_env = std::getenv("HXB_ENDPOINT_REGISTRY_CACHE");
+	if (from_env)
+		return from_env;
+
+	boost::filesystem::path cache_dir;
+	if (const char* xdg = std::getenv("XDG_CACHE_HOME")) {
+		cache_dir = xdg;
+	} else if (const char* home = std::getenv("HOME")) {
+		cache_dir = boost::filesystem::path(home) / ".cache";
+	}
+	if (cache_dir.empty() || !cache_dir.is_absolute())
+		return boost::filesystem::path();
+
+	boost::filesystem::path absolute = boost::filesystem::absolute(path);
+	boost::crc_32_type crc;
+	crc.process_bytes(absolute.string().data(), absolute.string().size());
+
+	std::ostringstream name;
+	name << path.filename().string() << '-' << std::hex << std::setw(8) << std::setfill('0') << crc.checksum() << ".cache";
+	return cache_dir / "libhexabus" / name.str();
+}
+
 EndpointRegistry::EndpointRegistry()
-	: _path(path_from_env_or_default())
+	: _path(path_from_env_or_default()), _cache_path(cache_path_from_env_or_default(_path)),
+	  _current(0), _readers(0), _watch_fd(-1)
 {
 	reload();
 }
 
 EndpointRegistry::EndpointRegistry(const boost::filesystem::path& path)
-	: _path(path)
+	: _path(path), _cache_path(cache_path_from_env_or_default(_path)),
+	  _current(0), _readers(0), _watch_fd(-1)
 {
 	reload();
 }
 
+EndpointRegistry::~EndpointRegistry()
+{
+	unwatch();
+}
+
+// {{{ Compiled registry cache
+
+namespace {
+
+// All integers are stored in host byte order. byte_order doubles as an endianness check,
+// a cache written on a host with different byte order is simply regenerated.
+struct CacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t source_mtime;
+	uint64_t source_size;
+	uint32_t count;
+	uint32_t strings_size;
+	uint32_t checksum;
+	uint32_t reserved;
+};
+
+// descriptions and units are offsets into the string table following the entries.
+// every string in the table is NUL terminated and stored only once.
+struct CacheEntry {
+	uint32_t eid;
+	uint32_t description;
+	uint32_t unit;
+	uint8_t type;
+	uint8_t access;
+	uint8_t function;
+	uint8_t reserved;
+};
+
+const char cache_magic[8] = { 'H', 'X', 'B', 'R', 'E', 'G', 'C', 0 };
+const uint32_t cache_version = 1;
+const uint32_t cache_byte_order = 0x01020304;
+const uint32_t cache_no_unit = 0xFFFFFFFF;
+
+struct SourceStamp {
+	uint64_t mtime;
+	uint64_t size;
+};
+
+}
+
+static uint32_t cache_checksum(const void* entries, size_t entries_size, const void* strings, size_t strings_size)
+{
+	boost::crc_32_type crc;
+	crc.process_bytes(entries, entries_size);
+	crc.process_bytes(strings, strings_size);
+	return crc.checksum();
+}
+
+static bool load_cache(const boost::filesystem::path& cache_path, const SourceStamp& source,
+		EndpointRegistry::table_type& eids)
+{
+	if (cache_path.empty())
+		return false;
+
+	int fd = open(cache_path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(CacheHeader)) {
+		close(fd);
+		return false;
+	}
+
+	size_t size = st.st_size;
+	void* map = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	BOOST_SCOPE_EXIT((map)(size)) {
+		munmap(map, size);
+	} BOOST_SCOPE_EXIT_END
+
+	const char* data = static_cast<const char*>(map);
+	CacheHeader header;
+	memcpy(&header, data, sizeof(header));
+
+	if (memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0
+			|| header.version != cache_version
+			|| header.byte_order != cache_byte_order
+			|| header.source_mtime != source.mtime
+			|| header.source_size != source.size
+			|| size != sizeof(CacheHeader) + uint64_t(header.count) * sizeof(CacheEntry) + header.strings_size)
+		return false;
+
+	const CacheEntry* entries = reinterpret_cast<const CacheEntry*>(data + sizeof(CacheHeader));
+	const char* strings = data + sizeof(CacheHeader) + header.count * sizeof(CacheEntry);
+
+	if (header.strings_size == 0 || strings[header.strings_size - 1] != '\0'
+			|| header.checksum != cache_checksum(entries, header.count * sizeof(CacheEntry), strings, header.strings_size))
+		return false;
+
+	EndpointRegistry::table_type result;
+	result.reserve(header.count);
+	for (uint32_t i = 0; i < header.count; i++) {
+		const CacheEntry& e = entries[i];
+
+		if ((i > 0 && e.eid <= entries[i - 1].eid)
+				|| e.description >= header.strings_size
+				|| (e.unit != cache_no_unit && e.unit >= header.strings_size))
+			return false;
+
+		boost::optional<std::string> unit;
+		if (e.unit != cache_no_unit)
+			unit = std::string(strings + e.unit);
+
+		result.push_back(std::make_pair(e.eid,
+			EndpointDescriptor(e.eid, strings + e.description, unit, hxb_datatype(e.type),
+				EndpointDescriptor::Access(e.access), EndpointDescriptor::Function(e.function))));
+	}
+
+	eids.swap(result);
+	return true;
+}
+
+static void write_cache(const boost::filesystem::path& cache_path, const SourceStamp& source,
+		const EndpointRegistry::table_type& eids)
+{
+	if (cache_path.empty())
+		return;
+
+	std::vector<CacheEntry> entries;
+	std::string strings;
+	std::map<std::string, uint32_t> interned;
+
+	for (EndpointRegistry::const_iterator it = eids.begin(), end = eids.end(); it != end; ++it) {
+		const EndpointDescriptor& ep = it->second;
+		CacheEntry e;
+
+		memset(&e, 0, sizeof(e));
+		e.eid = ep.eid();
+		e.type = ep.type();
+		e.access = ep.access();
+		e.function = ep.function();
+		e.unit = cache_no_unit;
+
+		const std::string* values[2] = { &ep.description(), ep.unit() ? ep.unit().get_ptr() : NULL };
+		uint32_t* offsets[2] = { &e.description, &e.unit };
+		for (int i = 0; i < 2; i++) {
+			if (!values[i])
+				continue;
+
+			std::map<std::string, uint32_t>::iterator found = interned.find(*values[i]);
+			if (found == interned.end()) {
+				found = interned.insert(std::make_pair(*values[i], uint32_t(strings.size()))).first;
+				strings.append(values[i]->c_str(), values[i]->size() + 1);
+			}
+			*offsets[i] = found->second;
+		}
+
+		entries.push_back(e);
+	}
+
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, cache_magic, sizeof(cache_magic));
+	header.version = cache_version;
+	header.byte_order = cache_byte_order;
+	header.source_mtime = source.mtime;
+	header.source_size = source.size;
+	header.count = entries.size();
+	header.strings_size = strings.size();
+	header.checksum = cache_checksum(entries.data(), entries.size() * sizeof(CacheEntry), strings.data(), strings.size());
+
+	// write to a temporary file and rename it over the cache, so concurrent readers only ever see
+	// a complete cache. failing to write the cache is not an error, the next load simply parses again.
+	boost::system::error_code err;
+	boost::filesystem::create_directories(cache_path.parent_path(), err);
+
+	std::string tmp_path = cache_path.string() + ".XXXXXX";
+	int fd = mkstemp(&tmp_path[0]);
+	if (fd < 0)
+		return;
+
+	bool ok = write(fd, &header, sizeof(header)) == ssize_t(sizeof(header))
+		&& write(fd, entries.data(), entries.size() * sizeof(CacheEntry)) == ssize_t(entries.size() * sizeof(CacheEntry))
+		&& write(fd, strings.data(), strings.size()) == ssize_t(strings.size());
+	ok = fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == 0 && ok;
+	ok = close(fd) == 0 && ok;
+
+	if (!ok || rename(tmp_path.c_str(), cache_path.c_str()) != 0)
+		unlink(tmp_path.c_str());
+}
+
+// }}}
+
 static std::string single_child(const boost::property_tree::ptree& tree, const std::string& key, uint32_t eid)
 {
 	switch (tree.count(key)) {
@@ -59,9 +295,19 @@ static std::string single_child(const boost::property_tree::ptree& tree, const s
 	return tree.find(key)->second.get_value<std::string>();
 }
 
-void EndpointRegistry::reload()
+static bool compare_eid(const EndpointRegistry::table_type::value_type& a, const EndpointRegistry::table_type::value_type& b)
+{
+	return a.first < b.first;
+}
+
+static bool entry_before_eid(const EndpointRegistry::table_type::value_type& entry, uint32_t eid)
+{
+	return entry.first < eid;
+}
+
+static EndpointRegistry::table_type parse_registry(const boost::filesystem::path& path)
 {
-	boost::filesystem::ifstream file(_path, std::ios_base::in);
+	boost::filesystem::ifstream file(path, std::ios_base::in);
 
 	if (!file.good())
 		throw GenericException("Endpoint registry file not found");
@@ -74,7 +320,7 @@ void EndpointRegistry::reload()
 		throw GenericException(e.what());
 	}
 
-	std::map<uint32_t, EndpointDescriptor> eids;
+	EndpointRegistry::table_type eids;
 
 	typedef boost::property_tree::ptree::const_iterator iterator;
 	for (iterator it = ptree.begin(), end = ptree.end(); it != end; it++) {
@@ -100,12 +346,6 @@ void EndpointRegistry::reload()
 			throw GenericException(o.str());
 		}
 
-		if (eids.count(eid)) {
-			std::ostringstream o;
-			o << "Duplicate descriptors for EID " << eid;
-			throw GenericException(o.str());
-		}
-
 		description = single_child(it->second, "description", eid);
 		unit = it->second.get_optional<std::string>("unit");
 
@@ -153,28 +393,157 @@ void EndpointRegistry::reload()
 			throw GenericException(o.str());
 		}
 
-		eids.insert(std::make_pair(eid, EndpointDescriptor(eid, description, unit, type, access, function)));
+		eids.push_back(std::make_pair(eid, EndpointDescriptor(eid, description, unit, type, access, function)));
+	}
+
+	std::stable_sort(eids.begin(), eids.end(), compare_eid);
+	for (size_t i = 1; i < eids.size(); i++) {
+		if (eids[i - 1].first == eids[i].first) {
+			std::ostringstream o;
+			o << "Duplicate descriptors for EID " << eids[i].first;
+			throw GenericException(o.str());
+		}
+	}
+
+	return eids;
+}
+
+void EndpointRegistry::reload()
+{
+	std::lock_guard<std::mutex> lock(_reload_mutex);
+
+	struct stat st;
+	if (stat(_path.c_str(), &st) < 0)
+		throw GenericException("Endpoint registry file not found");
+
+	SourceStamp source = { uint64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec, uint64_t(st.st_size) };
+
+	table_type eids;
+	if (!load_cache(_cache_path, source, eids)) {
+		eids = parse_registry(_path);
+		write_cache(_cache_path, source, eids);
+	}
+
+	if (_published)
+		_retired.push_back(_published);
+	_published = std::make_shared<Snapshot>(eids);
+	_current.store(_published.get());
+
+	// a reader that registers after the store above sees the new snapshot. if none is registered now,
+	// no reader can still take a reference to a retired snapshot, and the retired snapshots are freed
+	// once the readers already holding them let go. otherwise they wait for a later reload.
+	if (_readers.load() == 0)
+		_retired.clear();
+}
+
+std::shared_ptr<const EndpointRegistry::Snapshot> EndpointRegistry::snapshot() const
+{
+	_readers.fetch_add(1);
+	std::shared_ptr<const Snapshot> result = _current.load()->shared_from_this();
+	_readers.fetch_sub(1);
+
+	return result;
+}
+
+void EndpointRegistry::watch()
+{
+	if (_watcher.joinable())
+		return;
+
+	boost::filesystem::path dir = _path.parent_path();
+	if (dir.empty())
+		dir = ".";
+
+	// watch the directory, not the file: editors and package managers usually replace the file
+	int fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0)
+		throw GenericException(std::string("Could not watch endpoint registry: ") + strerror(errno));
+
+	if (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0 || pipe(_watch_wakeup) < 0) {
+		int err = errno;
+		close(fd);
+		throw GenericException(std::string("Could not watch endpoint registry: ") + strerror(err));
 	}
 
-	_eids = eids;
+	_watch_fd = fd;
+	_watcher = std::thread(&EndpointRegistry::watchLoop, this);
 }
 
-EndpointRegistry::const_iterator EndpointRegistry::begin() const
+void EndpointRegistry::unwatch()
 {
-	return _eids.begin();
+	if (!_watcher.joinable())
+		return;
+
+	char c = 0;
+	while (write(_watch_wakeup[1], &c, 1) < 0 && errno == EINTR)
+		;
+	_watcher.join();
+
+	close(_watch_fd);
+	close(_watch_wakeup[0]);
+	close(_watch_wakeup[1]);
+	_watch_fd = -1;
 }
 
-EndpointRegistry::const_iterator EndpointRegistry::end() const
+void EndpointRegistry::watchLoop()
 {
-	return _eids.end();
+	const std::string name = _path.filename().string();
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+	for (;;) {
+		struct pollfd fds[2] = {
+			{ _watch_fd, POLLIN, 0 },
+			{ _watch_wakeup[0], POLLIN, 0 },
+		};
+
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			_reloadError(GenericException(std::string("Watching endpoint registry failed: ") + strerror(errno)));
+			return;
+		}
+
+		if (fds[1].revents)
+			return;
+
+		ssize_t len = read(_watch_fd, buffer, sizeof(buffer));
+		if (len <= 0)
+			continue;
+
+		bool changed = false;
+		for (char* p = buffer; p < buffer + len; p += sizeof(struct inotify_event) + reinterpret_cast<struct inotify_event*>(p)->len) {
+			const struct inotify_event* event = reinterpret_cast<struct inotify_event*>(p);
+			if (event->len && name == event->name)
+				changed = true;
+		}
+
+		if (!changed)
+			continue;
+
+		try {
+			reload();
+		} catch (const GenericException& e) {
+			_reloadError(e);
+		}
+	}
 }
 
-EndpointRegistry::const_iterator EndpointRegistry::find(uint32_t eid) const
+boost::signals2::connection EndpointRegistry::onReloadError(const reload_error_fn_t& callback)
 {
-	return _eids.find(eid);
+	return _reloadError.connect(callback);
+}
+
+EndpointRegistry::const_iterator EndpointRegistry::Snapshot::find(uint32_t eid) const
+{
+	const_iterator it = std::lower_bound(_eids.begin(), _eids.end(), eid, entry_before_eid);
+
+	if (it != _eids.end() && it->first == eid)
+		return it;
+	else
+		return _eids.end();
 }
 
-const EndpointDescriptor& EndpointRegistry::lookup(uint32_t eid) const
+const EndpointDescriptor& EndpointRegistry::Snapshot::lookup(uint32_t eid) const
 {
 	const_iterator found = find(eid);
 
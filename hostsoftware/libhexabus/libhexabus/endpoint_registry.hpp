@@ -2,13 +2,21 @@
 #define LIBHEXABUS_ENDPOINT__REGISTRY_HPP 1
 
 #include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <map>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 #include <boost/optional.hpp>
+#include <boost/signals2.hpp>
 
 #include <libhexabus/hexabus_types.h>
+#include <libhexabus/error.hpp>
 
 namespace hexabus {
 
@@ -62,27 +70,81 @@ namespace hexabus {
 
 
 	class EndpointRegistry {
+		public:
+			// flat table of descriptors, sorted by eid
+			typedef std::vector<std::pair<uint32_t, EndpointDescriptor> > table_type;
+			typedef table_type::const_iterator const_iterator;
+			typedef std::function<void (const GenericException& error)> reload_error_fn_t;
+
+			// Immutable view of the registry contents at one point in time. reload() never modifies a
+			// published snapshot, it publishes a new one instead. Snapshots are reference counted, iterators
+			// and references obtained from a snapshot remain valid as long as it is held.
+			class Snapshot : public std::enable_shared_from_this<Snapshot> {
+				private:
+					table_type _eids;
+
+				public:
+					explicit Snapshot(table_type& eids) { _eids.swap(eids); }
+
+					const_iterator begin() const { return _eids.begin(); }
+					const_iterator end() const { return _eids.end(); }
+
+					const_iterator find(uint32_t eid) const;
+					const EndpointDescriptor& lookup(uint32_t eid) const;
+			};
+
 		private:
-			std::map<uint32_t, EndpointDescriptor> _eids;
 			boost::filesystem::path _path;
+			boost::filesystem::path _cache_path;
+
+			// The published snapshot. Readers load it without taking a lock and then take a reference to it,
+			// so reload() keeps every snapshot it replaced in _retired until no reader can still be between
+			// the two steps.
+			std::atomic<const Snapshot*> _current;
+			mutable std::atomic<unsigned> _readers;
+			std::shared_ptr<const Snapshot> _published;
+			std::vector<std::shared_ptr<const Snapshot> > _retired;
+			std::mutex _reload_mutex;
+
+			std::thread _watcher;
+			int _watch_fd;
+			int _watch_wakeup[2];
+			boost::signals2::signal<void (const GenericException& error)> _reloadError;
+
+			void watchLoop();
+
+			EndpointRegistry(const EndpointRegistry&);
+			EndpointRegistry& operator=(const EndpointRegistry&);
 
 		public:
 			static const char* default_path;
 
-			typedef std::map<uint32_t, EndpointDescriptor>::const_iterator const_iterator;
-
 			EndpointRegistry();
 			EndpointRegistry(const boost::filesystem::path& path);
+			~EndpointRegistry();
 
 			const boost::filesystem::path& path() const { return _path; }
 
-			const_iterator begin() const;
-			const_iterator end() const;
+			// Location of the compiled registry cache. The cache is generated from the registry
+			// file on first load and reused as long as the registry file's size and mtime match.
+			// Defaults to $XDG_CACHE_HOME/libhexabus/<name>-<hash of path>.cache (or ~/.cache if
+			// XDG_CACHE_HOME is not set), may be overridden with HXB_ENDPOINT_REGISTRY_CACHE.
+			// An empty path disables the cache.
+			const boost::filesystem::path& cache_path() const { return _cache_path; }
 
-			const_iterator find(uint32_t eid) const;
-			const EndpointDescriptor& lookup(uint32_t eid) const;
+			// The current snapshot, may be called concurrently with reload() and never blocks. Hold on to
+			// it for as long as iterators or descriptors taken from it are used.
+			std::shared_ptr<const Snapshot> snapshot() const;
 
 			void reload();
+
+			// Reload the registry from a background thread whenever the registry file is written or
+			// replaced. Errors during reload keep the previous snapshot and are reported through
+			// onReloadError, which is called on the watcher thread.
+			void watch();
+			void unwatch();
+
+			boost::signals2::connection onReloadError(const reload_error_fn_t& callback);
 	};
 
 
@@ -0,0 +1,943 @@
+#include "json.hpp"
+
+#include <cmath>
+#include <cfloat>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include "error.hpp"
+
+using namespace hexabus;
+
+namespace {
+
+// the character following the backslash for characters that must be escaped, 'u' for \u00XX, 0 otherwise
+struct EscapeTable {
+	char map[256];
+
+	EscapeTable()
+	{
+		memset(map, 0, sizeof(map));
+		for (unsigned c = 0; c < 0x20; c++)
+			map[c] = 'u';
+		map[unsigned('"')] = '"';
+		map[unsigned('\\')] = '\\';
+		map[unsigned('\b')] = 'b';
+		map[unsigned('\f')] = 'f';
+		map[unsigned('\n')] = 'n';
+		map[unsigned('\r')] = 'r';
+		map[unsigned('\t')] = 't';
+		map[0x7F] = 'u';
+	}
+};
+
+const EscapeTable escapes;
+
+const char digitPairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+// writes the decimal digits of u so that they end just before end, returns the first digit
+inline char* formatDigits(uint64_t u, char* end)
+{
+	while (u >= 100) {
+		unsigned pair = (u % 100) * 2;
+		u /= 100;
+		*--end = digitPairs[pair + 1];
+		*--end = digitPairs[pair];
+	}
+	if (u >= 10) {
+		*--end = digitPairs[u * 2 + 1];
+		*--end = digitPairs[u * 2];
+	} else {
+		*--end = char('0' + u);
+	}
+	return end;
+}
+
+}
+
+JsonWriter::JsonWriter(bool pretty)
+	: _hasMembers(0), _depth(0), _afterKey(false), _pretty(pretty)
+{
+	_buffer.reserve(256);
+}
+
+void JsonWriter::clear()
+{
+	_buffer.clear();
+	_hasMembers = 0;
+	_depth = 0;
+	_afterKey = false;
+}
+
+void JsonWriter::writeLine(std::ostream& target)
+{
+	_buffer.push_back('\n');
+	target.write(_buffer.data(), _buffer.size());
+	clear();
+}
+
+void JsonWriter::flushLine(std::ostream& target)
+{
+	writeLine(target);
+	target.flush();
+}
+
+void JsonWriter::newline()
+{
+	_buffer.push_back('\n');
+	_buffer.append(_depth, '\t');
+}
+
+void JsonWriter::beginValue()
+{
+	if (_afterKey) {
+		_afterKey = false;
+		return;
+	}
+
+	if (_depth == 0) {
+		if (!_buffer.empty())
+			throw GenericException("JSON document already complete");
+		return;
+	}
+
+	uint64_t bit = uint64_t(1) << (_depth - 1);
+	if (_hasMembers & bit)
+		_buffer.push_back(',');
+	_hasMembers |= bit;
+
+	if (_pretty)
+		newline();
+}
+
+void JsonWriter::open(char c)
+{
+	if (_depth == 64)
+		throw GenericException("JSON nesting too deep");
+
+	beginValue();
+	_buffer.push_back(c);
+	_depth++;
+	_hasMembers &= ~(uint64_t(1) << (_depth - 1));
+}
+
+void JsonWriter::close(char c)
+{
+	if (_depth == 0 || _afterKey)
+		throw GenericException("unbalanced JSON document");
+
+	bool empty = !(_hasMembers & (uint64_t(1) << (_depth - 1)));
+	_depth--;
+	if (_pretty && !empty)
+		newline();
+	_buffer.push_back(c);
+}
+
+JsonWriter& JsonWriter::beginObject()
+{
+	open('{');
+	return *this;
+}
+
+JsonWriter& JsonWriter::endObject()
+{
+	close('}');
+	return *this;
+}
+
+JsonWriter& JsonWriter::beginArray()
+{
+	open('[');
+	return *this;
+}
+
+JsonWriter& JsonWriter::endArray()
+{
+	close(']');
+	return *this;
+}
+
+JsonWriter& JsonWriter::key(const char* name)
+{
+	return key(name, strlen(name));
+}
+
+JsonWriter& JsonWriter::key(const char* name, size_t length)
+{
+	if (_afterKey)
+		throw GenericException("JSON key without value");
+
+	beginValue();
+	writeString(name, length);
+	_buffer.push_back(':');
+	if (_pretty)
+		_buffer.push_back(' ');
+	_afterKey = true;
+	return *this;
+}
+
+JsonWriter& JsonWriter::value(const char* str)
+{
+	return value(str, strlen(str));
+}
+
+JsonWriter& JsonWriter::value(const char* str, size_t length)
+{
+	beginValue();
+	writeString(str, length);
+	return *this;
+}
+
+JsonWriter& JsonWriter::value(bool b)
+{
+	beginValue();
+	if (b)
+		_buffer.append("true", 4);
+	else
+		_buffer.append("false", 5);
+	return *this;
+}
+
+JsonWriter& JsonWriter::value(float f)
+{
+	if (!std::isfinite(f))
+		return null();
+
+	// FLT_DIG digits are exact for every decimal that was converted to float
+	char buf[32];
+	int len = snprintf(buf, sizeof(buf), "%.*g", FLT_DIG, double(f));
+	beginValue();
+	_buffer.append(buf, len);
+	return *this;
+}
+
+JsonWriter& JsonWriter::value(double d)
+{
+	if (!std::isfinite(d))
+		return null();
+
+	char buf[32];
+	int len = snprintf(buf, sizeof(buf), "%.*g", DBL_DIG, d);
+	beginValue();
+	_buffer.append(buf, len);
+	return *this;
+}
+
+JsonWriter& JsonWriter::null()
+{
+	beginValue();
+	_buffer.append("null", 4);
+	return *this;
+}
+
+JsonWriter& JsonWriter::number(const char* text, size_t length)
+{
+	beginValue();
+	_buffer.append(text, length);
+	return *this;
+}
+
+void JsonWriter::writeInt(int64_t i)
+{
+	char buf[24];
+	char* end = buf + sizeof(buf);
+	// negate in unsigned arithmetic, -INT64_MIN does not fit into int64_t
+	char* begin = formatDigits(i < 0 ? -uint64_t(i) : uint64_t(i), end);
+	if (i < 0)
+		*--begin = '-';
+
+	beginValue();
+	_buffer.append(begin, end - begin);
+}
+
+void JsonWriter::writeUInt(uint64_t u)
+{
+	char buf[24];
+	char* end = buf + sizeof(buf);
+	char* begin = formatDigits(u, end);
+
+	beginValue();
+	_buffer.append(begin, end - begin);
+}
+
+void JsonWriter::writeString(const char* str, size_t length)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	_buffer.push_back('"');
+
+	// copy runs of characters that need no escaping in one go
+	const char* run = str;
+	const char* end = str + length;
+	for (const char* p = str; p != end; p++) {
+		char esc = escapes.map[uint8_t(*p)];
+		if (!esc)
+			continue;
+
+		_buffer.append(run, p - run);
+		run = p + 1;
+
+		char seq[6] = { '\\', esc };
+		if (esc == 'u') {
+			seq[2] = '0';
+			seq[3] = '0';
+			seq[4] = hex[uint8_t(*p) >> 4];
+			seq[5] = hex[uint8_t(*p) & 0xF];
+			_buffer.append(seq, 6);
+		} else {
+			_buffer.append(seq, 2);
+		}
+	}
+	_buffer.append(run, end - run);
+
+	_buffer.push_back('"');
+}
+
+
+
+const char* JsonDocument::Value::c_str() const
+{
+	if (node().numberKind != n_text)
+		return numberText();
+	return &_doc->_strings[node().text];
+}
+
+size_t JsonDocument::Value::length() const
+{
+	if (node().numberKind != n_text) {
+		numberText();
+		return node().numberTextLength;
+	}
+	return node().textLength;
+}
+
+const char* JsonDocument::Value::numberText() const
+{
+	const Node& n = node();
+	if (n.numberTextLength)
+		return n.numberText;
+
+	char* end = n.numberText + sizeof(n.numberText) - 1;
+	char* begin;
+	switch (n.numberKind) {
+	case n_int:
+		begin = formatDigits(n.number.i < 0 ? -uint64_t(n.number.i) : uint64_t(n.number.i), end);
+		if (n.number.i < 0)
+			*--begin = '-';
+		break;
+
+	case n_uint:
+		begin = formatDigits(n.number.u, end);
+		break;
+
+	default:
+		// enough digits to read back the exact value
+		begin = n.numberText;
+		end = begin + snprintf(n.numberText, sizeof(n.numberText), "%.*g",
+			n.numberKind == n_float ? 9 : 17, n.number.d);
+		break;
+	}
+
+	*end = '\0';
+	n.numberTextLength = end - begin;
+	if (begin != n.numberText)
+		memmove(n.numberText, begin, n.numberTextLength + 1);
+	return n.numberText;
+}
+
+bool JsonDocument::Value::toInt(int64_t& i) const
+{
+	uint64_t u;
+
+	switch (node().numberKind) {
+	case n_int:
+		i = node().number.i;
+		return true;
+
+	case n_uint:
+		if (node().number.u > uint64_t(std::numeric_limits<int64_t>::max()))
+			return false;
+		i = node().number.u;
+		return true;
+
+	case n_text:
+		if (type() != t_number)
+			return false;
+		if (*c_str() != '-') {
+			if (!toUInt(u) || u > uint64_t(std::numeric_limits<int64_t>::max()))
+				return false;
+			i = u;
+			return true;
+		}
+		break;
+
+	default:
+		return false;
+	}
+
+	// negative integer text
+	const char* p = c_str() + 1;
+	u = 0;
+	for (; *p >= '0' && *p <= '9'; p++) {
+		if (u > (uint64_t(1) << 63) / 10 || u * 10 + (*p - '0') > (uint64_t(1) << 63))
+			return false;
+		u = u * 10 + (*p - '0');
+	}
+	if (*p)
+		return false;
+	i = -u;
+	return true;
+}
+
+bool JsonDocument::Value::toUInt(uint64_t& u) const
+{
+	switch (node().numberKind) {
+	case n_int:
+		if (node().number.i < 0)
+			return false;
+		u = node().number.i;
+		return true;
+
+	case n_uint:
+		u = node().number.u;
+		return true;
+
+	case n_text:
+		break;
+
+	default:
+		return false;
+	}
+
+	if (type() != t_number)
+		return false;
+
+	// only plain digits, anything with a sign, fraction or exponent is not an unsigned integer
+	const char* p = c_str();
+	u = 0;
+	for (; *p >= '0' && *p <= '9'; p++) {
+		if (u > std::numeric_limits<uint64_t>::max() / 10 || u * 10 > std::numeric_limits<uint64_t>::max() - (*p - '0'))
+			return false;
+		u = u * 10 + (*p - '0');
+	}
+	return !*p;
+}
+
+bool JsonDocument::Value::toDouble(double& d) const
+{
+	switch (node().numberKind) {
+	case n_int: d = node().number.i; return true;
+	case n_uint: d = node().number.u; return true;
+	case n_float:
+	case n_double: d = node().number.d; return true;
+
+	case n_text:
+		if (type() != t_number)
+			return false;
+		d = strtod(c_str(), NULL);
+		return true;
+	}
+
+	return false;
+}
+
+bool JsonDocument::Value::operator==(const char* text) const
+{
+	size_t len = strlen(text);
+	return len == length() && memcmp(c_str(), text, len) == 0;
+}
+
+JsonDocument::Value JsonDocument::Value::operator[](const char* path) const
+{
+	Value result = *this;
+
+	while (result.isObject()) {
+		const char* dot = strchr(path, '.');
+		size_t len = dot ? dot - path : strlen(path);
+
+		Value member = result.first();
+		while (member && !(member.node().keyLength == len && memcmp(member.key(), path, len) == 0))
+			member = member.next();
+
+		if (!dot || !member)
+			return member;
+
+		result = member;
+		path = dot + 1;
+	}
+
+	return Value();
+}
+
+JsonDocument::JsonDocument()
+	: _pos(NULL), _end(NULL), _begin(NULL)
+{
+	_nodes.reserve(32);
+	_strings.reserve(256);
+}
+
+void JsonDocument::parse(const char* text, size_t length)
+{
+	_nodes.clear();
+	_strings.clear();
+	// offset 0 is the empty text of containers and the key of nodes that are not members
+	_strings.push_back('\0');
+
+	_begin = _pos = text;
+	_end = text + length;
+
+	try {
+		parseValue(0);
+		skipSpace();
+		if (_pos != _end)
+			fail("garbage after data");
+	} catch (...) {
+		_nodes.clear();
+		throw;
+	}
+}
+
+void JsonDocument::fail(const char* what)
+{
+	std::ostringstream msg;
+	msg << what << " at offset " << (_pos - _begin);
+	throw GenericException(msg.str());
+}
+
+void JsonDocument::skipSpace()
+{
+	while (_pos != _end && (*_pos == ' ' || *_pos == '\t' || *_pos == '\n' || *_pos == '\r'))
+		_pos++;
+}
+
+void JsonDocument::expect(char c)
+{
+	skipSpace();
+	if (_pos == _end || *_pos != c) {
+		char msg[] = "expected ' '";
+		msg[10] = c;
+		fail(msg);
+	}
+	_pos++;
+}
+
+uint32_t JsonDocument::appendNode(Type type)
+{
+	Node node = { type, n_text, 0, 0, 0, 0, none, none, 0 };
+	_nodes.push_back(node);
+	return _nodes.size() - 1;
+}
+
+uint32_t JsonDocument::parseValue(unsigned depth)
+{
+	skipSpace();
+	if (_pos == _end)
+		fail("unexpected end of data");
+
+	uint32_t index;
+	uint32_t text = _strings.size();
+
+	switch (*_pos) {
+	case '{':
+		index = appendNode(t_object);
+		parseContainer(index, '}', depth + 1);
+		return index;
+
+	case '[':
+		index = appendNode(t_array);
+		parseContainer(index, ']', depth + 1);
+		return index;
+
+	case '"':
+		index = appendNode(t_string);
+		parseString();
+		break;
+
+	case 't':
+		index = appendNode(t_bool);
+		parseLiteral("true", 4);
+		break;
+
+	case 'f':
+		index = appendNode(t_bool);
+		parseLiteral("false", 5);
+		break;
+
+	case 'n':
+		index = appendNode(t_null);
+		parseLiteral("null", 4);
+		break;
+
+	default:
+		index = appendNode(t_number);
+		parseNumber();
+		break;
+	}
+
+	_nodes[index].text = text;
+	_nodes[index].textLength = _strings.size() - text;
+	_strings.push_back('\0');
+	return index;
+}
+
+void JsonDocument::parseContainer(uint32_t index, char close, unsigned depth)
+{
+	if (depth > 64)
+		fail("nesting too deep");
+
+	_pos++;
+	skipSpace();
+	if (_pos != _end && *_pos == close) {
+		_pos++;
+		return;
+	}
+
+	uint32_t last = none;
+	for (;;) {
+		uint32_t key = 0, keyLength = 0;
+
+		if (close == '}') {
+			skipSpace();
+			if (_pos == _end || *_pos != '"')
+				fail("expected member name");
+
+			key = _strings.size();
+			parseString();
+			keyLength = _strings.size() - key;
+			_strings.push_back('\0');
+
+			expect(':');
+		}
+
+		uint32_t child = parseValue(depth);
+		_nodes[child].key = key;
+		_nodes[child].keyLength = keyLength;
+
+		if (last == none)
+			_nodes[index].firstChild = child;
+		else
+			_nodes[last].next = child;
+		last = child;
+		_nodes[index].size++;
+
+		skipSpace();
+		if (_pos != _end && *_pos == ',') {
+			_pos++;
+			continue;
+		}
+
+		expect(close);
+		return;
+	}
+}
+
+void JsonDocument::parseLiteral(const char* literal, size_t length)
+{
+	if (size_t(_end - _pos) < length || memcmp(_pos, literal, length) != 0)
+		fail("invalid literal");
+
+	_strings.append(_pos, length);
+	_pos += length;
+}
+
+void JsonDocument::parseNumber()
+{
+	const char* start = _pos;
+
+	auto digits = [this] () {
+		const char* first = _pos;
+		while (_pos != _end && *_pos >= '0' && *_pos <= '9')
+			_pos++;
+		if (_pos == first)
+			fail("invalid number");
+	};
+
+	if (_pos != _end && *_pos == '-')
+		_pos++;
+	if (_pos != _end && *_pos == '0')
+		_pos++;
+	else
+		digits();
+	if (_pos != _end && *_pos == '.') {
+		_pos++;
+		digits();
+	}
+	if (_pos != _end && (*_pos == 'e' || *_pos == 'E')) {
+		_pos++;
+		if (_pos != _end && (*_pos == '+' || *_pos == '-'))
+			_pos++;
+		digits();
+	}
+
+	_strings.append(start, _pos - start);
+}
+
+void JsonDocument::parseString()
+{
+	auto hex4 = [this] () -> unsigned {
+		if (_end - _pos < 4)
+			fail("invalid escape");
+
+		unsigned result = 0;
+		for (int i = 0; i < 4; i++) {
+			char c = *_pos++;
+			result <<= 4;
+			if (c >= '0' && c <= '9')
+				result |= c - '0';
+			else if (c >= 'a' && c <= 'f')
+				result |= c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F')
+				result |= c - 'A' + 10;
+			else
+				fail("invalid escape");
+		}
+		return result;
+	};
+
+	// skip the opening quote
+	_pos++;
+
+	for (;;) {
+		// copy runs of plain characters in one go
+		const char* run = _pos;
+		while (_pos != _end && *_pos != '"' && *_pos != '\\' && uint8_t(*_pos) >= 0x20)
+			_pos++;
+		_strings.append(run, _pos - run);
+
+		if (_pos == _end)
+			fail("unterminated string");
+
+		char c = *_pos++;
+		if (c == '"')
+			return;
+		if (c != '\\') {
+			_pos--;
+			fail("control character in string");
+		}
+
+		if (_pos == _end)
+			fail("unterminated string");
+
+		switch (*_pos++) {
+		case '"': _strings.push_back('"'); break;
+		case '\\': _strings.push_back('\\'); break;
+		case '/': _strings.push_back('/'); break;
+		case 'b': _strings.push_back('\b'); break;
+		case 'f': _strings.push_back('\f'); break;
+		case 'n': _strings.push_back('\n'); break;
+		case 'r': _strings.push_back('\r'); break;
+		case 't': _strings.push_back('\t'); break;
+		case 'u': {
+			unsigned cp = hex4();
+			if (cp >= 0xD800 && cp <= 0xDBFF) {
+				if (_end - _pos < 2 || _pos[0] != '\\' || _pos[1] != 'u')
+					fail("unpaired surrogate");
+				_pos += 2;
+				unsigned low = hex4();
+				if (low < 0xDC00 || low > 0xDFFF)
+					fail("unpaired surrogate");
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+			} else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+				fail("unpaired surrogate");
+			}
+
+			if (cp < 0x80) {
+				_strings.push_back(char(cp));
+			} else if (cp < 0x800) {
+				_strings.push_back(char(0xC0 | (cp >> 6)));
+				_strings.push_back(char(0x80 | (cp & 0x3F)));
+			} else if (cp < 0x10000) {
+				_strings.push_back(char(0xE0 | (cp >> 12)));
+				_strings.push_back(char(0x80 | ((cp >> 6) & 0x3F)));
+				_strings.push_back(char(0x80 | (cp & 0x3F)));
+			} else {
+				_strings.push_back(char(0xF0 | (cp >> 18)));
+				_strings.push_back(char(0x80 | ((cp >> 12) & 0x3F)));
+				_strings.push_back(char(0x80 | ((cp >> 6) & 0x3F)));
+				_strings.push_back(char(0x80 | (cp & 0x3F)));
+			}
+			break;
+		}
+		default:
+			_pos--;
+			fail("invalid escape");
+		}
+	}
+}
+
+void JsonDocument::parseMsgPack(const char* data, size_t length)
+{
+	_nodes.clear();
+	_strings.clear();
+	_strings.push_back('\0');
+
+	_begin = _pos = data;
+	_end = data + length;
+
+	try {
+		parseMsgPackValue(0);
+		if (_pos != _end)
+			fail("garbage after data");
+	} catch (...) {
+		_nodes.clear();
+		throw;
+	}
+}
+
+uint64_t JsonDocument::readBE(size_t bytes)
+{
+	if (size_t(_end - _pos) < bytes)
+		fail("unexpected end of data");
+
+	uint64_t result = 0;
+	for (size_t i = 0; i < bytes; i++)
+		result = (result << 8) | uint8_t(*_pos++);
+	return result;
+}
+
+void JsonDocument::readBytes(size_t length)
+{
+	if (size_t(_end - _pos) < length)
+		fail("unexpected end of data");
+
+	_strings.append(_pos, length);
+	_pos += length;
+}
+
+uint32_t JsonDocument::parseMsgPackValue(unsigned depth)
+{
+	if (_pos == _end)
+		fail("unexpected end of data");
+
+	uint8_t tag = *_pos++;
+	uint32_t text = _strings.size();
+	uint32_t index = none;
+	size_t count = 0;
+	bool map = false;
+
+	auto number = [this] (NumberKind kind) {
+		uint32_t index = appendNode(t_number);
+		_nodes[index].numberKind = kind;
+		return index;
+	};
+
+	switch (tag) {
+	case 0xDC: count = readBE(2); break;
+	case 0xDD: count = readBE(4); break;
+	case 0xDE: map = true; count = readBE(2); break;
+	case 0xDF: map = true; count = readBE(4); break;
+
+	default:
+		if ((tag & 0xF0) == 0x80) {
+			map = true;
+			count = tag & 0x0F;
+			break;
+		}
+		if ((tag & 0xF0) == 0x90) {
+			count = tag & 0x0F;
+			break;
+		}
+
+		if (tag < 0x80) {
+			index = number(n_uint);
+			_nodes[index].number.u = tag;
+		} else if (tag >= 0xE0) {
+			index = number(n_int);
+			_nodes[index].number.i = int8_t(tag);
+		} else if ((tag & 0xE0) == 0xA0) {
+			index = appendNode(t_string);
+			readBytes(tag & 0x1F);
+		} else {
+			switch (tag) {
+			case 0xC0: index = appendNode(t_null); _strings.append("null", 4); break;
+			case 0xC2: index = appendNode(t_bool); _strings.append("false", 5); break;
+			case 0xC3: index = appendNode(t_bool); _strings.append("true", 4); break;
+
+			case 0xC4: case 0xD9: index = appendNode(t_string); readBytes(readBE(1)); break;
+			case 0xC5: case 0xDA: index = appendNode(t_string); readBytes(readBE(2)); break;
+			case 0xC6: case 0xDB: index = appendNode(t_string); readBytes(readBE(4)); break;
+
+			case 0xCA: {
+				uint32_t bits = readBE(4);
+				float f;
+				memcpy(&f, &bits, sizeof(f));
+				index = number(n_float);
+				_nodes[index].number.d = f;
+				break;
+			}
+			case 0xCB: {
+				uint64_t bits = readBE(8);
+				index = number(n_double);
+				memcpy(&_nodes[index].number.d, &bits, sizeof(bits));
+				break;
+			}
+
+			case 0xCC: index = number(n_uint); _nodes[index].number.u = readBE(1); break;
+			case 0xCD: index = number(n_uint); _nodes[index].number.u = readBE(2); break;
+			case 0xCE: index = number(n_uint); _nodes[index].number.u = readBE(4); break;
+			case 0xCF: index = number(n_uint); _nodes[index].number.u = readBE(8); break;
+			case 0xD0: index = number(n_int); _nodes[index].number.i = int8_t(readBE(1)); break;
+			case 0xD1: index = number(n_int); _nodes[index].number.i = int16_t(readBE(2)); break;
+			case 0xD2: index = number(n_int); _nodes[index].number.i = int32_t(readBE(4)); break;
+			case 0xD3: index = number(n_int); _nodes[index].number.i = int64_t(readBE(8)); break;
+
+			default:
+				_pos--;
+				fail("unsupported MessagePack type");
+			}
+		}
+
+		_nodes[index].text = text;
+		_nodes[index].textLength = _strings.size() - text;
+		_strings.push_back('\0');
+		return index;
+	}
+
+	if (depth >= 64)
+		fail("nesting too deep");
+	// every entry takes at least one byte, which bounds count by the remaining data
+	if (count > size_t(_end - _pos))
+		fail("unexpected end of data");
+
+	index = appendNode(map ? t_object : t_array);
+
+	uint32_t last = none;
+	for (size_t i = 0; i < count; i++) {
+		uint32_t key = 0, keyLength = 0;
+
+		if (map) {
+			uint32_t keyNode = parseMsgPackValue(depth + 1);
+			if (_nodes[keyNode].type != t_string)
+				fail("map key is not a string");
+			key = _nodes[keyNode].text;
+			keyLength = _nodes[keyNode].textLength;
+			// the key is stored in the member node, drop its own node again
+			_nodes.pop_back();
+		}
+
+		uint32_t child = parseMsgPackValue(depth + 1);
+		_nodes[child].key = key;
+		_nodes[child].keyLength = keyLength;
+
+		if (last == none)
+			_nodes[index].firstChild = child;
+		else
+			_nodes[last].next = child;
+		last = child;
+		_nodes[index].size++;
+	}
+
+	return index;
+}
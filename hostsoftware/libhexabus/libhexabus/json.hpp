@@ -0,0 +1,263 @@
+#ifndef LIBHEXABUS_JSON_HPP
+#define LIBHEXABUS_JSON_HPP 1
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <limits>
+#include <type_traits>
+#include <stdint.h>
+
+namespace hexabus {
+	// Streaming JSON writer for the command line tools. Documents are written directly into a buffer that is
+	// kept across documents, so once the buffer has grown to the size of a typical document, writing one does
+	// not allocate. Commas and key separators are inserted automatically; nesting is limited to 64 levels.
+	//
+	// Strings are expected to be UTF-8 and are written unchanged, except for quotes, backslashes and control
+	// characters, which are escaped.
+	class JsonWriter {
+		public:
+			// pretty writers put every member and element on a line of its own, indented with tabs
+			JsonWriter(bool pretty = false);
+
+			JsonWriter& beginObject();
+			JsonWriter& endObject();
+			JsonWriter& beginArray();
+			JsonWriter& endArray();
+
+			JsonWriter& key(const char* name);
+			JsonWriter& key(const std::string& name) { return key(name.c_str(), name.size()); }
+			JsonWriter& key(const char* name, size_t length);
+
+			JsonWriter& value(const char* str);
+			JsonWriter& value(const std::string& str) { return value(str.c_str(), str.size()); }
+			JsonWriter& value(const char* str, size_t length);
+			JsonWriter& value(bool b);
+			// non-finite values have no JSON representation and are written as null
+			JsonWriter& value(float f);
+			JsonWriter& value(double d);
+			JsonWriter& null();
+			// writes a number given as text, which must be a valid JSON number
+			JsonWriter& number(const char* text, size_t length);
+
+			template<typename Int>
+			typename std::enable_if<std::is_integral<Int>::value && !std::is_same<Int, bool>::value, JsonWriter&>::type
+			value(Int i)
+			{
+				if (std::is_signed<Int>::value)
+					writeInt(int64_t(i));
+				else
+					writeUInt(uint64_t(i));
+				return *this;
+			}
+
+			// shorthand for key(name).value(v)
+			template<typename Value>
+			JsonWriter& member(const char* name, const Value& v)
+			{
+				key(name);
+				return value(v);
+			}
+
+			const std::string& str() const { return _buffer; }
+			const char* data() const { return _buffer.data(); }
+			size_t size() const { return _buffer.size(); }
+			// true once all opened objects and arrays have been closed again
+			bool complete() const { return _depth == 0 && !_buffer.empty(); }
+
+			// starts a new document, keeping the allocated buffer
+			void clear();
+
+			// writes the document followed by a newline to target and starts a new document
+			void writeLine(std::ostream& target);
+			// like writeLine, but also flushes target
+			void flushLine(std::ostream& target);
+
+		private:
+			std::string _buffer;
+			// bit n is set if the container at depth n has members already
+			uint64_t _hasMembers;
+			unsigned _depth;
+			bool _afterKey;
+			bool _pretty;
+
+			void beginValue();
+			void open(char c);
+			void close(char c);
+			void newline();
+			void writeString(const char* str, size_t length);
+			void writeInt(int64_t i);
+			void writeUInt(uint64_t u);
+	};
+
+	// Parsed JSON document for reading commands. Nodes and decoded strings are kept in arrays that are reused by
+	// the next parse, so a document of the same shape as the one before is parsed without allocating.
+	// Numbers are not converted while parsing, their text is kept as it appeared in the input and only converted
+	// when asked for with Value::get.
+	class JsonDocument {
+		public:
+			enum Type {
+				t_null,
+				t_bool,
+				t_number,
+				t_string,
+				t_array,
+				t_object,
+			};
+
+		private:
+			static const uint32_t none = uint32_t(-1);
+
+			// numbers from JSON text keep their text, numbers from MessagePack their value
+			enum NumberKind {
+				n_text,
+				n_int,
+				n_uint,
+				n_float,
+				n_double,
+			};
+
+			struct Node {
+				Type type;
+				NumberKind numberKind;
+				// offsets into _strings, every text is followed by a NUL
+				uint32_t key, keyLength;
+				uint32_t text, textLength;
+				uint32_t firstChild, next;
+				uint32_t size;
+
+				union {
+					int64_t i;
+					uint64_t u;
+					double d;
+				} number;
+				// the text of numbers that have a value, formatted on first use
+				mutable char numberText[32];
+				mutable uint8_t numberTextLength;
+			};
+
+		public:
+			// Handle to a node of the document, valid until the document is parsed again. Default constructed
+			// handles and handles returned for missing members are invalid.
+			class Value {
+				public:
+					Value() : _doc(NULL), _index(none) {}
+
+					bool valid() const { return _doc != NULL; }
+					explicit operator bool() const { return valid(); }
+
+					Type type() const { return node().type; }
+					bool isObject() const { return valid() && type() == t_object; }
+					bool isArray() const { return valid() && type() == t_array; }
+
+					// decoded string, or the literal text of numbers, booleans and null. empty for containers
+					const char* c_str() const;
+					size_t length() const;
+					std::string str() const { return std::string(c_str(), length()); }
+
+					// converts numbers, and booleans to bool. false if the value has a different type or does not
+					// fit into T exactly; integers are never rounded or truncated
+					template<typename T>
+					bool get(T& out) const;
+					bool operator==(const char* text) const;
+
+					// name of this member, if the parent is an object
+					const char* key() const { return &_doc->_strings[node().key]; }
+
+					// number of members or elements
+					size_t size() const { return node().size; }
+					// iteration over members and elements
+					Value first() const { return Value(_doc, node().firstChild); }
+					Value next() const { return Value(_doc, node().next); }
+
+					// member lookup; path may name nested members, separated by dots
+					Value operator[](const char* path) const;
+
+				private:
+					friend class JsonDocument;
+
+					const JsonDocument* _doc;
+					uint32_t _index;
+
+					Value(const JsonDocument* doc, uint32_t index)
+						: _doc(index == none ? NULL : doc), _index(index)
+					{}
+
+					const Node& node() const { return _doc->_nodes[_index]; }
+					const char* numberText() const;
+
+					bool toInt(int64_t& i) const;
+					bool toUInt(uint64_t& u) const;
+					bool toDouble(double& d) const;
+			};
+
+			JsonDocument();
+
+			// throws GenericException if text is not a single valid JSON value
+			void parse(const char* text, size_t length);
+			// reads a single MessagePack value instead. Integers and floats become numbers, binary data becomes a
+			// string; map keys must be strings
+			void parseMsgPack(const char* data, size_t length);
+
+			Value root() const { return Value(this, _nodes.empty() ? none : 0); }
+
+		private:
+			std::vector<Node> _nodes;
+			std::string _strings;
+
+			const char* _pos;
+			const char* _end;
+			const char* _begin;
+
+			uint32_t parseValue(unsigned depth);
+			void parseContainer(uint32_t index, char close, unsigned depth);
+			void parseString();
+			void parseNumber();
+			void parseLiteral(const char* literal, size_t length);
+			uint32_t appendNode(Type type);
+			void skipSpace();
+			void expect(char c);
+			void fail(const char* what);
+
+			uint32_t parseMsgPackValue(unsigned depth);
+			uint64_t readBE(size_t bytes);
+			void readBytes(size_t length);
+	};
+
+	template<typename T>
+	bool JsonDocument::Value::get(T& out) const
+	{
+		typedef std::numeric_limits<T> limits;
+
+		if (std::is_same<T, bool>::value) {
+			if (type() != t_bool)
+				return false;
+			out = T(*c_str() == 't');
+		} else if (std::is_floating_point<T>::value) {
+			double d;
+			if (!toDouble(d) || (std::isfinite(d) && std::fabs(d) > limits::max()))
+				return false;
+			out = T(d);
+		} else if (std::is_signed<T>::value) {
+			int64_t i;
+			if (!toInt(i) || i < int64_t(limits::min()) || i > int64_t(limits::max()))
+				return false;
+			out = T(i);
+		} else {
+			uint64_t u;
+			if (!toUInt(u) || u > uint64_t(limits::max()))
+				return false;
+			out = T(u);
+		}
+
+		return true;
+	}
+
+	inline std::ostream& operator<<(std::ostream& os, const JsonWriter& writer)
+	{
+		return os.write(writer.data(), writer.size());
+	}
+}
+
+#endif
@@ -0,0 +1,445 @@
+#include "column_store.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <boost/filesystem/operations.hpp>
+
+#include "../error.hpp"
+#include "gorilla.hpp"
+
+using namespace hexabus;
+
+namespace {
+
+// All integers are stored in host byte order, like the registry cache and segment logs.
+struct ColumnHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t block_size;
+	uint32_t encoding;
+	uint64_t count;
+	uint64_t blocks;
+	uint64_t index_offset;
+	uint64_t reserved2[2];
+};
+
+const char column_magic[8] = { 'H', 'X', 'B', 'C', 'O', 'L', 'S', 0 };
+const uint32_t column_version = 1;
+const uint32_t column_byte_order = 0x01020304;
+
+}
+
+static_assert(sizeof(ColumnHeader) == 64, "column header must be 64 bytes");
+
+// {{{ Aggregation
+
+void hexabus::aggregate_values(const double* values, size_t n, ColumnAggregate& agg)
+{
+	if (!n)
+		return;
+
+	size_t i = 0;
+	double min = agg.min, max = agg.max, sum = 0;
+
+#if defined(__SSE2__)
+	// two accumulators of two lanes each hide the latency of addpd
+	if (n >= 4) {
+		__m128d vmin = _mm_set1_pd(min), vmax = _mm_set1_pd(max);
+		__m128d vsum0 = _mm_setzero_pd(), vsum1 = _mm_setzero_pd();
+
+		for (; i + 4 <= n; i += 4) {
+			__m128d a = _mm_loadu_pd(values + i);
+			__m128d b = _mm_loadu_pd(values + i + 2);
+
+			vmin = _mm_min_pd(vmin, _mm_min_pd(a, b));
+			vmax = _mm_max_pd(vmax, _mm_max_pd(a, b));
+			vsum0 = _mm_add_pd(vsum0, a);
+			vsum1 = _mm_add_pd(vsum1, b);
+		}
+
+		double lanes[2];
+		_mm_storeu_pd(lanes, vmin);
+		min = std::min(lanes[0], lanes[1]);
+		_mm_storeu_pd(lanes, vmax);
+		max = std::max(lanes[0], lanes[1]);
+		_mm_storeu_pd(lanes, _mm_add_pd(vsum0, vsum1));
+		sum = lanes[0] + lanes[1];
+	}
+#else
+	// independent accumulators, so compilers for other targets can vectorize the loop
+	if (n >= 4) {
+		double mins[4] = { min, min, min, min }, maxs[4] = { max, max, max, max }, sums[4] = { 0, 0, 0, 0 };
+
+		for (; i + 4 <= n; i += 4) {
+			for (int l = 0; l < 4; l++) {
+				mins[l] = values[i + l] < mins[l] ? values[i + l] : mins[l];
+				maxs[l] = values[i + l] > maxs[l] ? values[i + l] : maxs[l];
+				sums[l] += values[i + l];
+			}
+		}
+
+		min = std::min(std::min(mins[0], mins[1]), std::min(mins[2], mins[3]));
+		max = std::max(std::max(maxs[0], maxs[1]), std::max(maxs[2], maxs[3]));
+		sum = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+	}
+#endif
+
+	for (; i < n; i++) {
+		min = std::min(min, values[i]);
+		max = std::max(max, values[i]);
+		sum += values[i];
+	}
+
+	agg.count += n;
+	agg.min = min;
+	agg.max = max;
+	agg.sum += sum;
+}
+
+// }}}
+
+// {{{ ColumnWriter
+
+ColumnWriter::ColumnWriter(const boost::filesystem::path& file, uint32_t block_size, ColumnEncoding encoding)
+	: _file(file), _tmp(file.string() + ".tmp"), _block_size(block_size), _encoding(encoding),
+	  _offset(sizeof(ColumnHeader)), _count(0), _closed(false)
+{
+	if (!_block_size)
+		throw GenericException("Column blocks must hold at least one reading");
+
+	_out.open(_tmp, std::ios::binary | std::ios::trunc);
+	if (!_out)
+		throw GenericException("Could not create " + _tmp.string());
+
+	// the header is written last, once the index is known
+	ColumnHeader header;
+	memset(&header, 0, sizeof(header));
+	_out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	_timestamps.reserve(_block_size);
+	_values.reserve(_block_size);
+}
+
+ColumnWriter::~ColumnWriter()
+{
+	if (!_closed) {
+		_out.close();
+		boost::system::error_code err;
+		boost::filesystem::remove(_tmp, err);
+	}
+}
+
+void ColumnWriter::append(int64_t timestamp, double value)
+{
+	if (!_timestamps.empty() ? timestamp < _timestamps.back() : !_index.empty() && timestamp < _index.back().last)
+		throw GenericException("Column readings must be appended in time order");
+
+	_timestamps.push_back(timestamp);
+	_values.push_back(value);
+	if (_timestamps.size() == _block_size)
+		write_block();
+}
+
+void ColumnWriter::write_block()
+{
+	if (_timestamps.empty())
+		return;
+
+	IndexEntry entry;
+	ColumnAggregate agg;
+	aggregate_values(&_values[0], _values.size(), agg);
+
+	entry.first = _timestamps.front();
+	entry.last = _timestamps.back();
+	entry.offset = _offset;
+	entry.count = _timestamps.size();
+	entry.min = agg.min;
+	entry.max = agg.max;
+	entry.sum = agg.sum;
+
+	if (_encoding == column_gorilla) {
+		_encoded.clear();
+		GorillaEncoder encoder(_encoded);
+		for (size_t i = 0; i < _timestamps.size(); i++)
+			encoder.append(_timestamps[i], _values[i]);
+		encoder.finish();
+
+		entry.bytes = _encoded.size();
+		_out.write(reinterpret_cast<const char*>(&_encoded[0]), _encoded.size());
+	} else {
+		entry.bytes = _timestamps.size() * (sizeof(int64_t) + sizeof(double));
+		_out.write(reinterpret_cast<const char*>(&_timestamps[0]), _timestamps.size() * sizeof(int64_t));
+		_out.write(reinterpret_cast<const char*>(&_values[0]), _values.size() * sizeof(double));
+	}
+
+	_index.push_back(entry);
+	_offset += entry.bytes;
+	_count += _timestamps.size();
+
+	_timestamps.clear();
+	_values.clear();
+}
+
+void ColumnWriter::close()
+{
+	if (_closed)
+		return;
+
+	write_block();
+	// keep the index aligned, it is accessed in place
+	static const char padding[sizeof(int64_t)] = {};
+	size_t pad = (sizeof(int64_t) - _offset % sizeof(int64_t)) % sizeof(int64_t);
+	_out.write(padding, pad);
+	_offset += pad;
+
+	if (!_index.empty())
+		_out.write(reinterpret_cast<const char*>(&_index[0]), _index.size() * sizeof(IndexEntry));
+
+	ColumnHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, column_magic, sizeof(column_magic));
+	header.version = column_version;
+	header.byte_order = column_byte_order;
+	header.block_size = _block_size;
+	header.encoding = _encoding;
+	header.count = _count;
+	header.blocks = _index.size();
+	header.index_offset = _offset;
+
+	_out.seekp(0);
+	_out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	_out.close();
+	if (!_out)
+		throw GenericException("Could not write " + _tmp.string());
+
+	boost::filesystem::rename(_tmp, _file);
+	_closed = true;
+}
+
+// }}}
+
+// {{{ ColumnReader
+
+ColumnReader::ColumnReader(const boost::filesystem::path& file)
+	: _map(NULL), _size(0), _encoding(column_plain), _count(0), _blocks(0), _index(NULL), _decoded(size_t(-1))
+{
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd < 0) {
+		std::ostringstream oss;
+		oss << "Could not open " << file.string() << ": " << strerror(errno);
+		throw GenericException(oss.str());
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(ColumnHeader)) {
+		close(fd);
+		throw GenericException("Invalid column file " + file.string());
+	}
+
+	_size = st.st_size;
+	_map = mmap(0, _size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (_map == MAP_FAILED) {
+		_map = NULL;
+		throw GenericException("Could not map " + file.string());
+	}
+
+	const char* data = static_cast<const char*>(_map);
+	ColumnHeader header;
+	memcpy(&header, data, sizeof(header));
+
+	bool valid = memcmp(header.magic, column_magic, sizeof(column_magic)) == 0
+		&& header.version == column_version
+		&& header.byte_order == column_byte_order
+		&& (header.encoding == column_plain || header.encoding == column_gorilla)
+		&& header.index_offset <= _size
+		&& header.blocks <= (_size - header.index_offset) / sizeof(IndexEntry)
+		&& header.index_offset + header.blocks * sizeof(IndexEntry) == _size
+		&& header.index_offset % sizeof(int64_t) == 0;
+
+	if (valid) {
+		_index = reinterpret_cast<const IndexEntry*>(data + header.index_offset);
+		_blocks = header.blocks;
+		_count = header.count;
+		_encoding = ColumnEncoding(header.encoding);
+
+		uint64_t count = 0;
+		for (uint64_t b = 0; valid && b < _blocks; b++) {
+			const IndexEntry& e = _index[b];
+			valid = e.count > 0
+				&& e.count <= header.block_size
+				&& e.offset >= sizeof(ColumnHeader)
+				&& e.offset + e.bytes <= header.index_offset
+				&& (_encoding == column_plain
+					? e.offset % sizeof(int64_t) == 0 && e.bytes == e.count * (sizeof(int64_t) + sizeof(double))
+					: e.bytes > 0)
+				&& e.first <= e.last
+				&& (b == 0 || _index[b - 1].last <= e.first);
+			count += e.count;
+		}
+		valid = valid && count == _count;
+	}
+
+	if (!valid) {
+		munmap(_map, _size);
+		_map = NULL;
+		throw GenericException("Invalid column file " + file.string());
+	}
+
+	madvise(_map, _size, MADV_RANDOM);
+}
+
+ColumnReader::~ColumnReader()
+{
+	if (_map)
+		munmap(_map, _size);
+}
+
+int64_t ColumnReader::first_timestamp() const
+{
+	return _blocks ? _index[0].first : 0;
+}
+
+int64_t ColumnReader::last_timestamp() const
+{
+	return _blocks ? _index[_blocks - 1].last : 0;
+}
+
+size_t ColumnReader::first_block(int64_t from) const
+{
+	const IndexEntry* it = std::lower_bound(_index, _index + _blocks, from,
+		[] (const IndexEntry& e, int64_t ts) { return e.last < ts; });
+	return it - _index;
+}
+
+void ColumnReader::block_range(size_t b, int64_t from, int64_t to, const int64_t*& ts, const double*& values,
+		size_t& begin, size_t& end) const
+{
+	const IndexEntry& e = _index[b];
+	const char* data = static_cast<const char*>(_map) + e.offset;
+
+	if (_encoding == column_gorilla) {
+		if (_decoded != b) {
+			_decoded_timestamps.resize(e.count);
+			_decoded_values.resize(e.count);
+
+			GorillaDecoder decoder(reinterpret_cast<const uint8_t*>(data), e.bytes);
+			size_t n = decoder.decode(&_decoded_timestamps[0], &_decoded_values[0], e.count);
+			if (n != e.count || _decoded_timestamps[0] != e.first || _decoded_timestamps[n - 1] != e.last) {
+				std::ostringstream oss;
+				oss << "Corrupt block " << b << " in column file";
+				throw GenericException(oss.str());
+			}
+			_decoded = b;
+		}
+
+		ts = &_decoded_timestamps[0];
+		values = &_decoded_values[0];
+	} else {
+		ts = reinterpret_cast<const int64_t*>(data);
+		values = reinterpret_cast<const double*>(data + e.count * sizeof(int64_t));
+	}
+	begin = e.first >= from ? 0 : std::lower_bound(ts, ts + e.count, from) - ts;
+	end = e.last < to ? e.count : std::lower_bound(ts + begin, ts + e.count, to) - ts;
+}
+
+ColumnAggregate ColumnReader::aggregate(int64_t from, int64_t to) const
+{
+	ColumnAggregate result;
+
+	for (size_t b = first_block(from); b < _blocks && _index[b].first < to; b++) {
+		const IndexEntry& e = _index[b];
+
+		if (e.first >= from && e.last < to) {
+			ColumnAggregate block;
+			block.count = e.count;
+			block.min = e.min;
+			block.max = e.max;
+			block.sum = e.sum;
+			result.add(block);
+		} else {
+			const int64_t* ts;
+			const double* values;
+			size_t begin, end;
+
+			block_range(b, from, to, ts, values, begin, end);
+			aggregate_values(values + begin, end - begin, result);
+		}
+	}
+
+	return result;
+}
+
+void ColumnReader::aggregate(int64_t from, int64_t to, int64_t bucket,
+		const std::function<void (int64_t start, const ColumnAggregate& agg)>& fn) const
+{
+	if (bucket <= 0)
+		throw GenericException("Bucket size must be positive");
+	if (to <= from)
+		return;
+	if (uint64_t(to) - uint64_t(from) > uint64_t(std::numeric_limits<int64_t>::max()))
+		throw GenericException("Time range too large");
+
+	// readings come in order, so only the current bucket is kept and emitted once a later one starts
+	uint64_t current = 0;
+	ColumnAggregate agg;
+	auto bucket_for = [&] (int64_t ts) -> ColumnAggregate& {
+		uint64_t idx = uint64_t(ts - from) / bucket;
+		if (idx != current) {
+			if (agg.count)
+				fn(from + int64_t(current * bucket), agg);
+			current = idx;
+			agg = ColumnAggregate();
+		}
+		return agg;
+	};
+
+	for (size_t b = first_block(from); b < _blocks && _index[b].first < to; b++) {
+		const IndexEntry& e = _index[b];
+		const int64_t* ts;
+		const double* values;
+		size_t begin, end;
+
+		// a block within a single bucket needs only its index entry
+		if (e.first >= from && e.last < to && (e.first - from) / bucket == (e.last - from) / bucket) {
+			ColumnAggregate block;
+			block.count = e.count;
+			block.min = e.min;
+			block.max = e.max;
+			block.sum = e.sum;
+			bucket_for(e.first).add(block);
+			continue;
+		}
+
+		// otherwise aggregate the runs of readings falling into the same bucket
+		block_range(b, from, to, ts, values, begin, end);
+		while (begin < end) {
+			ColumnAggregate& target = bucket_for(ts[begin]);
+			// the end of the last bucket may lie beyond the range of int64_t
+			uint64_t bucket_end = (current + 1) * uint64_t(bucket);
+			size_t run_end = end;
+			if (bucket_end < uint64_t(to) - uint64_t(from))
+				run_end = std::lower_bound(ts + begin, ts + end, from + int64_t(bucket_end)) - ts;
+
+			aggregate_values(values + begin, run_end - begin, target);
+			begin = run_end;
+		}
+	}
+
+	if (agg.count)
+		fn(from + int64_t(current * bucket), agg);
+}
+
+// }}}
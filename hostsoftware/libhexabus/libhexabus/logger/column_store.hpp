@@ -0,0 +1,167 @@
+#ifndef LIBHEXABUS_LOGGER_COLUMN_STORE_HPP
+#define LIBHEXABUS_LOGGER_COLUMN_STORE_HPP 1
+
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/path.hpp>
+
+namespace hexabus {
+
+	// min/max/sum over a set of readings
+	struct ColumnAggregate {
+		uint64_t count;
+		double min;
+		double max;
+		double sum;
+
+		ColumnAggregate()
+			: count(0), min(std::numeric_limits<double>::infinity()), max(-std::numeric_limits<double>::infinity()), sum(0)
+		{
+		}
+
+		void add(const ColumnAggregate& other)
+		{
+			count += other.count;
+			sum += other.sum;
+			if (other.min < min)
+				min = other.min;
+			if (other.max > max)
+				max = other.max;
+		}
+
+		double mean() const { return count ? sum / count : std::numeric_limits<double>::quiet_NaN(); }
+	};
+
+	// aggregates n values into agg. vectorized where the target supports it
+	void aggregate_values(const double* values, size_t n, ColumnAggregate& agg);
+
+	// how the blocks of a column file are stored
+	enum ColumnEncoding {
+		// timestamps followed by values, as arrays
+		column_plain = 0,
+		// delta of delta timestamps and XORed values, see GorillaEncoder
+		column_gorilla = 1
+	};
+
+	// The readings of one sensor in a column file: blocks of up to block_size readings, each holding
+	// its timestamps followed by its values, and a sparse index with the time range and the aggregate of
+	// every block at the end of the file. Readers only touch the blocks overlapping a query, and blocks
+	// completely inside a query only through their index entry.
+	//
+	// The file is written to <file>.tmp and renamed when the writer is closed.
+	class ColumnWriter {
+		public:
+			ColumnWriter(const boost::filesystem::path& file, uint32_t block_size = 4096,
+					ColumnEncoding encoding = column_plain);
+			// discards the file if it was not closed
+			~ColumnWriter();
+
+			// timestamps must not decrease
+			void append(int64_t timestamp, double value);
+			void close();
+
+		private:
+			ColumnWriter(const ColumnWriter&);
+			ColumnWriter& operator=(const ColumnWriter&);
+
+			struct IndexEntry {
+				int64_t first;
+				int64_t last;
+				uint64_t offset;
+				uint32_t count;
+				// length of the block in the file
+				uint32_t bytes;
+				double min;
+				double max;
+				double sum;
+			};
+
+			void write_block();
+
+			boost::filesystem::path _file;
+			boost::filesystem::path _tmp;
+			boost::filesystem::ofstream _out;
+			uint32_t _block_size;
+			ColumnEncoding _encoding;
+			uint64_t _offset;
+			uint64_t _count;
+			std::vector<int64_t> _timestamps;
+			std::vector<double> _values;
+			std::vector<IndexEntry> _index;
+			std::vector<uint8_t> _encoded;
+			bool _closed;
+
+			friend class ColumnReader;
+	};
+
+	// Blocks of gorilla encoded files are decoded into a buffer of the reader when a query needs their
+	// readings, so a reader must not be shared between threads.
+	class ColumnReader {
+		public:
+			// maps the file, throws a GenericException if it is not a valid column file
+			ColumnReader(const boost::filesystem::path& file);
+			~ColumnReader();
+
+			uint64_t size() const { return _count; }
+			ColumnEncoding encoding() const { return _encoding; }
+			// size of the file in bytes
+			size_t file_size() const { return _size; }
+			// timestamps of the first and last reading, or 0 if the file is empty
+			int64_t first_timestamp() const;
+			int64_t last_timestamp() const;
+
+			// aggregate of the readings in [from, to)
+			ColumnAggregate aggregate(int64_t from, int64_t to) const;
+			// calls fn(start, aggregate) for every bucket of bucket seconds in [from, to) that has readings, in
+			// order. buckets are aligned to from. throws a GenericException if to - from does not fit an int64_t
+			void aggregate(int64_t from, int64_t to, int64_t bucket,
+					const std::function<void (int64_t start, const ColumnAggregate& agg)>& fn) const;
+
+			// calls fn(timestamp, value) for every reading in [from, to), in order
+			template<typename Fn>
+			void scan(int64_t from, int64_t to, Fn fn) const
+			{
+				for (size_t b = first_block(from); b < _blocks && _index[b].first < to; b++) {
+					const int64_t* ts;
+					const double* values;
+					size_t begin, end;
+
+					block_range(b, from, to, ts, values, begin, end);
+					for (size_t i = begin; i < end; i++)
+						fn(ts[i], values[i]);
+				}
+			}
+
+		private:
+			ColumnReader(const ColumnReader&);
+			ColumnReader& operator=(const ColumnReader&);
+
+			typedef ColumnWriter::IndexEntry IndexEntry;
+
+			// the first block that may contain readings at or after from
+			size_t first_block(int64_t from) const;
+			// the readings of block b that lie in [from, to)
+			void block_range(size_t b, int64_t from, int64_t to, const int64_t*& ts, const double*& values,
+					size_t& begin, size_t& end) const;
+
+			void* _map;
+			size_t _size;
+			ColumnEncoding _encoding;
+			uint64_t _count;
+			uint64_t _blocks;
+			const IndexEntry* _index;
+
+			// the last decoded block of an encoded file
+			mutable size_t _decoded;
+			mutable std::vector<int64_t> _decoded_timestamps;
+			mutable std::vector<double> _decoded_values;
+	};
+
+}
+
+#endif
@@ -0,0 +1,342 @@
+#include "gorilla.hpp"
+
+#include <cstring>
+#include <endian.h>
+
+using namespace hexabus;
+
+// Timestamps: the first one verbatim, then the difference between consecutive deltas:
+//   0                   dod == 0
+//   10    + 7 bits      dod in [-64, 63]
+//   110   + 9 bits      dod in [-256, 255]
+//   1110  + 12 bits     dod in [-2048, 2047]
+//   11110 + 32 bits     dod fits into 32 bits
+//   11111 + 64 bits     anything else
+//
+// Values: the first one verbatim, then the XOR with the previous value:
+//   0                   xor == 0
+//   10 + bits           the meaningful bits of xor fit into the window of the previous value
+//   11 + 5 bits leading zeros + 6 bits length - 1 + bits
+//                       a new window
+
+namespace {
+
+struct DodClass {
+	unsigned prefix;
+	unsigned prefix_bits;
+	unsigned value_bits;
+};
+
+const DodClass dod_classes[] = {
+	{ 0x2, 2, 7 },
+	{ 0x6, 3, 9 },
+	{ 0xE, 4, 12 },
+	{ 0x1E, 5, 32 },
+};
+
+inline uint64_t double_bits(double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+inline double bits_double(uint64_t bits)
+{
+	double value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+inline uint64_t low_mask(unsigned n)
+{
+	return n >= 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+}
+
+inline int64_t sign_extend(uint64_t bits, unsigned n)
+{
+	uint64_t sign = uint64_t(1) << (n - 1);
+	return int64_t((bits ^ sign) - sign);
+}
+
+}
+
+// {{{ GorillaEncoder
+
+GorillaEncoder::GorillaEncoder(std::vector<uint8_t>& out)
+	: _out(out), _acc(0), _bits(0), _count(0), _prev_timestamp(0), _prev_delta(0), _prev_value(0),
+	  _prev_leading(0), _prev_trailing(0)
+{
+}
+
+// n <= 32
+void GorillaEncoder::write(uint64_t bits, unsigned n)
+{
+	_acc = (_acc << n) | (bits & low_mask(n));
+	_bits += n;
+	while (_bits >= 8) {
+		_bits -= 8;
+		_out.push_back(uint8_t(_acc >> _bits));
+	}
+}
+
+void GorillaEncoder::append(int64_t timestamp, double value)
+{
+	uint64_t bits = double_bits(value);
+
+	if (_count == 0) {
+		write(uint64_t(timestamp) >> 32, 32);
+		write(uint64_t(timestamp), 32);
+		write(bits >> 32, 32);
+		write(bits, 32);
+		// a new window is forced for the first XOR
+		_prev_leading = 64;
+		_prev_trailing = 64;
+	} else {
+		write_timestamp(timestamp);
+		write_value(bits);
+	}
+
+	_prev_timestamp = timestamp;
+	_prev_value = bits;
+	_count++;
+}
+
+void GorillaEncoder::write_timestamp(int64_t timestamp)
+{
+	// wrapping arithmetic, any pair of timestamps can be encoded
+	int64_t delta = uint64_t(timestamp) - uint64_t(_prev_timestamp);
+	int64_t dod = uint64_t(delta) - uint64_t(_prev_delta);
+	_prev_delta = delta;
+
+	if (dod == 0) {
+		write(0, 1);
+		return;
+	}
+
+	for (size_t i = 0; i < sizeof(dod_classes) / sizeof(dod_classes[0]); i++) {
+		const DodClass& c = dod_classes[i];
+		int64_t limit = int64_t(1) << (c.value_bits - 1);
+
+		if (dod >= -limit && dod < limit) {
+			write(c.prefix, c.prefix_bits);
+			write(uint64_t(dod), c.value_bits);
+			return;
+		}
+	}
+
+	write(0x1F, 5);
+	write(uint64_t(dod) >> 32, 32);
+	write(uint64_t(dod), 32);
+}
+
+void GorillaEncoder::write_value(uint64_t value)
+{
+	uint64_t x = value ^ _prev_value;
+
+	if (x == 0) {
+		write(0, 1);
+		return;
+	}
+
+	unsigned leading = __builtin_clzll(x);
+	unsigned trailing = __builtin_ctzll(x);
+	// the leading zero count is stored in 5 bits
+	if (leading > 31)
+		leading = 31;
+
+	if (leading >= _prev_leading && trailing >= _prev_trailing) {
+		unsigned len = 64 - _prev_leading - _prev_trailing;
+
+		write(0x2, 2);
+		x >>= _prev_trailing;
+		if (len > 32) {
+			write(x >> 32, len - 32);
+			len = 32;
+		}
+		write(x, len);
+	} else {
+		unsigned len = 64 - leading - trailing;
+
+		write(0x3, 2);
+		write(leading, 5);
+		write(len - 1, 6);
+		x >>= trailing;
+		if (len > 32) {
+			write(x >> 32, len - 32);
+			len = 32;
+		}
+		write(x, len);
+
+		_prev_leading = leading;
+		_prev_trailing = trailing;
+	}
+}
+
+void GorillaEncoder::finish()
+{
+	if (_bits) {
+		_out.push_back(uint8_t(_acc << (8 - _bits)));
+		_bits = 0;
+	}
+}
+
+// }}}
+
+// {{{ GorillaDecoder
+
+GorillaDecoder::GorillaDecoder(const uint8_t* data, size_t size)
+	: _pos(data), _end(data + size), _acc(0), _bits(0), _count(0), _prev_timestamp(0), _prev_delta(0),
+	  _prev_value(0), _prev_leading(64), _prev_trailing(64)
+{
+}
+
+// n <= 32
+inline bool GorillaDecoder::read(unsigned n, uint64_t& bits)
+{
+	if (_bits < n) {
+		if (_end - _pos >= 8) {
+			// refill as many whole bytes as fit into the accumulator with a single load
+			uint64_t word;
+			memcpy(&word, _pos, sizeof(word));
+			word = be64toh(word);
+
+			unsigned bytes = (63 - _bits) / 8;
+			_acc = (_acc << (bytes * 8)) | (word >> (64 - bytes * 8));
+			_pos += bytes;
+			_bits += bytes * 8;
+		} else {
+			do {
+				if (_pos == _end)
+					return false;
+				_acc = (_acc << 8) | *_pos++;
+				_bits += 8;
+			} while (_bits < n);
+		}
+	}
+
+	_bits -= n;
+	bits = (_acc >> _bits) & low_mask(n);
+	return true;
+}
+
+inline bool GorillaDecoder::read_bit(bool& bit)
+{
+	uint64_t b;
+	if (!read(1, b))
+		return false;
+	bit = b;
+	return true;
+}
+
+bool GorillaDecoder::read_timestamp(int64_t& timestamp)
+{
+	bool bit;
+	if (!read_bit(bit))
+		return false;
+
+	int64_t dod = 0;
+	if (bit) {
+		// count the ones of the prefix, at most four after the first
+		unsigned ones = 1;
+		while (ones < 5) {
+			if (!read_bit(bit))
+				return false;
+			if (!bit)
+				break;
+			ones++;
+		}
+
+		uint64_t hi, lo;
+		if (ones < 5) {
+			unsigned n = dod_classes[ones - 1].value_bits;
+			if (!read(n, lo))
+				return false;
+			dod = sign_extend(lo, n);
+		} else {
+			if (!read(32, hi) || !read(32, lo))
+				return false;
+			dod = int64_t((hi << 32) | lo);
+		}
+	}
+
+	_prev_delta = uint64_t(_prev_delta) + uint64_t(dod);
+	timestamp = uint64_t(_prev_timestamp) + uint64_t(_prev_delta);
+	return true;
+}
+
+bool GorillaDecoder::read_value(uint64_t& value)
+{
+	bool bit;
+	if (!read_bit(bit))
+		return false;
+
+	if (!bit) {
+		value = _prev_value;
+		return true;
+	}
+
+	if (!read_bit(bit))
+		return false;
+
+	uint64_t leading, len, hi = 0, lo;
+	if (!bit) {
+		if (_prev_leading + _prev_trailing >= 64)
+			return false;
+		len = 64 - _prev_leading - _prev_trailing;
+	} else {
+		if (!read(5, leading) || !read(6, len))
+			return false;
+		len++;
+		if (leading + len > 64)
+			return false;
+		_prev_leading = leading;
+		_prev_trailing = 64 - leading - len;
+	}
+
+	if (len > 32) {
+		if (!read(len - 32, hi))
+			return false;
+		len = 32;
+	}
+	if (!read(len, lo))
+		return false;
+
+	value = _prev_value ^ (((hi << 32) | lo) << _prev_trailing);
+	return true;
+}
+
+size_t GorillaDecoder::decode(int64_t* timestamps, double* values, size_t n)
+{
+	size_t i = 0;
+
+	if (_count == 0 && n > 0) {
+		uint64_t t_hi, t_lo, v_hi, v_lo;
+		if (!read(32, t_hi) || !read(32, t_lo) || !read(32, v_hi) || !read(32, v_lo))
+			return 0;
+
+		_prev_timestamp = int64_t((t_hi << 32) | t_lo);
+		_prev_value = (v_hi << 32) | v_lo;
+		timestamps[0] = _prev_timestamp;
+		values[0] = bits_double(_prev_value);
+		_count++;
+		i++;
+	}
+
+	for (; i < n; i++) {
+		int64_t ts;
+		uint64_t value;
+
+		if (!read_timestamp(ts) || !read_value(value))
+			break;
+
+		timestamps[i] = _prev_timestamp = ts;
+		_prev_value = value;
+		values[i] = bits_double(value);
+		_count++;
+	}
+
+	return i;
+}
+
+// }}}
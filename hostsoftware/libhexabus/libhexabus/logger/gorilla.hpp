@@ -0,0 +1,78 @@
+#ifndef LIBHEXABUS_LOGGER_GORILLA_HPP
+#define LIBHEXABUS_LOGGER_GORILLA_HPP 1
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace hexabus {
+
+	// Compressed encoding of (timestamp, value) series as described in "Gorilla: A Fast, Scalable, In-Memory
+	// Time Series Database" (Pelkonen et al., VLDB 2015). Timestamps are stored as delta of deltas, values as
+	// the XOR with the previous value, both with variable length prefix codes. Readings arriving at a fixed
+	// interval with slowly changing values take one or two bits per timestamp and a few bits per value.
+	//
+	// The first reading is stored verbatim, so every encoded block can be decoded on its own. The number of
+	// readings is not part of the encoding and must be stored alongside it: the padding bits of the last byte
+	// may decode as further readings.
+	class GorillaEncoder {
+		public:
+			// appends the encoded readings to out
+			GorillaEncoder(std::vector<uint8_t>& out);
+
+			void append(int64_t timestamp, double value);
+			// writes out the last partial byte. no readings may be appended afterwards
+			void finish();
+
+			size_t count() const { return _count; }
+
+		private:
+			void write(uint64_t bits, unsigned n);
+			void write_timestamp(int64_t timestamp);
+			void write_value(uint64_t value);
+
+			std::vector<uint8_t>& _out;
+			uint64_t _acc;
+			unsigned _bits;
+			size_t _count;
+
+			int64_t _prev_timestamp;
+			int64_t _prev_delta;
+			uint64_t _prev_value;
+			unsigned _prev_leading;
+			unsigned _prev_trailing;
+	};
+
+	class GorillaDecoder {
+		public:
+			GorillaDecoder(const uint8_t* data, size_t size);
+
+			// decodes up to n readings into the timestamps and values arrays. returns the number of readings
+			// decoded, which is less than n only at the end of the data or if the data is corrupt.
+			// decoding into separate arrays keeps the values ready for vectorized aggregation
+			size_t decode(int64_t* timestamps, double* values, size_t n);
+
+			bool next(int64_t& timestamp, double& value) { return decode(&timestamp, &value, 1) == 1; }
+
+		private:
+			bool read(unsigned n, uint64_t& bits);
+			bool read_bit(bool& bit);
+			bool read_timestamp(int64_t& timestamp);
+			bool read_value(uint64_t& value);
+
+			const uint8_t* _pos;
+			const uint8_t* _end;
+			uint64_t _acc;
+			unsigned _bits;
+			size_t _count;
+
+			int64_t _prev_timestamp;
+			int64_t _prev_delta;
+			uint64_t _prev_value;
+			unsigned _prev_leading;
+			unsigned _prev_trailing;
+	};
+
+}
+
+#endif
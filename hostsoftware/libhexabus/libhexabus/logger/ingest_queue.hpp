@@ -0,0 +1,141 @@
+#ifndef LIBHEXABUS_LOGGER_INGEST_QUEUE_HPP
+#define LIBHEXABUS_LOGGER_INGEST_QUEUE_HPP 1
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+
+namespace hexabus {
+
+	// Bounded multi-producer/single-consumer queue between the packet receive path and a storage writer
+	// thread. The consumer takes everything queued in one swap, so producers only ever contend for a short
+	// push_back. When the queue is full, push either drops the item (drop_newest) or waits for the consumer
+	// (block); dropped items are counted.
+	template<typename T>
+	class IngestQueue {
+		public:
+			enum Overflow {
+				drop_newest,
+				block,
+			};
+
+			struct Statistics {
+				uint64_t pushed;
+				uint64_t dropped;
+				uint64_t popped;
+				size_t high_watermark;
+			};
+
+			typedef std::chrono::steady_clock clock;
+
+			IngestQueue(size_t capacity, Overflow overflow)
+				: _capacity(capacity), _overflow(overflow), _closed(false), _wake_at(1),
+				  _pushed(0), _dropped(0), _popped(0), _high_watermark(0)
+			{
+				_items.reserve(capacity);
+			}
+
+			// returns false if the item was dropped or the queue is closed. force ignores the capacity limit,
+			// for the rare items that must not be lost
+			bool push(T item, bool force = false)
+			{
+				std::unique_lock<std::mutex> lock(_lock);
+
+				if (!force) {
+					if (_overflow == block) {
+						_not_full.wait(lock, [this] () { return _closed || _items.size() < _capacity; });
+					} else if (_items.size() >= _capacity) {
+						_dropped++;
+						return false;
+					}
+				}
+				if (_closed)
+					return false;
+
+				if (_items.empty())
+					_oldest = clock::now();
+				_items.push_back(std::move(item));
+				_pushed++;
+				if (_items.size() > _high_watermark)
+					_high_watermark = _items.size();
+
+				if (_items.size() == 1 || _items.size() == _wake_at)
+					_not_empty.notify_one();
+				return true;
+			}
+
+			// waits until at least min_batch items are queued, the oldest queued item has waited for max_delay,
+			// or the queue is closed, then moves all queued items into batch. returns false once the queue is
+			// closed and drained.
+			bool pop_batch(std::vector<T>& batch, size_t min_batch, std::chrono::milliseconds max_delay)
+			{
+				batch.clear();
+
+				std::unique_lock<std::mutex> lock(_lock);
+
+				_not_empty.wait(lock, [this] () { return _closed || !_items.empty(); });
+				_wake_at = min_batch;
+				_not_empty.wait_until(lock, _oldest + max_delay,
+					[this, min_batch] () { return _closed || _items.size() >= min_batch; });
+
+				if (_items.empty())
+					return false;
+
+				// batch is the buffer of the previous call, so neither side allocates in steady state
+				batch.swap(_items);
+				_popped += batch.size();
+				lock.unlock();
+
+				_not_full.notify_all();
+				return true;
+			}
+
+			// wakes all waiting producers and the consumer. items pushed afterwards are rejected, items already
+			// queued are still handed out by pop_batch
+			void close()
+			{
+				std::lock_guard<std::mutex> lock(_lock);
+				_closed = true;
+				_not_empty.notify_all();
+				_not_full.notify_all();
+			}
+
+			size_t size() const
+			{
+				std::lock_guard<std::mutex> lock(_lock);
+				return _items.size();
+			}
+
+			Statistics statistics() const
+			{
+				std::lock_guard<std::mutex> lock(_lock);
+				Statistics result = { _pushed, _dropped, _popped, _high_watermark };
+				return result;
+			}
+
+		private:
+			IngestQueue(const IngestQueue&);
+			IngestQueue& operator=(const IngestQueue&);
+
+			mutable std::mutex _lock;
+			std::condition_variable _not_empty;
+			std::condition_variable _not_full;
+
+			std::vector<T> _items;
+			clock::time_point _oldest;
+			size_t _capacity;
+			Overflow _overflow;
+			bool _closed;
+			size_t _wake_at;
+
+			uint64_t _pushed;
+			uint64_t _dropped;
+			uint64_t _popped;
+			size_t _high_watermark;
+	};
+
+}
+
+#endif
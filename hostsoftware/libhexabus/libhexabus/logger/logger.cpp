@@ -1,7 +1,8 @@
 #include "logger.hpp"
 
+#include <algorithm>
+
 #include "../../../shared/endpoints.h"
-#define DEBUG 0
 
 
 using namespace hexabus;
@@ -12,61 +13,63 @@ void Logger::operator()(const hexabus::Packet& packet, const boost::asio::ip::ud
 	visitPacket(packet);
 }
 
-const char* Logger::eid_to_unit(uint32_t eid)
+std::string Logger::eid_to_unit(uint32_t eid)
 {
+	std::shared_ptr<const hexabus::EndpointRegistry::Snapshot> eps = registry.snapshot();
 	hexabus::EndpointRegistry::const_iterator it;
 
-	it = registry.find(eid);
-	if (it == registry.end() || !it->second.unit()) {
+	it = eps->find(eid);
+	if (it == eps->end() || !it->second.unit()) {
 		return "unknown";
 	} else {
-		return it->second.unit()->c_str();
+		return *it->second.unit();
 	}
 }
 
-void Logger::on_sensor_name_received(const std::string& sensor_id, const boost::asio::ip::address_v6& address, const hexabus::Packet& ep_info)
+void Logger::on_sensor_name_received(const SensorKey& key, const hexabus::Packet& ep_info)
 {
-  double msecs1;
-  double msecs2;
-  double mdiff;
-      
-  struct timeval tv1;
-  struct timeval tv2;
-
-  gettimeofday(&tv1, NULL) ;
-  msecs1=(double)tv1.tv_sec + ((double)tv1.tv_usec/1000000);
+	new_sensor_t* entry = new_sensor_backlog.find(key);
+	if (!entry)
+		return;
 
 	klio::Sensor::Ptr sensor = sensor_factory.createSensor(
-			sensor_id,
+			entry->sensor_id,
 			static_cast<const hexabus::EndpointInfoPacket&>(ep_info).value(),
-			eid_to_unit(new_sensor_backlog[sensor_id].first),
+			eid_to_unit(key.eid()),
 			sensor_timezone);
 
-	new_sensor_found(sensor, address);
-	sensor_cache.insert(std::make_pair(sensor_id, sensor));
+	new_sensor_found(sensor, key.address());
+	resolve_backlog(key, sensor);
+}
 
-	new_sensor_t& backlog = new_sensor_backlog[sensor_id];
-	klio::readings_it_t it, end;
-	for (it = backlog.second.begin(), end = backlog.second.end(); it != end; ++it) {
-		record_reading(sensor, it->first, it->second);
-	}
+void Logger::resolve_backlog(const SensorKey& key, const klio::Sensor::Ptr& sensor)
+{
+	new_sensor_t backlog;
+	std::swap(backlog, *new_sensor_backlog.find(key));
+	new_sensor_backlog.erase(key);
+	backlog_readings -= backlog.readings.size();
 
-	new_sensor_backlog.erase(sensor_id);
+	sensor_state_t& state = cache_sensor(key, sensor);
 
-  gettimeofday(&tv2, NULL) ;
-  msecs2=(double)tv2.tv_sec + ((double)tv2.tv_usec/1000000);
-  mdiff = msecs2 - msecs1;
-  std::cout << "Time in on_sensor_name_received " << mdiff << std::endl;
+	klio::readings_it_t it, end;
+	for (it = backlog.readings.begin(), end = backlog.readings.end(); it != end; ++it) {
+		store_reading(state, it->first, it->second);
+	}
 }
 
-void Logger::on_sensor_error(const std::string& sensor_id, const hexabus::GenericException& err)
+void Logger::on_sensor_error(const SensorKey& key, const hexabus::GenericException& err)
 {
+	new_sensor_t* entry = new_sensor_backlog.find(key);
+	if (!entry)
+		return;
+
 	std::cerr
 		<< "Error getting device name: " << err.what() << ", "
-		<< "dropping " << new_sensor_backlog[sensor_id].second.size() 
-		<< " readings from " << sensor_id << std::endl;
+		<< "dropping " << entry->readings.size()
+		<< " readings from " << entry->sensor_id << std::endl;
 
-	new_sensor_backlog.erase(sensor_id);
+	backlog_readings -= entry->readings.size();
+	new_sensor_backlog.erase(key);
 }
 
 std::string Logger::get_sensor_id(const boost::asio::ip::address_v6& source, uint32_t eid)
@@ -78,67 +81,295 @@ std::string Logger::get_sensor_id(const boost::asio::ip::address_v6& source, uin
 
 void Logger::accept_packet(double value, uint32_t eid)
 {
-  double msecs1;
-  double msecs2;
-  double mdiff;
-      
-  struct timeval tv1;
-  struct timeval tv2;
-
-  gettimeofday(&tv1, NULL) ;
-  msecs1=(double)tv1.tv_sec + ((double)tv1.tv_usec/1000000);
-
 	/**
-	 * 1. Create unique ID for each info message and sensor,
-	 * <ip>-<endpoint>
+	 * 1. Look the sensor up by its binary (address, eid) key. The
+	 * <ip>-<endpoint> external ID is only needed for sensors that are
+	 * not cached yet.
 	 */
-	std::string sensor_id(get_sensor_id(source, eid));
+	SensorKey key(source, eid);
+	klio::timestamp_t now = current_time();
+
+	sensor_state_t* cached = sensor_cache.find(key);
+	if (cached) {
+		sensor_lru.splice(sensor_lru.end(), sensor_lru, cached->lru_pos);
+		store_reading(*cached, now, value);
+		return;
+	}
 
 	/**
-	 * 2. Ask for a sensor instance. If none is known for this
+	 * 2. Ask the store for a sensor instance. If none is known for this
 	 * sensor, create a new one.
 	 */
-
-	klio::Sensor::Ptr sensor;
-	klio::timestamp_t now = tc.get_timestamp();
-
-	if (sensor_cache.count(sensor_id)) {
-		sensor = sensor_cache[sensor_id];
-#if DEBUG
-    gettimeofday(&tv2, NULL) ;
-    msecs2=(double)tv2.tv_sec + ((double)tv2.tv_usec/1000000);
-    mdiff = msecs2 - msecs1;
-    std::cout << "Time in accept_packet (-cache 1)" << mdiff << std::endl;
-#endif // DEBUG
-	} else {
-		sensor = lookup_sensor(sensor_id);
-#if DEBUG
-    gettimeofday(&tv2, NULL) ;
-    msecs2=(double)tv2.tv_sec + ((double)tv2.tv_usec/1000000);
-    mdiff = msecs2 - msecs1;
-    std::cout << "Time in accept_packet (2)" << mdiff << std::endl;
-#endif // DEBUG
+	new_sensor_t* backlog = new_sensor_backlog.find(key);
+	if (backlog) {
+		if (backlog->readings.size() >= backlog_sensor_limit || backlog_readings >= backlog_total_limit) {
+			stats.backlog_dropped++;
+			return;
+		}
+		if (backlog->readings.insert(std::make_pair(now, value)).second)
+			backlog_readings++;
+		return;
 	}
 
+	std::string sensor_id(get_sensor_id(source, eid));
+	klio::Sensor::Ptr sensor = find_preloaded(sensor_id, source);
 	if (sensor) {
 		/**
 		 * 3. Use the sensor instance to save the value.
 		 */
-		record_reading(sensor, now, value);
+		store_reading(cache_sensor(key, sensor), now, value);
+		return;
+	}
+
+	// with the backlogs full, looking up yet another sensor would only produce more readings to drop
+	if (backlog_readings >= backlog_total_limit) {
+		stats.backlog_dropped++;
+		return;
+	}
+
+	backlog = &new_sensor_backlog[key];
+	backlog->sensor_id = sensor_id;
+	if (!backlog_sensor_limit)
+		stats.backlog_dropped++;
+	else if (backlog->readings.insert(std::make_pair(now, value)).second)
+		backlog_readings++;
+
+	// the sensor may still be found by a running preload
+	if (!preload_pending)
+		resolve_sensor(key);
+}
+
+void Logger::resolve_sensor(const SensorKey& key)
+{
+	new_sensor_t* backlog = new_sensor_backlog.find(key);
+
+	// sensors missing from a complete preload are new
+	if (preload_complete) {
+		backlog->stage = new_sensor_t::querying;
+		query_sensor_name(key);
+	} else {
+		backlog->stage = new_sensor_t::looking_up;
+		lookup_sensor(key, backlog->sensor_id);
+	}
+}
+
+void Logger::sensor_looked_up(const SensorKey& key, const klio::Sensor::Ptr& sensor)
+{
+	new_sensor_t* backlog = new_sensor_backlog.find(key);
+	if (!backlog || backlog->stage != new_sensor_t::looking_up)
+		return;
+
+	if (sensor) {
+		resolve_backlog(key, sensor);
+	} else {
+		backlog->stage = new_sensor_t::querying;
+		query_sensor_name(key);
+	}
+}
+
+klio::Sensor::Ptr Logger::find_preloaded(const std::string& sensor_id, const boost::asio::ip::address_v6& address)
+{
+	std::unordered_map<std::string, klio::Sensor::Ptr>::iterator it = preloaded_sensors.find(sensor_id);
+	if (it != preloaded_sensors.end()) {
+		klio::Sensor::Ptr sensor = it->second;
+		// from now on the sensor cache owns the sensor
+		preloaded_sensors.erase(it);
+		preloaded_sensor_found(sensor, address);
+		return sensor;
+	}
+
+	return klio::Sensor::Ptr();
+}
+
+void Logger::query_sensor_name(const SensorKey& key)
+{
+	interrogator.send_request(
+			key.address(),
+			hexabus::EndpointQueryPacket(EP_DEVICE_DESCRIPTOR),
+			hexabus::filtering::IsEndpointInfo(),
+			boost::bind(&Logger::on_sensor_name_received, this, key, _1),
+			boost::bind(&Logger::on_sensor_error, this, key, _1));
+}
+
+void Logger::preload_sensors(const std::vector<klio::Sensor::Ptr>& sensors)
+{
+	for (std::vector<klio::Sensor::Ptr>::const_iterator it = sensors.begin(), end = sensors.end(); it != end; ++it) {
+		preloaded_sensors[(*it)->external_id()] = *it;
+	}
+	preload_complete = true;
+	cancel_preload();
+}
+
+void Logger::cancel_preload()
+{
+	preload_pending = false;
+
+	// sensors that sent readings while the preload was running are either known now or really new
+	std::vector<SensorKey> waiting;
+	new_sensor_backlog.for_each([&waiting] (const SensorKey& key, const new_sensor_t& backlog) {
+		if (backlog.stage == new_sensor_t::waiting_for_preload)
+			waiting.push_back(key);
+	});
+
+	for (std::vector<SensorKey>::const_iterator it = waiting.begin(), end = waiting.end(); it != end; ++it) {
+		new_sensor_t* backlog = new_sensor_backlog.find(*it);
+		klio::Sensor::Ptr sensor = find_preloaded(backlog->sensor_id, it->address());
+
+		if (sensor) {
+			resolve_backlog(*it, sensor);
+		} else {
+			resolve_sensor(*it);
+		}
+	}
+}
+
+Logger::sensor_state_t& Logger::cache_sensor(const SensorKey& key, const klio::Sensor::Ptr& sensor)
+{
+	sensor_state_t* cached = sensor_cache.find(key);
+	if (cached) {
+		close_window(*cached);
+		sensor_lru.splice(sensor_lru.end(), sensor_lru, cached->lru_pos);
+	} else {
+		if (sensor_cache_capacity && sensor_cache.size() >= sensor_cache_capacity)
+			evict_sensor();
+
+		cached = &sensor_cache[key];
+		cached->lru_pos = sensor_lru.insert(sensor_lru.end(), key);
+	}
+
+	sensor_state_t& state = *cached;
+	state.sensor = sensor;
+	state.count = 0;
+
+	std::map<uint32_t, AggregationPolicy>::const_iterator by_eid = eid_aggregation.find(key.eid());
+	if (by_eid != eid_aggregation.end()) {
+		state.policy = by_eid->second;
 	} else {
-		if (!new_sensor_backlog.count(sensor_id)) {
-			new_sensor_backlog[sensor_id].first = eid;
-			interrogator.send_request(
-					source,
-					hexabus::EndpointQueryPacket(EP_DEVICE_DESCRIPTOR),
-					hexabus::filtering::IsEndpointInfo(),
-					boost::bind(&Logger::on_sensor_name_received, this, sensor_id, source, _1),
-					boost::bind(&Logger::on_sensor_error, this, sensor_id, _1));
+		std::map<std::string, AggregationPolicy>::const_iterator by_unit = unit_aggregation.find(sensor->unit());
+		state.policy = by_unit != unit_aggregation.end() ? by_unit->second : AggregationPolicy();
+	}
+
+	sensor_state_t* evicted = evicted_windows.find(key);
+	if (evicted) {
+		if (evicted->sensor->uuid() == sensor->uuid() && evicted->policy.window == state.policy.window
+				&& evicted->policy.function == state.policy.function) {
+			state.window_start = evicted->window_start;
+			state.count = evicted->count;
+			state.min = evicted->min;
+			state.max = evicted->max;
+			state.sum = evicted->sum;
+			state.last = evicted->last;
+		} else {
+			close_window(*evicted);
 		}
-		new_sensor_backlog[sensor_id].second.insert(std::make_pair(now, value));
+		evicted_windows.erase(key);
 	}
-  gettimeofday(&tv2, NULL) ;
-  msecs2=(double)tv2.tv_sec + ((double)tv2.tv_usec/1000000);
-  mdiff = msecs2 - msecs1;
-  std::cout << "Time in accept_packet " << mdiff << std::endl;
+
+	return state;
+}
+
+void Logger::evict_sensor()
+{
+	if (sensor_lru.empty())
+		return;
+
+	SensorKey key = sensor_lru.front();
+	sensor_lru.pop_front();
+
+	sensor_state_t* state = sensor_cache.find(key);
+	if (state) {
+		if (state->count)
+			evicted_windows[key] = *state;
+		if (preload_complete)
+			preloaded_sensors[state->sensor->external_id()] = state->sensor;
+	}
+	sensor_cache.erase(key);
+	stats.sensors_evicted++;
+}
+
+void Logger::setSensorCacheCapacity(size_t capacity)
+{
+	sensor_cache_capacity = capacity;
+	while (capacity && sensor_cache.size() > capacity)
+		evict_sensor();
+}
+
+void Logger::print_statistics(std::ostream& out) const
+{
+	out << "Sensors: " << sensor_cache.size() << " cached, "
+		<< stats.sensors_evicted << " evicted, "
+		<< new_sensor_backlog.size() << " waiting for their name with "
+		<< backlog_readings << " readings, "
+		<< stats.backlog_dropped << " readings dropped, "
+		<< preloaded_sensors.size() << " preloaded sensors not cached" << std::endl;
+}
+
+void Logger::store_reading(sensor_state_t& state, klio::timestamp_t ts, double value)
+{
+	uint32_t window = state.policy.window;
+
+	if (!window) {
+		record_reading(state.sensor, ts, value);
+		return;
+	}
+
+	if (state.count && ts >= state.window_start + window)
+		close_window(state);
+
+	if (!state.count) {
+		state.window_start = ts - ts % window;
+		state.min = state.max = state.sum = value;
+	} else {
+		state.min = std::min(state.min, value);
+		state.max = std::max(state.max, value);
+		state.sum += value;
+	}
+	state.last = value;
+	state.count++;
+}
+
+void Logger::close_window(sensor_state_t& state)
+{
+	if (!state.count)
+		return;
+
+	double value = 0;
+	switch (state.policy.function) {
+	case AggregationPolicy::mean: value = state.sum / state.count; break;
+	case AggregationPolicy::min: value = state.min; break;
+	case AggregationPolicy::max: value = state.max; break;
+	case AggregationPolicy::last: value = state.last; break;
+	}
+
+	state.count = 0;
+	record_reading(state.sensor, state.window_start, value);
+}
+
+void Logger::flush_windows(klio::timestamp_t now)
+{
+	sensor_cache.for_each([this, now] (const SensorKey&, sensor_state_t& state) {
+		if (state.count && now >= state.window_start + state.policy.window)
+			close_window(state);
+	});
+
+	std::vector<SensorKey> ended;
+	evicted_windows.for_each([this, now, &ended] (const SensorKey& key, sensor_state_t& state) {
+		if (now >= state.window_start + state.policy.window) {
+			close_window(state);
+			ended.push_back(key);
+		}
+	});
+	for (std::vector<SensorKey>::const_iterator it = ended.begin(), end = ended.end(); it != end; ++it)
+		evicted_windows.erase(*it);
+}
+
+void Logger::flush_windows()
+{
+	sensor_cache.for_each([this] (const SensorKey&, sensor_state_t& state) {
+		close_window(state);
+	});
+	evicted_windows.for_each([this] (const SensorKey&, sensor_state_t& state) {
+		close_window(state);
+	});
+	evicted_windows.clear();
 }
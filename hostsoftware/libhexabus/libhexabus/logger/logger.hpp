@@ -2,7 +2,11 @@
 #define LIBHEXALOG_LOGGER_HPP 1
 
 #include <string>
+#include <list>
 #include <map>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
 
 #include <libklio/sensor.hpp>
 #include <libklio/time.hpp>
@@ -10,9 +14,30 @@
 #include <libhexabus/socket.hpp>
 #include <libhexabus/endpoint_registry.hpp>
 #include <libhexabus/device_interrogator.hpp>
+#include <libhexabus/logger/sensor_map.hpp>
 
 namespace hexabus {
 
+// Readings of a sensor can be aggregated over tumbling windows of window seconds, aligned to multiples
+// of window. Only one value per window is recorded, stamped with the start of the window.
+struct AggregationPolicy {
+	enum Function {
+		mean,
+		min,
+		max,
+		last,
+	};
+
+	// 0 records every reading as it is received
+	uint32_t window;
+	Function function;
+
+	AggregationPolicy(uint32_t window = 0, Function function = mean)
+		: window(window), function(function)
+	{
+	}
+};
+
 class Logger : private PacketVisitor {
 	protected:
 		klio::TimeConverter& tc;
@@ -22,21 +47,87 @@ class Logger : private PacketVisitor {
 
 		hexabus::EndpointRegistry& registry;
 
-		typedef std::pair<uint32_t, klio::readings_t> new_sensor_t;
-		std::map<std::string, new_sensor_t> new_sensor_backlog;
-		std::map<std::string, klio::Sensor::Ptr> sensor_cache;
+		// readings of a sensor that is not cached, kept until the sensor is found in the store or, for new
+		// sensors, until the device name is known
+		struct new_sensor_t {
+			enum Stage {
+				waiting_for_preload,
+				looking_up,
+				querying,
+			};
+
+			std::string sensor_id;
+			klio::readings_t readings;
+			Stage stage;
+
+			new_sensor_t() : stage(waiting_for_preload) {}
+		};
+		SensorMap<new_sensor_t> new_sensor_backlog;
+		// readings in all backlogs
+		size_t backlog_readings;
+		size_t backlog_sensor_limit;
+		size_t backlog_total_limit;
+
+		struct sensor_state_t {
+			klio::Sensor::Ptr sensor;
+			AggregationPolicy policy;
+			// position in sensor_lru
+			std::list<SensorKey>::iterator lru_pos;
+
+			// the open window, if count > 0
+			klio::timestamp_t window_start;
+			uint32_t count;
+			double min, max, sum, last;
+
+			sensor_state_t() : count(0) {}
+		};
+		SensorMap<sensor_state_t> sensor_cache;
+		// keys of the cached sensors, least recently used first
+		std::list<SensorKey> sensor_lru;
+		size_t sensor_cache_capacity;
+		// open windows of sensors evicted from the cache. a sensor that comes back takes its window over, so
+		// that every window is recorded once. windows that ended are recorded by flush_windows
+		SensorMap<sensor_state_t> evicted_windows;
+
+		// sensors of the store that are not cached, by external id
+		std::unordered_map<std::string, klio::Sensor::Ptr> preloaded_sensors;
+		bool preload_pending;
+		// once all sensors of the store are known, sensors not found among them are new and evicted sensors
+		// go back to preloaded_sensors, so lookup_sensor is not needed anymore
+		bool preload_complete;
+
+		std::map<uint32_t, AggregationPolicy> eid_aggregation;
+		std::map<std::string, AggregationPolicy> unit_aggregation;
 
 		boost::asio::ip::address_v6 source;
 
-		virtual const char* eid_to_unit(uint32_t eid);
+		virtual std::string eid_to_unit(uint32_t eid);
+		// the external id of a sensor in the store. only called for sensors that are not cached yet
 		virtual std::string get_sensor_id(const boost::asio::ip::address_v6& source, uint32_t eid);
+		// the timestamp of a reading received now
+		virtual klio::timestamp_t current_time() { return tc.get_timestamp(); }
 
-		void on_sensor_name_received(const std::string& sensor_name, const boost::asio::ip::address_v6& address, const hexabus::Packet& ep_info);
+		void on_sensor_name_received(const SensorKey& key, const hexabus::Packet& ep_info);
 
-		void on_sensor_error(const std::string& sensor_name, const hexabus::GenericException& err);
+		void on_sensor_error(const SensorKey& key, const hexabus::GenericException& err);
 
 		void accept_packet(double value, uint32_t eid);
 
+		// the preloaded sensor with this external id, if any
+		klio::Sensor::Ptr find_preloaded(const std::string& sensor_id, const boost::asio::ip::address_v6& address);
+		// finds the sensor of a backlog that is not preloaded, through lookup_sensor or by querying its device name
+		void resolve_sensor(const SensorKey& key);
+		void query_sensor_name(const SensorKey& key);
+		// removes the backlog of key and records its readings for sensor
+		void resolve_backlog(const SensorKey& key, const klio::Sensor::Ptr& sensor);
+
+		sensor_state_t& cache_sensor(const SensorKey& key, const klio::Sensor::Ptr& sensor);
+		// drops the least recently used sensor from the cache, keeping its open window in evicted_windows
+		void evict_sensor();
+		// records the reading, or adds it to the open window of the sensor
+		void store_reading(sensor_state_t& state, klio::timestamp_t ts, double value);
+		void close_window(sensor_state_t& state);
+
 		virtual void visit(const hexabus::InfoPacket<bool>& info) { accept_packet(info.value(), info.eid()); }
 		virtual void visit(const hexabus::InfoPacket<uint8_t>& info) { accept_packet(info.value(), info.eid()); }
 		virtual void visit(const hexabus::InfoPacket<uint16_t>& info) { accept_packet(info.value(), info.eid()); }
@@ -75,7 +166,26 @@ class Logger : private PacketVisitor {
 	protected:
 		virtual void record_reading(klio::Sensor::Ptr sensor, klio::timestamp_t ts, double value) = 0;
 		virtual void new_sensor_found(klio::Sensor::Ptr sensor, const boost::asio::ip::address_v6& address) = 0;
-		virtual klio::Sensor::Ptr lookup_sensor(const std::string& name) = 0;
+		// looks the sensor up in the store, which may take a while, so it may be done on another thread. the result
+		// must be passed to sensor_looked_up on the thread that handles packets, possibly before lookup_sensor returns
+		virtual void lookup_sensor(const SensorKey& key, const std::string& sensor_id) = 0;
+		// the sensor found by lookup_sensor, or an empty pointer if it is not in the store
+		void sensor_looked_up(const SensorKey& key, const klio::Sensor::Ptr& sensor);
+		// called instead of lookup_sensor when a preloaded sensor receives its first reading
+		virtual void preloaded_sensor_found(klio::Sensor::Ptr sensor, const boost::asio::ip::address_v6& address) {}
+
+	public:
+		struct Statistics {
+			// sensors dropped from the cache to make room for others
+			uint64_t sensors_evicted;
+			// readings of unknown sensors dropped because a backlog was full
+			uint64_t backlog_dropped;
+
+			Statistics() : sensors_evicted(0), backlog_dropped(0) {}
+		};
+
+	protected:
+		Statistics stats;
 
 	public:
 		Logger(klio::TimeConverter& tc,
@@ -83,7 +193,9 @@ class Logger : private PacketVisitor {
 			const std::string& sensor_timezone,
 			hexabus::DeviceInterrogator& interrogator,
 			hexabus::EndpointRegistry& registry)
-			: tc(tc), sensor_factory(sensor_factory), sensor_timezone(sensor_timezone), interrogator(interrogator), registry(registry)
+			: tc(tc), sensor_factory(sensor_factory), sensor_timezone(sensor_timezone), interrogator(interrogator), registry(registry),
+			  backlog_readings(0), backlog_sensor_limit(1000), backlog_total_limit(100000), sensor_cache_capacity(4096),
+			  preload_pending(false), preload_complete(false)
 		{
 		}
 
@@ -92,6 +204,39 @@ class Logger : private PacketVisitor {
 		}
 
 		void operator()(const hexabus::Packet& packet, const boost::asio::ip::udp::endpoint& from);
+
+		// aggregation by eid takes precedence over aggregation by the unit of the sensor. changes apply to
+		// sensors seen afterwards
+		void setAggregation(uint32_t eid, const AggregationPolicy& policy) { eid_aggregation[eid] = policy; }
+		void setAggregation(const std::string& unit, const AggregationPolicy& policy) { unit_aggregation[unit] = policy; }
+
+		// maximum number of sensors kept in the cache, 0 for no limit. evicted sensors are looked up again
+		// when their next reading arrives
+		void setSensorCacheCapacity(size_t capacity);
+		// maximum number of readings kept for a sensor whose device name is being queried, and for all of
+		// them together. further readings are dropped, and no queries are sent while the total limit is reached
+		void setBacklogLimits(size_t per_sensor, size_t total)
+		{
+			backlog_sensor_limit = per_sensor;
+			backlog_total_limit = total;
+		}
+
+		// makes the sensors of the store known without calling lookup_sensor for each of them. sensors must
+		// be all sensors in the store, loaded with a single query at startup
+		void preload_sensors(const std::vector<klio::Sensor::Ptr>& sensors);
+		// for preloads running on another thread: until preload_sensors or cancel_preload is called, readings
+		// of sensors that are not cached are kept in the backlog instead of looking the sensors up one by one
+		void begin_preload() { preload_pending = true; }
+		// continues with lookup_sensor, e.g. after the preload failed
+		void cancel_preload();
+
+		const Statistics& statistics() const { return stats; }
+		void print_statistics(std::ostream& out) const;
+
+		// records all windows that ended at or before now, e.g. of sensors that stopped sending
+		void flush_windows(klio::timestamp_t now);
+		// records all open windows, e.g. before shutting down
+		void flush_windows();
 };
 
 }
@@ -0,0 +1,512 @@
+#include "segment_log.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/crc.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/scope_exit.hpp>
+
+#include "../error.hpp"
+#include "gorilla.hpp"
+
+using namespace hexabus;
+
+namespace {
+
+// All integers are stored in host byte order, segments are not meant to be moved between hosts.
+struct SegmentHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t record_size;
+	uint32_t reserved;
+	uint64_t sequence;
+	uint64_t reserved2[4];
+};
+
+const char segment_magic[8] = { 'H', 'X', 'B', 'S', 'E', 'G', 'L', 0 };
+// active segments hold records, sealed segments the series of every sensor in the segment
+const uint32_t segment_version = 1;
+const uint32_t sealed_version = 2;
+const uint32_t segment_byte_order = 0x01020304;
+
+const char* active_extension = ".log";
+const char* sealed_extension = ".seg";
+const char* temp_extension = ".tmp";
+
+// A sealed segment is a SegmentHeader followed by one series per sensor: this header and the GorillaEncoder
+// encoding of the readings of the sensor, in the order they were appended.
+struct SeriesHeader {
+	uint32_t sensor;
+	uint32_t count;
+	uint32_t bytes;
+	// of the other fields and the encoded readings
+	uint32_t crc;
+};
+
+}
+
+static_assert(sizeof(SegmentHeader) == 64, "segment header must be 64 bytes");
+static_assert(sizeof(SegmentLog::Record) == 24, "segment records must be 24 bytes");
+static_assert(sizeof(SeriesHeader) == 16, "series headers must be 16 bytes");
+
+static void throw_errno(const std::string& what, const boost::filesystem::path& path)
+{
+	std::ostringstream oss;
+	oss << what << " " << path.string() << ": " << strerror(errno);
+	throw GenericException(oss.str());
+}
+
+static bool parse_sequence(const boost::filesystem::path& path, uint64_t& sequence)
+{
+	std::string stem = path.stem().string();
+	if (stem.size() != 16 || stem.find_first_not_of("0123456789abcdef") != std::string::npos)
+		return false;
+
+	sequence = strtoull(stem.c_str(), NULL, 16);
+	return true;
+}
+
+static boost::filesystem::path segment_path(const boost::filesystem::path& directory, uint64_t sequence, const char* extension)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx%s", (unsigned long long) sequence, extension);
+	return directory / name;
+}
+
+static void sync_directory(const boost::filesystem::path& directory)
+{
+	int fd = open(directory.c_str(), O_RDONLY);
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+}
+
+static uint32_t series_crc(const SeriesHeader& header, const uint8_t* data)
+{
+	boost::crc_32_type crc;
+	crc.process_bytes(&header.sensor, sizeof(header.sensor));
+	crc.process_bytes(&header.count, sizeof(header.count));
+	crc.process_bytes(&header.bytes, sizeof(header.bytes));
+	crc.process_bytes(data, header.bytes);
+	return crc.checksum();
+}
+
+// writes the sealed form of the records of the active segment at path and removes it. the sealed segment
+// is written to a temporary file first, so a crash leaves either the active or the sealed segment
+static void seal_segment(const boost::filesystem::path& path, uint64_t sequence,
+		const SegmentLog::Record* records, size_t count)
+{
+	SegmentHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, segment_magic, sizeof(segment_magic));
+	header.version = sealed_version;
+	header.byte_order = segment_byte_order;
+	header.record_size = sizeof(SegmentLog::Record);
+	header.sequence = sequence;
+
+	std::vector<uint8_t> data(reinterpret_cast<const uint8_t*>(&header), reinterpret_cast<const uint8_t*>(&header + 1));
+
+	// readings of a sensor arrive at a near constant interval and change slowly, which the encoding
+	// only exploits if they are not interleaved with those of other sensors
+	std::vector<uint32_t> order(count);
+	for (size_t i = 0; i < count; i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [records] (uint32_t a, uint32_t b) {
+		return records[a].sensor < records[b].sensor;
+	});
+
+	for (size_t begin = 0, end; begin < count; begin = end) {
+		size_t offset = data.size();
+		data.resize(offset + sizeof(SeriesHeader));
+
+		GorillaEncoder encoder(data);
+		uint32_t sensor = records[order[begin]].sensor;
+		for (end = begin; end < count && records[order[end]].sensor == sensor; end++)
+			encoder.append(records[order[end]].timestamp, records[order[end]].value);
+		encoder.finish();
+
+		SeriesHeader series;
+		series.sensor = sensor;
+		series.count = end - begin;
+		series.bytes = data.size() - offset - sizeof(SeriesHeader);
+		series.crc = series_crc(series, &data[offset + sizeof(SeriesHeader)]);
+		memcpy(&data[offset], &series, sizeof(series));
+	}
+
+	boost::filesystem::path temp = path;
+	temp.replace_extension(temp_extension);
+
+	int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		throw_errno("Could not create", temp);
+
+	const uint8_t* pos = &data[0];
+	size_t left = data.size();
+	while (left) {
+		ssize_t written = write(fd, pos, left);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			break;
+		pos += written;
+		left -= written;
+	}
+	if (left || fsync(fd) < 0) {
+		int saved = errno;
+		close(fd);
+		unlink(temp.c_str());
+		errno = saved;
+		throw_errno("Could not write", temp);
+	}
+	close(fd);
+
+	boost::filesystem::path sealed = path;
+	sealed.replace_extension(sealed_extension);
+	boost::filesystem::rename(temp, sealed);
+	boost::filesystem::remove(path);
+}
+
+uint32_t SegmentLog::record_crc(const Record& r)
+{
+	boost::crc_32_type crc;
+	crc.process_bytes(&r.timestamp, sizeof(r.timestamp));
+	crc.process_bytes(&r.sensor, sizeof(r.sensor));
+	crc.process_bytes(&r.value, sizeof(r.value));
+	return crc.checksum();
+}
+
+SegmentLog::SegmentLog(const boost::filesystem::path& directory, size_t segment_records)
+	: _directory(directory), _capacity(segment_records), _sensors_fd(-1), _next_sequence(0),
+	  _fd(-1), _map(NULL), _map_size(0), _records(NULL), _count(0), _synced(0)
+{
+	if (!_capacity)
+		throw GenericException("Segments must hold at least one record");
+
+	boost::system::error_code err;
+	boost::filesystem::create_directories(_directory, err);
+	if (err)
+		throw GenericException("Could not create segment directory " + _directory.string() + ": " + err.message());
+
+	load_sensors();
+	recover();
+}
+
+SegmentLog::~SegmentLog()
+{
+	try {
+		seal();
+	} catch (const GenericException&) {
+	}
+
+	if (_sensors_fd >= 0)
+		close(_sensors_fd);
+}
+
+// {{{ Sensors
+
+void SegmentLog::load_sensors()
+{
+	boost::filesystem::path path = _directory / "sensors";
+
+	_sensors_fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (_sensors_fd < 0)
+		throw_errno("Could not open", path);
+
+	std::string contents;
+	char buf[4096];
+	ssize_t len;
+	while ((len = read(_sensors_fd, buf, sizeof(buf))) > 0)
+		contents.append(buf, len);
+	if (len < 0)
+		throw_errno("Could not read", path);
+
+	// one external id per line. a line without its newline was not completely written and is discarded
+	size_t pos = 0, end;
+	while ((end = contents.find('\n', pos)) != std::string::npos) {
+		std::string name = contents.substr(pos, end - pos);
+		_sensor_indices.insert(std::make_pair(name, uint32_t(_sensor_names.size())));
+		_sensor_names.push_back(name);
+		pos = end + 1;
+	}
+	if (pos != contents.size() && ftruncate(_sensors_fd, pos) < 0)
+		throw_errno("Could not truncate", path);
+}
+
+uint32_t SegmentLog::sensor_index(const std::string& external_id)
+{
+	std::lock_guard<std::mutex> lock(_sensors_lock);
+
+	std::map<std::string, uint32_t>::const_iterator it = _sensor_indices.find(external_id);
+	if (it != _sensor_indices.end())
+		return it->second;
+
+	if (external_id.find('\n') != std::string::npos)
+		throw GenericException("Invalid sensor id " + external_id);
+
+	// the sensor must be on disk before the first record referring to it can be
+	std::string line = external_id + "\n";
+	if (write(_sensors_fd, line.c_str(), line.size()) != ssize_t(line.size()) || fdatasync(_sensors_fd) < 0)
+		throw_errno("Could not write", _directory / "sensors");
+
+	uint32_t index = _sensor_names.size();
+	_sensor_indices.insert(std::make_pair(external_id, index));
+	_sensor_names.push_back(external_id);
+	return index;
+}
+
+std::string SegmentLog::sensor_name(uint32_t index) const
+{
+	std::lock_guard<std::mutex> lock(_sensors_lock);
+
+	if (index >= _sensor_names.size())
+		return std::string();
+	return _sensor_names[index];
+}
+
+// }}}
+
+// {{{ Segments
+
+void SegmentLog::recover()
+{
+	std::vector<boost::filesystem::path> active;
+
+	for (boost::filesystem::directory_iterator it(_directory), end; it != end; ++it) {
+		uint64_t sequence;
+		if (!parse_sequence(it->path(), sequence))
+			continue;
+
+		if (it->path().extension() == active_extension) {
+			active.push_back(it->path());
+		} else if (it->path().extension() == temp_extension) {
+			// a segment that was being sealed, its active segment is still there
+			boost::filesystem::remove(it->path());
+			continue;
+		} else if (it->path().extension() != sealed_extension) {
+			continue;
+		}
+		_next_sequence = std::max(_next_sequence, sequence + 1);
+	}
+
+	// keep the valid prefix of segments that were active when we crashed
+	std::vector<Record> records;
+	for (std::vector<boost::filesystem::path>::const_iterator it = active.begin(), end = active.end(); it != end; ++it) {
+		records.clear();
+
+		size_t count;
+		try {
+			count = read_segment(*it, records);
+		} catch (const GenericException&) {
+			count = 0;
+		}
+
+		if (!count) {
+			boost::filesystem::remove(*it);
+			continue;
+		}
+
+		uint64_t sequence;
+		parse_sequence(*it, sequence);
+		seal_segment(*it, sequence, &records[0], count);
+	}
+	sync_directory(_directory);
+}
+
+void SegmentLog::open_segment()
+{
+	_segment_path = segment_path(_directory, _next_sequence, active_extension);
+	_map_size = sizeof(SegmentHeader) + _capacity * sizeof(Record);
+
+	_fd = open(_segment_path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (_fd < 0)
+		throw_errno("Could not create", _segment_path);
+
+	// allocate all blocks up front, a full disk would otherwise only show as SIGBUS on a later append
+	int err = posix_fallocate(_fd, 0, _map_size);
+	if (err == 0) {
+		_map = mmap(NULL, _map_size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	}
+	if (err != 0 || _map == MAP_FAILED) {
+		if (err)
+			errno = err;
+		int saved = errno;
+		close(_fd);
+		unlink(_segment_path.c_str());
+		_fd = -1;
+		_map = NULL;
+		errno = saved;
+		throw_errno("Could not map", _segment_path);
+	}
+
+	SegmentHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, segment_magic, sizeof(segment_magic));
+	header.version = segment_version;
+	header.byte_order = segment_byte_order;
+	header.record_size = sizeof(Record);
+	header.sequence = _next_sequence;
+	memcpy(_map, &header, sizeof(header));
+
+	// records synced to the segment are lost with it if its directory entry is not on disk
+	sync_directory(_directory);
+
+	_records = reinterpret_cast<Record*>(static_cast<char*>(_map) + sizeof(SegmentHeader));
+	_count = 0;
+	_synced = 0;
+	_next_sequence++;
+}
+
+void SegmentLog::sync()
+{
+	if (!_records || _synced == _count)
+		return;
+
+	// msync wants a page aligned start address
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t begin = (sizeof(SegmentHeader) + _synced * sizeof(Record)) / page * page;
+	size_t end = sizeof(SegmentHeader) + _count * sizeof(Record);
+
+	if (msync(static_cast<char*>(_map) + begin, end - begin, MS_SYNC) < 0)
+		throw_errno("Could not sync", _segment_path);
+	_synced = _count;
+}
+
+void SegmentLog::seal()
+{
+	if (!_records)
+		return;
+
+	// the records stay in the active segment until the sealed segment is complete
+	sync();
+	BOOST_SCOPE_EXIT((this_)) {
+		munmap(this_->_map, this_->_map_size);
+		close(this_->_fd);
+		this_->_map = NULL;
+		this_->_records = NULL;
+		this_->_fd = -1;
+	} BOOST_SCOPE_EXIT_END
+
+	if (_count) {
+		SegmentHeader header;
+		memcpy(&header, _map, sizeof(header));
+		seal_segment(_segment_path, header.sequence, _records, _count);
+	} else {
+		boost::filesystem::remove(_segment_path);
+	}
+	sync_directory(_directory);
+}
+
+std::vector<boost::filesystem::path> SegmentLog::sealed_segments() const
+{
+	std::vector<boost::filesystem::path> result;
+	uint64_t sequence;
+
+	for (boost::filesystem::directory_iterator it(_directory), end; it != end; ++it) {
+		if (it->path().extension() == sealed_extension && parse_sequence(it->path(), sequence))
+			result.push_back(it->path());
+	}
+
+	// names are fixed width, so they sort by sequence
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+size_t SegmentLog::read_segment(const boost::filesystem::path& path, std::vector<Record>& records)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw_errno("Could not open", path);
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(SegmentHeader)) {
+		close(fd);
+		throw GenericException("Invalid segment " + path.string());
+	}
+
+	size_t size = st.st_size;
+	void* map = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		throw_errno("Could not map", path);
+
+	BOOST_SCOPE_EXIT((map)(size)) {
+		munmap(map, size);
+	} BOOST_SCOPE_EXIT_END
+
+	const char* data = static_cast<const char*>(map);
+	SegmentHeader header;
+	memcpy(&header, data, sizeof(header));
+
+	if (memcmp(header.magic, segment_magic, sizeof(segment_magic)) != 0
+			|| (header.version != segment_version && header.version != sealed_version)
+			|| header.byte_order != segment_byte_order
+			|| header.record_size != sizeof(Record))
+		throw GenericException("Invalid segment " + path.string());
+
+	madvise(map, size, MADV_SEQUENTIAL);
+
+	if (header.version == sealed_version)
+		return read_series(data + sizeof(SegmentHeader), size - sizeof(SegmentHeader), records);
+
+	const Record* begin = reinterpret_cast<const Record*>(data + sizeof(SegmentHeader));
+	const Record* end = begin + (size - sizeof(SegmentHeader)) / sizeof(Record);
+	const Record* r;
+	for (r = begin; r != end && r->crc == record_crc(*r); ++r)
+		;
+
+	records.insert(records.end(), begin, r);
+	return r - begin;
+}
+
+// the valid series of a sealed segment, up to the first corrupt one
+size_t SegmentLog::read_series(const char* data, size_t size, std::vector<Record>& records)
+{
+	size_t total = 0;
+	std::vector<int64_t> timestamps;
+	std::vector<double> values;
+
+	while (size >= sizeof(SeriesHeader)) {
+		SeriesHeader series;
+		memcpy(&series, data, sizeof(series));
+		data += sizeof(series);
+		size -= sizeof(series);
+
+		const uint8_t* encoded = reinterpret_cast<const uint8_t*>(data);
+		if (series.bytes > size || series.crc != series_crc(series, encoded))
+			break;
+
+		timestamps.resize(series.count);
+		values.resize(series.count);
+		GorillaDecoder decoder(encoded, series.bytes);
+		if (decoder.decode(timestamps.data(), values.data(), series.count) != series.count)
+			break;
+
+		for (size_t i = 0; i < series.count; i++) {
+			Record r;
+			r.timestamp = timestamps[i];
+			r.sensor = series.sensor;
+			r.value = values[i];
+			r.crc = record_crc(r);
+			records.push_back(r);
+		}
+
+		total += series.count;
+		data += series.bytes;
+		size -= series.bytes;
+	}
+
+	return total;
+}
+
+// }}}
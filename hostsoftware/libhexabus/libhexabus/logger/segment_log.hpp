@@ -0,0 +1,102 @@
+#ifndef LIBHEXABUS_LOGGER_SEGMENT_LOG_HPP
+#define LIBHEXABUS_LOGGER_SEGMENT_LOG_HPP 1
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/filesystem/path.hpp>
+
+namespace hexabus {
+
+	// Append-only log of readings in a directory of segment files. Each segment is a preallocated, mmap'd
+	// file of fixed-size records that carry their own CRC, so appending is a memcpy and recovery after a
+	// crash keeps every record up to the first torn or missing one. Sensors are stored once, in the
+	// "sensors" file of the directory, and referenced by index.
+	//
+	// The active segment is named <sequence>.log. Full segments are sealed: their records are grouped by
+	// sensor, compressed with GorillaEncoder and written to <sequence>.seg, ready to be loaded into a store
+	// and removed. Opening a log seals segments left active by a crash.
+	//
+	// append, sync and seal must be called from a single thread. sensor_name and sealed_segments may be
+	// called from any thread.
+	class SegmentLog {
+		public:
+			struct Record {
+				int64_t timestamp;
+				uint32_t sensor;
+				uint32_t crc;
+				double value;
+			};
+
+			SegmentLog(const boost::filesystem::path& directory, size_t segment_records = 1 << 20);
+			// seals the active segment
+			~SegmentLog();
+
+			// index of the sensor, which is added to the sensors file if it is new
+			uint32_t sensor_index(const std::string& external_id);
+			std::string sensor_name(uint32_t index) const;
+
+			void append(uint32_t sensor, int64_t timestamp, double value)
+			{
+				if (!_records)
+					open_segment();
+
+				Record& r = _records[_count++];
+				r.timestamp = timestamp;
+				r.sensor = sensor;
+				r.value = value;
+				r.crc = record_crc(r);
+
+				if (_count == _capacity)
+					seal();
+			}
+
+			// writes records appended since the last sync to disk
+			void sync();
+			void seal();
+
+			// sealed segments, oldest first
+			std::vector<boost::filesystem::path> sealed_segments() const;
+
+			// appends all valid records of a segment to records and returns their number. records of a sealed
+			// segment are ordered by sensor. throws a GenericException if path is not a segment
+			static size_t read_segment(const boost::filesystem::path& path, std::vector<Record>& records);
+
+			static uint32_t record_crc(const Record& r);
+
+			const boost::filesystem::path& directory() const { return _directory; }
+
+		private:
+			SegmentLog(const SegmentLog&);
+			SegmentLog& operator=(const SegmentLog&);
+
+			void load_sensors();
+			void recover();
+			void open_segment();
+
+			static size_t read_series(const char* data, size_t size, std::vector<Record>& records);
+
+			boost::filesystem::path _directory;
+			size_t _capacity;
+
+			mutable std::mutex _sensors_lock;
+			std::vector<std::string> _sensor_names;
+			std::map<std::string, uint32_t> _sensor_indices;
+			int _sensors_fd;
+
+			uint64_t _next_sequence;
+			boost::filesystem::path _segment_path;
+			int _fd;
+			void* _map;
+			size_t _map_size;
+			Record* _records;
+			size_t _count;
+			size_t _synced;
+	};
+
+}
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef LIBHEXABUS_LOGGER_SENSOR_MAP_HPP
+#define LIBHEXABUS_LOGGER_SENSOR_MAP_HPP 1
+
+#include <string.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/ip/address_v6.hpp>
+
+namespace hexabus {
+
+	// A sensor is identified by the address of its device and its eid. Packed into 20 bytes, the key can be
+	// built from every received packet without formatting or allocating anything.
+	struct SensorKey {
+		uint8_t bytes[20];
+
+		SensorKey()
+		{
+			memset(bytes, 0, sizeof(bytes));
+		}
+
+		SensorKey(const boost::asio::ip::address_v6& address, uint32_t eid)
+		{
+			boost::asio::ip::address_v6::bytes_type addr = address.to_bytes();
+			memcpy(bytes, addr.data(), 16);
+			memcpy(bytes + 16, &eid, 4);
+		}
+
+		boost::asio::ip::address_v6 address() const
+		{
+			boost::asio::ip::address_v6::bytes_type addr;
+			memcpy(addr.data(), bytes, 16);
+			return boost::asio::ip::address_v6(addr);
+		}
+
+		uint32_t eid() const
+		{
+			uint32_t result;
+			memcpy(&result, bytes + 16, 4);
+			return result;
+		}
+
+		size_t hash() const
+		{
+			uint64_t a, b;
+			uint32_t c;
+			memcpy(&a, bytes, 8);
+			memcpy(&b, bytes + 8, 8);
+			memcpy(&c, bytes + 16, 4);
+
+			// the interface identifier in b and the eid carry almost all of the entropy
+			uint64_t h = (a ^ (b * 0x9E3779B97F4A7C15ULL) ^ c) * 0xFF51AFD7ED558CCDULL;
+			return h ^ (h >> 32);
+		}
+
+		bool operator==(const SensorKey& other) const { return memcmp(bytes, other.bytes, sizeof(bytes)) == 0; }
+		bool operator!=(const SensorKey& other) const { return !(*this == other); }
+	};
+
+	// Open addressing hash map from SensorKey to Value with linear probing. Entries live in one flat array
+	// that is kept at most half full, so a lookup is a hash and usually a single key compare.
+	// Pointers returned by find and operator[] are invalidated by insertions and erasures.
+	template<typename Value>
+	class SensorMap {
+		public:
+			SensorMap(size_t capacity = 64)
+				: _size(0)
+			{
+				size_t slots = 16;
+				while (slots < 2 * capacity)
+					slots *= 2;
+				_slots.resize(slots);
+			}
+
+			size_t size() const { return _size; }
+			bool empty() const { return _size == 0; }
+
+			Value* find(const SensorKey& key)
+			{
+				size_t i = locate(key);
+				return _slots[i].used ? &_slots[i].value : NULL;
+			}
+
+			const Value* find(const SensorKey& key) const
+			{
+				size_t i = locate(key);
+				return _slots[i].used ? &_slots[i].value : NULL;
+			}
+
+			bool contains(const SensorKey& key) const { return find(key) != NULL; }
+
+			// inserts a default constructed value if key is not present yet
+			Value& operator[](const SensorKey& key)
+			{
+				size_t i = locate(key);
+				if (_slots[i].used)
+					return _slots[i].value;
+
+				if (2 * (_size + 1) > _slots.size()) {
+					grow();
+					i = locate(key);
+				}
+
+				_slots[i].used = true;
+				_slots[i].key = key;
+				_size++;
+				return _slots[i].value;
+			}
+
+			bool erase(const SensorKey& key)
+			{
+				size_t mask = _slots.size() - 1;
+				size_t hole = locate(key);
+				if (!_slots[hole].used)
+					return false;
+
+				// backward shift deletion: move later entries of the probe sequence into the hole until an
+				// entry is already at its home slot, so lookups never need tombstones
+				for (size_t i = (hole + 1) & mask; _slots[i].used; i = (i + 1) & mask) {
+					size_t home = _slots[i].key.hash() & mask;
+					if (((i - home) & mask) >= ((i - hole) & mask)) {
+						_slots[hole].key = _slots[i].key;
+						_slots[hole].value = std::move(_slots[i].value);
+						hole = i;
+					}
+				}
+
+				_slots[hole].used = false;
+				_slots[hole].value = Value();
+				_size--;
+				return true;
+			}
+
+			void clear()
+			{
+				for (typename std::vector<Slot>::iterator it = _slots.begin(), end = _slots.end(); it != end; ++it) {
+					it->used = false;
+					it->value = Value();
+				}
+				_size = 0;
+			}
+
+			// calls fn(key, value) for every entry, in no particular order
+			template<typename Fn>
+			void for_each(Fn fn) const
+			{
+				for (typename std::vector<Slot>::const_iterator it = _slots.begin(), end = _slots.end(); it != end; ++it) {
+					if (it->used)
+						fn(it->key, it->value);
+				}
+			}
+
+			// fn must not insert or erase entries
+			template<typename Fn>
+			void for_each(Fn fn)
+			{
+				for (typename std::vector<Slot>::iterator it = _slots.begin(), end = _slots.end(); it != end; ++it) {
+					if (it->used)
+						fn(it->key, it->value);
+				}
+			}
+
+		private:
+			struct Slot {
+				SensorKey key;
+				Value value;
+				bool used;
+
+				Slot() : used(false) {}
+			};
+
+			std::vector<Slot> _slots;
+			size_t _size;
+
+			// the slot holding key, or the empty slot ending its probe sequence
+			size_t locate(const SensorKey& key) const
+			{
+				size_t mask = _slots.size() - 1;
+				size_t i = key.hash() & mask;
+				while (_slots[i].used && _slots[i].key != key)
+					i = (i + 1) & mask;
+				return i;
+			}
+
+			void grow()
+			{
+				std::vector<Slot> old(_slots.size() * 2);
+				old.swap(_slots);
+
+				for (typename std::vector<Slot>::iterator it = old.begin(), end = old.end(); it != end; ++it) {
+					if (!it->used)
+						continue;
+
+					Slot& slot = _slots[locate(it->key)];
+					slot.used = true;
+					slot.key = it->key;
+					slot.value = std::move(it->value);
+				}
+			}
+	};
+
+}
+
+#endif
@@ -0,0 +1,231 @@
+#include "msgpack.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "error.hpp"
+
+using namespace hexabus;
+
+MsgPackWriter::MsgPackWriter()
+	: _depth(0)
+{
+	_buffer.reserve(256);
+}
+
+void MsgPackWriter::clear()
+{
+	_buffer.clear();
+	_depth = 0;
+}
+
+template<typename T>
+void MsgPackWriter::putBE(uint8_t tag, T value)
+{
+	char bytes[1 + sizeof(T)];
+	bytes[0] = char(tag);
+	for (size_t i = 0; i < sizeof(T); i++)
+		bytes[sizeof(T) - i] = char(uint64_t(value) >> (8 * i));
+	_buffer.append(bytes, sizeof(bytes));
+}
+
+void MsgPackWriter::beginValue()
+{
+	if (_depth == 0) {
+		if (!_buffer.empty())
+			throw GenericException("MessagePack document already complete");
+		return;
+	}
+
+	// values in maps were counted by their key
+	if (!_open[_depth - 1].map)
+		_open[_depth - 1].count++;
+}
+
+void MsgPackWriter::open(bool map)
+{
+	if (_depth == 64)
+		throw GenericException("MessagePack nesting too deep");
+
+	beginValue();
+	Container c = { uint32_t(_buffer.size()), 0, map };
+	_open[_depth++] = c;
+	put(0);
+}
+
+void MsgPackWriter::close(bool map)
+{
+	if (_depth == 0 || _open[_depth - 1].map != map)
+		throw GenericException("unbalanced MessagePack document");
+
+	const Container& c = _open[--_depth];
+	if (c.count < 16) {
+		_buffer[c.header] = char((map ? 0x80 : 0x90) | c.count);
+		return;
+	}
+
+	// widen the header, rare enough for the copy not to matter
+	char wide[5];
+	size_t len;
+	if (c.count <= 0xFFFF) {
+		wide[0] = char(map ? 0xDE : 0xDC);
+		wide[1] = char(c.count >> 8);
+		wide[2] = char(c.count);
+		len = 3;
+	} else {
+		wide[0] = char(map ? 0xDF : 0xDD);
+		wide[1] = char(c.count >> 24);
+		wide[2] = char(c.count >> 16);
+		wide[3] = char(c.count >> 8);
+		wide[4] = char(c.count);
+		len = 5;
+	}
+	_buffer.replace(c.header, 1, wide, len);
+}
+
+MsgPackWriter& MsgPackWriter::beginObject()
+{
+	open(true);
+	return *this;
+}
+
+MsgPackWriter& MsgPackWriter::endObject()
+{
+	close(true);
+	return *this;
+}
+
+MsgPackWriter& MsgPackWriter::beginArray()
+{
+	open(false);
+	return *this;
+}
+
+MsgPackWriter& MsgPackWriter::endArray()
+{
+	close(false);
+	return *this;
+}
+
+MsgPackWriter& MsgPackWriter::key(const char* name)
+{
+	return key(name, strlen(name));
+}
+
+MsgPackWriter& MsgPackWriter::key(const char* name, size_t length)
+{
+	if (_depth == 0 || !_open[_depth - 1].map)
+		throw GenericException("MessagePack key outside of map");
+
+	_open[_depth - 1].count++;
+	writeString(name, length);
+	return *this;
+}
+
+MsgPackWriter& MsgPackWriter::value(const char* str)
+{
+	return value(str, strlen(str));
+}
+
+MsgPackWriter& MsgPackWriter::value(const char* str, size_t length)
+{
+	beginValue();
+	writeString(str, length);
+	return *this;
+}
+
+MsgPackWriter& MsgPackWriter::value(bool b)
+{
+	beginValue();
+	put(b ? 0xC3 : 0xC2);
+	return *this;
+}
+
+MsgPackWriter& MsgPackWriter::value(float f)
+{
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	beginValue();
+	putBE(0xCA, bits);
+	return *this;
+}
+
+MsgPackWriter& MsgPackWriter::value(double d)
+{
+	uint64_t bits;
+	memcpy(&bits, &d, sizeof(bits));
+	beginValue();
+	putBE(0xCB, bits);
+	return *this;
+}
+
+MsgPackWriter& MsgPackWriter::null()
+{
+	beginValue();
+	put(0xC0);
+	return *this;
+}
+
+MsgPackWriter& MsgPackWriter::number(const char* text, size_t length)
+{
+	std::string str(text, length);
+
+	if (str.find_first_of(".eE") == std::string::npos) {
+		char* end;
+		errno = 0;
+		if (str[0] == '-') {
+			long long i = strtoll(str.c_str(), &end, 10);
+			if (!errno && !*end)
+				return value(int64_t(i));
+		} else {
+			unsigned long long u = strtoull(str.c_str(), &end, 10);
+			if (!errno && !*end)
+				return value(uint64_t(u));
+		}
+	}
+
+	return value(strtod(str.c_str(), NULL));
+}
+
+void MsgPackWriter::writeInt(int64_t i)
+{
+	if (i >= -32)
+		put(uint8_t(i));
+	else if (i >= INT8_MIN)
+		putBE(0xD0, uint8_t(i));
+	else if (i >= INT16_MIN)
+		putBE(0xD1, uint16_t(i));
+	else if (i >= INT32_MIN)
+		putBE(0xD2, uint32_t(i));
+	else
+		putBE(0xD3, uint64_t(i));
+}
+
+void MsgPackWriter::writeUInt(uint64_t u)
+{
+	if (u < 0x80)
+		put(uint8_t(u));
+	else if (u <= UINT8_MAX)
+		putBE(0xCC, uint8_t(u));
+	else if (u <= UINT16_MAX)
+		putBE(0xCD, uint16_t(u));
+	else if (u <= UINT32_MAX)
+		putBE(0xCE, uint32_t(u));
+	else
+		putBE(0xCF, u);
+}
+
+void MsgPackWriter::writeString(const char* str, size_t length)
+{
+	if (length < 32)
+		put(0xA0 | length);
+	else if (length <= UINT8_MAX)
+		putBE(0xD9, uint8_t(length));
+	else if (length <= UINT16_MAX)
+		putBE(0xDA, uint16_t(length));
+	else
+		putBE(0xDB, uint32_t(length));
+
+	_buffer.append(str, length);
+}
@@ -0,0 +1,85 @@
+#ifndef LIBHEXABUS_MSGPACK_HPP
+#define LIBHEXABUS_MSGPACK_HPP 1
+
+#include <string>
+#include <type_traits>
+#include <stdint.h>
+
+namespace hexabus {
+	// Streaming MessagePack writer with the interface of JsonWriter, so code producing JSON documents can
+	// produce the same documents in MessagePack by swapping the writer type. Maps and arrays are written with a
+	// one byte header that is filled in when the container is closed and only widened if it ends up with more
+	// than 15 entries. Use JsonDocument::parseMsgPack to read the documents back.
+	class MsgPackWriter {
+		public:
+			MsgPackWriter();
+
+			MsgPackWriter& beginObject();
+			MsgPackWriter& endObject();
+			MsgPackWriter& beginArray();
+			MsgPackWriter& endArray();
+
+			MsgPackWriter& key(const char* name);
+			MsgPackWriter& key(const std::string& name) { return key(name.c_str(), name.size()); }
+			MsgPackWriter& key(const char* name, size_t length);
+
+			MsgPackWriter& value(const char* str);
+			MsgPackWriter& value(const std::string& str) { return value(str.c_str(), str.size()); }
+			MsgPackWriter& value(const char* str, size_t length);
+			MsgPackWriter& value(bool b);
+			MsgPackWriter& value(float f);
+			MsgPackWriter& value(double d);
+			MsgPackWriter& null();
+			// writes a number given as JSON text, as an integer if it has neither fraction nor exponent
+			MsgPackWriter& number(const char* text, size_t length);
+
+			template<typename Int>
+			typename std::enable_if<std::is_integral<Int>::value && !std::is_same<Int, bool>::value, MsgPackWriter&>::type
+			value(Int i)
+			{
+				beginValue();
+				if (std::is_signed<Int>::value && i < 0)
+					writeInt(int64_t(i));
+				else
+					writeUInt(uint64_t(i));
+				return *this;
+			}
+
+			template<typename Value>
+			MsgPackWriter& member(const char* name, const Value& v)
+			{
+				key(name);
+				return value(v);
+			}
+
+			const std::string& str() const { return _buffer; }
+			const char* data() const { return _buffer.data(); }
+			size_t size() const { return _buffer.size(); }
+			bool complete() const { return _depth == 0 && !_buffer.empty(); }
+
+			void clear();
+
+		private:
+			struct Container {
+				uint32_t header;
+				uint32_t count;
+				bool map;
+			};
+
+			std::string _buffer;
+			Container _open[64];
+			unsigned _depth;
+
+			void beginValue();
+			void open(bool map);
+			void close(bool map);
+			void writeString(const char* str, size_t length);
+			void writeInt(int64_t i);
+			void writeUInt(uint64_t u);
+			void put(uint8_t tag) { _buffer.push_back(char(tag)); }
+			template<typename T>
+			void putBE(uint8_t tag, T value);
+	};
+}
+
+#endif
@@ -152,6 +152,25 @@ namespace hexabus {
 			uint8_t datatype() const { return _datatype; }
 	};
 
+	template<typename TValue>
+	constexpr uint8_t datatype_of()
+	{
+		return
+			std::is_same<TValue, bool>::value ? HXB_DTYPE_BOOL :
+			std::is_same<TValue, uint8_t>::value ? HXB_DTYPE_UINT8 :
+			std::is_same<TValue, uint16_t>::value ? HXB_DTYPE_UINT16 :
+			std::is_same<TValue, uint32_t>::value ? HXB_DTYPE_UINT32 :
+			std::is_same<TValue, uint64_t>::value ? HXB_DTYPE_UINT64 :
+			std::is_same<TValue, int8_t>::value ? HXB_DTYPE_SINT8 :
+			std::is_same<TValue, int16_t>::value ? HXB_DTYPE_SINT16 :
+			std::is_same<TValue, int32_t>::value ? HXB_DTYPE_SINT32 :
+			std::is_same<TValue, int64_t>::value ? HXB_DTYPE_SINT64 :
+			std::is_same<TValue, float>::value ? HXB_DTYPE_FLOAT :
+			std::is_same<TValue, std::string>::value ? HXB_DTYPE_128STRING :
+			std::is_same<TValue, std::array<uint8_t, 16>>::value ? HXB_DTYPE_16BYTES :
+			std::is_same<TValue, std::array<uint8_t, 65>>::value ? HXB_DTYPE_65BYTES : HXB_DTYPE_UNDEFINED;
+	}
+
 	template<typename TValue>
 	class ValuePacket : public TypedPacket {
 		private:
@@ -172,18 +191,7 @@ namespace hexabus {
 
 			static uint8_t calculateDatatype()
 			{
-				return
-					std::is_same<TValue, bool>::value ? HXB_DTYPE_BOOL :
-					std::is_same<TValue, uint8_t>::value ? HXB_DTYPE_UINT8 :
-					std::is_same<TValue, uint16_t>::value ? HXB_DTYPE_UINT16 :
-					std::is_same<TValue, uint32_t>::value ? HXB_DTYPE_UINT32 :
-					std::is_same<TValue, uint64_t>::value ? HXB_DTYPE_UINT64 :
-					std::is_same<TValue, int8_t>::value ? HXB_DTYPE_SINT8 :
-					std::is_same<TValue, int16_t>::value ? HXB_DTYPE_SINT16 :
-					std::is_same<TValue, int32_t>::value ? HXB_DTYPE_SINT32 :
-					std::is_same<TValue, int64_t>::value ? HXB_DTYPE_SINT64 :
-					std::is_same<TValue, float>::value ? HXB_DTYPE_FLOAT :
-					std::is_same<TValue, std::array<uint8_t, 16>>::value ? HXB_DTYPE_16BYTES : HXB_DTYPE_65BYTES;
+				return datatype_of<TValue>();
 			}
 
 			TValue _value;
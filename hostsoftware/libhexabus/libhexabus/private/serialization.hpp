@@ -7,6 +7,8 @@
 
 namespace hexabus {
 	std::vector<char> serialize(const Packet& packet);
+	// serialize into target, reusing its storage
+	void serialize(const Packet& packet, std::vector<char>& target);
 
 	void deserialize(const void* packet, size_t size, PacketVisitor& handler);
 	Packet::Ptr deserialize(const void* packet, size_t size);
@@ -219,13 +219,20 @@ void BinarySerializer::appendValue(const ValuePacket<std::array<uint8_t, 65> >&
 std::vector<char> hexabus::serialize(const Packet& packet)
 {
 	std::vector<char> result;
-	BinarySerializer serializer(result);
 
-	serializer.visitPacket(packet);
+	serialize(packet, result);
 
 	return result;
 }
 
+void hexabus::serialize(const Packet& packet, std::vector<char>& target)
+{
+	BinarySerializer serializer(target);
+
+	target.clear();
+	serializer.visitPacket(packet);
+}
+
 // {{{ Binary deserialization
 
 class BinaryDeserializer {
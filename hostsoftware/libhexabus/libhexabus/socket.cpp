@@ -266,11 +266,13 @@ void Socket::bind(const boost::asio::ip::udp::endpoint& ep)
 
 void Socket::send(const Packet& packet, const boost::asio::ip::udp::endpoint& dest)
 {
+	// one buffer per thread keeps send reentrant without allocating for every packet
+	static thread_local std::vector<char> sendBuffer;
 	boost::system::error_code err;
 
-	std::vector<char> data = serialize(packet);
+	serialize(packet, sendBuffer);
 
-	socket.send_to(boost::asio::buffer(&data[0], data.size()), dest, 0, err);
+	socket.send_to(boost::asio::buffer(&sendBuffer[0], sendBuffer.size()), dest, 0, err);
 	if (err)
 		throw NetworkException("send", err);
 }
@@ -0,0 +1,30 @@
+#include "worker_pool.hpp"
+
+#include "error.hpp"
+
+using namespace hexabus;
+
+WorkerPool::WorkerPool(size_t threads)
+	: _work(new boost::asio::io_service::work(_io))
+{
+	if (threads == 0)
+		throw GenericException("A worker pool needs at least one thread");
+
+	for (size_t i = 0; i < threads; i++) {
+		_threads.push_back(std::thread([this] () {
+			_io.run();
+		}));
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	_work.reset();
+	for (std::vector<std::thread>::iterator it = _threads.begin(), end = _threads.end(); it != end; ++it)
+		it->join();
+}
+
+void WorkerPool::post(const job_fn_t& job)
+{
+	_io.post(job);
+}
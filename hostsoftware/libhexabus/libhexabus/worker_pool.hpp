@@ -0,0 +1,36 @@
+#ifndef LIBHEXABUS_WORKER_POOL_HPP
+#define LIBHEXABUS_WORKER_POOL_HPP 1
+
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+
+namespace hexabus {
+	// A fixed number of threads that run blocking jobs, e.g. endpoint handlers that read files or talk to
+	// external hardware, off the io_service thread of a Device.
+	class WorkerPool {
+		public:
+			typedef std::function<void ()> job_fn_t;
+
+			WorkerPool(size_t threads = 1);
+			// waits for all queued jobs to finish
+			~WorkerPool();
+
+			// jobs must not throw
+			void post(const job_fn_t& job);
+			size_t size() const { return _threads.size(); }
+
+		private:
+			WorkerPool(const WorkerPool&);
+			WorkerPool& operator=(const WorkerPool&);
+
+			boost::asio::io_service _io;
+			std::unique_ptr<boost::asio::io_service::work> _work;
+			std::vector<std::thread> _threads;
+	};
+}
+
+#endif
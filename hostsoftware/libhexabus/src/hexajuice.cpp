@@ -1,21 +1,26 @@
+#include <cerrno>
+#include <cstring>
 #include <functional>
 #include <iostream>
 #include <set>
 
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <libhexabus/json.hpp>
+#include <libhexabus/msgpack.hpp>
 #include <libhexabus/socket.hpp>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/asio.hpp>
-#include <boost/format.hpp>
-#include <boost/property_tree/json_parser.hpp>
-#include <boost/property_tree/ptree.hpp>
+#include <boost/optional.hpp>
+#include <boost/program_options.hpp>
 
 #include "shared.hpp"
 
 using namespace hexabus;
 namespace ba = boost::asio;
-namespace bp = boost::property_tree;
-namespace bpj = boost::property_tree::json_parser;
+namespace po = boost::program_options;
 
 namespace std {
 
@@ -28,75 +33,123 @@ struct is_placeholder<boost::arg<Arg>> : integral_constant<int, Arg> {
 
 namespace {
 
-class FiledescLineWrapper {
+// Reads commands from a file descriptor, either as lines or as frames of a 32 bit big endian length followed by
+// the payload. Complete commands are passed to the command handler in place, without copying them out of the
+// read buffer; after all commands of one read, the batch handler is called.
+class FiledescFrameReader {
 private:
-	ba::io_service& io;
+	static const size_t maxFrameSize = 1 << 20;
+
 	ba::posix::stream_descriptor stream;
+	bool binary;
 
-	std::function<void (const std::string&, bool)> handler;
-	std::string buffer, incompleteLine;
+	std::function<void (const char*, size_t)> onFrame;
+	std::function<void (bool)> onBatch;
 
-	bool processBuffer()
+	std::vector<char> buffer;
+	size_t filled;
+
+	// returns the number of bytes consumed
+	size_t splitLines(char* begin, char* end, char* scan)
 	{
-		incompleteLine.reserve(incompleteLine.size() + buffer.size());
-		for (auto it = buffer.begin(), end = buffer.end(); it != end; ++it) {
-			if (*it == '\n') {
-				buffer.erase(buffer.begin(), it + 1);
-				auto line = incompleteLine;
-				io.post([&, line] () {
-					handler(line, false);
-				});
-				return true;
-			} else {
-				incompleteLine += *it;
+		char* line = begin;
+
+		// only the new data can contain the end of the current line
+		while (char* nl = static_cast<char*>(memchr(scan, '\n', end - scan))) {
+			onFrame(line, nl - line);
+			line = scan = nl + 1;
+		}
+
+		return line - begin;
+	}
+
+	size_t splitFrames(char* begin, char* end)
+	{
+		char* frame = begin;
+
+		while (end - frame >= 4) {
+			uint32_t length;
+			memcpy(&length, frame, 4);
+			length = ntohl(length);
+
+			if (length > maxFrameSize)
+				throw std::runtime_error("input frame too large");
+			if (size_t(end - frame - 4) < length) {
+				if (buffer.size() < length + 4)
+					buffer.resize(length + 4);
+				break;
 			}
+
+			onFrame(frame + 4, length);
+			frame += 4 + length;
 		}
-		return false;
+
+		return frame - begin;
 	}
 
 	void readSome(const boost::system::error_code& err, size_t size)
 	{
 		if (err) {
-			handler("", true);
+			// a last line without newline still counts
+			if (filled && !binary)
+				onFrame(&buffer[0], filled);
+			filled = 0;
+			onBatch(true);
+			return;
+		}
+
+		char* begin = &buffer[0];
+		char* end = begin + filled + size;
+		size_t used;
+
+		try {
+			used = binary
+				? splitFrames(begin, end)
+				: splitLines(begin, end, begin + filled);
+		} catch (const std::exception& e) {
+			std::cerr << "error: " << e.what() << std::endl;
+			filled = 0;
+			onBatch(true);
 			return;
 		}
 
-		buffer.resize(size);
-		if (!processBuffer())
-			continueRead();
+		// splitFrames may have grown the buffer
+		begin = &buffer[0];
+		filled = filled + size - used;
+		if (used)
+			memmove(begin, begin + used, filled);
+		// the partial line fills the whole buffer, make room for more
+		if (filled == buffer.size())
+			buffer.resize(2 * buffer.size());
+
+		onBatch(false);
+		continueRead();
 	}
 
 	void continueRead()
 	{
-		buffer.resize(buffer.capacity());
 		stream.async_read_some(
-			ba::buffer(&buffer[0], buffer.size()),
-			std::bind(&FiledescLineWrapper::readSome, this, _1, _2));
-	}
-
-	void beginRead()
-	{
-		incompleteLine.erase();
-		if (!processBuffer())
-			continueRead();
+			ba::buffer(&buffer[filled], buffer.size() - filled),
+			std::bind(&FiledescFrameReader::readSome, this, _1, _2));
 	}
 
 public:
-	FiledescLineWrapper(ba::io_service& io, const ba::posix::stream_descriptor::native_handle_type& handle)
-		: io(io), stream(io, handle)
+	FiledescFrameReader(ba::io_service& io, const ba::posix::stream_descriptor::native_handle_type& handle,
+			bool binary)
+		: stream(io, handle), binary(binary), buffer(65536), filled(0)
 	{
-		buffer.reserve(4096);
 	}
 
-	~FiledescLineWrapper()
+	~FiledescFrameReader()
 	{
 		stream.release();
 	}
 
-	void asyncGetline(std::function<void (const std::string&, bool)> handler)
+	void start(std::function<void (const char*, size_t)> onFrame, std::function<void (bool)> onBatch)
 	{
-		this->handler = handler;
-		beginRead();
+		this->onFrame = onFrame;
+		this->onBatch = onBatch;
+		continueRead();
 	}
 
 	static bool canWrap(const ba::posix::stream_descriptor::native_handle_type& handle)
@@ -114,146 +167,89 @@ public:
 	}
 };
 
-
-
-class JsonValue {
-public:
-	typedef std::shared_ptr<JsonValue> Ptr;
-
-	virtual ~JsonValue() {}
-	virtual void write(std::ostream& out) = 0;
-};
-
-class JsonString : public JsonValue {
+// Collects output and writes it in batches. The first document of a batch posts a flush to the io_service, so
+// everything produced by the handlers that are ready at that point goes out in a single write.
+class FrameOutput {
 private:
-	std::string value;
-
-public:
-	JsonString(const std::string& value)
-		: value(value)
-	{}
-
-	void write(std::ostream& out)
-	{
-		out << '"';
-		for (auto c : value) {
-			if (std::isprint(c) && c != '"')
-				out << c;
-			else
-				out << str(boost::format("\\x%02x") % static_cast<unsigned char>(c));
-		}
-		out << '"';
-	}
-};
+	ba::io_service& io;
+	int fd;
+	bool binary;
 
-class JsonNonstring : public JsonValue {
-private:
-	std::string value;
+	std::string pending;
+	bool flushPosted;
 
 public:
-	template<typename T>
-	JsonNonstring(T value)
-		: value(str(boost::format("%1%") % value))
-	{}
-
-	void write(std::ostream& out)
+	FrameOutput(ba::io_service& io, int fd, bool binary)
+		: io(io), fd(fd), binary(binary), flushPosted(false)
 	{
-		out << value;
+		pending.reserve(65536);
 	}
-};
 
-class JsonObject : public JsonValue {
-private:
-	std::map<std::string, Ptr> keys;
-
-public:
-	JsonObject(std::map<std::string, Ptr> keys)
-		: keys(std::move(keys))
+	template<typename Writer>
+	void emit(Writer& document)
 	{
+		if (binary) {
+			uint32_t length = htonl(document.size());
+			pending.append(reinterpret_cast<const char*>(&length), 4);
+		}
+		pending.append(document.data(), document.size());
+		if (!binary)
+			pending.push_back('\n');
+		document.clear();
+
+		if (!flushPosted) {
+			flushPosted = true;
+			io.post(std::bind(&FrameOutput::flush, this));
+		}
 	}
 
-	void write(std::ostream& out)
+	void flush()
 	{
-		unsigned printed = 0;
-		out << '{';
-		for (const auto& key : keys) {
-			if (printed++)
-				out << ',';
-
-			JsonString(key.first).write(out);
-			out << ':';
-			key.second->write(out);
+		flushPosted = false;
+
+		size_t done = 0;
+		while (done < pending.size()) {
+			ssize_t written = ::write(fd, pending.data() + done, pending.size() - done);
+			if (written < 0) {
+				if (errno == EINTR)
+					continue;
+				// nobody is reading any more, there is no one to report to either
+				break;
+			}
+			done += written;
 		}
-		out << '}';
+		pending.clear();
 	}
 };
 
-class JsonArray : public JsonValue {
+
+
+template<typename Writer>
+class PacketFormatter : private PacketVisitor {
 private:
-	std::vector<JsonValue::Ptr> values;
+	Writer* out;
 
-public:
-	JsonArray(std::vector<JsonValue::Ptr> values)
-		: values(std::move(values))
+	template<typename T>
+	void writeValue(const T& value)
 	{
+		out->value(value);
 	}
 
-	void write(std::ostream& out)
+	template<size_t Len>
+	void writeValue(const std::array<uint8_t, Len>& array)
 	{
-		unsigned printed = 0;
-		out << '[';
-		for (const auto& v : values) {
-			if (printed++)
-				out << ',';
-			v->write(out);
-		}
-		out << ']';
+		out->beginArray();
+		for (auto c : array)
+			out->value(c);
+		out->endArray();
 	}
-};
-
-
-JsonValue::Ptr jvalue(const std::string& value)
-{
-	return JsonValue::Ptr(new JsonString(value));
-}
-
-template<typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
-JsonValue::Ptr jvalue(const T& value)
-{
-	return JsonValue::Ptr(new JsonNonstring(value));
-}
-
-template<size_t Len>
-JsonValue::Ptr jvalue(const std::array<uint8_t, Len>& array)
-{
-	std::vector<JsonValue::Ptr> values;
-	for (auto c : array)
-		values.push_back(jvalue(unsigned(c)));
-	return JsonValue::Ptr(new JsonArray(std::move(values)));
-}
-
-JsonValue::Ptr jobject(std::map<std::string, JsonValue::Ptr> keys)
-{
-	return JsonValue::Ptr(new JsonObject(std::move(keys)));
-}
-
-std::ostream& operator<<(std::ostream& out, const JsonValue::Ptr& json)
-{
-	json->write(out);
-	return out << std::endl;
-}
-
-
-
-class PacketFormatter : private PacketVisitor {
-private:
-	std::map<std::string, JsonValue::Ptr> keys;
 
 	template<typename T>
 	void printValuePacket(const char* type, const ValuePacket<T>& packet)
 	{
+		// bools are written as 0/1, which is also what the command parser accepts
 		typedef typename std::conditional<
-			std::is_same<T, uint8_t>::value,
+			std::is_same<T, uint8_t>::value || std::is_same<T, bool>::value,
 			unsigned,
 			typename std::conditional<
 				std::is_same<T, int8_t>::value,
@@ -261,32 +257,33 @@ private:
 				const T&>::type
 			>::type Widened;
 
-		keys.insert({ "type", jvalue(type) });
-		keys.insert({ "eid", jvalue(packet.eid()) });
-		keys.insert({ "flags", jvalue(unsigned(packet.flags())) });
-		keys.insert({ "datatype", jvalue(datatypeName((hxb_datatype) packet.datatype())) });
-		keys.insert({ "value", jvalue(Widened(packet.value())) });
+		out->member("type", type);
+		out->member("eid", packet.eid());
+		out->member("flags", unsigned(packet.flags()));
+		out->member("datatype", datatypeName((hxb_datatype) packet.datatype()));
+		out->key("value");
+		writeValue(Widened(packet.value()));
 	}
 
 	virtual void visit(const ErrorPacket& error)
 	{
-		keys.insert({ "type", jvalue("error") });
-		keys.insert({ "flags", jvalue(unsigned(error.flags())) });
-		keys.insert({ "code", jvalue(unsigned(error.code())) });
+		out->member("type", "error");
+		out->member("flags", unsigned(error.flags()));
+		out->member("code", unsigned(error.code()));
 	}
 
 	virtual void visit(const QueryPacket& query)
 	{
-		keys.insert({ "type", jvalue("query") });
-		keys.insert({ "flags", jvalue(unsigned(query.flags())) });
-		keys.insert({ "eid", jvalue(query.eid()) });
+		out->member("type", "query");
+		out->member("flags", unsigned(query.flags()));
+		out->member("eid", query.eid());
 	}
 
 	virtual void visit(const EndpointQueryPacket& endpointQuery)
 	{
-		keys.insert({ "type", jvalue("epquery") });
-		keys.insert({ "flags", jvalue(unsigned(endpointQuery.flags())) });
-		keys.insert({ "eid", jvalue(endpointQuery.eid()) });
+		out->member("type", "epquery");
+		out->member("flags", unsigned(endpointQuery.flags()));
+		out->member("eid", endpointQuery.eid());
 	}
 
 	virtual void visit(const EndpointInfoPacket& endpointInfo)
@@ -323,26 +320,34 @@ private:
 	virtual void visit(const WritePacket<std::array<uint8_t, 65> >& write) { printValuePacket("write", write); }
 
 public:
-	void print(const Packet& packet, const boost::asio::ip::udp::endpoint& from, const std::string* socket)
+	void print(Writer& out, const Packet& packet, const boost::asio::ip::udp::endpoint& from,
+			const std::string* socket)
 	{
-		keys.insert({ "from", jobject({
-				{ "ip", jvalue(from.address().to_string()) },
-				{ "port", jvalue(from.port()) }
-			}) });
+		this->out = &out;
+
+		out.beginObject().key("packet").beginObject();
+		out.key("from").beginObject()
+			.member("ip", from.address().to_string())
+			.member("port", from.port())
+			.endObject();
 		if (socket)
-			keys.insert({ "socket", jvalue(*socket) });
+			out.member("socket", *socket);
 		packet.accept(*this);
-		std::cout << jobject({
-			{ "packet", jobject(std::move(keys)) }
-		});
+		out.endObject().endObject();
 	}
 };
 
 
+template<typename Writer>
 class Hexajuice {
 private:
+	// MessagePack output goes with MessagePack input
+	static const bool binary = std::is_same<Writer, MsgPackWriter>::value;
+
 	ba::io_service& io;
-	FiledescLineWrapper& input;
+	FiledescFrameReader& input;
+	FrameOutput& out;
+	ba::ip::udp::resolver resolver;
 
 	std::unique_ptr<Listener> listener;
 	std::set<std::string> listeningOn;
@@ -350,16 +355,44 @@ private:
 	std::map<std::string, std::unique_ptr<Socket>> sockets;
 	std::map<Socket*, std::string> socketNames;
 
+	// reused for every command read from stdin and every line written to stdout
+	JsonDocument command;
+	Writer output;
+	PacketFormatter<Writer> formatter;
+
+	// commands waiting for name resolution
+	unsigned pending;
+	bool inputClosed;
+
+	// the id a client attached to a command, echoed in the reply and in errors
+	struct RequestId {
+		JsonDocument::Type type;
+		std::string text;
+	};
+
 	struct bad_cast {
 		std::string field;
 	};
 
+	struct missing_field {
+		std::string field;
+	};
+
+	struct invalid_input {
+		const char* diag;
+	};
+
 	template<typename To, typename Via = To>
-	static To cast(const std::string& field, const std::string& from)
+	static To cast(const std::string& field, const JsonDocument::Value& from)
 	{
+		To result;
+		if (from.get(result))
+			return result;
+
+		// strings holding numbers are accepted as well
 		try {
-			auto val = boost::lexical_cast<Via>(from);
-			if (val < std::numeric_limits<To>::min() || val > std::numeric_limits<To>::max())
+			auto val = boost::lexical_cast<Via>(from.c_str(), from.length());
+			if (val < std::numeric_limits<To>::lowest() || val > std::numeric_limits<To>::max())
 				throw bad_cast{field};
 			return val;
 		} catch (const boost::bad_lexical_cast& e) {
@@ -368,59 +401,59 @@ private:
 	}
 
 	template<size_t Len>
-	static std::array<uint8_t, Len> parseBinary(const bp::ptree& value)
+	static std::array<uint8_t, Len> parseBinary(const JsonDocument::Value& value)
 	{
 		std::array<uint8_t, Len> result;
 
-		if (value.size() != Len)
+		if (!value.isArray() || value.size() != Len)
 			throw bad_cast{"packet.value"};
 
-		auto it = value.begin();
-		for (size_t i = 0; i < Len; i++, it++)
-			result[i] = cast<uint8_t, unsigned>("packet.value", it->second.data());
+		auto it = value.first();
+		for (size_t i = 0; i < Len; i++, it = it.next())
+			result[i] = cast<uint8_t, unsigned>("packet.value", it);
 
 		return result;
 	}
 
 	template<template<typename> class TPacket>
-	static std::unique_ptr<Packet> parseValuePacket(uint32_t eid, uint8_t dt, const bp::ptree& value,
+	static std::unique_ptr<Packet> parseValuePacket(uint32_t eid, uint8_t dt, const JsonDocument::Value& value,
 			uint8_t flags)
 	{
 		switch (dt) {
 		case HXB_DTYPE_BOOL:
 			return std::unique_ptr<Packet>(new TPacket<bool>(eid,
-					cast<bool>("packet.value", value.data()), flags));
+					cast<bool>("packet.value", value), flags));
 		case HXB_DTYPE_UINT8:
 			return std::unique_ptr<Packet>(new TPacket<uint8_t>(eid,
-					cast<uint8_t, unsigned>("packet.value", value.data()), flags));
+					cast<uint8_t, unsigned>("packet.value", value), flags));
 		case HXB_DTYPE_UINT16:
 			return std::unique_ptr<Packet>(new TPacket<uint16_t>(eid,
-					cast<uint16_t>("packet.value", value.data()), flags));
+					cast<uint16_t>("packet.value", value), flags));
 		case HXB_DTYPE_UINT32:
 			return std::unique_ptr<Packet>(new TPacket<uint32_t>(eid,
-					cast<uint32_t>("packet.value", value.data()), flags));
+					cast<uint32_t>("packet.value", value), flags));
 		case HXB_DTYPE_UINT64:
 			return std::unique_ptr<Packet>(new TPacket<uint64_t>(eid,
-					cast<uint64_t>("packet.value", value.data()), flags));
+					cast<uint64_t>("packet.value", value), flags));
 		case HXB_DTYPE_SINT8:
 			return std::unique_ptr<Packet>(new TPacket<int8_t>(eid,
-					cast<int8_t, int>("packet.value", value.data()), flags));
+					cast<int8_t, int>("packet.value", value), flags));
 		case HXB_DTYPE_SINT16:
 			return std::unique_ptr<Packet>(new TPacket<int16_t>(eid,
-					cast<int16_t>("packet.value", value.data()), flags));
+					cast<int16_t>("packet.value", value), flags));
 		case HXB_DTYPE_SINT32:
 			return std::unique_ptr<Packet>(new TPacket<int32_t>(eid,
-					cast<int32_t>("packet.value", value.data()), flags));
+					cast<int32_t>("packet.value", value), flags));
 		case HXB_DTYPE_SINT64:
 			return std::unique_ptr<Packet>(new TPacket<int64_t>(eid,
-					cast<int64_t>("packet.value", value.data()), flags));
+					cast<int64_t>("packet.value", value), flags));
 		case HXB_DTYPE_FLOAT:
 			return std::unique_ptr<Packet>(new TPacket<float>(eid,
-					cast<float>("packet.value", value.data()), flags));
+					cast<float>("packet.value", value), flags));
 		case HXB_DTYPE_128STRING:
-			if (value.data().size() > TPacket<std::string>::max_length)
+			if (value.length() > TPacket<std::string>::max_length)
 				throw bad_cast{"packet.value"};
-			return std::unique_ptr<Packet>(new TPacket<std::string>(eid, value.data(), flags));
+			return std::unique_ptr<Packet>(new TPacket<std::string>(eid, value.str(), flags));
 		case HXB_DTYPE_65BYTES:
 			return std::unique_ptr<Packet>(new TPacket<std::array<uint8_t, 65>>(eid,
 					parseBinary<65>(value), flags));
@@ -435,7 +468,9 @@ private:
 	void processPacket(const Packet& packet, const boost::asio::ip::udp::endpoint& from, Socket* socket)
 	{
 		const auto* socketName = socketNames.count(socket) ? &socketNames.at(socket) : nullptr;
-		PacketFormatter().print(packet, from, socketName);
+		output.clear();
+		formatter.print(output, packet, from, socketName);
+		out.emit(output);
 	}
 
 	Socket& openSocket(const std::string& name)
@@ -447,286 +482,360 @@ private:
 		return *it->second;
 	};
 
-	void processCommand(const bp::ptree& json)
+	JsonDocument::Value requiredField(const char* field)
 	{
-		auto requiredField = [&] (const std::string& field) -> const bp::ptree& {
-			auto child = json.get_child_optional(field);
-			if (!child) {
-				throw jobject({
-					{ "error", jobject({
-							{ "type", jvalue("required field missing") },
-							{ "field", jvalue(field) }
-						}) }
-				});
-			}
-			return *child;
-		};
-
-		auto parseAddress = [&] (const std::string& prefix, uint16_t defaultPort) -> ba::ip::udp::endpoint {
-			boost::system::error_code err;
-			auto& addr = requiredField(prefix);
+		auto child = command.root()[field];
+		if (!child)
+			throw missing_field{field};
+		return child;
+	}
 
-			if (addr.size() == 0) {
-				auto result = resolve(io, addr.data(), err);
-				if (err)
-					throw boost::system::system_error(err);
+	Socket& findSocket(const boost::optional<std::string>& name)
+	{
+		if (!name) {
+			if (!sockets.size())
+				return openSocket("");
+			if (sockets.size() == 1)
+				return *sockets.begin()->second;
 
-				return {result, defaultPort};
-			} else {
-				auto ip = resolve(io, requiredField(prefix + ".ip").data(), err);
-				auto port = cast<uint16_t>(prefix + ".port", requiredField(prefix + ".port").data());
+			throw invalid_input{"socket not specified"};
+		}
 
-				if (err)
-					throw boost::system::system_error(err);
+		auto resolved = sockets.find(*name);
+		if (resolved == sockets.end())
+			throw invalid_input{"unknown socket"};
 
-				return {ip, port};
-			}
-		};
-
-		auto parseSocket = [&] () -> Socket& {
-			auto socket = json.get_child_optional("socket");
-
-			if (!socket) {
-				if (!sockets.size())
-					return openSocket("");
-				if (sockets.size() == 1)
-					return *sockets.begin()->second;
-			} else {
-				auto resolved = sockets.find(socket->data());
-				if (resolved != sockets.end())
-					return *resolved->second;
-				else
-					throw jobject({
-						{ "error", jobject({
-								{ "type", jvalue("invalid input") },
-								{ "diag", jvalue("unknown socket") }
-							}) }
-					});
-			}
+		return *resolved->second;
+	}
 
-			throw jobject({
-				{ "error", jobject({
-						{ "type", jvalue("invalid input") },
-						{ "diag", jvalue("socket not specified") }
-					}) }
-			});
-		};
-
-		auto parsePacket = [&] () {
-			auto& type = requiredField("packet.type").data();
-			auto flags = json.get("packet.flags", 0);
-
-			if (type == "error") {
-				auto code = cast<uint8_t>("packet.code", requiredField("packet.code").data());
-				return std::unique_ptr<Packet>(new ErrorPacket(code, flags));
-			} else if (type == "query") {
-				auto eid = cast<uint32_t>("packet.eid", requiredField("packet.eid").data());
-				return std::unique_ptr<Packet>(new QueryPacket(eid, flags));
-			} else if (type == "epquery") {
-				auto eid = cast<uint32_t>("packet.eid", requiredField("packet.eid").data());
-				return std::unique_ptr<Packet>(new EndpointQueryPacket(eid, flags));
-			} else if (type == "epinfo") {
-				auto eid = cast<uint32_t>("packet.eid", requiredField("packet.eid").data());
-				auto dt = cast<uint8_t>("packet.datatype", requiredField("packet.datatype").data());
-				auto value = requiredField("packet.value").data();
-				return std::unique_ptr<Packet>(new EndpointInfoPacket(eid, dt, value, flags));
-			} else if (type == "info") {
-				auto eid = cast<uint32_t>("packet.eid", requiredField("packet.eid").data());
-				auto dt = dtypeStrToDType(requiredField("packet.datatype").data());
-				auto value = requiredField("packet.value");
-
-				if (dt < 0)
-					throw jobject({
-						{ "error", jobject({
-								{ "type", jvalue("invalid input") },
-								{ "diag", jvalue("invalid datatype") }
-							}) }
-					});
+	boost::optional<std::string> socketName()
+	{
+		auto socket = command.root()["socket"];
+		return socket ? boost::optional<std::string>(socket.str()) : boost::none;
+	}
 
+	std::unique_ptr<Packet> parsePacket()
+	{
+		auto type = requiredField("packet.type");
+		auto flagsField = command.root()["packet.flags"];
+		uint8_t flags = flagsField ? cast<uint8_t, unsigned>("packet.flags", flagsField) : 0;
+
+		if (type == "error") {
+			auto code = cast<uint8_t, unsigned>("packet.code", requiredField("packet.code"));
+			return std::unique_ptr<Packet>(new ErrorPacket(code, flags));
+		} else if (type == "query") {
+			auto eid = cast<uint32_t>("packet.eid", requiredField("packet.eid"));
+			return std::unique_ptr<Packet>(new QueryPacket(eid, flags));
+		} else if (type == "epquery") {
+			auto eid = cast<uint32_t>("packet.eid", requiredField("packet.eid"));
+			return std::unique_ptr<Packet>(new EndpointQueryPacket(eid, flags));
+		} else if (type == "epinfo") {
+			auto eid = cast<uint32_t>("packet.eid", requiredField("packet.eid"));
+			auto dt = cast<uint8_t, unsigned>("packet.datatype", requiredField("packet.datatype"));
+			auto value = requiredField("packet.value").str();
+			return std::unique_ptr<Packet>(new EndpointInfoPacket(eid, dt, value, flags));
+		} else if (type == "info" || type == "write") {
+			auto eid = cast<uint32_t>("packet.eid", requiredField("packet.eid"));
+			auto dt = dtypeStrToDType(requiredField("packet.datatype").str());
+			auto value = requiredField("packet.value");
+
+			if (dt < 0)
+				throw invalid_input{"invalid datatype"};
+
+			if (type == "info")
 				return parseValuePacket<InfoPacket>(eid, dt, value, flags);
-			} else if (type == "write") {
-				auto eid = cast<uint32_t>("packet.eid", requiredField("packet.eid").data());
-				auto dt = dtypeStrToDType(requiredField("packet.datatype").data());
-				auto value = requiredField("packet.value");
-
-				if (dt < 0)
-					throw jobject({
-						{ "error", jobject({
-								{ "type", jvalue("invalid input") },
-								{ "diag", jvalue("invalid datatype") }
-							}) }
-					});
-
+			else
 				return parseValuePacket<WritePacket>(eid, dt, value, flags);
-			} else {
-				throw jobject({
-					{ "error", jobject({
-							{ "type", jvalue("invalid input") },
-							{ "diag", jvalue("invalid packet type") }
-						}) }
+		} else {
+			throw invalid_input{"invalid packet type"};
+		}
+	}
+
+	// Calls then with the endpoint given in field prefix, either as an address or as an object with ip and port.
+	// Addresses that are not IPv6 literals are resolved asynchronously, in which case the command is completed
+	// from the resolver callback and false is returned.
+	bool withEndpoint(const RequestId& id, const char* prefix, uint16_t defaultPort,
+			std::function<void (const ba::ip::udp::endpoint&)> then)
+	{
+		auto addr = requiredField(prefix);
+
+		std::string host;
+		uint16_t port = defaultPort;
+		if (addr.isObject()) {
+			std::string field(prefix);
+			host = requiredField((field + ".ip").c_str()).str();
+			port = cast<uint16_t>(field + ".port", requiredField((field + ".port").c_str()));
+		} else {
+			host = addr.str();
+		}
+
+		boost::system::error_code err;
+		auto literal = ba::ip::address_v6::from_string(host, err);
+		if (!err) {
+			then({literal, port});
+			return true;
+		}
+
+		pending++;
+		resolver.async_resolve(ba::ip::udp::resolver::query(host, ""),
+			[this, id, port, then] (const boost::system::error_code& err, ba::ip::udp::resolver::iterator it) {
+				pending--;
+				finishCommand(id, [&] () -> bool {
+					if (err)
+						throw boost::system::system_error(err);
+
+					for (ba::ip::udp::resolver::iterator end; it != end; ++it) {
+						if (it->endpoint().address().is_v6()) {
+							then({it->endpoint().address().to_v6(), port});
+							return true;
+						}
+					}
+					throw boost::system::system_error(
+						boost::system::error_code(boost::system::errc::invalid_argument, boost::system::generic_category()));
 				});
-			}
-		};
+				stopIfDone();
+			});
+		return false;
+	}
 
-		auto command = requiredField("command").data();
+	// returns false if the command completes asynchronously
+	bool processCommand(const RequestId& id)
+	{
+		auto name = requiredField("command");
 
-		if (command == "listen") {
-			auto& iface = requiredField("interface");
+		if (name == "listen") {
+			auto iface = requiredField("interface").str();
 			if (!listener) {
 				listener.reset(new Listener(io));
 				listener->onPacketReceived(std::bind(&Hexajuice::processPacket, this, _1, _2, nullptr));
 			}
-			listeningOn.insert(iface.data());
-			listener->listen(iface.data());
-		} else if (command == "ignore") {
-			auto& iface = requiredField("interface");
-			listener->ignore(iface.data());
-			listeningOn.erase(iface.data());
+			listeningOn.insert(iface);
+			listener->listen(iface);
+		} else if (name == "ignore") {
+			auto iface = requiredField("interface").str();
+			if (!listeningOn.count(iface))
+				throw invalid_input{"not listening on interface"};
+			listener->ignore(iface);
+			listeningOn.erase(iface);
 			if (!listeningOn.size())
 				listener.reset();
-		} else if (command == "open") {
-			auto name = requiredField("socket").data();
-			if (sockets.count(name))
-				throw jobject({
-					{ "error", jobject({
-						{ "type", jvalue("invalid input") },
-						{ "diag", jvalue("socket name already used") }
-					}) }
-				});
-			openSocket(name);
-		} else if (command == "close") {
-			auto name = requiredField("socket").data();
-			auto it = sockets.find(name);
+		} else if (name == "open") {
+			auto socket = requiredField("socket").str();
+			if (sockets.count(socket))
+				throw invalid_input{"socket name already used"};
+			openSocket(socket);
+		} else if (name == "close") {
+			auto it = sockets.find(requiredField("socket").str());
 			if (it == sockets.end())
-				throw jobject({
-					{ "error", jobject({
-						{ "type", jvalue("invalid input") },
-						{ "diag", jvalue("unknown socket") }
-					}) }
-				});
+				throw invalid_input{"unknown socket"};
 			socketNames.erase(it->second.get());
 			sockets.erase(it);
-		} else if (command == "mcast_from") {
-			auto& iface = requiredField("interface");
-			parseSocket().mcast_from(iface.data());
-		} else if (command == "bind") {
-			parseSocket().bind(parseAddress("address", 0));
-		} else if (command == "send") {
-			auto packet = parsePacket();
-			ba::ip::udp::endpoint target{Socket::GroupAddress, 61616};
-
-			if (json.get_child_optional("to"))
-				target = parseAddress("to", 61616);
-
-			parseSocket().send(*packet, target);
-		} else if (command == "quit") {
+		} else if (name == "mcast_from") {
+			auto iface = requiredField("interface").str();
+			findSocket(socketName()).mcast_from(iface);
+		} else if (name == "bind") {
+			auto socket = socketName();
+			return withEndpoint(id, "address", 0, [this, socket] (const ba::ip::udp::endpoint& ep) {
+				findSocket(socket).bind(ep);
+			});
+		} else if (name == "send") {
+			std::shared_ptr<Packet> packet = parsePacket();
+			auto socket = socketName();
+			auto send = [this, socket, packet] (const ba::ip::udp::endpoint& ep) {
+				findSocket(socket).send(*packet, ep);
+			};
+
+			if (command.root()["to"])
+				return withEndpoint(id, "to", 61616, send);
+
+			send({Socket::GroupAddress, 61616});
+		} else if (name == "quit") {
+			out.flush();
 			exit(0);
 		}
+
+		return true;
 	}
 
-	void onCommand(const std::string& line, bool eof)
+	// runs action and replies to the command if it completed
+	void finishCommand(const RequestId& id, const std::function<bool ()>& action)
 	{
-		if (eof) {
-			io.stop();
-			return;
+		try {
+			if (action() && id.type != JsonDocument::t_null) {
+				output.clear();
+				output.beginObject().key("reply").beginObject();
+				writeId(id);
+				output.endObject().endObject();
+				out.emit(output);
+			}
+		} catch (...) {
+			printError(id);
 		}
+	}
 
-		allowNextCommand();
-
-		bp::ptree json;
+	void onLine(const char* line, size_t length)
+	{
+		RequestId id{JsonDocument::t_null, ""};
 
 		try {
-			std::istringstream stream(line);
-			bpj::read_json(stream, json);
-		} catch (const bpj::json_parser_error& e) {
-			std::cout << jobject({
-				{ "error", jobject({
-						{ "type", jvalue("invalid input") },
-						{ "diag", jvalue(e.message()) }
-					}) }
-			});
+			if (binary)
+				command.parseMsgPack(line, length);
+			else
+				command.parse(line, length);
+		} catch (const GenericException& e) {
+			beginError(id, "invalid input").member("diag", e.reason());
+			finishError();
 			return;
 		}
 
+		auto idField = command.root()["id"];
+		if (idField) {
+			if (idField.type() != JsonDocument::t_string && idField.type() != JsonDocument::t_number) {
+				beginError(id, "invalid input").member("diag", "invalid request id");
+				finishError();
+				return;
+			}
+			id.type = idField.type();
+			id.text.assign(idField.c_str(), idField.length());
+		}
+
+		finishCommand(id, [&] () {
+			return processCommand(id);
+		});
+	}
+
+	void onInputBatch(bool eof)
+	{
+		if (eof) {
+			inputClosed = true;
+			stopIfDone();
+		}
+	}
+
+	void stopIfDone()
+	{
+		if (inputClosed && !pending) {
+			out.flush();
+			io.stop();
+		}
+	}
+
+	void writeId(const RequestId& id)
+	{
+		if (id.type == JsonDocument::t_string)
+			output.member("id", id.text);
+		else if (id.type == JsonDocument::t_number)
+			output.key("id").number(id.text.c_str(), id.text.size());
+	}
+
+	Writer& beginError(const RequestId& id, const char* type)
+	{
+		output.clear();
+		output.beginObject().key("error").beginObject();
+		writeId(id);
+		return output.member("type", type);
+	}
+
+	void finishError()
+	{
+		output.endObject().endObject();
+		out.emit(output);
+	}
+
+	void printSystemError(const RequestId& id, const boost::system::error_code& code)
+	{
+		beginError(id, "system error")
+			.member("category", code.category().name())
+			.member("code", code.value())
+			.member("message", code.message());
+		finishError();
+	}
+
+	// reports the exception currently being handled
+	void printError(const RequestId& id)
+	{
 		try {
-			processCommand(json);
-		} catch (const JsonValue::Ptr& err) {
-			std::cout << err;
+			throw;
+		} catch (const missing_field& e) {
+			beginError(id, "required field missing").member("field", e.field);
+			finishError();
+		} catch (const invalid_input& e) {
+			beginError(id, "invalid input").member("diag", e.diag);
+			finishError();
 		} catch (const NetworkException& e) {
-			std::cout << jobject({
-				{ "error", jobject({
-						{ "type", jvalue("system error") },
-						{ "category", jvalue(e.code().category().name()) },
-						{ "code", jvalue(e.code().value()) },
-						{ "message", jvalue(e.code().message()) }
-					}) }
-			});
+			printSystemError(id, e.code());
 		} catch (const bad_cast& e) {
-			std::cout << jobject({
-				{ "error", jobject({
-						{ "type", jvalue("invalid input") },
-						{ "diag", jvalue("invalid input value") },
-						{ "field", jvalue(e.field) }
-					}) }
-			});
+			beginError(id, "invalid input")
+				.member("diag", "invalid input value")
+				.member("field", e.field);
+			finishError();
 		} catch (const boost::system::system_error& e) {
-			std::cout << jobject({
-				{ "error", jobject({
-						{ "type", jvalue("system error") },
-						{ "category", jvalue(e.code().category().name()) },
-						{ "code", jvalue(e.code().value()) },
-						{ "message", jvalue(e.code().message()) }
-					}) }
-			});
+			printSystemError(id, e.code());
 		} catch (const std::exception& e) {
-			std::cout << jobject({
-				{ "error", jobject({
-						{ "type", jvalue("unknown") },
-						{ "diag", jvalue(e.what()) }
-					}) }
-			});
+			beginError(id, "unknown").member("diag", e.what());
+			finishError();
 		} catch (...) {
-			std::cout << jobject({
-				{ "error", jobject({
-						{ "type", jvalue("unknown") }
-					}) }
-			});
+			beginError(id, "unknown");
+			finishError();
 		}
 	}
 
-	void allowNextCommand()
-	{
-		input.asyncGetline(std::bind(&Hexajuice::onCommand, this, _1, _2));
-	}
-
 public:
-	Hexajuice(ba::io_service& io, FiledescLineWrapper& input)
-		: io(io), input(input)
+	Hexajuice(ba::io_service& io, FiledescFrameReader& input, FrameOutput& out)
+		: io(io), input(input), out(out), resolver(io), pending(0), inputClosed(false)
 	{
-		allowNextCommand();
+		input.start(
+			std::bind(&Hexajuice::onLine, this, _1, _2),
+			std::bind(&Hexajuice::onInputBatch, this, _1));
 	}
 };
 
 }
 
+template<typename Writer>
+void run(bool binary)
+{
+	ba::io_service io;
+	FiledescFrameReader input(io, STDIN_FILENO, binary);
+	FrameOutput output(io, STDOUT_FILENO, binary);
+	Hexajuice<Writer> juice(io, input, output);
+
+	io.run();
+	output.flush();
+}
+
 int main(int argc, char* argv[])
 {
-	if (argc != 1) {
-		std::cout << R"(Usage: hexajuice)" << std::endl;
+	po::options_description desc("Usage: hexajuice [options]\nAllowed options");
+	desc.add_options()
+		("help,h", "produce help message")
+		("binary,b", "exchange MessagePack documents in frames of a 32 bit big endian length and the payload "
+			"instead of JSON lines");
+	po::variables_map vm;
+
+	try {
+		po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+		po::notify(vm);
+	} catch (const std::exception& e) {
+		std::cerr << "Cannot process commandline options: " << e.what() << std::endl;
+		return 1;
+	}
+
+	if (vm.count("help")) {
+		std::cout << desc << std::endl;
 		return 0;
 	}
 
-	if (!FiledescLineWrapper::canWrap(STDIN_FILENO)) {
+	if (!FiledescFrameReader::canWrap(STDIN_FILENO)) {
 		std::cerr << "stdin is not a stream" << std::endl;
 		return 1;
 	}
 
 	try {
-		ba::io_service io;
-		FiledescLineWrapper input(io, STDIN_FILENO);
-		Hexajuice juice(io, input);
-
-		io.run();
+		if (vm.count("binary"))
+			run<MsgPackWriter>(true);
+		else
+			run<JsonWriter>(false);
 	} catch (const std::exception& e) {
 		std::cerr << "error: " << e.what() << std::endl;
 		return 1;
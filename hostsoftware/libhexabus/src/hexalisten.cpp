@@ -1,6 +1,8 @@
+#include <csignal>
 #include <iostream>
 #include <iomanip>
 #include <libhexabus/socket.hpp>
+#include <boost/bind.hpp>
 #include <boost/program_options.hpp>
 
 #include "shared.hpp"
@@ -11,12 +13,17 @@ namespace po = boost::program_options;
 int main(int argc, char* argv[])
 {
 	bool oneline = false;
+	size_t queueSize;
+	std::string overflow;
 	std::vector<std::string> interfaces;
 
 	po::options_description visibleOpts;
 	visibleOpts.add_options()
 		("help,h", "display this message")
-		("oneline,o", po::bool_switch(&oneline), "one packet per line");
+		("oneline,o", po::bool_switch(&oneline), "one packet per line")
+		("queue,q", po::value<size_t>(&queueSize)->default_value(4096), "number of packets buffered for output")
+		("overflow", po::value<std::string>(&overflow)->default_value("block"),
+			"what to do when output does not keep up {block|drop-oldest|drop-newest}");
 
 	po::options_description invisibleOpts;
 	invisibleOpts.add_options()
@@ -49,9 +56,19 @@ int main(int argc, char* argv[])
 		return 0;
 	}
 
+	OutputRing::Policy policy;
+	if (!OutputRing::parsePolicy(overflow, policy)) {
+		std::cerr << "error in command line: unknown overflow policy " << overflow << std::endl;
+		return 1;
+	}
+
+	// a reader that went away is noticed by the output queue, which stops listening
+	signal(SIGPIPE, SIG_IGN);
+
 	boost::asio::io_service io;
 	hexabus::Listener listener(io);
-	PacketPrinter printer(oneline);
+	OutputRing output(io, STDOUT_FILENO, queueSize, policy);
+	PacketPrinter printer(oneline, &output);
 
 	for (const auto& iface : interfaces) {
 		try {
@@ -67,12 +84,21 @@ int main(int argc, char* argv[])
 		throw e;
 	});
 
+	boost::asio::signal_set terminate(io, SIGINT, SIGTERM);
+	terminate.async_wait(boost::bind(&boost::asio::io_service::stop, &io));
+
+	int result = 0;
 	try {
 		io.run();
 	} catch (const std::exception& e) {
 		std::cerr << e.what() << std::endl;
-		return 1;
+		result = 1;
 	}
 
-	return 0;
+	// waiting for the reader should not keep further signals from ending the program
+	terminate.clear();
+	output.drain();
+	std::cerr << output.linesWritten() << " packets printed, " << output.linesDropped() << " dropped" << std::endl;
+
+	return result;
 }
@@ -1,7 +1,16 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
 #include <fstream>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <string.h>
 #include <libhexabus/common.hpp>
 #include <libhexabus/crc.hpp>
@@ -19,10 +28,9 @@
 #include <libklio/sqlite3/sqlite3-store.hpp>
 #include <boost/uuid/uuid_io.hpp>
 #include <boost/algorithm/string.hpp>
-#include <boost/lambda/lambda.hpp>
-#include <boost/lambda/bind.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
 
 // commandline parsing.
 #include <boost/program_options.hpp>
@@ -37,145 +45,642 @@ namespace po = boost::program_options;
 #include <unistd.h>
 
 #include <libhexabus/logger/logger.hpp>
+#include <libhexabus/logger/ingest_queue.hpp>
+#include <libhexabus/logger/segment_log.hpp>
 
 #include "shared.hpp"
 using boost::format;
 using boost::io::group;
 
-#define KLIO_AUTOCOMMIT 0
+typedef std::map<klio::Sensor::Ptr, klio::readings_t> sensor_readings_t;
+
+// stores readings of many sensors in one transaction. returns false if the transaction was rolled back
+static bool commit_readings(klio::SQLite3Store::Ptr& store, const sensor_readings_t& readings, uint64_t count)
+{
+	try {
+		store->start_transaction();
+		for (sensor_readings_t::const_iterator it = readings.begin(), end = readings.end(); it != end; ++it) {
+			store->add_readings(it->first, it->second);
+		}
+		store->commit_transaction();
+		return true;
+	} catch (std::exception const& ex) {
+		std::cerr << "Failed to commit " << count << " readings: " << ex.what() << std::endl;
+		try {
+			store->rollback_transaction();
+		} catch (std::exception const&) {
+		}
+		return false;
+	}
+}
+
+// Writes to the klio store on a thread of its own. The receive path only pushes into an IngestQueue; the
+// writer commits everything that accumulated in one transaction once commit_size readings are queued or
+// the oldest of them has waited for commit_interval.
+// With a SegmentLog, readings are appended to the log instead and synced every sync_interval; a
+// SegmentCompactor loads them into the store later.
+class StoreWriter {
+public:
+	typedef std::function<void (const klio::Sensor::Ptr& sensor)> lookup_done_fn_t;
+
+	struct Lookup {
+		std::string sensor_id;
+		lookup_done_fn_t done;
+	};
+
+	struct Op {
+		klio::Sensor::Ptr sensor;
+		klio::timestamp_t timestamp;
+		double value;
+		bool new_sensor;
+		// set for lookups, which carry neither a sensor nor a reading
+		std::shared_ptr<Lookup> lookup;
+	};
+
+	typedef hexabus::IngestQueue<Op> queue_t;
+
+	StoreWriter(klio::SQLite3Store::Ptr store, size_t queue_size, queue_t::Overflow overflow,
+			size_t commit_size, std::chrono::milliseconds commit_interval,
+			hexabus::SegmentLog* segments = NULL, std::chrono::milliseconds sync_interval = std::chrono::milliseconds(0))
+		: _store(store), _queue(queue_size, overflow), _commit_size(commit_size), _commit_interval(commit_interval),
+		  _segments(segments), _sync_interval(sync_interval), _last_sync(std::chrono::steady_clock::now()),
+		  _committed(0), _failed(0), _commits(0), _longest_switch(0)
+	{
+		_thread = std::thread(&StoreWriter::run, this);
+	}
+
+	~StoreWriter()
+	{
+		stop();
+	}
+
+	// returns false if the reading was dropped because the queue is full
+	bool add_reading(const klio::Sensor::Ptr& sensor, klio::timestamp_t ts, double value)
+	{
+		Op op = { sensor, ts, value, false, std::shared_ptr<Lookup>() };
+		return _queue.push(op);
+	}
+
+	// new sensors are never dropped, readings for them would fail to commit otherwise
+	void add_sensor(const klio::Sensor::Ptr& sensor)
+	{
+		Op op = { sensor, 0, 0, true, std::shared_ptr<Lookup>() };
+		_queue.push(op, true);
+	}
+
+	// looks a sensor up by its external id on the writer thread, after the sensors queued before it were added.
+	// done is called on the writer thread, with an empty pointer if the store does not know the sensor
+	void lookup_sensor(const std::string& sensor_id, const lookup_done_fn_t& done)
+	{
+		Lookup lookup = { sensor_id, done };
+		Op op = { klio::Sensor::Ptr(), 0, 0, false, std::make_shared<Lookup>(lookup) };
+		_queue.push(op, true);
+	}
+
+	// runs fn with exclusive access to the store, between two commits of the writer thread
+	template<typename Fn>
+	typename std::result_of<Fn(klio::SQLite3Store::Ptr&)>::type with_store(Fn fn)
+	{
+		std::lock_guard<std::mutex> lock(_store_lock);
+		return fn(_store);
+	}
+
+	// replaces the store between two commits of the writer thread. make_store gets the current store and
+	// returns its replacement. it runs with the writer locked out, so it should be quick; readings keep
+	// queueing up meanwhile. returns the old store
+	template<typename Fn>
+	klio::SQLite3Store::Ptr switch_store(Fn make_store)
+	{
+		std::lock_guard<std::mutex> lock(_store_lock);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		klio::SQLite3Store::Ptr old = _store;
+		_store = make_store(old);
+
+		uint64_t pause = std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - start).count();
+		if (pause > _longest_switch)
+			_longest_switch = pause;
+		return old;
+	}
+
+	// commits everything still queued and stops the writer thread. the active segment is sealed
+	void stop()
+	{
+		_queue.close();
+		if (_thread.joinable())
+			_thread.join();
+
+		if (_segments) {
+			try {
+				_segments->seal();
+			} catch (hexabus::GenericException const& ex) {
+				std::cerr << "Failed to seal segment: " << ex.what() << std::endl;
+			}
+		}
+	}
+
+	void print_statistics(std::ostream& out) const
+	{
+		queue_t::Statistics stats = _queue.statistics();
+
+		out << "Ingest: " << stats.pushed << " queued, "
+			<< stats.dropped << " dropped, "
+			<< _committed << " committed, "
+			<< _failed << " failed in "
+			<< _commits << " commits, "
+			<< "queue high watermark " << stats.high_watermark << ", "
+			<< "longest store switch " << _longest_switch / 1000.0 << " ms" << std::endl;
+	}
 
-class Logger : public hexabus::Logger {
 private:
-  bfs::path store_file;
-  klio::SQLite3Store::Ptr store;
-  unsigned int _packet_counter;
-  unsigned int _packet_counter_max;
+	StoreWriter(const StoreWriter&);
+	StoreWriter& operator=(const StoreWriter&);
 
-  klio::Sensor::Ptr lookup_sensor(const std::string& id)
-		{
-			std::vector<klio::Sensor::Ptr> sensors = store->get_sensors_by_external_id(id);
-			
-			if (!sensors.size())
-				return klio::Sensor::Ptr();
-      return sensors[0];
+	void run()
+	{
+		std::vector<Op> batch;
+
+		while (_queue.pop_batch(batch, _commit_size, _commit_interval)) {
+			write_batch(batch);
 		}
+	}
 
-  void new_sensor_found(klio::Sensor::Ptr sensor, const boost::asio::ip::address_v6&)
-		{
-			store->add_sensor(sensor);
-			std::cout << "Created new sensor: " << sensor->str() << std::endl;
-#if KLIO_AUTOCOMMIT
-      store->commit_transaction();
-      store->start_transaction();
-#endif
+	// adds the new sensors of the batch and answers its lookups, in the order they were queued
+	void add_sensors(const std::vector<Op>& batch)
+	{
+		std::unique_lock<std::mutex> lock(_store_lock, std::defer_lock);
+
+		for (std::vector<Op>::const_iterator it = batch.begin(), end = batch.end(); it != end; ++it) {
+			if (!it->new_sensor && !it->lookup)
+				continue;
+
+			if (!lock.owns_lock())
+				lock.lock();
+			if (it->lookup) {
+				klio::Sensor::Ptr sensor;
+				try {
+					std::vector<klio::Sensor::Ptr> sensors = _store->get_sensors_by_external_id(it->lookup->sensor_id);
+					if (sensors.size())
+						sensor = sensors[0];
+				} catch (klio::StoreException const& ex) {
+					std::cerr << "Failed to look up sensor " << it->lookup->sensor_id << ": " << ex.what() << std::endl;
+				}
+				it->lookup->done(sensor);
+				continue;
+			}
+
+			try {
+				_store->add_sensor(it->sensor);
+				std::cout << "Created new sensor: " << it->sensor->str() << std::endl;
+			} catch (klio::StoreException const& ex) {
+				std::cerr << "Failed to add sensor " << it->sensor->external_id() << ": " << ex.what() << std::endl;
+			}
+		}
+	}
+
+	void write_batch(std::vector<Op>& batch)
+	{
+		// readings of a sensor are only queued after the sensor itself, so adding all sensors of the batch
+		// first keeps them in order
+		add_sensors(batch);
+
+		// the segment log is not shared, appends do not have to wait for the compactor to release the store
+		if (_segments) {
+			append_batch(batch);
+			return;
+		}
+
+		sensor_readings_t readings;
+		uint64_t count = 0;
+		for (std::vector<Op>::const_iterator it = batch.begin(), end = batch.end(); it != end; ++it) {
+			if (it->new_sensor || it->lookup)
+				continue;
+
+			readings[it->sensor][it->timestamp] = it->value;
+			count++;
+		}
+
+		if (!count)
+			return;
+
+		std::lock_guard<std::mutex> lock(_store_lock);
+		if (commit_readings(_store, readings, count)) {
+			_committed += count;
+			_commits++;
+		} else {
+			_failed += count;
+		}
+	}
+
+	void append_batch(const std::vector<Op>& batch)
+	{
+		uint64_t count = 0, total = 0;
+
+		for (std::vector<Op>::const_iterator it = batch.begin(), end = batch.end(); it != end; ++it) {
+			total += !it->new_sensor && !it->lookup;
+		}
+
+		try {
+			for (std::vector<Op>::const_iterator it = batch.begin(), end = batch.end(); it != end; ++it) {
+				if (it->new_sensor || it->lookup)
+					continue;
+
+				std::unordered_map<const klio::Sensor*, uint32_t>::const_iterator index = _segment_sensors.find(it->sensor.get());
+				if (index == _segment_sensors.end()) {
+					uint32_t idx = _segments->sensor_index(it->sensor->external_id());
+					index = _segment_sensors.insert(std::make_pair(it->sensor.get(), idx)).first;
+					_segment_sensor_refs.push_back(it->sensor);
+				}
+
+				_segments->append(index->second, it->timestamp, it->value);
+				count++;
+			}
+
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if (now - _last_sync >= _sync_interval) {
+				_segments->sync();
+				_last_sync = now;
+				_commits++;
+			}
+		} catch (hexabus::GenericException const& ex) {
+			std::cerr << "Failed to append readings to segment log: " << ex.what() << std::endl;
+			_failed += total - count;
 		}
+		_committed += count;
+	}
+
+	klio::SQLite3Store::Ptr _store;
+	std::mutex _store_lock;
+	queue_t _queue;
+	size_t _commit_size;
+	std::chrono::milliseconds _commit_interval;
+	std::thread _thread;
+
+	hexabus::SegmentLog* _segments;
+	std::chrono::milliseconds _sync_interval;
+	std::chrono::steady_clock::time_point _last_sync;
+	// sensors are keyed by address, the references keep the addresses from being reused
+	std::unordered_map<const klio::Sensor*, uint32_t> _segment_sensors;
+	std::vector<klio::Sensor::Ptr> _segment_sensor_refs;
+
+	std::atomic<uint64_t> _committed;
+	std::atomic<uint64_t> _failed;
+	std::atomic<uint64_t> _commits;
+	std::atomic<uint64_t> _longest_switch;
+};
+
+// Loads sealed segments of a SegmentLog into the store of a StoreWriter, one transaction per segment, and
+// removes them. A segment that cannot be loaded is kept and retried in the next round; after max_attempts
+// failed rounds it is moved aside as .bad, so it cannot hold back the segments behind it forever.
+class SegmentCompactor {
+public:
+	static const unsigned max_attempts = 5;
+
+	SegmentCompactor(hexabus::SegmentLog& segments, StoreWriter& writer, std::chrono::seconds interval)
+		: _segments(segments), _writer(writer), _interval(interval), _stopping(false), _loaded(0), _dropped(0), _bad(0)
+	{
+		_thread = std::thread(&SegmentCompactor::run, this);
+	}
 
-  void record_reading(klio::Sensor::Ptr sensor, klio::timestamp_t ts, double value)
+	~SegmentCompactor()
+	{
+		stop();
+	}
+
+	// loads all sealed segments once more, then stops
+	void stop()
+	{
 		{
-      double msecs1;
-      double msecs2;
-      double mdiff;
-      
-      struct timeval tv1;
-      struct timeval tv2;
-#if KLIO_AUTOCOMMIT
-      if( _packet_counter > _packet_counter_max ) {
-        _packet_counter = 0;
-        std::cout<<"need to commit fitst"<< std::endl;
-        store->commit_transaction();
-        store->start_transaction();
-      }
-#endif
+			std::lock_guard<std::mutex> lock(_lock);
+			_stopping = true;
+		}
+		_wakeup.notify_all();
+
+		if (_thread.joinable())
+			_thread.join();
+	}
+
+	void print_statistics(std::ostream& out) const
+	{
+		out << "Compaction: " << _loaded << " readings loaded, " << _dropped << " dropped, "
+			<< _bad << " segments moved aside" << std::endl;
+	}
+
+private:
+	SegmentCompactor(const SegmentCompactor&);
+	SegmentCompactor& operator=(const SegmentCompactor&);
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(_lock);
+
+		for (;;) {
+			lock.unlock();
+			// this is a bare thread, anything escaping would terminate hexalog
 			try {
+				compact();
+			} catch (std::exception const& ex) {
+				std::cerr << "Compaction failed: " << ex.what() << std::endl;
+			}
+			lock.lock();
 
-        gettimeofday(&tv1, NULL) ;
-        msecs1=(double)tv1.tv_sec + ((double)tv1.tv_usec/1000000);
-				std::cout << "Call Record-Reading at " <<  tv1.tv_sec << "." << tv1.tv_usec << std::endl;
-
-				store->add_reading(sensor, ts, value);
-        _packet_counter++;
-        gettimeofday(&tv2, NULL) ;
-        msecs2=(double)tv2.tv_sec + ((double)tv2.tv_usec/1000000);
-        mdiff = msecs2 - msecs1;
-        
-				std::cout << "Added reading " << value << " to sensor " << sensor->name() << " ("<<sensor->external_id()<< ")" << "t="<< ts << " diff=" <<mdiff << std::endl;
-			} catch (klio::StoreException const& ex) {
-        gettimeofday(&tv2, NULL) ;
-        msecs2=(double)tv2.tv_sec + ((double)tv2.tv_usec/1000000);
-        mdiff = msecs2 - msecs1;
+			if (_stopping)
+				break;
+			_wakeup.wait_for(lock, _interval, [this] () { return _stopping; });
+		}
+	}
+
+	void compact()
+	{
+		std::vector<bfs::path> sealed = _segments.sealed_segments();
+		std::vector<hexabus::SegmentLog::Record> records;
+
+		for (std::vector<bfs::path>::const_iterator it = sealed.begin(), end = sealed.end(); it != end; ++it) {
+			records.clear();
+			try {
+				hexabus::SegmentLog::read_segment(*it, records);
+			} catch (hexabus::GenericException const& ex) {
+				std::cerr << "Skipping segment: " << ex.what() << std::endl;
+				move_aside(*it);
+				continue;
+			}
 
-				std::cout << "Failed to record reading to sensor " << sensor->name()<< " ("<<sensor->external_id()<< ")"<< "t="<< ts << " diff=" << mdiff<< " : " << ex.what() << std::endl;
+			bool loaded;
+			try {
+				loaded = load(records);
 			} catch (std::exception const& ex) {
-        gettimeofday(&tv2, NULL) ;
-        msecs2=(double)tv2.tv_sec + ((double)tv2.tv_usec/1000000);
-        mdiff = msecs2 - msecs1;
+				std::cerr << "Could not load " << *it << ": " << ex.what() << std::endl;
+				loaded = false;
+			}
 
-				std::cout << "Failed to record reading to sensor " << sensor->name()<< " ("<<sensor->external_id()<< ")"<< "t="<< ts << " diff=" << mdiff<< " : " << ex.what() << std::endl;
+			if (!loaded) {
+				// later segments wait for this one, so readings of a sensor are loaded in order
+				if (++_attempts[*it] < max_attempts)
+					break;
+				std::cerr << "Giving up on " << *it << " after " << max_attempts << " attempts" << std::endl;
+				_attempts.erase(*it);
+				move_aside(*it);
+				continue;
 			}
+			_attempts.erase(*it);
+
+			// a segment that cannot be removed is loaded again in the next round
+			boost::system::error_code err;
+			bfs::remove(*it, err);
+			if (err)
+				std::cerr << "Could not remove " << *it << ": " << err.message() << std::endl;
 		}
+	}
 
-public:
-  Logger(const bfs::path& store_file,
-         klio::SQLite3Store::Ptr& store,
-         klio::TimeConverter& tc,
-         klio::SensorFactory& sensor_factory,
-         const std::string& sensor_timezone,
-         hexabus::DeviceInterrogator& interrogator,
-         hexabus::EndpointRegistry& reg)
-			: hexabus::Logger(tc, sensor_factory, sensor_timezone, interrogator, reg), store_file(store_file), store(store)
-      , _packet_counter(0)
-      , _packet_counter_max(10)
-		{
+	bool load(const std::vector<hexabus::SegmentLog::Record>& records)
+	{
+		return _writer.with_store([this, &records] (klio::SQLite3Store::Ptr& store) {
+			sensor_readings_t readings;
+			uint64_t count = 0;
+
+			for (std::vector<hexabus::SegmentLog::Record>::const_iterator r = records.begin(), end = records.end(); r != end; ++r) {
+				klio::Sensor::Ptr sensor = lookup_sensor(store, r->sensor);
+				if (!sensor) {
+					_dropped++;
+					continue;
+				}
+				readings[sensor][r->timestamp] = r->value;
+				count++;
+			}
+
+			if (!count)
+				return true;
+
+			if (!commit_readings(store, readings, count))
+				return false;
+			_loaded += count;
+			return true;
+		});
+	}
+
+	void move_aside(const bfs::path& segment)
+	{
+		bfs::path bad = segment;
+		bad.replace_extension(".bad");
+		boost::system::error_code err;
+		bfs::rename(segment, bad, err);
+		if (err)
+			std::cerr << "Could not move " << segment << " aside: " << err.message() << std::endl;
+		else
+			_bad++;
+	}
+
+	klio::Sensor::Ptr lookup_sensor(klio::SQLite3Store::Ptr& store, uint32_t index)
+	{
+		std::map<uint32_t, klio::Sensor::Ptr>::const_iterator it = _sensors.find(index);
+		if (it != _sensors.end())
+			return it->second;
+
+		klio::Sensor::Ptr sensor;
+		std::vector<klio::Sensor::Ptr> sensors = store->get_sensors_by_external_id(_segments.sensor_name(index));
+		if (sensors.size()) {
+			sensor = sensors[0];
+			_sensors.insert(std::make_pair(index, sensor));
 		}
+		return sensor;
+	}
+
+	hexabus::SegmentLog& _segments;
+	StoreWriter& _writer;
+	std::chrono::seconds _interval;
+	std::map<uint32_t, klio::Sensor::Ptr> _sensors;
+	// failed loads of segments that are still waiting
+	std::map<bfs::path, unsigned> _attempts;
+
+	std::mutex _lock;
+	std::condition_variable _wakeup;
+	bool _stopping;
+	std::thread _thread;
+
+	std::atomic<uint64_t> _loaded;
+	std::atomic<uint64_t> _dropped;
+	std::atomic<uint64_t> _bad;
+};
+
+class Logger : public hexabus::Logger {
+private:
+	boost::asio::io_service& io;
+	bfs::path store_file;
+	StoreWriter& writer;
+	std::thread rotation;
+	std::atomic<bool> rotating;
+
+	// the store is only touched by the writer thread, which hands the result back through the io_service
+	void lookup_sensor(const hexabus::SensorKey& key, const std::string& id)
+	{
+		writer.lookup_sensor(id, [this, key] (const klio::Sensor::Ptr& sensor) {
+			io.post([this, key, sensor] () { sensor_looked_up(key, sensor); });
+		});
+	}
+
+	void new_sensor_found(klio::Sensor::Ptr sensor, const boost::asio::ip::address_v6&)
+	{
+		writer.add_sensor(sensor);
+	}
+
+	void record_reading(klio::Sensor::Ptr sensor, klio::timestamp_t ts, double value)
+	{
+		writer.add_reading(sensor, ts, value);
+	}
+
+	// copies the sensors of the current store into a new store at path. the store is closed again, so that
+	// it can be renamed without its journal getting lost
+	std::set<boost::uuids::uuid> prepare_store(const bfs::path& path)
+	{
+		klio::StoreFactory store_factory;
+		std::set<boost::uuids::uuid> copied;
+
+		std::vector<klio::Sensor::Ptr> sensors = writer.with_store([] (klio::SQLite3Store::Ptr& store) {
+			return store->get_sensors();
+		});
+
+		bfs::remove(path);
+		klio::SQLite3Store::Ptr next = store_factory.create_sqlite3_store(path, false, false, 0, klio::SQLite3Store::OS_SYNC_OFF);
+		try {
+			for (std::vector<klio::Sensor::Ptr>::const_iterator it = sensors.begin(), end = sensors.end(); it != end; ++it) {
+				next->add_sensor(*it);
+				copied.insert((*it)->uuid());
+			}
+			next->flush(true);
+		} catch (...) {
+			next->close();
+			bfs::remove(path);
+			throw;
+		}
+		next->close();
+
+		return copied;
+	}
+
+	// moves the store file aside and continues in a fresh store with the same sensors. the new store is
+	// populated beforehand, the writer is only paused while the files are renamed and the new store is
+	// opened, the old store is closed afterwards.
+	void rotate(const bfs::path& dbname)
+	{
+		try {
+			bfs::path next_file = store_file.string() + ".next";
+			std::set<boost::uuids::uuid> copied = prepare_store(next_file);
+
+			klio::SQLite3Store::Ptr old = writer.switch_store([this, &dbname, &next_file, &copied] (klio::SQLite3Store::Ptr& current) {
+				klio::StoreFactory store_factory;
+				klio::SQLite3Store::Ptr next;
+
+				// no transaction is open while the writer is locked out, so the file can be moved away
+				bfs::rename(store_file, dbname);
+				try {
+					bfs::rename(next_file, store_file);
+					next = store_factory.open_sqlite3_store(store_file, false, false, 0, klio::SQLite3Store::OS_SYNC_OFF);
+
+					// sensors the writer added since the new store was prepared
+					std::vector<klio::Sensor::Ptr> sensors = current->get_sensors();
+					for (std::vector<klio::Sensor::Ptr>::const_iterator it = sensors.begin(), end = sensors.end(); it != end; ++it) {
+						if (!copied.count((*it)->uuid()))
+							next->add_sensor(*it);
+					}
+				} catch (...) {
+					if (next)
+						next->close();
+					if (bfs::exists(store_file))
+						bfs::remove(store_file);
+					bfs::rename(dbname, store_file);
+					throw;
+				}
+
+				return next;
+			});
 
-  void rotate_stores()
-		{
-			std::cout << "Rotating store " << store_file << "..." << std::endl;
-			std::cout << "Rotating store call flush " << store_file << "..." << std::endl;
-      fflush(stdout);
 			try {
-        store->flush(true);
+				old->flush(true);
 			} catch (klio::StoreException const& ex) {
 				std::cout << "Failed to flush the buffers : " << ex.what() << std::endl;
-      }
-      std::cout << "Rotating store flushed " << store_file << "..." << std::endl;
-      fflush(stdout);
-
-			std::cout << "Reopening store" << std::endl;
-
-      const boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
-
-      std::string s;
-      s= str( format("%04d%02d%02d-%02d%02d")        % now.date().year_month_day().year
-              % now.date().year_month_day().month.as_number()
-              % now.date().year_month_day().day.as_number()
-              % now.time_of_day().hours()
-              % now.time_of_day().minutes());
-
-      std::string name(store_file.string());
-      name+=".";
-      name+=s;
-      
-      bfs::path dbname(name);
-      std::cout << "===> renaming to: "<< name<<std::endl;
-      fflush(stdout);
-			try {
-        store->rotate(dbname);
-			} catch (klio::StoreException const& ex) {
-				std::cout << "Failed to rotate the klio-databse : " << ex.what() << std::endl;
-      }
-      
-
-#if KLIO_AUTOCOMMIT
-      store->start_transaction();
-#endif
+			}
+			old->close();
 
 			std::cout << "Rotation done" << std::endl;
+		} catch (std::exception const& ex) {
+			std::cout << "Failed to rotate the klio-databse : " << ex.what() << std::endl;
+		}
+
+		rotating = false;
+	}
+
+public:
+	Logger(boost::asio::io_service& io,
+			const bfs::path& store_file,
+			StoreWriter& writer,
+			klio::TimeConverter& tc,
+			klio::SensorFactory& sensor_factory,
+			const std::string& sensor_timezone,
+			hexabus::DeviceInterrogator& interrogator,
+			hexabus::EndpointRegistry& reg)
+		: hexabus::Logger(tc, sensor_factory, sensor_timezone, interrogator, reg), io(io), store_file(store_file), writer(writer),
+		  rotating(false)
+	{
+	}
+
+	~Logger()
+	{
+		finish_rotation();
+	}
+
+	// starts a rotation in the background, packets are received and queued as usual meanwhile
+	void rotate_stores()
+	{
+		if (rotating) {
+			std::cout << "Rotation of " << store_file << " still in progress" << std::endl;
+			return;
 		}
+
+		std::cout << "Rotating store " << store_file << "..." << std::endl;
+		writer.print_statistics(std::cout);
+		print_statistics(std::cout);
+
+		const boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
+
+		std::string s;
+		s = str(format("%04d%02d%02d-%02d%02d") % now.date().year_month_day().year
+				% now.date().year_month_day().month.as_number()
+				% now.date().year_month_day().day.as_number()
+				% now.time_of_day().hours()
+				% now.time_of_day().minutes());
+
+		std::string name(store_file.string());
+		name += ".";
+		name += s;
+
+		bfs::path dbname(name);
+		std::cout << "===> renaming to: " << name << std::endl;
+
+		finish_rotation();
+		rotating = true;
+		rotation = std::thread(&Logger::rotate, this, dbname);
+	}
+
+	void finish_rotation()
+	{
+		if (rotation.joinable())
+			rotation.join();
+	}
 };
 
 
 
+static std::vector<klio::Sensor::Ptr> load_sensors(StoreWriter& writer)
+{
+	std::vector<klio::Sensor::Ptr> sensors = writer.with_store([] (klio::SQLite3Store::Ptr& store) {
+		return store->get_sensors();
+	});
+
+	std::cout << "Preloaded " << sensors.size() << " sensors" << std::endl;
+	return sensors;
+}
+
 enum ErrorCode {
 	ERR_NONE = 0,
 
@@ -190,6 +695,69 @@ enum ErrorCode {
 	ERR_OTHER = 127
 };
 
+static void print_registry_error(const hexabus::GenericException& e)
+{
+	std::cerr << "Could not reload endpoint registry: " << e.reason() << std::endl;
+}
+
+static void on_rotate_signal(const boost::system::error_code& err, boost::asio::signal_set& signals, Logger& logger)
+{
+	if (err)
+		return;
+
+	logger.rotate_stores();
+	signals.async_wait(boost::bind(on_rotate_signal, _1, boost::ref(signals), boost::ref(logger)));
+}
+
+// closes windows of sensors that stopped sending
+static void on_window_timer(const boost::system::error_code& err, boost::asio::deadline_timer& timer, Logger& logger,
+		klio::TimeConverter& tc)
+{
+	if (err)
+		return;
+
+	logger.flush_windows(tc.get_timestamp());
+	timer.expires_from_now(boost::posix_time::seconds(5));
+	timer.async_wait(boost::bind(on_window_timer, _1, boost::ref(timer), boost::ref(logger), boost::ref(tc)));
+}
+
+// <eid or unit>=<seconds>[:mean|min|max|last]
+static bool parse_aggregation(const std::string& spec, std::string& key, hexabus::AggregationPolicy& policy)
+{
+	size_t eq = spec.find('=');
+	if (eq == 0 || eq == std::string::npos)
+		return false;
+
+	key = spec.substr(0, eq);
+	std::string window = spec.substr(eq + 1);
+	std::string function = "mean";
+
+	size_t colon = window.find(':');
+	if (colon != std::string::npos) {
+		function = window.substr(colon + 1);
+		window = window.substr(0, colon);
+	}
+
+	try {
+		policy.window = boost::lexical_cast<uint32_t>(window);
+	} catch (const boost::bad_lexical_cast&) {
+		return false;
+	}
+
+	if (function == "mean") {
+		policy.function = hexabus::AggregationPolicy::mean;
+	} else if (function == "min") {
+		policy.function = hexabus::AggregationPolicy::min;
+	} else if (function == "max") {
+		policy.function = hexabus::AggregationPolicy::max;
+	} else if (function == "last") {
+		policy.function = hexabus::AggregationPolicy::last;
+	} else {
+		return false;
+	}
+
+	return true;
+}
 
 int main(int argc, char** argv)
 {
@@ -202,7 +770,22 @@ int main(int argc, char** argv)
 		("storefile,s", po::value<std::string>(), "the data store to use")
 		("timezone,t", po::value<std::string>(), "the timezone to use for new sensors")
 		("interface,I", po::value<std::string>(), "interface to listen on")
-		("bind,b", po::value<std::string>(), "address to bind to");
+		("bind,b", po::value<std::string>(), "address to bind to")
+		("queue-size", po::value<unsigned>()->default_value(100000), "maximum number of readings waiting to be stored")
+		("overflow", po::value<std::string>()->default_value("drop"), "what to do with readings when the queue is full (drop|block)")
+		("commit-size", po::value<unsigned>()->default_value(1000), "number of readings to store in one transaction")
+		("commit-interval", po::value<unsigned>()->default_value(1000), "maximum time in ms a reading waits to be stored")
+		("segment-dir", po::value<std::string>(), "append readings to a segment log in this directory, load them into the store later")
+		("segment-size", po::value<unsigned>()->default_value(1 << 20), "number of readings per segment")
+		("segment-sync", po::value<unsigned>()->default_value(1000), "interval in ms to sync the segment log to disk")
+		("compact-interval", po::value<unsigned>()->default_value(60), "interval in s to load sealed segments into the store")
+		("sensor-cache", po::value<unsigned>()->default_value(4096), "maximum number of sensors kept in memory, 0 for no limit")
+		("backlog-per-sensor", po::value<unsigned>()->default_value(1000), "maximum number of readings kept for a new sensor until its device name is known")
+		("backlog-total", po::value<unsigned>()->default_value(100000), "maximum number of readings kept for all new sensors")
+		("preload", po::value<std::string>()->default_value("sync"),
+			"load all sensors of the store at startup (sync), in the background while receiving packets (async) or look them up one by one (none)")
+		("aggregate", po::value<std::vector<std::string> >(),
+			"record one value per window for sensors with this eid or unit: <eid|unit>=<seconds>[:mean|min|max|last]");
 
 	po::positional_options_description p;
 	p.add("interface", 1);
@@ -241,6 +824,39 @@ int main(int argc, char** argv)
 		return ERR_PARAMETER_MISSING;
 	}
 
+	StoreWriter::queue_t::Overflow overflow;
+	if (vm["overflow"].as<std::string>() == "drop") {
+		overflow = StoreWriter::queue_t::drop_newest;
+	} else if (vm["overflow"].as<std::string>() == "block") {
+		overflow = StoreWriter::queue_t::block;
+	} else {
+		std::cerr << "Invalid overflow policy " << vm["overflow"].as<std::string>() << ", must be drop or block" << std::endl;
+		return ERR_PARAMETER_VALUE_INVALID;
+	}
+	if (!vm["queue-size"].as<unsigned>() || !vm["commit-size"].as<unsigned>() || !vm["segment-size"].as<unsigned>()) {
+		std::cerr << "Queue, commit and segment size must be positive" << std::endl;
+		return ERR_PARAMETER_VALUE_INVALID;
+	}
+
+	std::string preload(vm["preload"].as<std::string>());
+	if (preload != "sync" && preload != "async" && preload != "none") {
+		std::cerr << "Invalid preload mode " << preload << ", must be sync, async or none" << std::endl;
+		return ERR_PARAMETER_VALUE_INVALID;
+	}
+
+	std::vector<std::pair<std::string, hexabus::AggregationPolicy> > aggregations;
+	if (vm.count("aggregate")) {
+		const std::vector<std::string>& specs = vm["aggregate"].as<std::vector<std::string> >();
+		for (std::vector<std::string>::const_iterator it = specs.begin(), end = specs.end(); it != end; ++it) {
+			std::pair<std::string, hexabus::AggregationPolicy> aggregation;
+			if (!parse_aggregation(*it, aggregation.first, aggregation.second)) {
+				std::cerr << "Invalid aggregation " << *it << ", must be <eid|unit>=<seconds>[:mean|min|max|last]" << std::endl;
+				return ERR_PARAMETER_FORMAT;
+			}
+			aggregations.push_back(aggregation);
+		}
+	}
+
 	std::string interface(vm["interface"].as<std::string>());
 	boost::asio::ip::address_v6 addr(boost::asio::ip::address_v6::any());
 	boost::asio::io_service io;
@@ -266,12 +882,8 @@ int main(int argc, char** argv)
 			std::cerr << "Hint: you can create a database using klio-store create <dbfile>" << std::endl;
 			return ERR_PARAMETER_VALUE_INVALID;
 		}
-#if KLIO_AUTOCOMMIT
-		store = store_factory.open_sqlite3_store(db, false, true, 30);
-    store->start_transaction();
-#else
-		store = store_factory.open_sqlite3_store(db, true, true, 30, klio::SQLite3Store::OS_SYNC_OFF);
-#endif
+		// transactions are managed by the StoreWriter
+		store = store_factory.open_sqlite3_store(db, false, false, 0, klio::SQLite3Store::OS_SYNC_OFF);
 
 		std::string sensor_timezone("Europe/Berlin"); 
 		if (! vm.count("timezone")) {
@@ -289,8 +901,53 @@ int main(int argc, char** argv)
 		klio::TimeConverter tc;
 		hexabus::DeviceInterrogator di(network);
 		hexabus::EndpointRegistry reg;
+		reg.onReloadError(print_registry_error);
+		reg.watch();
+
+		std::unique_ptr<hexabus::SegmentLog> segments;
+		if (vm.count("segment-dir")) {
+			segments.reset(new hexabus::SegmentLog(vm["segment-dir"].as<std::string>(), vm["segment-size"].as<unsigned>()));
+		}
+
+		StoreWriter writer(store, vm["queue-size"].as<unsigned>(), overflow,
+				vm["commit-size"].as<unsigned>(), std::chrono::milliseconds(vm["commit-interval"].as<unsigned>()),
+				segments.get(), std::chrono::milliseconds(vm["segment-sync"].as<unsigned>()));
+		Logger logger(io, storefile, writer, tc, sensor_factory, sensor_timezone, di, reg);
+		logger.setSensorCacheCapacity(vm["sensor-cache"].as<unsigned>());
+		logger.setBacklogLimits(vm["backlog-per-sensor"].as<unsigned>(), vm["backlog-total"].as<unsigned>());
+
+		// keys made of digits only are eids, everything else is a unit
+		for (std::vector<std::pair<std::string, hexabus::AggregationPolicy> >::const_iterator it = aggregations.begin(),
+				end = aggregations.end(); it != end; ++it) {
+			if (it->first.find_first_not_of("0123456789") == std::string::npos) {
+				logger.setAggregation(boost::lexical_cast<uint32_t>(it->first), it->second);
+			} else {
+				logger.setAggregation(it->first, it->second);
+			}
+		}
 
-		Logger logger(storefile, store, tc, sensor_factory, sensor_timezone, di, reg);
+		std::thread preloader;
+		if (preload == "sync") {
+			logger.preload_sensors(load_sensors(writer));
+		} else if (preload == "async") {
+			// the io_service runs all Logger callbacks, so the result is handed over through it
+			logger.begin_preload();
+			preloader = std::thread([&io, &writer, &logger] () {
+				try {
+					std::vector<klio::Sensor::Ptr> sensors = load_sensors(writer);
+					io.post([&logger, sensors] () { logger.preload_sensors(sensors); });
+				} catch (const std::exception& e) {
+					std::cerr << "Could not preload sensors: " << e.what() << std::endl;
+					io.post([&logger] () { logger.cancel_preload(); });
+				}
+			});
+		}
+
+		// segments left over from the last run are loaded right away
+		std::unique_ptr<SegmentCompactor> compactor;
+		if (segments) {
+			compactor.reset(new SegmentCompactor(*segments, writer, std::chrono::seconds(vm["compact-interval"].as<unsigned>())));
+		}
 
 		network.bind(addr);
 		listener.listen(interface);
@@ -299,35 +956,41 @@ int main(int argc, char** argv)
 		boost::asio::signal_set rotate_handler(io, SIGHUP);
 		boost::asio::signal_set terminate_handler(io, SIGTERM);
 
-    bool term_received = false;
-		while (!term_received) {
-			bool hup_received = false;
+		// rotation runs in the background, so packets keep being received while it is in progress
+		rotate_handler.async_wait(boost::bind(on_rotate_signal, _1, boost::ref(rotate_handler), boost::ref(logger)));
+		terminate_handler.async_wait(boost::bind(&boost::asio::io_service::stop, &io));
 
-			using namespace boost::lambda;
-			rotate_handler.async_wait(
-        (var(hup_received) = true,
-         boost::lambda::bind(&boost::asio::io_service::stop, &io)));
-			terminate_handler.async_wait(
-        (var(term_received) = true,
-         boost::lambda::bind(&boost::asio::io_service::stop, &io)));
-
-			io.reset();
-			io.run();
+		boost::asio::deadline_timer window_timer(io);
+		if (!aggregations.empty()) {
+			on_window_timer(boost::system::error_code(), window_timer, logger, tc);
+		}
 
-			if (hup_received) {
-				logger.rotate_stores();
-			} else {
-				break;
-			}
+		io.run();
+
+		std::cout << "Terminating hexalog."<< std::endl;
+		if (preloader.joinable())
+			preloader.join();
+		logger.flush_windows();
+		logger.finish_rotation();
+		writer.stop();
+		writer.print_statistics(std::cout);
+		logger.print_statistics(std::cout);
+		if (compactor) {
+			compactor->stop();
+			compactor->print_statistics(std::cout);
 		}
-    std::cout << "Terminating hexalog."<< std::endl;
-    store->flush(true);
-    store->close();
-    fflush(stdout);
+		writer.with_store([] (klio::SQLite3Store::Ptr& store) {
+			store->flush(true);
+			store->close();
+		});
+		fflush(stdout);
     
 	} catch (const hexabus::NetworkException& e) {
 		std::cerr << "Network error: " << e.code().message() << std::endl;
 		return ERR_NETWORK;
+	} catch (const hexabus::GenericException& e) {
+		std::cerr << "Error: " << e.reason() << std::endl;
+		return ERR_OTHER;
 	} catch (const klio::GenericException& e) {
 		std::cerr << "Klio error: " << e.reason() << std::endl;
 		return ERR_KLIO;
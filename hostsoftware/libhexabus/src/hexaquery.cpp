@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <libhexabus/common.hpp>
+#include <libhexabus/error.hpp>
+#include <libhexabus/logger/column_store.hpp>
+
+#include <libklio/common.hpp>
+#include <libklio/store.hpp>
+#include <libklio/store-factory.hpp>
+#include <libklio/sensor.hpp>
+#include <libklio/sqlite3/sqlite3-store.hpp>
+#include <boost/uuid/uuid_io.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+// commandline parsing.
+#include <boost/program_options.hpp>
+#include <boost/program_options/positional_options.hpp>
+namespace po = boost::program_options;
+
+// A column directory holds one <uuid>.col file per sensor and a "sensors" file with one line per sensor:
+// uuid, external id, name and unit, separated by tabs.
+
+enum ErrorCode {
+	ERR_NONE = 0,
+
+	ERR_UNKNOWN_PARAMETER = 1,
+	ERR_PARAMETER_MISSING = 2,
+	ERR_PARAMETER_FORMAT = 3,
+	ERR_PARAMETER_VALUE_INVALID = 4,
+
+	ERR_KLIO = 6,
+
+	ERR_OTHER = 127
+};
+
+struct SensorEntry {
+	std::string uuid;
+	std::string external_id;
+	std::string name;
+	std::string unit;
+};
+
+static std::vector<SensorEntry> read_sensors(const bfs::path& dir)
+{
+	std::ifstream in((dir / "sensors").c_str());
+	if (!in)
+		throw hexabus::GenericException("No sensors file in " + dir.string());
+
+	std::vector<SensorEntry> result;
+	std::string line;
+	while (std::getline(in, line)) {
+		std::vector<std::string> fields;
+		size_t pos = 0, tab;
+		while ((tab = line.find('\t', pos)) != std::string::npos) {
+			fields.push_back(line.substr(pos, tab - pos));
+			pos = tab + 1;
+		}
+		fields.push_back(line.substr(pos));
+
+		if (fields.size() != 4)
+			throw hexabus::GenericException("Invalid sensors file in " + dir.string());
+
+		SensorEntry e = { fields[0], fields[1], fields[2], fields[3] };
+		result.push_back(e);
+	}
+
+	return result;
+}
+
+static std::string strip_tabs(std::string s)
+{
+	for (std::string::iterator it = s.begin(), end = s.end(); it != end; ++it) {
+		if (*it == '\t' || *it == '\n')
+			*it = ' ';
+	}
+	return s;
+}
+
+static int export_store(const bfs::path& storefile, const bfs::path& dir, uint32_t block_size,
+		hexabus::ColumnEncoding encoding)
+{
+	if (!bfs::exists(storefile)) {
+		std::cerr << "Database " << storefile << " does not exist, cannot continue." << std::endl;
+		return ERR_PARAMETER_VALUE_INVALID;
+	}
+	bfs::create_directories(dir);
+
+	klio::StoreFactory store_factory;
+	klio::SQLite3Store::Ptr store = store_factory.open_sqlite3_store(storefile);
+
+	std::vector<klio::Sensor::Ptr> sensors = store->get_sensors();
+	std::ofstream index((dir / "sensors.tmp").c_str());
+
+	for (std::vector<klio::Sensor::Ptr>::const_iterator it = sensors.begin(), end = sensors.end(); it != end; ++it) {
+		const klio::Sensor::Ptr& sensor = *it;
+		std::string uuid = boost::uuids::to_string(sensor->uuid());
+
+		// readings_t is ordered by timestamp, just like the column file
+		klio::readings_t_Ptr readings = store->get_all_readings(sensor);
+		hexabus::ColumnWriter writer(dir / (uuid + ".col"), block_size, encoding);
+		for (klio::readings_cit_t r = readings->begin(), rend = readings->end(); r != rend; ++r) {
+			writer.append(r->first, r->second);
+		}
+		writer.close();
+
+		index << uuid << '\t' << strip_tabs(sensor->external_id()) << '\t'
+			<< strip_tabs(sensor->name()) << '\t' << strip_tabs(sensor->unit()) << '\n';
+		std::cout << "Exported " << readings->size() << " readings of " << sensor->external_id() << std::endl;
+	}
+
+	index.close();
+	if (!index)
+		throw hexabus::GenericException("Could not write sensors file");
+	bfs::rename(dir / "sensors.tmp", dir / "sensors");
+
+	store->close();
+	return ERR_NONE;
+}
+
+static int list_sensors(const bfs::path& dir)
+{
+	std::vector<SensorEntry> sensors = read_sensors(dir);
+
+	for (std::vector<SensorEntry>::const_iterator it = sensors.begin(), end = sensors.end(); it != end; ++it) {
+		hexabus::ColumnReader reader(dir / (it->uuid + ".col"));
+
+		std::cout << it->uuid << '\t' << it->external_id << '\t' << it->name << '\t' << it->unit << '\t'
+			<< reader.size() << " readings";
+		if (reader.size())
+			std::cout << " from " << reader.first_timestamp() << " to " << reader.last_timestamp();
+		std::cout << std::endl;
+	}
+
+	return ERR_NONE;
+}
+
+// size of every column file and the time needed to read all of its readings
+static int print_stats(const bfs::path& dir)
+{
+	using namespace boost::posix_time;
+
+	std::vector<SensorEntry> sensors = read_sensors(dir);
+	uint64_t total_count = 0, total_bytes = 0;
+	time_duration total_time;
+
+	std::cout << "sensor,encoding,readings,bytes,bytes_per_reading,readings_per_second\n";
+	std::cout.precision(4);
+	for (std::vector<SensorEntry>::const_iterator it = sensors.begin(), end = sensors.end(); it != end; ++it) {
+		hexabus::ColumnReader reader(dir / (it->uuid + ".col"));
+		if (!reader.size())
+			continue;
+
+		double sum = 0;
+		ptime start = microsec_clock::universal_time();
+		reader.scan(reader.first_timestamp(), reader.last_timestamp() + 1, [&sum] (int64_t, double value) {
+			sum += value;
+		});
+		time_duration elapsed = microsec_clock::universal_time() - start;
+		// keeps the scan from being optimized away
+		if (sum != sum)
+			std::cerr << "NaN readings in " << it->external_id << std::endl;
+
+		std::cout << it->external_id << ','
+			<< (reader.encoding() == hexabus::column_gorilla ? "gorilla" : "plain") << ','
+			<< reader.size() << ',' << reader.file_size() << ','
+			<< double(reader.file_size()) / reader.size() << ','
+			<< double(reader.size()) / std::max(elapsed.total_microseconds(), int64_t(1)) * 1e6 << '\n';
+
+		total_count += reader.size();
+		total_bytes += reader.file_size();
+		total_time += elapsed;
+	}
+
+	if (total_count) {
+		std::cout << "total,," << total_count << ',' << total_bytes << ','
+			<< double(total_bytes) / total_count << ','
+			<< double(total_count) / std::max(total_time.total_microseconds(), int64_t(1)) * 1e6 << std::endl;
+	}
+
+	return ERR_NONE;
+}
+
+// seconds since the epoch, either given as such or as "YYYY-MM-DD HH:MM:SS" in UTC
+static int64_t parse_time(const std::string& value)
+{
+	try {
+		return boost::lexical_cast<int64_t>(value);
+	} catch (const boost::bad_lexical_cast&) {
+	}
+
+	using namespace boost::posix_time;
+	ptime t = time_from_string(value);
+	if (t.is_not_a_date_time())
+		throw hexabus::GenericException("Invalid time " + value);
+	return (t - ptime(boost::gregorian::date(1970, 1, 1))).total_seconds();
+}
+
+static void print_aggregate(int64_t start, const hexabus::ColumnAggregate& agg)
+{
+	std::cout << start << ',' << agg.count << ','
+		<< agg.min << ',' << agg.max << ',' << agg.mean() << ',' << agg.sum << '\n';
+}
+
+static int query(const bfs::path& dir, const std::string& name, const po::variables_map& vm)
+{
+	std::vector<SensorEntry> sensors = read_sensors(dir);
+	std::vector<SensorEntry>::const_iterator sensor, end;
+
+	for (sensor = sensors.begin(), end = sensors.end(); sensor != end; ++sensor) {
+		if (sensor->uuid == name || sensor->external_id == name || sensor->name == name)
+			break;
+	}
+	if (sensor == end) {
+		std::cerr << "Unknown sensor " << name << std::endl;
+		return ERR_PARAMETER_VALUE_INVALID;
+	}
+
+	hexabus::ColumnReader reader(dir / (sensor->uuid + ".col"));
+
+	int64_t from = vm.count("from") ? parse_time(vm["from"].as<std::string>()) : reader.first_timestamp();
+	int64_t to = vm.count("to") ? parse_time(vm["to"].as<std::string>()) : reader.last_timestamp() + 1;
+
+	std::cout.precision(10);
+	if (vm.count("raw")) {
+		std::cout << "timestamp,value\n";
+		reader.scan(from, to, [] (int64_t ts, double value) {
+			std::cout << ts << ',' << value << '\n';
+		});
+	} else if (vm.count("bucket")) {
+		int64_t bucket = vm["bucket"].as<unsigned>();
+		if (!bucket) {
+			std::cerr << "Bucket size must be positive" << std::endl;
+			return ERR_PARAMETER_VALUE_INVALID;
+		}
+
+		std::cout << "start,count,min,max,avg,sum\n";
+		reader.aggregate(from, to, bucket, print_aggregate);
+	} else {
+		std::cout << "start,count,min,max,avg,sum\n";
+		print_aggregate(from, reader.aggregate(from, to));
+	}
+	std::cout.flush();
+
+	return ERR_NONE;
+}
+
+int main(int argc, char** argv)
+{
+	std::ostringstream oss;
+	oss << "Usage: " << argv[0] << " export <storefile> <dir> | list <dir> | stats <dir> | query <dir> <sensor> [options]";
+	po::options_description desc(oss.str());
+	desc.add_options()
+		("help,h", "produce help message")
+		("version,v", "print version and exit")
+		("command", po::value<std::string>(), "export, list, stats or query")
+		("args", po::value<std::vector<std::string> >(), "arguments of the command")
+		("block-size", po::value<unsigned>()->default_value(4096), "readings per block when exporting")
+		("compress,c", "store delta of delta timestamps and XORed values when exporting")
+		("from,f", po::value<std::string>(), "start of the queried time range (seconds since the epoch or \"YYYY-MM-DD HH:MM:SS\" UTC)")
+		("to,t", po::value<std::string>(), "end of the queried time range, exclusive")
+		("bucket,b", po::value<unsigned>(), "aggregate over buckets of this many seconds")
+		("raw,r", "print the readings instead of aggregates");
+
+	po::positional_options_description p;
+	p.add("command", 1);
+	p.add("args", -1);
+
+	po::variables_map vm;
+	try {
+		po::store(po::command_line_parser(argc, argv).
+				options(desc).positional(p).run(), vm);
+		po::notify(vm);
+	} catch (const std::exception& e) {
+		std::cerr << "Cannot process commandline options: " << e.what() << std::endl;
+		return ERR_UNKNOWN_PARAMETER;
+	}
+
+	if (vm.count("help")) {
+		std::cout << desc << std::endl;
+		return ERR_NONE;
+	}
+
+	if (vm.count("version")) {
+		std::cout << "libhexabus version " << hexabus::version() << std::endl;
+		return ERR_NONE;
+	}
+
+	if (!vm.count("command")) {
+		std::cerr << "You must specify a command." << std::endl;
+		return ERR_PARAMETER_MISSING;
+	}
+
+	std::string command = vm["command"].as<std::string>();
+	std::vector<std::string> args;
+	if (vm.count("args"))
+		args = vm["args"].as<std::vector<std::string> >();
+
+	try {
+		if (command == "export" && args.size() == 2) {
+			return export_store(args[0], args[1], vm["block-size"].as<unsigned>(),
+					vm.count("compress") ? hexabus::column_gorilla : hexabus::column_plain);
+		} else if (command == "list" && args.size() == 1) {
+			return list_sensors(args[0]);
+		} else if (command == "stats" && args.size() == 1) {
+			return print_stats(args[0]);
+		} else if (command == "query" && args.size() == 2) {
+			return query(args[0], args[1], vm);
+		} else {
+			std::cerr << desc << std::endl;
+			return ERR_PARAMETER_MISSING;
+		}
+	} catch (const klio::GenericException& e) {
+		std::cerr << "Klio error: " << e.reason() << std::endl;
+		return ERR_KLIO;
+	} catch (const hexabus::GenericException& e) {
+		std::cerr << "Error: " << e.reason() << std::endl;
+		return ERR_PARAMETER_VALUE_INVALID;
+	} catch (const std::exception& e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return ERR_OTHER;
+	}
+}
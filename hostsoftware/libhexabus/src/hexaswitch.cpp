@@ -1,3 +1,4 @@
+#include <csignal>
 #include <iostream>
 #include <string.h>
 #include <iomanip>
@@ -7,10 +8,12 @@
 #include <libhexabus/socket.hpp>
 #include <libhexabus/packet.hpp>
 #include <libhexabus/error.hpp>
+#include <libhexabus/json.hpp>
 #include <time.h>
 #include <boost/program_options.hpp>
 #include <boost/program_options/positional_options.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/optional.hpp>
 #include <typeinfo>
@@ -113,35 +116,39 @@ public:
 		}
 	}
 
-	std::string finish()
+	void flush(std::ostream& target)
 	{
-		auto result = buffer.str();
+		target << buffer.str() << (oneline ? "" : "\n") << std::endl;
+		buffer.str("");
+	}
+
+	void flush(hexabus::OutputRing& target)
+	{
+		if (!oneline)
+			buffer << '\n';
+		target.pushLine(buffer.str());
 		buffer.str("");
-		return result + (oneline ? "" : "\n");
 	}
 };
 
 class JsonBuffer {
 private:
-	std::stringstream buffer;
+	hexabus::JsonWriter writer;
 
 	void beginField(FieldName fieldName)
 	{
-		if (buffer.tellp())
-			buffer << ',';
+		if (!writer.size())
+			writer.beginObject();
 
-		std::string fieldNameStr;
 		switch (fieldName) {
-		case F_FROM: fieldNameStr = "from"; break;
-		case F_VALUE: fieldNameStr = "value"; break;
-		case F_EID: fieldNameStr = "eid"; break;
-		case F_DATATYPE: fieldNameStr = "datatype"; break;
-		case F_TYPE: fieldNameStr = "type"; break;
-		case F_ERROR_CODE: fieldNameStr = "error_code"; break;
-		case F_ERROR_STR: fieldNameStr = "error_str"; break;
+		case F_FROM: writer.key("from"); break;
+		case F_VALUE: writer.key("value"); break;
+		case F_EID: writer.key("eid"); break;
+		case F_DATATYPE: writer.key("datatype"); break;
+		case F_TYPE: writer.key("type"); break;
+		case F_ERROR_CODE: writer.key("error_code"); break;
+		case F_ERROR_STR: writer.key("error_str"); break;
 		}
-
-		buffer << '"' << fieldNameStr << '"' << ':';
 	}
 
 public:
@@ -149,21 +156,7 @@ public:
 	void addField(FieldName name, const Value& value)
 	{
 		beginField(name);
-		buffer << value;
-	}
-
-	void addField(FieldName name, const std::string& value)
-	{
-		beginField(name);
-
-		buffer << '"';
-		for (auto c : value) {
-			if (std::isprint(c) && c != '"')
-				buffer << c;
-			else
-				buffer << "\\x" << std::hex << std::setw(2) << unsigned(int(c));
-		}
-		buffer << '"';
+		writer.value(value);
 	}
 
 	template<size_t L>
@@ -171,38 +164,48 @@ public:
 	{
 		beginField(name);
 
-		buffer << '[';
-
-		unsigned printed = 0;
-		for (auto c : value) {
-			if (printed++)
-				buffer << ", ";
-
-			buffer << "0x" << std::hex << std::setw(2) << unsigned(c);
-		}
+		writer.beginArray();
+		for (auto c : value)
+			writer.value(c);
+		writer.endArray();
+	}
 
-		buffer << ']';
+	void flush(std::ostream& target)
+	{
+		writer.endObject();
+		writer.flushLine(target);
 	}
 
-	std::string finish()
+	void flush(hexabus::OutputRing& target)
 	{
-		auto result = "{" + buffer.str() + "}";
-		buffer.str("");
-		return result;
+		writer.endObject();
+		target.pushLine(writer.data(), writer.size());
+		writer.clear();
 	}
 };
 
 struct Printer {
 	virtual void printPacket(const hexabus::Packet& p, const boost::asio::ip::udp::endpoint& from) = 0;
 	virtual void printPacket(const hexabus::Packet& p) = 0;
+	// queue packets in ring instead of writing them to the target stream directly
+	virtual void queueTo(hexabus::OutputRing* ring) = 0;
 };
 
 template<typename Buffer>
 class BufferedPrinter : public Printer, private hexabus::PacketVisitor {
 private:
 	std::ostream& target;
+	hexabus::OutputRing* ring;
 	Buffer buffer;
 
+	void flush()
+	{
+		if (ring)
+			buffer.flush(*ring);
+		else
+			buffer.flush(target);
+	}
+
 	template<typename T>
 	void printValuePacket(const hexabus::ValuePacket<T>& packet, const char* type)
 	{
@@ -272,20 +275,25 @@ private:
 public:
 	template<typename... Args>
 	BufferedPrinter(std::ostream& target, Args... args)
-		: target(target), buffer(std::forward<Args>(args)...)
+		: target(target), ring(NULL), buffer(std::forward<Args>(args)...)
 	{}
 
 	virtual void printPacket(const hexabus::Packet& p, const boost::asio::ip::udp::endpoint& from)
 	{
 		buffer.addField(F_FROM, from.address().to_string());
 		p.accept(*this);
-		target << buffer.finish() << std::endl;
+		flush();
 	}
 
 	virtual void printPacket(const hexabus::Packet& p)
 	{
 		p.accept(*this);
-		target << buffer.finish() << std::endl;
+		flush();
+	}
+
+	virtual void queueTo(hexabus::OutputRing* ring)
+	{
+		this->ring = ring;
 	}
 };
 
@@ -413,6 +421,8 @@ int main(int argc, char** argv) {
     ("reliable,r", po::bool_switch(), "Reliable initialization of network access (adds delay, only needed for broadcasts)")
     ("oneline", po::bool_switch(), "Print each receive packet on one line")
     ("json", po::bool_switch(), "Print packet data as JSON, one packet per line")
+    ("queue", po::value<size_t>()->default_value(4096), "for listen: number of packets buffered for output")
+    ("overflow", po::value<std::string>()->default_value("block"), "for listen: what to do when output does not keep up {block|drop-oldest|drop-newest}")
     ;
   po::positional_options_description p;
   p.add("command", 1);
@@ -515,6 +525,12 @@ int main(int argc, char** argv) {
 		return ERR_PARAMETER_MISSING;
 	}
 
+	hexabus::OutputRing::Policy overflow;
+	if (!hexabus::OutputRing::parsePolicy(vm["overflow"].as<std::string>(), overflow)) {
+		std::cerr << "Unknown overflow policy \"" << vm["overflow"].as<std::string>() << "\"" << std::endl;
+		return ERR_PARAMETER_VALUE_INVALID;
+	}
+
 	hexabus::Listener listener(io);
 	hexabus::Socket socket(io);
 
@@ -549,20 +565,37 @@ int main(int argc, char** argv) {
 		}
 		lbuf << std::endl;
 
-		while (true) {
-			std::pair<hexabus::Packet::Ptr, boost::asio::ip::udp::endpoint> pair;
-			try {
-				pair = listener.receive();
-			} catch (const hexabus::NetworkException& e) {
-				std::cerr << "Error receiving packet: " << e.code().message() << std::endl;
-				return ERR_NETWORK;
-			} catch (const hexabus::GenericException& e) {
+		// see hexalisten: a closed pipe is reported to the output queue as EPIPE and ends listen mode
+		signal(SIGPIPE, SIG_IGN);
+
+		hexabus::OutputRing output(io, STDOUT_FILENO, vm["queue"].as<size_t>(), overflow);
+		packetPrinter->queueTo(&output);
+
+		ErrorCode result = ERR_NONE;
+		listener.onPacketReceived([] (const hexabus::Packet& packet, const boost::asio::ip::udp::endpoint& from) {
+			packetPrinter->printPacket(packet, from);
+		});
+		listener.onAsyncError([&] (const hexabus::GenericException& e) {
+			const hexabus::NetworkException* ne = dynamic_cast<const hexabus::NetworkException*>(&e);
+			if (ne)
+				std::cerr << "Error receiving packet: " << ne->code().message() << std::endl;
+			else
 				std::cerr << "Error receiving packet: " << e.what() << std::endl;
-				return ERR_NETWORK;
-			}
+			result = ERR_NETWORK;
+			io.stop();
+		});
 
-			packetPrinter->printPacket(*pair.first, pair.second);
-		}
+		boost::asio::signal_set terminate(io, SIGINT, SIGTERM);
+		terminate.async_wait(boost::bind(&boost::asio::io_service::stop, &io));
+
+		io.run();
+
+		terminate.clear();
+		output.drain();
+		packetPrinter->queueTo(NULL);
+		std::cerr << output.linesWritten() << " packets printed, " << output.linesDropped() << " dropped" << std::endl;
+
+		return result;
 	}
 
 	if (!ip && command == C_SEND) {
@@ -1,7 +1,14 @@
 #ifndef SRC_SHARED_HPP_04D73A47C8DF11F7
 #define SRC_SHARED_HPP_04D73A47C8DF11F7
 
+#include <algorithm>
+#include <cerrno>
 #include <string>
+#include <vector>
+#include <limits.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include <boost/asio.hpp>
 #include <boost/format.hpp>
@@ -58,6 +65,239 @@ inline int dtypeStrToDType(const std::string& s)
 	return -1;
 }
 
+// Bounded queue of output lines for the listening tools. Lines are written in batches with writev, either
+// when the queue is half full or when the oldest line has waited for a few milliseconds, so a busy listener
+// does not pay for one write per packet and an idle one still prints promptly.
+//
+// fd is usually shared with the terminal, stderr and the parent shell, so it is left in blocking mode. Writes
+// do not block until the queue is full anyway: a batch is only written when fd polls as writable, and holds
+// at most PIPE_BUF bytes, which a pipe that polls as writable takes at once. A reader that is not ready is
+// polled again after a few milliseconds.
+//
+// If the reader of fd does not keep up and the queue fills, the overflow policy decides what happens: BLOCK
+// waits for the reader, which stalls the io_service and lets the socket buffers overflow instead, the DROP
+// policies discard the oldest queued or the new line and count it. A line that has been partially written is
+// always completed. If the reader goes away, the io_service is stopped.
+class OutputRing {
+public:
+	enum Policy {
+		BLOCK,
+		DROP_OLDEST,
+		DROP_NEWEST,
+	};
+
+	static bool parsePolicy(const std::string& name, Policy& policy)
+	{
+		if (name == "block")
+			policy = BLOCK;
+		else if (name == "drop-oldest")
+			policy = DROP_OLDEST;
+		else if (name == "drop-newest")
+			policy = DROP_NEWEST;
+		else
+			return false;
+
+		return true;
+	}
+
+private:
+	boost::asio::io_service& io;
+	int fd;
+	Policy policy;
+	boost::asio::deadline_timer timer;
+
+	std::vector<std::string> lines;
+	size_t head, count;
+	// unwritten rest of a line that was written partially
+	std::string partial;
+
+	bool timerArmed;
+	bool waitingForReader;
+	bool failed;
+
+	uint64_t written, dropped;
+
+	bool full() const { return count == lines.size(); }
+
+	// discards the first bytes of the queue, after they have been written
+	void consume(size_t bytes)
+	{
+		if (!partial.empty()) {
+			size_t n = std::min(bytes, partial.size());
+			partial.erase(0, n);
+			bytes -= n;
+		}
+
+		while (bytes && count) {
+			std::string& line = lines[head];
+			if (bytes < line.size()) {
+				partial.assign(line, bytes, std::string::npos);
+				bytes = 0;
+			} else {
+				bytes -= line.size();
+			}
+			line.clear();
+			head = (head + 1) % lines.size();
+			count--;
+			written++;
+		}
+	}
+
+	// one writev of up to PIPE_BUF bytes of the queue. false if the reader is not ready
+	bool writeSome()
+	{
+		struct pollfd pfd = { fd, POLLOUT, 0 };
+		int ready = poll(&pfd, 1, 0);
+		if (ready < 0 && errno == EINTR)
+			return true;
+		// errors are reported by writev
+		if (ready == 0)
+			return false;
+
+		struct iovec iov[256];
+		int n = 0;
+		size_t bytes = 0;
+
+		if (!partial.empty()) {
+			iov[n].iov_base = const_cast<char*>(partial.data());
+			iov[n].iov_len = std::min<size_t>(partial.size(), PIPE_BUF);
+			bytes += iov[n].iov_len;
+			n++;
+		}
+		for (size_t i = 0; i < count && n < 256 && bytes < PIPE_BUF; i++) {
+			std::string& line = lines[(head + i) % lines.size()];
+			iov[n].iov_base = const_cast<char*>(line.data());
+			iov[n].iov_len = std::min<size_t>(line.size(), PIPE_BUF - bytes);
+			bytes += iov[n].iov_len;
+			n++;
+		}
+
+		ssize_t result = ::writev(fd, iov, n);
+		if (result < 0) {
+			if (errno == EINTR)
+				return true;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return false;
+
+			// nobody is reading any more, so there is nothing left to do
+			failed = true;
+			partial.clear();
+			for (; count; count--, head = (head + 1) % lines.size())
+				lines[head].clear();
+			io.stop();
+			return true;
+		}
+
+		consume(result);
+		return true;
+	}
+
+	bool empty() const { return partial.empty() && !count; }
+
+	void waitForReader()
+	{
+		struct pollfd pfd = { fd, POLLOUT, 0 };
+		poll(&pfd, 1, -1);
+	}
+
+	// writes the queue when the timer expires, unless it is written before
+	void armTimer()
+	{
+		if (timerArmed)
+			return;
+
+		timerArmed = true;
+		timer.expires_from_now(boost::posix_time::milliseconds(10));
+		timer.async_wait([this] (const boost::system::error_code& err) {
+			timerArmed = false;
+			waitingForReader = false;
+			if (!err)
+				writeQueued();
+		});
+	}
+
+	void writeQueued()
+	{
+		if (waitingForReader)
+			return;
+
+		while (!empty()) {
+			if (!writeSome()) {
+				waitingForReader = true;
+				armTimer();
+				return;
+			}
+		}
+	}
+
+public:
+	OutputRing(boost::asio::io_service& io, int fd, size_t capacity, Policy policy)
+		: io(io), fd(fd), policy(policy), timer(io),
+		  lines(std::max<size_t>(capacity, 1)), head(0), count(0),
+		  timerArmed(false), waitingForReader(false), failed(false),
+		  written(0), dropped(0)
+	{
+	}
+
+	void pushLine(const std::string& line) { pushLine(line.c_str(), line.size()); }
+
+	// queues line, followed by a newline
+	void pushLine(const char* line, size_t length)
+	{
+		if (failed)
+			return;
+
+		if (full()) {
+			switch (policy) {
+			case BLOCK:
+				while (full() && !failed)
+					if (!writeSome())
+						waitForReader();
+				if (failed)
+					return;
+				break;
+
+			case DROP_OLDEST:
+				lines[head].clear();
+				head = (head + 1) % lines.size();
+				count--;
+				dropped++;
+				break;
+
+			case DROP_NEWEST:
+				dropped++;
+				return;
+			}
+		}
+
+		std::string& slot = lines[(head + count) % lines.size()];
+		slot.assign(line, length);
+		slot.push_back('\n');
+		count++;
+
+		if (count >= lines.size() / 2) {
+			writeQueued();
+		} else {
+			armTimer();
+		}
+	}
+
+	// writes the rest of the queue after the io_service has stopped. with the BLOCK policy, this waits for the
+	// reader to take everything, otherwise only what it takes right away is written
+	void drain()
+	{
+		while (!empty() && !failed)
+			if (!writeSome()) {
+				if (policy != BLOCK)
+					break;
+				waitForReader();
+			}
+	}
+
+	uint64_t linesWritten() const { return written; }
+	uint64_t linesDropped() const { return dropped; }
+};
+
 class PacketPrinter : private hexabus::PacketVisitor {
 private:
 	enum FieldName {
@@ -71,6 +311,7 @@ private:
 	};
 
 private:
+	OutputRing* output;
 	bool oneline;
 
 	std::stringstream buffer;
@@ -197,17 +438,24 @@ private:
 	virtual void visit(const hexabus::WritePacket<std::array<uint8_t, 65> >& write) { printValuePacket(write, "Write"); }
 
 public:
-	PacketPrinter(bool oneline)
-		: oneline(oneline)
+	// packets are printed to std::cout, or queued in output if one is given
+	PacketPrinter(bool oneline, OutputRing* output = NULL)
+		: output(output), oneline(oneline)
 	{}
 
 	void operator()(const hexabus::Packet& p, const boost::asio::ip::udp::endpoint& from)
 	{
 		addField(F_FROM, from);
 		p.accept(*this);
-		std::cout << buffer.str() << std::endl;
-		if (!oneline)
-			std::cout << std::endl;
+		if (output) {
+			if (!oneline)
+				buffer << '\n';
+			output->pushLine(buffer.str());
+		} else {
+			std::cout << buffer.str() << std::endl;
+			if (!oneline)
+				std::cout << std::endl;
+		}
 		buffer.str("");
 	}
 };
@@ -0,0 +1,231 @@
+#include <boost/test/unit_test.hpp>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+
+#include <libhexabus/error.hpp>
+#include <libhexabus/json.hpp>
+
+using hexabus::JsonDocument;
+using hexabus::JsonWriter;
+
+namespace {
+
+void parse(JsonDocument& doc, const char* text)
+{
+	doc.parse(text, strlen(text));
+}
+
+bool rejects(const char* text)
+{
+	JsonDocument doc;
+	try {
+		parse(doc, text);
+	} catch (const hexabus::GenericException&) {
+		return !doc.root();
+	}
+	std::cout << "accepted " << text << std::endl;
+	return false;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE ( check_json_document_roundtrip ) {
+	std::cout << "Checking that documents of the JSON writer parse back to the written values." << std::endl;
+
+	JsonWriter w;
+	w.beginObject()
+		.member("name", std::string("a\"b\\c\n\x01\xc3\xa9", 9))
+		.member("count", 42)
+		.member("negative", std::numeric_limits<int64_t>::min())
+		.member("big", std::numeric_limits<uint64_t>::max())
+		.member("ratio", 0.1)
+		.member("on", true)
+		.key("nothing").null()
+		.key("list").beginArray().value(1).value("two").beginArray().endArray().endArray()
+		.key("nested").beginObject().key("deeper").beginObject().member("x", -7).endObject().endObject()
+		.endObject();
+
+	JsonDocument doc;
+	doc.parse(w.data(), w.size());
+	JsonDocument::Value root = doc.root();
+	BOOST_REQUIRE(root.isObject());
+	BOOST_CHECK_EQUAL(root.size(), 9u);
+
+	BOOST_CHECK_EQUAL(root["name"].type(), JsonDocument::t_string);
+	BOOST_CHECK_EQUAL(root["name"].str(), std::string("a\"b\\c\n\x01\xc3\xa9", 9));
+	BOOST_CHECK_EQUAL(root["name"].length(), 9u);
+
+	int count;
+	int64_t negative;
+	uint64_t big;
+	double ratio;
+	bool on;
+	BOOST_CHECK(root["count"].get(count) && count == 42);
+	BOOST_CHECK(root["negative"].get(negative) && negative == std::numeric_limits<int64_t>::min());
+	BOOST_CHECK(root["big"].get(big) && big == std::numeric_limits<uint64_t>::max());
+	BOOST_CHECK(root["ratio"].get(ratio) && ratio == 0.1);
+	BOOST_CHECK(root["on"].get(on) && on);
+	BOOST_CHECK_EQUAL(root["nothing"].type(), JsonDocument::t_null);
+	BOOST_CHECK(root["nothing"] == "null");
+
+	// numbers keep their text
+	BOOST_CHECK(root["ratio"] == "0.1");
+	BOOST_CHECK(root["big"] == "18446744073709551615");
+
+	JsonDocument::Value list = root["list"];
+	BOOST_REQUIRE(list.isArray());
+	BOOST_CHECK_EQUAL(list.size(), 3u);
+	BOOST_CHECK(list.first() == "1");
+	BOOST_CHECK(list.first().next() == "two");
+	BOOST_CHECK(list.first().next().next().isArray());
+	BOOST_CHECK_EQUAL(list.first().next().next().size(), 0u);
+	BOOST_CHECK(!list.first().next().next().next());
+
+	// members are iterated in document order
+	JsonDocument::Value member = root.first();
+	BOOST_CHECK_EQUAL(member.key(), "name");
+	BOOST_CHECK_EQUAL(member.next().key(), "count");
+
+	int x;
+	BOOST_CHECK(root["nested.deeper.x"].get(x) && x == -7);
+	BOOST_CHECK(root["nested.deeper"].isObject());
+	BOOST_CHECK(!root["nested.missing.x"]);
+	BOOST_CHECK(!root["nested.deeper.x.y"]);
+	BOOST_CHECK(!root["missing"]);
+	BOOST_CHECK(!root["list.x"]);
+	BOOST_CHECK(!root["count"]["x"]);
+}
+
+BOOST_AUTO_TEST_CASE ( check_json_document_get ) {
+	std::cout << "Checking that numbers are only converted to types that hold them exactly." << std::endl;
+
+	JsonDocument doc;
+	parse(doc, "[127, 128, -129, 4294967295, -1, 1.0, 1e3, 0.5, \"5\", true, null, "
+		"9223372036854775807, 9223372036854775808, -9223372036854775808, -9223372036854775809, 18446744073709551616]");
+	JsonDocument::Value v = doc.root().first();
+
+	int8_t i8;
+	uint8_t u8;
+	int16_t i16;
+	uint32_t u32;
+	int32_t i32;
+	int64_t i64;
+	uint64_t u64;
+	double d;
+	float f;
+	bool b;
+
+	// 127
+	BOOST_CHECK(v.get(i8) && i8 == 127);
+	BOOST_CHECK(v.get(d) && d == 127);
+	BOOST_CHECK(!v.get(b));
+	v = v.next();
+	// 128
+	BOOST_CHECK(!v.get(i8));
+	BOOST_CHECK(v.get(u8) && u8 == 128);
+	v = v.next();
+	// -129
+	BOOST_CHECK(!v.get(i8));
+	BOOST_CHECK(!v.get(u32));
+	BOOST_CHECK(v.get(i16) && i16 == -129);
+	v = v.next();
+	// 4294967295
+	BOOST_CHECK(v.get(u32) && u32 == 4294967295u);
+	BOOST_CHECK(!v.get(i32));
+	v = v.next();
+	// -1
+	BOOST_CHECK(!v.get(u64));
+	BOOST_CHECK(v.get(i64) && i64 == -1);
+	v = v.next();
+	// 1.0 and 1e3 are not integers
+	BOOST_CHECK(!v.get(i32));
+	BOOST_CHECK(v.get(d) && d == 1);
+	v = v.next();
+	BOOST_CHECK(!v.get(i32));
+	BOOST_CHECK(v.get(d) && d == 1000);
+	v = v.next();
+	// 0.5
+	BOOST_CHECK(v.get(f) && f == 0.5f);
+	v = v.next();
+	// "5" is a string
+	BOOST_CHECK(!v.get(i32));
+	BOOST_CHECK(!v.get(d));
+	BOOST_CHECK(v == "5");
+	v = v.next();
+	// true
+	BOOST_CHECK(v.get(b) && b);
+	BOOST_CHECK(!v.get(i32));
+	v = v.next();
+	// null
+	BOOST_CHECK(!v.get(b));
+	BOOST_CHECK(!v.get(d));
+	v = v.next();
+	// the limits of int64_t and uint64_t
+	BOOST_CHECK(v.get(i64) && i64 == std::numeric_limits<int64_t>::max());
+	v = v.next();
+	BOOST_CHECK(!v.get(i64));
+	BOOST_CHECK(v.get(u64) && u64 == uint64_t(1) << 63);
+	v = v.next();
+	BOOST_CHECK(v.get(i64) && i64 == std::numeric_limits<int64_t>::min());
+	v = v.next();
+	BOOST_CHECK(!v.get(i64));
+	BOOST_CHECK(v.get(d));
+	v = v.next();
+	BOOST_CHECK(!v.get(u64));
+	BOOST_CHECK(v.get(d) && d == 18446744073709551616.0);
+	BOOST_CHECK(!v.next());
+}
+
+BOOST_AUTO_TEST_CASE ( check_json_document_strings ) {
+	std::cout << "Checking that escapes in JSON strings are decoded to UTF-8." << std::endl;
+
+	JsonDocument doc;
+	parse(doc, " \t\r\n\"\\\"\\\\\\/\\b\\f\\n\\r\\t\\u0041\\u00e9\\u20AC\\ud83d\\ude00\" ");
+	BOOST_CHECK_EQUAL(doc.root().str(), "\"\\/\b\f\n\r\tA\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80");
+
+	// the document is reused by the next parse
+	parse(doc, "{\"a\":{\"b\":[]}}");
+	BOOST_CHECK(doc.root()["a.b"].isArray());
+	parse(doc, "\"\"");
+	BOOST_CHECK_EQUAL(doc.root().type(), JsonDocument::t_string);
+	BOOST_CHECK_EQUAL(doc.root().length(), 0u);
+
+	// NUL bytes inside strings are kept
+	parse(doc, "\"a\\u0000b\"");
+	BOOST_CHECK_EQUAL(doc.root().str(), std::string("a\0b", 3));
+}
+
+BOOST_AUTO_TEST_CASE ( check_json_document_malformed ) {
+	std::cout << "Checking that malformed JSON text is rejected." << std::endl;
+
+	const char* malformed[] = {
+		"", " ", "{", "[", "}", "[1,]", "[,1]", "[1 2]", "{\"a\" 1}", "{\"a\":}", "{a:1}", "{1:2}", "{\"a\":1,}",
+		"tru", "nul", "falsey", "True", "01", "-", "1.", ".5", "1e", "1e+", "+1", "0x10", "--1", "1 2",
+		"\"unterminated", "\"bad \\x escape\"", "\"\\u12\"", "\"\\u12g4\"", "\"\\ud800\"", "\"\\ud800\\u0041\"",
+		"\"\\udc00\"", "\"control \x01 character\"", "\"tab\tin string\"", "[\"a\"]]", "{\"a\":1}}", "NaN", "Infinity",
+	};
+	for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++)
+		BOOST_CHECK(rejects(malformed[i]));
+
+	// nesting is limited to the depth JsonWriter can write
+	std::string deep = std::string(64, '[') + std::string(64, ']');
+	JsonDocument doc;
+	doc.parse(deep.data(), deep.size());
+	BOOST_CHECK(doc.root().isArray());
+	deep = "[" + deep + "]";
+	BOOST_CHECK(rejects(deep.c_str()));
+
+	// every prefix of a document is incomplete
+	std::string text = "{\"a\":[1,-2.5e3,\"x\\n\",true,null],\"b\":{\"c\":false}}";
+	bool all = true;
+	for (size_t len = 0; len < text.size(); len++)
+		all = all && rejects(text.substr(0, len).c_str());
+	BOOST_CHECK(all);
+
+	// a failed parse leaves no document behind
+	parse(doc, "[1]");
+	BOOST_CHECK_THROW(parse(doc, "[1"), hexabus::GenericException);
+	BOOST_CHECK(!doc.root());
+}
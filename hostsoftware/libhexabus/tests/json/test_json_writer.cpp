@@ -0,0 +1,126 @@
+#define BOOST_TEST_MODULE json_test
+#include <boost/test/unit_test.hpp>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+
+#include <libhexabus/error.hpp>
+#include <libhexabus/json.hpp>
+
+using hexabus::JsonWriter;
+
+BOOST_AUTO_TEST_CASE ( check_json_writer_values ) {
+	std::cout << "Checking that the JSON writer formats strings and numbers." << std::endl;
+
+	JsonWriter w;
+	w.beginArray()
+		.value("plain")
+		.value(std::string("a\"b\\c\nd\te\x01\x1f\x7f/\xc3\xa9", 15))
+		.value("")
+		.value(true)
+		.value(false)
+		.null()
+		.endArray();
+	BOOST_CHECK_EQUAL(w.str(), "[\"plain\",\"a\\\"b\\\\c\\nd\\te\\u0001\\u001f\\u007f/\xc3\xa9\",\"\",true,false,null]");
+
+	w.clear();
+	w.beginArray()
+		.value(0)
+		.value(-1)
+		.value(int8_t(-128))
+		.value(uint8_t(255))
+		.value(std::numeric_limits<int64_t>::min())
+		.value(std::numeric_limits<int64_t>::max())
+		.value(std::numeric_limits<uint64_t>::max())
+		.endArray();
+	BOOST_CHECK_EQUAL(w.str(), "[0,-1,-128,255,-9223372036854775808,9223372036854775807,18446744073709551615]");
+
+	w.clear();
+	w.beginArray()
+		.value(0.1)
+		.value(-0.0)
+		.value(1e300)
+		.value(1.5f)
+		.value(0.1f)
+		.value(std::numeric_limits<double>::quiet_NaN())
+		.value(std::numeric_limits<double>::infinity())
+		.value(-std::numeric_limits<float>::infinity())
+		.number("12.5e-3", 7)
+		.endArray();
+	BOOST_CHECK_EQUAL(w.str(), "[0.1,-0,1e+300,1.5,0.1,null,null,null,12.5e-3]");
+}
+
+BOOST_AUTO_TEST_CASE ( check_json_writer_nesting ) {
+	std::cout << "Checking that the JSON writer separates members and elements of nested documents." << std::endl;
+
+	JsonWriter w;
+	w.beginObject()
+		.member("a", 1)
+		.key("b").beginArray().endArray()
+		.key("c").beginObject().endObject()
+		.key("d").beginArray()
+			.beginObject().member("e", "f").member("g", 2.5).endObject()
+			.beginArray().value(1).value(2).endArray()
+		.endArray()
+		.endObject();
+	BOOST_CHECK_EQUAL(w.str(), "{\"a\":1,\"b\":[],\"c\":{},\"d\":[{\"e\":\"f\",\"g\":2.5},[1,2]]}");
+	BOOST_CHECK(w.complete());
+
+	// every level up to the limit may be opened
+	w.clear();
+	for (int i = 0; i < 64; i++)
+		w.beginArray();
+	BOOST_CHECK(!w.complete());
+	BOOST_CHECK_THROW(w.beginArray(), hexabus::GenericException);
+	for (int i = 0; i < 64; i++)
+		w.endArray();
+	BOOST_CHECK(w.complete());
+	BOOST_CHECK_EQUAL(w.str(), std::string(64, '[') + std::string(64, ']'));
+}
+
+BOOST_AUTO_TEST_CASE ( check_json_writer_pretty ) {
+	std::cout << "Checking that pretty JSON writers indent members and elements." << std::endl;
+
+	JsonWriter w(true);
+	w.beginObject()
+		.member("a", 1)
+		.key("b").beginArray().endArray()
+		.key("c").beginArray().value(true).null().endArray()
+		.endObject();
+	BOOST_CHECK_EQUAL(w.str(), "{\n\t\"a\": 1,\n\t\"b\": [],\n\t\"c\": [\n\t\ttrue,\n\t\tnull\n\t]\n}");
+}
+
+BOOST_AUTO_TEST_CASE ( check_json_writer_documents ) {
+	std::cout << "Checking that the JSON writer rejects malformed documents and reuses its buffer." << std::endl;
+
+	JsonWriter w;
+	BOOST_CHECK(!w.complete());
+	w.value(42);
+	BOOST_CHECK(w.complete());
+	BOOST_CHECK_THROW(w.value(43), hexabus::GenericException);
+
+	std::ostringstream out;
+	w.writeLine(out);
+	w.beginObject().member("x", "y").endObject();
+	w.writeLine(out);
+	BOOST_CHECK_EQUAL(out.str(), "42\n{\"x\":\"y\"}\n");
+	BOOST_CHECK_EQUAL(w.size(), 0u);
+	BOOST_CHECK(!w.complete());
+
+	BOOST_CHECK_THROW(w.endArray(), hexabus::GenericException);
+
+	w.clear();
+	w.beginObject().key("a");
+	BOOST_CHECK_THROW(w.key("b"), hexabus::GenericException);
+	BOOST_CHECK_THROW(w.endObject(), hexabus::GenericException);
+	w.value(1).endObject();
+	BOOST_CHECK_EQUAL(w.str(), "{\"a\":1}");
+
+	// writing the same document again must not allocate, so the buffer keeps its place
+	const char* data = w.data();
+	w.clear();
+	w.beginObject().member("a", 2).endObject();
+	BOOST_CHECK(w.data() == data);
+	BOOST_CHECK_EQUAL(w.str(), "{\"a\":2}");
+}
@@ -0,0 +1,281 @@
+#include <boost/test/unit_test.hpp>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+
+#include <libhexabus/error.hpp>
+#include <libhexabus/json.hpp>
+#include <libhexabus/msgpack.hpp>
+
+using hexabus::JsonDocument;
+using hexabus::JsonWriter;
+using hexabus::MsgPackWriter;
+
+namespace {
+
+std::string bytes(const char* data, size_t length)
+{
+	return std::string(data, length);
+}
+
+// the same document through either writer
+template<typename Writer>
+void write_sample(Writer& w)
+{
+	w.beginObject()
+		.member("name", "sensor \"1\"")
+		.member("small", 5)
+		.member("negative", -100000)
+		.member("big", std::numeric_limits<uint64_t>::max())
+		.member("min", std::numeric_limits<int64_t>::min())
+		.member("value", 230.25)
+		.member("half", 0.5f)
+		.member("on", false)
+		.key("nothing").null()
+		.key("readings").beginArray();
+	for (int i = 0; i < 20; i++)
+		w.beginArray().value(1400000000 + i).value(i * 0.5).endArray();
+	w.endArray()
+		.key("empty").beginObject().endObject()
+		.endObject();
+}
+
+bool same_value(const JsonDocument::Value& a, const JsonDocument::Value& b)
+{
+	if (a.type() != b.type() || a.size() != b.size())
+		return false;
+
+	switch (a.type()) {
+	case JsonDocument::t_number: {
+		// JSON text does not tell 0.0 from 0, so integers only have to match where both are integers
+		double da, db;
+		int64_t ia, ib;
+		uint64_t ua, ub;
+		return a.get(da) && b.get(db) && da == db
+			&& (!a.get(ia) || !b.get(ib) || ia == ib)
+			&& (!a.get(ua) || !b.get(ub) || ua == ub);
+	}
+
+	case JsonDocument::t_array:
+	case JsonDocument::t_object:
+		for (JsonDocument::Value ca = a.first(), cb = b.first(); ca || cb; ca = ca.next(), cb = cb.next()) {
+			if (!ca || !cb || strcmp(ca.key(), cb.key()) || !same_value(ca, cb))
+				return false;
+		}
+		return true;
+
+	default:
+		return a.str() == b.str();
+	}
+}
+
+bool rejects(const std::string& data)
+{
+	JsonDocument doc;
+	try {
+		doc.parseMsgPack(data.data(), data.size());
+	} catch (const hexabus::GenericException&) {
+		return !doc.root();
+	}
+	return false;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE ( check_msgpack_encoding ) {
+	std::cout << "Checking that MessagePack values are written in their shortest encoding." << std::endl;
+
+	MsgPackWriter w;
+	w.beginObject().member("a", 1).key("b").beginArray().value(true).null().endArray().endObject();
+	BOOST_CHECK_EQUAL(w.str(), bytes("\x82\xa1" "a" "\x01\xa1" "b" "\x92\xc3\xc0", 9));
+	BOOST_CHECK(w.complete());
+
+	w.clear();
+	w.beginArray()
+		.value(0).value(127).value(128).value(255).value(256).value(65536).value(uint64_t(1) << 32)
+		.value(-1).value(-32).value(-33).value(-128).value(-129).value(-32769).value(std::numeric_limits<int64_t>::min())
+		.endArray();
+	BOOST_CHECK_EQUAL(w.str(), bytes(
+		"\x9e" "\x00" "\x7f" "\xcc\x80" "\xcc\xff" "\xcd\x01\x00" "\xce\x00\x01\x00\x00" "\xcf\x00\x00\x00\x01\x00\x00\x00\x00"
+		"\xff" "\xe0" "\xd0\xdf" "\xd0\x80" "\xd1\xff\x7f" "\xd2\xff\xff\x7f\xff" "\xd3\x80\x00\x00\x00\x00\x00\x00\x00", 47));
+
+	w.clear();
+	w.beginArray().value(1.5f).value(-2.0).value(false).endArray();
+	BOOST_CHECK_EQUAL(w.str(), bytes("\x93" "\xca\x3f\xc0\x00\x00" "\xcb\xc0\x00\x00\x00\x00\x00\x00\x00" "\xc2", 16));
+
+	// numbers given as text become integers unless they have a fraction or exponent
+	w.clear();
+	w.beginArray()
+		.number("-3", 2).number("200", 3).number("18446744073709551615", 20).number("18446744073709551616", 20)
+		.number("1.5", 3).number("1e2", 3)
+		.endArray();
+	BOOST_CHECK_EQUAL(w.str(), bytes("\x96" "\xfd" "\xcc\xc8" "\xcf\xff\xff\xff\xff\xff\xff\xff\xff"
+		"\xcb\x43\xf0\x00\x00\x00\x00\x00\x00" "\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00" "\xcb\x40\x59\x00\x00\x00\x00\x00\x00", 40));
+}
+
+BOOST_AUTO_TEST_CASE ( check_msgpack_widening ) {
+	std::cout << "Checking that MessagePack strings, arrays and maps get wider headers as they grow." << std::endl;
+
+	const size_t lengths[] = { 31, 32, 255, 256, 65535, 65536 };
+	const char tags[] = { '\xbf', '\xd9', '\xd9', '\xda', '\xda', '\xdb' };
+	const size_t headers[] = { 1, 2, 2, 3, 3, 5 };
+	for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		MsgPackWriter w;
+		w.value(std::string(lengths[i], 'x'));
+		BOOST_CHECK_EQUAL(w.str()[0], tags[i]);
+		BOOST_CHECK_EQUAL(w.size(), headers[i] + lengths[i]);
+
+		JsonDocument doc;
+		doc.parseMsgPack(w.data(), w.size());
+		BOOST_CHECK_EQUAL(doc.root().length(), lengths[i]);
+	}
+
+	const size_t counts[] = { 15, 16, 65535, 65536 };
+	for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		MsgPackWriter w;
+		w.beginArray();
+		for (size_t n = 0; n < counts[i]; n++)
+			w.beginObject().member("n", n).endObject();
+		w.endArray();
+
+		JsonDocument doc;
+		doc.parseMsgPack(w.data(), w.size());
+		BOOST_REQUIRE(doc.root().isArray());
+		BOOST_CHECK_EQUAL(doc.root().size(), counts[i]);
+
+		size_t n = 0, last;
+		bool ordered = true;
+		for (JsonDocument::Value v = doc.root().first(); v; v = v.next())
+			ordered = ordered && v["n"].get(last) && last == n++;
+		BOOST_CHECK(ordered);
+		BOOST_CHECK_EQUAL(n, counts[i]);
+	}
+
+	MsgPackWriter w;
+	w.beginObject();
+	for (int n = 0; n < 20; n++)
+		w.member(std::string(1, char('a' + n)).c_str(), n);
+	w.endObject();
+	BOOST_CHECK_EQUAL(w.str().substr(0, 3), bytes("\xde\x00\x14", 3));
+
+	JsonDocument doc;
+	doc.parseMsgPack(w.data(), w.size());
+	int t;
+	BOOST_CHECK_EQUAL(doc.root().size(), 20u);
+	BOOST_CHECK(doc.root()["t"].get(t) && t == 19);
+}
+
+BOOST_AUTO_TEST_CASE ( check_msgpack_roundtrip ) {
+	std::cout << "Checking that MessagePack documents read back like the same documents in JSON." << std::endl;
+
+	JsonWriter json;
+	MsgPackWriter msgpack;
+	write_sample(json);
+	write_sample(msgpack);
+	BOOST_CHECK_LT(msgpack.size(), json.size());
+
+	JsonDocument from_json, from_msgpack;
+	from_json.parse(json.data(), json.size());
+	from_msgpack.parseMsgPack(msgpack.data(), msgpack.size());
+	BOOST_CHECK(same_value(from_json.root(), from_msgpack.root()));
+
+	JsonDocument::Value root = from_msgpack.root();
+	int64_t min;
+	uint64_t big;
+	float half;
+	BOOST_CHECK(root["min"].get(min) && min == std::numeric_limits<int64_t>::min());
+	BOOST_CHECK(root["big"].get(big) && big == std::numeric_limits<uint64_t>::max());
+	BOOST_CHECK(root["half"].get(half) && half == 0.5f);
+	BOOST_CHECK(root["name"] == "sensor \"1\"");
+
+	// numbers read from MessagePack are formatted on demand
+	BOOST_CHECK(root["negative"] == "-100000");
+	BOOST_CHECK(root["big"] == "18446744073709551615");
+	BOOST_CHECK(root["value"] == "230.25");
+
+	// floats and doubles keep every bit, which JSON text does not promise
+	msgpack.clear();
+	msgpack.beginArray().value(0.1f).value(0.1).value(std::numeric_limits<double>::quiet_NaN()).endArray();
+	from_msgpack.parseMsgPack(msgpack.data(), msgpack.size());
+	float f;
+	double d;
+	BOOST_CHECK(from_msgpack.root().first().get(f) && f == 0.1f);
+	BOOST_CHECK(from_msgpack.root().first().next().get(d) && d == 0.1);
+	BOOST_CHECK(from_msgpack.root().first().next().next().get(d) && d != d);
+
+	// binary data reads as a string
+	const char bin[] = "\xc4\x03" "a\0b";
+	from_msgpack.parseMsgPack(bin, 5);
+	BOOST_CHECK_EQUAL(from_msgpack.root().type(), JsonDocument::t_string);
+	BOOST_CHECK_EQUAL(from_msgpack.root().str(), bytes("a\0b", 3));
+}
+
+BOOST_AUTO_TEST_CASE ( check_msgpack_writer_documents ) {
+	std::cout << "Checking that the MessagePack writer rejects malformed documents." << std::endl;
+
+	MsgPackWriter w;
+	BOOST_CHECK(!w.complete());
+	w.value(1);
+	BOOST_CHECK(w.complete());
+	BOOST_CHECK_THROW(w.value(2), hexabus::GenericException);
+
+	w.clear();
+	BOOST_CHECK_THROW(w.key("a"), hexabus::GenericException);
+	BOOST_CHECK_THROW(w.endObject(), hexabus::GenericException);
+	w.beginArray();
+	BOOST_CHECK_THROW(w.key("a"), hexabus::GenericException);
+	BOOST_CHECK_THROW(w.endObject(), hexabus::GenericException);
+	w.endArray();
+	BOOST_CHECK_EQUAL(w.str(), bytes("\x90", 1));
+
+	w.clear();
+	for (int i = 0; i < 64; i++)
+		w.beginArray();
+	BOOST_CHECK_THROW(w.beginObject(), hexabus::GenericException);
+	for (int i = 0; i < 64; i++)
+		w.endArray();
+	BOOST_CHECK(w.complete());
+
+	JsonDocument doc;
+	doc.parseMsgPack(w.data(), w.size());
+	BOOST_CHECK(doc.root().isArray());
+}
+
+BOOST_AUTO_TEST_CASE ( check_msgpack_corrupt ) {
+	std::cout << "Checking that truncated and corrupt MessagePack data is rejected." << std::endl;
+
+	MsgPackWriter w;
+	write_sample(w);
+	const std::string& data = w.str();
+
+	// every prefix of a document is incomplete
+	bool all = true;
+	for (size_t len = 0; len < data.size(); len++)
+		all = all && rejects(data.substr(0, len));
+	BOOST_CHECK(all);
+
+	BOOST_CHECK(rejects(data + '\x00'));
+	// 0xc1 is never used, the ext types are not supported
+	BOOST_CHECK(rejects(bytes("\xc1", 1)));
+	BOOST_CHECK(rejects(bytes("\xd4\x01\x00", 3)));
+	BOOST_CHECK(rejects(bytes("\xc7\x01\x01\x00", 4)));
+	// keys must be strings
+	BOOST_CHECK(rejects(bytes("\x81\x01\x02", 3)));
+	BOOST_CHECK(rejects(bytes("\x81\x90\x02", 3)));
+	// counts and lengths beyond the end of the data
+	BOOST_CHECK(rejects(bytes("\xdd\xff\xff\xff\xff\x01", 6)));
+	BOOST_CHECK(rejects(bytes("\xdf\x7f\xff\xff\xff", 5)));
+	BOOST_CHECK(rejects(bytes("\xdb\xff\xff\xff\xff" "abc", 8)));
+	BOOST_CHECK(rejects(bytes("\xa5" "abc", 4)));
+	BOOST_CHECK(rejects(bytes("\xcb\x00\x00", 3)));
+
+	// nesting is limited to the depth MsgPackWriter can write
+	BOOST_CHECK(rejects(std::string(64, '\x91') + '\x90'));
+
+	// a failed parse leaves no document behind
+	JsonDocument doc;
+	doc.parseMsgPack("\x01", 1);
+	BOOST_CHECK_THROW(doc.parseMsgPack("\x92\x01", 2), hexabus::GenericException);
+	BOOST_CHECK(!doc.root());
+}
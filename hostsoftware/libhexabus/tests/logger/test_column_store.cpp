@@ -0,0 +1,256 @@
+#include <boost/test/unit_test.hpp>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <random>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <libhexabus/error.hpp>
+#include <libhexabus/logger/column_store.hpp>
+
+using hexabus::ColumnAggregate;
+using hexabus::ColumnReader;
+using hexabus::ColumnWriter;
+
+namespace {
+
+struct ColumnFixture {
+	boost::filesystem::path dir;
+	std::vector<int64_t> timestamps;
+	std::vector<double> values;
+
+	ColumnFixture()
+		: dir(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("columntest-%%%%-%%%%"))
+	{
+		boost::filesystem::create_directories(dir);
+
+		// readings every minute with repeated timestamps and gaps of a day. values are multiples of 1/4, so
+		// sums are exact in any order
+		std::mt19937 rng(42);
+		int64_t ts = 1400000000;
+		for (int i = 0; i < 10000; i++) {
+			unsigned r = rng() % 100;
+			ts += r == 0 ? 86400 : r < 5 ? 0 : 60;
+			timestamps.push_back(ts);
+			values.push_back((int(rng() % 4000) - 2000) / 4.0);
+		}
+	}
+
+	~ColumnFixture()
+	{
+		boost::filesystem::remove_all(dir);
+	}
+
+	boost::filesystem::path write(hexabus::ColumnEncoding encoding)
+	{
+		boost::filesystem::path file = dir / (encoding == hexabus::column_gorilla ? "gorilla.col" : "plain.col");
+		ColumnWriter writer(file, 256, encoding);
+		for (size_t i = 0; i < timestamps.size(); i++)
+			writer.append(timestamps[i], values[i]);
+		writer.close();
+		return file;
+	}
+
+	ColumnAggregate brute_aggregate(int64_t from, int64_t to) const
+	{
+		ColumnAggregate agg;
+		for (size_t i = 0; i < timestamps.size(); i++) {
+			if (timestamps[i] >= from && timestamps[i] < to) {
+				agg.count++;
+				agg.sum += values[i];
+				agg.min = std::min(agg.min, values[i]);
+				agg.max = std::max(agg.max, values[i]);
+			}
+		}
+		return agg;
+	}
+
+	void check_reader(const ColumnReader& reader) const
+	{
+		BOOST_REQUIRE_EQUAL(reader.size(), timestamps.size());
+		BOOST_CHECK_EQUAL(reader.first_timestamp(), timestamps.front());
+		BOOST_CHECK_EQUAL(reader.last_timestamp(), timestamps.back());
+
+		size_t i = 0;
+		bool equal = true;
+		reader.scan(timestamps.front(), timestamps.back() + 1, [&] (int64_t ts, double value) {
+			equal = equal && i < timestamps.size() && ts == timestamps[i] && value == values[i];
+			i++;
+		});
+		BOOST_CHECK(equal);
+		BOOST_CHECK_EQUAL(i, timestamps.size());
+
+		std::mt19937 rng(7);
+		int64_t span = timestamps.back() - timestamps.front();
+		for (int q = 0; q < 50; q++) {
+			int64_t from = timestamps.front() - 100 + int64_t(rng() % (span + 200));
+			int64_t to = from + int64_t(rng() % (span / 4));
+
+			size_t scanned = 0;
+			reader.scan(from, to, [&] (int64_t ts, double) {
+				equal = equal && ts >= from && ts < to;
+				scanned++;
+			});
+			BOOST_CHECK(equal);
+
+			ColumnAggregate expected = brute_aggregate(from, to);
+			ColumnAggregate agg = reader.aggregate(from, to);
+			BOOST_CHECK_EQUAL(scanned, expected.count);
+			BOOST_CHECK_EQUAL(agg.count, expected.count);
+			BOOST_CHECK_EQUAL(agg.sum, expected.sum);
+			BOOST_CHECK_EQUAL(agg.min, expected.min);
+			BOOST_CHECK_EQUAL(agg.max, expected.max);
+		}
+	}
+
+	void check_buckets(const ColumnReader& reader, int64_t from, int64_t to, int64_t bucket) const
+	{
+		std::map<int64_t, ColumnAggregate> expected;
+		for (size_t i = 0; i < timestamps.size(); i++) {
+			if (timestamps[i] < from || timestamps[i] >= to)
+				continue;
+
+			ColumnAggregate& agg = expected[from + (timestamps[i] - from) / bucket * bucket];
+			agg.count++;
+			agg.sum += values[i];
+			agg.min = std::min(agg.min, values[i]);
+			agg.max = std::max(agg.max, values[i]);
+		}
+
+		std::map<int64_t, ColumnAggregate>::const_iterator it = expected.begin();
+		bool equal = true;
+		size_t buckets = 0;
+		reader.aggregate(from, to, bucket, [&] (int64_t start, const ColumnAggregate& agg) {
+			equal = equal && it != expected.end() && start == it->first && agg.count == it->second.count
+				&& agg.sum == it->second.sum && agg.min == it->second.min && agg.max == it->second.max;
+			if (it != expected.end())
+				++it;
+			buckets++;
+		});
+		BOOST_CHECK(equal);
+		BOOST_CHECK_EQUAL(buckets, expected.size());
+	}
+};
+
+void flip_byte(const boost::filesystem::path& file, long offset)
+{
+	FILE* f = fopen(file.c_str(), "r+b");
+	BOOST_REQUIRE(f);
+	fseek(f, offset, SEEK_SET);
+	int c = fgetc(f);
+	fseek(f, offset, SEEK_SET);
+	fputc(c ^ 0x55, f);
+	fclose(f);
+}
+
+// column headers are 64 bytes, the first block follows them
+const long column_header_size = 64;
+
+}
+
+BOOST_FIXTURE_TEST_CASE ( check_column_plain_roundtrip, ColumnFixture ) {
+	std::cout << "Checking that plain column files return their readings and aggregates." << std::endl;
+
+	ColumnReader reader(write(hexabus::column_plain));
+	BOOST_CHECK_EQUAL(reader.encoding(), hexabus::column_plain);
+	check_reader(reader);
+	check_buckets(reader, timestamps.front(), timestamps.back() + 1, 3600);
+	check_buckets(reader, timestamps.front() + 1234, timestamps.back() - 4321, 900);
+}
+
+BOOST_FIXTURE_TEST_CASE ( check_column_gorilla_roundtrip, ColumnFixture ) {
+	std::cout << "Checking that gorilla encoded column files return their readings and aggregates." << std::endl;
+
+	ColumnReader reader(write(hexabus::column_gorilla));
+	BOOST_CHECK_EQUAL(reader.encoding(), hexabus::column_gorilla);
+	BOOST_CHECK_LT(reader.file_size(), ColumnReader(write(hexabus::column_plain)).file_size());
+	check_reader(reader);
+	check_buckets(reader, timestamps.front(), timestamps.back() + 1, 3600);
+	check_buckets(reader, timestamps.front() + 1234, timestamps.back() - 4321, 900);
+}
+
+BOOST_FIXTURE_TEST_CASE ( check_column_ranges, ColumnFixture ) {
+	std::cout << "Checking empty column files, sparse ranges and invalid queries." << std::endl;
+
+	ColumnReader reader(write(hexabus::column_gorilla));
+
+	// ranges outside of the readings, or inside a gap
+	BOOST_CHECK_EQUAL(reader.aggregate(0, timestamps.front()).count, 0u);
+	BOOST_CHECK_EQUAL(reader.aggregate(timestamps.back() + 1, std::numeric_limits<int64_t>::max()).count, 0u);
+	BOOST_CHECK_EQUAL(reader.aggregate(timestamps.back(), timestamps.front()).count, 0u);
+	for (size_t i = 1; i < timestamps.size(); i++) {
+		if (timestamps[i] - timestamps[i - 1] > 3600) {
+			BOOST_CHECK_EQUAL(reader.aggregate(timestamps[i - 1] + 1, timestamps[i]).count, 0u);
+			check_buckets(reader, timestamps[i - 1] - 7200, timestamps[i] + 7200, 60);
+			break;
+		}
+	}
+
+	// the whole range of timestamps in buckets of a day
+	check_buckets(reader, 0, std::numeric_limits<int64_t>::max(), 86400);
+
+	BOOST_CHECK_THROW(reader.aggregate(std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max(), 60,
+			[] (int64_t, const ColumnAggregate&) {}), hexabus::GenericException);
+	BOOST_CHECK_THROW(reader.aggregate(0, 1, 0, [] (int64_t, const ColumnAggregate&) {}), hexabus::GenericException);
+
+	{
+		ColumnWriter writer(dir / "empty.col");
+		writer.close();
+	}
+	ColumnReader empty(dir / "empty.col");
+	BOOST_CHECK_EQUAL(empty.size(), 0u);
+	BOOST_CHECK_EQUAL(empty.first_timestamp(), 0);
+	BOOST_CHECK_EQUAL(empty.aggregate(0, std::numeric_limits<int64_t>::max()).count, 0u);
+}
+
+BOOST_FIXTURE_TEST_CASE ( check_column_writer, ColumnFixture ) {
+	std::cout << "Checking that column writers reject unordered readings and discard unclosed files." << std::endl;
+
+	{
+		ColumnWriter writer(dir / "unclosed.col");
+		writer.append(10, 1);
+		BOOST_CHECK_THROW(writer.append(9, 1), hexabus::GenericException);
+		writer.append(10, 2);
+	}
+	BOOST_CHECK(!boost::filesystem::exists(dir / "unclosed.col"));
+	BOOST_CHECK(!boost::filesystem::exists(dir / "unclosed.col.tmp"));
+
+	BOOST_CHECK_THROW(ColumnWriter(dir / "zero.col", 0), hexabus::GenericException);
+}
+
+BOOST_FIXTURE_TEST_CASE ( check_column_corruption, ColumnFixture ) {
+	std::cout << "Checking that invalid column files and corrupt blocks are rejected." << std::endl;
+
+	boost::filesystem::path file = write(hexabus::column_gorilla);
+	uintmax_t size = boost::filesystem::file_size(file);
+
+	// the first timestamp of the first block no longer matches its index entry
+	flip_byte(file, column_header_size + 7);
+	{
+		ColumnReader reader(file);
+		BOOST_CHECK_THROW(reader.scan(timestamps.front(), timestamps.front() + 1, [] (int64_t, double) {}),
+				hexabus::GenericException);
+		// blocks completely inside a query are aggregated from the index
+		BOOST_CHECK_EQUAL(reader.aggregate(timestamps.front(), timestamps.back() + 1).count, timestamps.size());
+	}
+
+	boost::filesystem::resize_file(file, size - 1);
+	BOOST_CHECK_THROW(ColumnReader reader(file), hexabus::GenericException);
+
+	boost::filesystem::resize_file(file, column_header_size / 2);
+	BOOST_CHECK_THROW(ColumnReader reader(file), hexabus::GenericException);
+
+	boost::filesystem::path plain = write(hexabus::column_plain);
+	flip_byte(plain, 0);
+	BOOST_CHECK_THROW(ColumnReader reader(plain), hexabus::GenericException);
+
+	boost::filesystem::path garbage = dir / "garbage.col";
+	boost::filesystem::ofstream(garbage) << "not a column file, but long enough to hold a column header if it were one";
+	BOOST_CHECK_THROW(ColumnReader reader(garbage), hexabus::GenericException);
+
+	BOOST_CHECK_THROW(ColumnReader reader(dir / "missing.col"), hexabus::GenericException);
+}
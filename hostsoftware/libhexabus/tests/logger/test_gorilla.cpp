@@ -0,0 +1,201 @@
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include <libhexabus/logger/gorilla.hpp>
+
+using hexabus::GorillaDecoder;
+using hexabus::GorillaEncoder;
+
+namespace {
+
+struct Series {
+	std::vector<int64_t> timestamps;
+	std::vector<double> values;
+
+	void add(int64_t timestamp, double value)
+	{
+		timestamps.push_back(timestamp);
+		values.push_back(value);
+	}
+
+	std::vector<uint8_t> encode() const
+	{
+		std::vector<uint8_t> out;
+		GorillaEncoder encoder(out);
+		for (size_t i = 0; i < timestamps.size(); i++)
+			encoder.append(timestamps[i], values[i]);
+		encoder.finish();
+		BOOST_CHECK_EQUAL(encoder.count(), timestamps.size());
+		return out;
+	}
+
+	// values are compared bitwise, so NaN payloads and the sign of zero must survive as well
+	bool matches(const int64_t* ts, const double* vals, size_t n) const
+	{
+		if (n > timestamps.size())
+			return false;
+		for (size_t i = 0; i < n; i++) {
+			if (ts[i] != timestamps[i] || memcmp(&vals[i], &values[i], sizeof(double)))
+				return false;
+		}
+		return true;
+	}
+
+	void check_roundtrip() const
+	{
+		std::vector<uint8_t> data = encode();
+		std::vector<int64_t> ts(timestamps.size());
+		std::vector<double> vals(values.size());
+
+		GorillaDecoder decoder(data.data(), data.size());
+		BOOST_CHECK_EQUAL(decoder.decode(ts.data(), vals.data(), ts.size()), ts.size());
+		BOOST_CHECK(matches(ts.data(), vals.data(), ts.size()));
+	}
+};
+
+double from_bits(uint64_t bits)
+{
+	double value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+Series random_series(size_t n)
+{
+	// readings at a jittery interval with a random walk of values, like a meter that is read every few seconds
+	std::mt19937 rng(23);
+	Series s;
+	int64_t ts = 1400000000;
+	double value = 230;
+	for (size_t i = 0; i < n; i++) {
+		ts += 5 + int64_t(rng() % 3) - 1;
+		if (rng() % 4 == 0)
+			value += (int(rng() % 201) - 100) / 10.0;
+		s.add(ts, value);
+	}
+	return s;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE ( check_gorilla_roundtrip ) {
+	std::cout << "Checking that gorilla encoded readings decode to the original readings." << std::endl;
+
+	Series s = random_series(5000);
+	s.check_roundtrip();
+
+	// a single reading is stored verbatim
+	Series one;
+	one.add(-1, 1.5);
+	BOOST_CHECK_EQUAL(one.encode().size(), 16u);
+	one.check_roundtrip();
+
+	// a constant series at a fixed interval takes two bits per reading
+	Series constant;
+	for (int i = 0; i < 1000; i++)
+		constant.add(60 * i, 42);
+	BOOST_CHECK_LE(constant.encode().size(), 16u + 2 + 999 * 2 / 8 + 1);
+	constant.check_roundtrip();
+}
+
+BOOST_AUTO_TEST_CASE ( check_gorilla_edge_values ) {
+	std::cout << "Checking that extreme timestamps and special values survive gorilla encoding." << std::endl;
+
+	Series s;
+	const double values[] = {
+		0.0, -0.0, 1.0, std::numeric_limits<double>::quiet_NaN(), from_bits(0x7ff0000000000001ull),
+		from_bits(0xfff8000000000123ull), std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(),
+		std::numeric_limits<double>::denorm_min(), std::numeric_limits<double>::max(), -std::numeric_limits<double>::max(),
+		std::numeric_limits<double>::min(), 1.0, 1.0 + std::numeric_limits<double>::epsilon(),
+	};
+	const size_t nvalues = sizeof(values) / sizeof(values[0]);
+
+	// deltas of delta at the edges of every prefix class, negative deltas and jumps across the whole range
+	const int64_t deltas[] = {
+		0, 0, 1, 64, 0, -63, -64, -65, 255, 256, -256, -257, 2047, 2048, -2048, -2049,
+		int64_t(1) << 31, -(int64_t(1) << 31), (int64_t(1) << 31) + 1, -86400, 86400 * 365,
+	};
+	const size_t ndeltas = sizeof(deltas) / sizeof(deltas[0]);
+
+	int64_t ts = 0;
+	for (size_t i = 0; i < ndeltas; i++) {
+		ts += deltas[i];
+		s.add(ts, values[i % nvalues]);
+	}
+	s.add(std::numeric_limits<int64_t>::max(), 0);
+	s.add(std::numeric_limits<int64_t>::min(), -0.0);
+	s.add(std::numeric_limits<int64_t>::max(), 0);
+	s.add(0, std::numeric_limits<double>::quiet_NaN());
+	s.add(std::numeric_limits<int64_t>::min(), 1);
+	s.check_roundtrip();
+
+	Series first;
+	first.add(std::numeric_limits<int64_t>::min(), -std::numeric_limits<double>::infinity());
+	first.add(std::numeric_limits<int64_t>::max(), std::numeric_limits<double>::quiet_NaN());
+	first.check_roundtrip();
+}
+
+BOOST_AUTO_TEST_CASE ( check_gorilla_chunks ) {
+	std::cout << "Checking that gorilla encoded readings can be decoded in chunks of any size." << std::endl;
+
+	Series s = random_series(1000);
+	std::vector<uint8_t> data = s.encode();
+
+	const size_t chunks[] = { 1, 2, 7, 64, 333 };
+	for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+		GorillaDecoder decoder(data.data(), data.size());
+		std::vector<int64_t> ts(s.timestamps.size());
+		std::vector<double> vals(s.values.size());
+
+		size_t decoded = 0;
+		while (decoded < ts.size()) {
+			size_t n = std::min(chunks[c], ts.size() - decoded);
+			size_t got = decoder.decode(&ts[decoded], &vals[decoded], n);
+			BOOST_REQUIRE_EQUAL(got, n);
+			decoded += got;
+		}
+		BOOST_CHECK(s.matches(ts.data(), vals.data(), ts.size()));
+	}
+
+	GorillaDecoder decoder(data.data(), data.size());
+	int64_t ts;
+	double value;
+	for (size_t i = 0; i < s.timestamps.size(); i++) {
+		BOOST_REQUIRE(decoder.next(ts, value));
+		BOOST_CHECK_EQUAL(ts, s.timestamps[i]);
+		BOOST_CHECK_EQUAL(value, s.values[i]);
+	}
+}
+
+BOOST_AUTO_TEST_CASE ( check_gorilla_truncated ) {
+	std::cout << "Checking that truncated gorilla data decodes to a prefix of the readings." << std::endl;
+
+	Series s = random_series(200);
+	std::vector<uint8_t> data = s.encode();
+	std::vector<int64_t> ts(s.timestamps.size());
+	std::vector<double> vals(s.values.size());
+
+	size_t previous = 0;
+	bool prefix = true, growing = true;
+	for (size_t size = 0; size < data.size(); size++) {
+		GorillaDecoder decoder(data.data(), size);
+		size_t n = decoder.decode(ts.data(), vals.data(), ts.size());
+
+		prefix = prefix && n < ts.size() && s.matches(ts.data(), vals.data(), n);
+		growing = growing && n >= previous;
+		previous = n;
+	}
+	BOOST_CHECK(prefix);
+	BOOST_CHECK(growing);
+
+	GorillaDecoder empty(data.data(), 0);
+	int64_t t;
+	double v;
+	BOOST_CHECK(!empty.next(t, v));
+	BOOST_CHECK_EQUAL(GorillaDecoder(data.data(), 15).decode(ts.data(), vals.data(), ts.size()), 0u);
+}
@@ -0,0 +1,282 @@
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <libhexabus/logger/logger.hpp>
+#include <libhexabus/packet.hpp>
+
+using hexabus::AggregationPolicy;
+
+namespace {
+
+typedef std::tuple<std::string, klio::timestamp_t, double> reading_t;
+typedef std::vector<reading_t> readings_t;
+
+// everything a Logger refers to, built before the logger itself
+struct LoggerEnv {
+	boost::filesystem::path registry_path;
+	boost::asio::io_service io;
+	hexabus::Socket socket;
+	hexabus::DeviceInterrogator device_interrogator;
+	klio::TimeConverter time_converter;
+	klio::SensorFactory factory;
+	std::unique_ptr<hexabus::EndpointRegistry> endpoints;
+
+	LoggerEnv()
+		: registry_path(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("loggertest-%%%%-%%%%")),
+		  socket(io), device_interrogator(socket)
+	{
+		boost::filesystem::ofstream(registry_path)
+			<< "eid 2 {\n\ttype FLOAT\n\tdescription \"Power\"\n\tunit \"W\"\n\taccess R\n\tfunction sensor\n}\n";
+		endpoints.reset(new hexabus::EndpointRegistry(registry_path));
+	}
+
+	~LoggerEnv()
+	{
+		boost::filesystem::remove(registry_path);
+	}
+};
+
+// a logger whose store holds endpoints 2 to 6 of devices fd00::1 to fd00::9, records to a vector and is
+// told the time of every packet. unknown sensors are not in the store, so the logger would query their
+// device names; the tests do not send readings of them
+class TestLogger : public LoggerEnv, public hexabus::Logger {
+public:
+	klio::timestamp_t now;
+	std::map<std::string, klio::Sensor::Ptr> store;
+	readings_t recorded;
+	unsigned lookups;
+
+	TestLogger()
+		: hexabus::Logger(time_converter, factory, "Europe/Berlin", device_interrogator, *endpoints), now(0), lookups(0)
+	{
+		for (int device = 1; device <= 9; device++) {
+			for (uint32_t eid = 2; eid <= 6; eid++) {
+				std::string id = get_sensor_id(address(device), eid);
+				store[id] = factory.createSensor(id, id, "W", "Europe/Berlin");
+			}
+		}
+	}
+
+	static boost::asio::ip::address_v6 address(int device)
+	{
+		return boost::asio::ip::address_v6::from_string("fd00::" + std::to_string(device));
+	}
+
+	static std::string id(int device, uint32_t eid)
+	{
+		return address(device).to_string() + "-" + std::to_string(eid);
+	}
+
+	void send(klio::timestamp_t ts, int device, uint32_t eid, float value)
+	{
+		now = ts;
+		(*this)(hexabus::InfoPacket<float>(eid, value), boost::asio::ip::udp::endpoint(address(device), 61616));
+	}
+
+	void preload()
+	{
+		std::vector<klio::Sensor::Ptr> sensors;
+		for (std::map<std::string, klio::Sensor::Ptr>::const_iterator it = store.begin(), end = store.end(); it != end; ++it)
+			sensors.push_back(it->second);
+		preload_sensors(sensors);
+	}
+
+	// the readings recorded since the last call
+	readings_t take()
+	{
+		readings_t result;
+		result.swap(recorded);
+		return result;
+	}
+
+protected:
+	virtual klio::timestamp_t current_time() { return now; }
+
+	virtual void record_reading(klio::Sensor::Ptr sensor, klio::timestamp_t ts, double value)
+	{
+		recorded.push_back(reading_t(sensor->external_id(), ts, value));
+	}
+
+	virtual void new_sensor_found(klio::Sensor::Ptr sensor, const boost::asio::ip::address_v6& address) {}
+
+	virtual void lookup_sensor(const hexabus::SensorKey& key, const std::string& sensor_id)
+	{
+		lookups++;
+		std::map<std::string, klio::Sensor::Ptr>::const_iterator it = store.find(sensor_id);
+		sensor_looked_up(key, it != store.end() ? it->second : klio::Sensor::Ptr());
+	}
+};
+
+reading_t reading(int device, uint32_t eid, klio::timestamp_t ts, double value)
+{
+	return reading_t(TestLogger::id(device, eid), ts, value);
+}
+
+// windows are flushed in no particular order, so the order of readings is not compared
+bool same(readings_t got, readings_t expected)
+{
+	std::sort(got.begin(), got.end());
+	std::sort(expected.begin(), expected.end());
+	if (got == expected)
+		return true;
+
+	std::cout << "recorded:" << std::endl;
+	for (readings_t::const_iterator it = got.begin(), end = got.end(); it != end; ++it)
+		std::cout << "\t" << std::get<0>(*it) << " " << std::get<1>(*it) << " " << std::get<2>(*it) << std::endl;
+	return false;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE ( check_logger_windows ) {
+	std::cout << "Checking that the logger records one aggregated value per window." << std::endl;
+
+	TestLogger logger;
+	logger.setAggregation(2, AggregationPolicy(60, AggregationPolicy::mean));
+	logger.setAggregation(3, AggregationPolicy(60, AggregationPolicy::min));
+	logger.setAggregation(4, AggregationPolicy(60, AggregationPolicy::max));
+	logger.setAggregation(5, AggregationPolicy(60, AggregationPolicy::last));
+
+	// readings without aggregation are recorded as they arrive
+	logger.send(5, 1, 6, 1.5);
+	BOOST_CHECK(same(logger.take(), readings_t { reading(1, 6, 5, 1.5) }));
+
+	const float values[] = { 4, 1, 7 };
+	for (uint32_t eid = 2; eid <= 5; eid++) {
+		logger.send(65, 1, eid, values[0]);
+		logger.send(90, 1, eid, values[1]);
+		logger.send(119, 1, eid, values[2]);
+	}
+	BOOST_CHECK(same(logger.take(), readings_t()));
+
+	// the first reading of the next window closes the open one, stamped with the start of the window
+	for (uint32_t eid = 2; eid <= 5; eid++)
+		logger.send(120, 1, eid, 10);
+	BOOST_CHECK(same(logger.take(), readings_t {
+		reading(1, 2, 60, 4),
+		reading(1, 3, 60, 1),
+		reading(1, 4, 60, 7),
+		reading(1, 5, 60, 7),
+	}));
+
+	// windows without readings are skipped
+	logger.send(300, 1, 2, 20);
+	logger.send(301, 1, 2, 30);
+	BOOST_CHECK(same(logger.take(), readings_t { reading(1, 2, 120, 10) }));
+
+	// flushing only closes windows that ended
+	logger.flush_windows(299);
+	BOOST_CHECK(same(logger.take(), readings_t { reading(1, 3, 120, 10), reading(1, 4, 120, 10), reading(1, 5, 120, 10) }));
+	logger.flush_windows(359);
+	BOOST_CHECK(same(logger.take(), readings_t()));
+	logger.flush_windows(360);
+	BOOST_CHECK(same(logger.take(), readings_t { reading(1, 2, 300, 25) }));
+
+	// a flushed window is not recorded again
+	logger.send(361, 1, 2, 1);
+	logger.flush_windows();
+	BOOST_CHECK(same(logger.take(), readings_t { reading(1, 2, 360, 1) }));
+	logger.flush_windows();
+	BOOST_CHECK(same(logger.take(), readings_t()));
+	BOOST_CHECK_EQUAL(logger.lookups, 5u);
+}
+
+BOOST_AUTO_TEST_CASE ( check_logger_evicted_windows ) {
+	std::cout << "Checking that windows of evicted sensors are recorded exactly once." << std::endl;
+
+	TestLogger logger;
+	logger.setAggregation("W", AggregationPolicy(60, AggregationPolicy::mean));
+	logger.setSensorCacheCapacity(1);
+
+	// sensor 1 is evicted with its window open and takes it over when it comes back
+	logger.send(0, 1, 2, 1);
+	logger.send(10, 2, 2, 5);
+	logger.send(20, 1, 2, 3);
+	BOOST_CHECK(same(logger.take(), readings_t()));
+	logger.send(60, 1, 2, 100);
+	BOOST_CHECK(same(logger.take(), readings_t { reading(1, 2, 0, 2) }));
+
+	// the open window of the evicted sensor 2 is recorded once it ended, and not again when it comes back
+	logger.flush_windows(59);
+	BOOST_CHECK(same(logger.take(), readings_t()));
+	logger.flush_windows(60);
+	BOOST_CHECK(same(logger.take(), readings_t { reading(2, 2, 0, 5) }));
+	logger.send(70, 2, 2, 8);
+	logger.flush_windows(60);
+	BOOST_CHECK(same(logger.take(), readings_t()));
+
+	// a sensor that comes back after its window ended closes it before opening the next one
+	logger.send(130, 1, 2, 50);
+	BOOST_CHECK(same(logger.take(), readings_t { reading(1, 2, 60, 100) }));
+
+	// shutting down records the windows of cached and evicted sensors
+	logger.flush_windows();
+	BOOST_CHECK(same(logger.take(), readings_t { reading(1, 2, 120, 50), reading(2, 2, 60, 8) }));
+	logger.flush_windows();
+	BOOST_CHECK(same(logger.take(), readings_t()));
+
+	BOOST_CHECK_EQUAL(logger.statistics().sensors_evicted, 4u);
+	BOOST_CHECK_EQUAL(logger.lookups, 5u);
+}
+
+BOOST_AUTO_TEST_CASE ( check_logger_lru ) {
+	std::cout << "Checking that the logger evicts the least recently used sensor from its cache." << std::endl;
+
+	TestLogger logger;
+	logger.setSensorCacheCapacity(3);
+
+	for (int device = 1; device <= 3; device++)
+		logger.send(device, device, 2, device);
+	BOOST_CHECK_EQUAL(logger.lookups, 3u);
+
+	// a reading makes sensor 1 the most recently used one, so sensor 2 makes room for sensor 4
+	logger.send(4, 1, 2, 1);
+	logger.send(5, 4, 2, 4);
+	BOOST_CHECK_EQUAL(logger.statistics().sensors_evicted, 1u);
+	BOOST_CHECK_EQUAL(logger.lookups, 4u);
+	logger.send(6, 1, 2, 1);
+	logger.send(7, 3, 2, 3);
+	logger.send(8, 4, 2, 4);
+	BOOST_CHECK_EQUAL(logger.lookups, 4u);
+
+	// sensor 2 is looked up again and takes the place of sensor 1
+	logger.send(9, 2, 2, 2);
+	BOOST_CHECK_EQUAL(logger.lookups, 5u);
+	logger.send(10, 3, 2, 3);
+	logger.send(11, 1, 2, 1);
+	BOOST_CHECK_EQUAL(logger.lookups, 6u);
+	BOOST_CHECK_EQUAL(logger.statistics().sensors_evicted, 3u);
+
+	// shrinking the cache evicts the least recently used sensors
+	logger.setSensorCacheCapacity(1);
+	BOOST_CHECK_EQUAL(logger.statistics().sensors_evicted, 5u);
+	logger.send(12, 1, 2, 1);
+	BOOST_CHECK_EQUAL(logger.lookups, 6u);
+
+	// every reading is recorded for its own sensor
+	BOOST_CHECK(same(logger.take(), readings_t {
+		reading(1, 2, 1, 1), reading(2, 2, 2, 2), reading(3, 2, 3, 3), reading(1, 2, 4, 1), reading(4, 2, 5, 4),
+		reading(1, 2, 6, 1), reading(3, 2, 7, 3), reading(4, 2, 8, 4), reading(2, 2, 9, 2), reading(3, 2, 10, 3),
+		reading(1, 2, 11, 1), reading(1, 2, 12, 1),
+	}));
+
+	// with all sensors of the store preloaded, evicted sensors come back without a lookup
+	logger.preload();
+	for (int round = 0; round < 3; round++) {
+		for (int device = 1; device <= 9; device++)
+			logger.send(20 + round, device, 3, device);
+	}
+	BOOST_CHECK_EQUAL(logger.lookups, 6u);
+	BOOST_CHECK_EQUAL(logger.take().size(), 27u);
+	BOOST_CHECK_EQUAL(logger.statistics().sensors_evicted, 5u + 27u);
+	BOOST_CHECK_EQUAL(logger.statistics().backlog_dropped, 0u);
+}
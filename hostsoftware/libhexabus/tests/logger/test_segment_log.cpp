@@ -0,0 +1,209 @@
+#define BOOST_TEST_MODULE logger_test
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <libhexabus/error.hpp>
+#include <libhexabus/logger/segment_log.hpp>
+
+using hexabus::SegmentLog;
+
+namespace {
+
+struct TempDir {
+	boost::filesystem::path dir;
+
+	TempDir()
+		: dir(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("loggertest-%%%%-%%%%"))
+	{
+	}
+
+	~TempDir()
+	{
+		boost::filesystem::remove_all(dir);
+	}
+};
+
+SegmentLog::Record make_record(uint32_t sensor, int64_t timestamp, double value)
+{
+	SegmentLog::Record r;
+	r.timestamp = timestamp;
+	r.sensor = sensor;
+	r.value = value;
+	r.crc = SegmentLog::record_crc(r);
+	return r;
+}
+
+bool record_less(const SegmentLog::Record& a, const SegmentLog::Record& b)
+{
+	return a.sensor != b.sensor ? a.sensor < b.sensor : a.timestamp < b.timestamp;
+}
+
+bool record_equal(const SegmentLog::Record& a, const SegmentLog::Record& b)
+{
+	return a.sensor == b.sensor && a.timestamp == b.timestamp && a.value == b.value;
+}
+
+std::vector<SegmentLog::Record> read_all(const SegmentLog& log)
+{
+	std::vector<SegmentLog::Record> records;
+	std::vector<boost::filesystem::path> sealed = log.sealed_segments();
+	for (std::vector<boost::filesystem::path>::const_iterator it = sealed.begin(), end = sealed.end(); it != end; ++it)
+		SegmentLog::read_segment(*it, records);
+	std::sort(records.begin(), records.end(), record_less);
+	return records;
+}
+
+void flip_byte(const boost::filesystem::path& file, long offset)
+{
+	FILE* f = fopen(file.c_str(), "r+b");
+	BOOST_REQUIRE(f);
+	fseek(f, offset, SEEK_SET);
+	int c = fgetc(f);
+	fseek(f, offset, SEEK_SET);
+	fputc(c ^ 0x55, f);
+	fclose(f);
+}
+
+// segment headers are 64 bytes, active segments hold records of 24 bytes after them
+const long header_size = 64;
+const long record_size = 24;
+// sealed segments hold series, each with a 16 byte header
+const long series_header_size = 16;
+
+}
+
+BOOST_FIXTURE_TEST_CASE ( check_segment_log_roundtrip, TempDir ) {
+	std::cout << "Checking that readings appended to a segment log are read back from its sealed segments." << std::endl;
+
+	std::vector<SegmentLog::Record> expected;
+	{
+		SegmentLog log(dir, 100);
+		uint32_t a = log.sensor_index("a"), b = log.sensor_index("b");
+		BOOST_CHECK_EQUAL(log.sensor_index("a"), a);
+
+		for (int i = 0; i < 250; i++) {
+			uint32_t sensor = i % 3 ? a : b;
+			// slowly changing values at a fixed interval, with an occasional jump back in time
+			int64_t ts = 1400000000 + 60 * i - (i % 50 == 49 ? 3601 : 0);
+			double value = 230.0 + (i / 10) * 0.1;
+			log.append(sensor, ts, value);
+			expected.push_back(make_record(sensor, ts, value));
+		}
+	}
+	std::sort(expected.begin(), expected.end(), record_less);
+
+	SegmentLog log(dir, 100);
+	BOOST_CHECK_EQUAL(log.sealed_segments().size(), 3u);
+	BOOST_CHECK_EQUAL(log.sensor_name(0), "a");
+	BOOST_CHECK_EQUAL(log.sensor_name(1), "b");
+	BOOST_CHECK_EQUAL(log.sensor_index("b"), 1u);
+	BOOST_CHECK_EQUAL(log.sensor_name(2), "");
+
+	std::vector<SegmentLog::Record> records = read_all(log);
+	BOOST_REQUIRE_EQUAL(records.size(), expected.size());
+	BOOST_CHECK(std::equal(records.begin(), records.end(), expected.begin(), record_equal));
+
+	// sealed segments are compressed
+	uintmax_t bytes = 0;
+	std::vector<boost::filesystem::path> sealed = log.sealed_segments();
+	for (std::vector<boost::filesystem::path>::const_iterator it = sealed.begin(), end = sealed.end(); it != end; ++it)
+		bytes += boost::filesystem::file_size(*it);
+	BOOST_CHECK_LT(bytes, expected.size() * record_size / 2);
+}
+
+BOOST_FIXTURE_TEST_CASE ( check_segment_log_recovery, TempDir ) {
+	std::cout << "Checking that a segment left active by a crash is sealed up to its first torn record." << std::endl;
+
+	// the child crashes with ten synced records in its active segment
+	pid_t child = fork();
+	BOOST_REQUIRE(child >= 0);
+	if (child == 0) {
+		SegmentLog log(dir, 100);
+		uint32_t a = log.sensor_index("a");
+		for (int i = 0; i < 10; i++)
+			log.append(a, i, i);
+		log.sync();
+		_exit(0);
+	}
+	int status;
+	waitpid(child, &status, 0);
+	BOOST_REQUIRE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	boost::filesystem::path active = dir / "0000000000000000.log";
+	BOOST_REQUIRE(boost::filesystem::exists(active));
+	flip_byte(active, header_size + 6 * record_size);
+
+	SegmentLog log(dir, 100);
+	BOOST_CHECK(!boost::filesystem::exists(active));
+
+	std::vector<SegmentLog::Record> records = read_all(log);
+	BOOST_REQUIRE_EQUAL(records.size(), 6u);
+	for (int i = 0; i < 6; i++) {
+		BOOST_CHECK_EQUAL(records[i].timestamp, i);
+		BOOST_CHECK_EQUAL(records[i].value, i);
+	}
+
+	// new segments do not reuse the sequence of the recovered one
+	log.append(log.sensor_index("a"), 100, 1);
+	log.seal();
+	BOOST_CHECK_EQUAL(log.sealed_segments().size(), 2u);
+}
+
+BOOST_FIXTURE_TEST_CASE ( check_segment_log_corruption, TempDir ) {
+	std::cout << "Checking that corrupt sealed segments keep their valid series and invalid files are rejected." << std::endl;
+
+	{
+		SegmentLog log(dir, 100);
+		uint32_t a = log.sensor_index("a"), b = log.sensor_index("b");
+		for (int i = 0; i < 20; i++)
+			log.append(i % 2 ? b : a, i, i);
+	}
+
+	SegmentLog log(dir, 100);
+	std::vector<boost::filesystem::path> sealed = log.sealed_segments();
+	BOOST_REQUIRE_EQUAL(sealed.size(), 1u);
+
+	// the second series, of sensor b, starts after the first one
+	std::vector<SegmentLog::Record> records;
+	BOOST_REQUIRE_EQUAL(SegmentLog::read_segment(sealed[0], records), 20u);
+	uintmax_t size = boost::filesystem::file_size(sealed[0]);
+	flip_byte(sealed[0], size - 1);
+
+	records.clear();
+	BOOST_CHECK_EQUAL(SegmentLog::read_segment(sealed[0], records), 10u);
+	for (size_t i = 0; i < records.size(); i++)
+		BOOST_CHECK_EQUAL(records[i].sensor, 0u);
+
+	flip_byte(sealed[0], header_size + series_header_size);
+	records.clear();
+	BOOST_CHECK_EQUAL(SegmentLog::read_segment(sealed[0], records), 0u);
+
+	boost::filesystem::path garbage = dir / "00000000000000ff.seg";
+	boost::filesystem::ofstream(garbage) << "not a segment, but long enough to hold a segment header if it were one";
+	BOOST_CHECK_THROW(SegmentLog::read_segment(garbage, records), hexabus::GenericException);
+
+	boost::filesystem::resize_file(sealed[0], header_size / 2);
+	BOOST_CHECK_THROW(SegmentLog::read_segment(sealed[0], records), hexabus::GenericException);
+}
+
+BOOST_FIXTURE_TEST_CASE ( check_segment_log_torn_sensor, TempDir ) {
+	std::cout << "Checking that a sensor whose name was not completely written is discarded." << std::endl;
+
+	boost::filesystem::create_directories(dir);
+	boost::filesystem::ofstream(dir / "sensors") << "a\nb";
+
+	SegmentLog log(dir, 100);
+	BOOST_CHECK_EQUAL(log.sensor_name(0), "a");
+	BOOST_CHECK_EQUAL(log.sensor_name(1), "");
+	BOOST_CHECK_EQUAL(log.sensor_index("c"), 1u);
+	BOOST_CHECK_EQUAL(log.sensor_name(1), "c");
+	BOOST_CHECK_THROW(log.sensor_index("d\ne"), hexabus::GenericException);
+}
@@ -0,0 +1,204 @@
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <libhexabus/logger/sensor_map.hpp>
+
+using hexabus::SensorKey;
+using hexabus::SensorMap;
+
+namespace {
+
+SensorKey make_key(uint64_t device, uint32_t eid)
+{
+	boost::asio::ip::address_v6::bytes_type addr = {{ 0xfd, 0x00, 0, 0, 0, 0, 0, 0 }};
+	for (int i = 0; i < 8; i++)
+		addr[8 + i] = uint8_t(device >> (8 * i));
+	return SensorKey(boost::asio::ip::address_v6(addr), eid);
+}
+
+std::string value_of(const SensorKey& key)
+{
+	return key.address().to_string() + "/" + std::to_string(key.eid());
+}
+
+// keys whose probe sequence starts at home in a map of slots slots
+std::vector<SensorKey> keys_at(size_t home, size_t slots, size_t count, uint64_t& device)
+{
+	std::vector<SensorKey> keys;
+	while (keys.size() < count) {
+		SensorKey key = make_key(device++, 2);
+		if ((key.hash() & (slots - 1)) == home)
+			keys.push_back(key);
+	}
+	return keys;
+}
+
+typedef std::vector<std::pair<SensorKey, std::string> > entries_t;
+
+// the map holds exactly the expected entries
+bool holds(const SensorMap<std::string>& map, const entries_t& expected)
+{
+	if (map.size() != expected.size())
+		return false;
+
+	for (entries_t::const_iterator it = expected.begin(), end = expected.end(); it != end; ++it) {
+		const std::string* value = map.find(it->first);
+		if (!value || *value != it->second)
+			return false;
+	}
+
+	size_t visited = 0;
+	map.for_each([&visited] (const SensorKey&, const std::string&) { visited++; });
+	return visited == expected.size();
+}
+
+}
+
+BOOST_AUTO_TEST_CASE ( check_sensor_key ) {
+	std::cout << "Checking that sensor keys keep the address and eid of a sensor." << std::endl;
+
+	boost::asio::ip::address_v6 address = boost::asio::ip::address_v6::from_string("fe80::50:c4ff:fe04:8310");
+	SensorKey key(address, 0xdeadbeef);
+	BOOST_CHECK_EQUAL(key.address(), address);
+	BOOST_CHECK_EQUAL(key.eid(), 0xdeadbeefu);
+
+	BOOST_CHECK(key == SensorKey(address, 0xdeadbeef));
+	BOOST_CHECK(key != SensorKey(address, 1));
+	BOOST_CHECK(key != SensorKey(boost::asio::ip::address_v6::from_string("fe80::50:c4ff:fe04:8311"), 0xdeadbeef));
+	BOOST_CHECK(SensorKey() == SensorKey(boost::asio::ip::address_v6(), 0));
+}
+
+BOOST_AUTO_TEST_CASE ( check_sensor_map_basic ) {
+	std::cout << "Checking that sensor maps insert, find and erase entries." << std::endl;
+
+	SensorMap<std::string> map;
+	SensorKey a = make_key(1, 1), b = make_key(1, 2), c = make_key(2, 1);
+
+	BOOST_CHECK(map.empty());
+	BOOST_CHECK(!map.find(a));
+	BOOST_CHECK(!map.erase(a));
+
+	map[a] = "a";
+	map[b] = "b";
+	BOOST_CHECK_EQUAL(map.size(), 2u);
+	BOOST_CHECK(map.contains(a) && map.contains(b) && !map.contains(c));
+	BOOST_CHECK_EQUAL(*map.find(a), "a");
+
+	// operator[] returns the present entry instead of inserting another one
+	map[a] += "!";
+	BOOST_CHECK_EQUAL(map.size(), 2u);
+	BOOST_CHECK_EQUAL(*map.find(a), "a!");
+	BOOST_CHECK(map[c].empty());
+	BOOST_CHECK_EQUAL(map.size(), 3u);
+
+	BOOST_CHECK(map.erase(b));
+	BOOST_CHECK(!map.erase(b));
+	BOOST_CHECK(!map.contains(b));
+	BOOST_CHECK_EQUAL(map.size(), 2u);
+
+	// erased entries come back default constructed
+	BOOST_CHECK(map[b].empty());
+
+	map.clear();
+	BOOST_CHECK(map.empty());
+	BOOST_CHECK(!map.contains(a) && !map.contains(b) && !map.contains(c));
+	map[a] = "again";
+	BOOST_CHECK_EQUAL(*map.find(a), "again");
+}
+
+BOOST_AUTO_TEST_CASE ( check_sensor_map_wraparound ) {
+	std::cout << "Checking that sensor maps erase entries from clusters that wrap around the end of the table." << std::endl;
+
+	// a map for 8 entries has 16 slots. the keys form one cluster of slots 14, 15, 0, 1, 2, 3, 4
+	const size_t slots = 16;
+	uint64_t device = 0;
+	std::vector<SensorKey> keys = keys_at(14, slots, 1, device);
+	std::vector<SensorKey> more = keys_at(15, slots, 3, device);
+	keys.insert(keys.end(), more.begin(), more.end());
+	more = keys_at(0, slots, 2, device);
+	keys.insert(keys.end(), more.begin(), more.end());
+	more = keys_at(1, slots, 1, device);
+	keys.insert(keys.end(), more.begin(), more.end());
+
+	// erase them in every order, from maps filled in two different orders
+	std::vector<size_t> order;
+	for (size_t i = 0; i < keys.size(); i++)
+		order.push_back(i);
+
+	bool all = true;
+	size_t orders = 0;
+	do {
+		for (int reversed = 0; reversed < 2; reversed++) {
+			SensorMap<std::string> map(8);
+			entries_t expected;
+			for (size_t i = 0; i < keys.size(); i++) {
+				const SensorKey& key = keys[reversed ? keys.size() - 1 - i : i];
+				map[key] = value_of(key);
+				expected.push_back(std::make_pair(key, value_of(key)));
+			}
+			all = all && holds(map, expected);
+
+			for (size_t i = 0; i < order.size(); i++) {
+				const SensorKey& key = keys[order[i]];
+				all = all && map.erase(key);
+				expected.erase(std::find_if(expected.begin(), expected.end(),
+					[&key] (const entries_t::value_type& e) { return e.first == key; }));
+				all = all && !map.contains(key) && holds(map, expected);
+			}
+		}
+		orders++;
+	} while (all && std::next_permutation(order.begin(), order.end()));
+
+	BOOST_CHECK(all);
+	BOOST_CHECK_EQUAL(orders, 5040u);
+}
+
+BOOST_AUTO_TEST_CASE ( check_sensor_map_growth ) {
+	std::cout << "Checking that sensor maps keep their entries while they grow and shrink." << std::endl;
+
+	// random operations on keys from a small set, so that inserts, updates and erases of present keys all
+	// happen often, checked against a std::map
+	std::mt19937 rng(37);
+	SensorMap<std::string> map(1);
+	std::map<std::pair<uint64_t, uint32_t>, std::string> reference;
+
+	bool consistent = true;
+	for (int round = 0; round < 20000; round++) {
+		uint64_t device = rng() % 2000;
+		uint32_t eid = rng() % 4;
+		SensorKey key = make_key(device, eid);
+		std::pair<uint64_t, uint32_t> ref_key(device, eid);
+
+		// grow for the first half, then shrink
+		unsigned op = rng() % 10;
+		if (round < 10000 ? op < 7 : op < 3) {
+			std::string value = std::to_string(round);
+			map[key] = value;
+			reference[ref_key] = value;
+		} else {
+			consistent = consistent && map.erase(key) == (reference.erase(ref_key) == 1);
+		}
+
+		if (round % 1000 == 999) {
+			entries_t expected;
+			for (std::map<std::pair<uint64_t, uint32_t>, std::string>::const_iterator it = reference.begin(), end = reference.end(); it != end; ++it)
+				expected.push_back(std::make_pair(make_key(it->first.first, it->first.second), it->second));
+			consistent = consistent && holds(map, expected);
+		}
+	}
+
+	BOOST_CHECK(consistent);
+	BOOST_CHECK_EQUAL(map.size(), reference.size());
+	BOOST_CHECK_GT(map.size(), 0u);
+
+	// a map that grew from one slot finds keys that were never inserted to be missing
+	bool missing = true;
+	for (uint64_t device = 2000; device < 3000; device++)
+		missing = missing && !map.contains(make_key(device, 0));
+	BOOST_CHECK(missing);
+}
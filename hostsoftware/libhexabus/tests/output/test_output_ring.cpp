@@ -0,0 +1,178 @@
+#define BOOST_TEST_MODULE output_test
+#include <boost/test/unit_test.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include <libhexabus/common.hpp>
+#include <libhexabus/packet.hpp>
+
+#include "shared.hpp"
+
+using hexabus::OutputRing;
+
+namespace {
+
+// a pipe of a single page, so that a line of a few kilobytes already fills it
+struct Pipe {
+	int fds[2];
+
+	Pipe()
+	{
+		BOOST_REQUIRE(pipe(fds) == 0);
+#ifdef F_SETPIPE_SZ
+		fcntl(fds[1], F_SETPIPE_SZ, 4096);
+#endif
+	}
+
+	~Pipe()
+	{
+		closeWriter();
+		close(fds[0]);
+	}
+
+	void closeWriter()
+	{
+		if (fds[1] >= 0)
+			close(fds[1]);
+		fds[1] = -1;
+	}
+};
+
+// reads chunk bytes at a time from fd, pausing between reads, until the writer closes the pipe
+struct SlowReader {
+	int fd;
+	size_t chunk;
+	std::chrono::milliseconds pause;
+	std::chrono::milliseconds delay;
+	std::string data;
+	std::thread thread;
+
+	SlowReader(int fd, size_t chunk, std::chrono::milliseconds pause, std::chrono::milliseconds delay)
+		: fd(fd), chunk(chunk), pause(pause), delay(delay)
+	{
+		thread = std::thread(&SlowReader::run, this);
+	}
+
+	void run()
+	{
+		std::this_thread::sleep_for(delay);
+
+		std::vector<char> buf(chunk);
+		ssize_t len;
+		while ((len = read(fd, &buf[0], chunk)) > 0) {
+			data.append(&buf[0], len);
+			std::this_thread::sleep_for(pause);
+		}
+	}
+
+	std::string join()
+	{
+		thread.join();
+		return data;
+	}
+};
+
+std::string line(unsigned index, size_t length)
+{
+	return std::to_string(index) + " " + std::string(length, char('a' + index % 26));
+}
+
+// splits output into the indices of its lines, which must all be complete lines made by line()
+bool parse(const std::string& output, const std::vector<size_t>& lengths, std::vector<unsigned>& indices)
+{
+	size_t pos = 0, end;
+	while ((end = output.find('\n', pos)) != std::string::npos) {
+		std::string text = output.substr(pos, end - pos);
+		pos = end + 1;
+
+		unsigned index = strtoul(text.c_str(), NULL, 10);
+		if (index >= lengths.size() || text != line(index, lengths[index])) {
+			std::cout << "garbled line " << text.substr(0, 40) << std::endl;
+			return false;
+		}
+		indices.push_back(index);
+	}
+
+	if (pos != output.size()) {
+		std::cout << "incomplete last line " << output.substr(pos, 40) << std::endl;
+		return false;
+	}
+	return true;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE ( check_output_ring_partial_lines ) {
+	std::cout << "Checking that lines longer than a pipe write arrive complete and in order." << std::endl;
+
+	Pipe p;
+	SlowReader reader(p.fds[0], 512, std::chrono::milliseconds(1), std::chrono::milliseconds(0));
+
+	boost::asio::io_service io;
+	OutputRing ring(io, p.fds[1], 8, OutputRing::BLOCK);
+
+	// lengths around and well above PIPE_BUF, so most lines are written in several parts
+	std::vector<size_t> lengths;
+	std::string expected;
+	for (unsigned i = 0; i < 40; i++) {
+		lengths.push_back(i % 4 ? (i * 997) % 9000 : PIPE_BUF - 3);
+		ring.pushLine(line(i, lengths[i]));
+		expected += line(i, lengths[i]) + "\n";
+	}
+	io.run();
+	ring.drain();
+	p.closeWriter();
+
+	std::string output = reader.join();
+	BOOST_CHECK_EQUAL(output.size(), expected.size());
+	BOOST_CHECK(output == expected);
+	BOOST_CHECK_EQUAL(ring.linesWritten(), 40u);
+	BOOST_CHECK_EQUAL(ring.linesDropped(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE ( check_output_ring_stalled_reader ) {
+	std::cout << "Checking that a stalled reader does not block the writer and only costs whole lines." << std::endl;
+
+	Pipe p;
+	// the reader only starts after the lines were pushed. a write of more than PIPE_BUF bytes, or of more
+	// than the pipe takes, would block the pushes until then
+	SlowReader reader(p.fds[0], 1000, std::chrono::milliseconds(1), std::chrono::milliseconds(1000));
+
+	boost::asio::io_service io;
+	OutputRing ring(io, p.fds[1], 4, OutputRing::DROP_OLDEST);
+
+	std::vector<size_t> lengths;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < 100; i++) {
+		lengths.push_back(3000);
+		ring.pushLine(line(i, lengths[i]));
+	}
+	std::chrono::steady_clock::duration pushing = std::chrono::steady_clock::now() - start;
+	BOOST_CHECK(pushing < std::chrono::milliseconds(500));
+
+	io.run();
+	p.closeWriter();
+
+	std::vector<unsigned> indices;
+	BOOST_REQUIRE(parse(reader.join(), lengths, indices));
+
+	// the first line fills the pipe and the second one is written partially, so both are kept. of the rest,
+	// only the newest lines are left
+	BOOST_CHECK_EQUAL(ring.linesWritten() + ring.linesDropped(), 100u);
+	BOOST_CHECK_EQUAL(indices.size(), ring.linesWritten());
+	BOOST_CHECK_GT(ring.linesDropped(), 0u);
+	BOOST_REQUIRE_GE(indices.size(), 3u);
+	BOOST_CHECK_EQUAL(indices[0], 0u);
+	BOOST_CHECK_EQUAL(indices[1], 1u);
+	BOOST_CHECK_EQUAL(indices.back(), 99u);
+	bool ordered = true;
+	for (size_t i = 1; i < indices.size(); i++)
+		ordered = ordered && indices[i - 1] < indices[i];
+	BOOST_CHECK(ordered);
+}
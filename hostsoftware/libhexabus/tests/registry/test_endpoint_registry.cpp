@@ -0,0 +1,216 @@
+#define BOOST_TEST_MODULE registry_test
+#include <boost/test/unit_test.hpp>
+#include <atomic>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <libhexabus/endpoint_registry.hpp>
+#include <libhexabus/error.hpp>
+
+using hexabus::EndpointRegistry;
+
+namespace {
+
+struct RegistryDir {
+	boost::filesystem::path dir;
+	boost::filesystem::path registry;
+	boost::filesystem::path cache;
+
+	RegistryDir()
+		: dir(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("registrytest-%%%%-%%%%"))
+		, registry(dir / "endpoint_registry")
+		, cache(dir / "cache" / "endpoint_registry.cache")
+	{
+		boost::filesystem::create_directories(dir);
+		setenv("HXB_ENDPOINT_REGISTRY_CACHE", cache.c_str(), 1);
+	}
+
+	~RegistryDir()
+	{
+		unsetenv("HXB_ENDPOINT_REGISTRY_CACHE");
+		boost::filesystem::remove_all(dir);
+	}
+
+	// a readable endpoint 2 with the given description and a writable endpoint 1
+	void write(const std::string& description)
+	{
+		boost::filesystem::ofstream out(registry, std::ios_base::out | std::ios_base::trunc);
+		out << "eid 2 {\n"
+			<< "\ttype UINT32\n"
+			<< "\tdescription \"" << description << "\"\n"
+			<< "\tunit \"W\"\n"
+			<< "\taccess R\n"
+			<< "\tfunction sensor\n"
+			<< "}\n"
+			<< "eid 1 {\n"
+			<< "\ttype BOOL\n"
+			<< "\tdescription \"Main switch\"\n"
+			<< "\taccess RW\n"
+			<< "\tfunction actor\n"
+			<< "}\n";
+	}
+
+	// replace the registry with another one of the same size and mtime, which the cache cannot tell apart
+	void write_behind_cache(const std::string& description)
+	{
+		struct stat st;
+		BOOST_REQUIRE(stat(registry.c_str(), &st) == 0);
+		write(description);
+
+		struct timespec times[2] = { st.st_atim, st.st_mtim };
+		BOOST_REQUIRE(utimensat(AT_FDCWD, registry.c_str(), times, 0) == 0);
+	}
+
+	std::string description() const
+	{
+		EndpointRegistry reg(registry);
+		return reg.snapshot()->lookup(2).description();
+	}
+};
+
+void patch(const boost::filesystem::path& file, off_t offset, char c)
+{
+	int fd = open(file.c_str(), O_WRONLY);
+	BOOST_REQUIRE(fd >= 0);
+	BOOST_CHECK(pwrite(fd, &c, 1, offset) == 1);
+	close(fd);
+}
+
+}
+
+BOOST_AUTO_TEST_CASE ( check_registry_parse ) {
+	std::cout << "Checking that the endpoint registry parses descriptors and sorts them by eid." << std::endl;
+
+	RegistryDir d;
+	d.write("Power");
+
+	EndpointRegistry reg(d.registry);
+	std::shared_ptr<const EndpointRegistry::Snapshot> eps = reg.snapshot();
+
+	EndpointRegistry::const_iterator it = eps->begin();
+	BOOST_REQUIRE(it != eps->end());
+	BOOST_CHECK_EQUAL(it->first, 1u);
+	BOOST_CHECK(it->second.can_write());
+	BOOST_CHECK(!it->second.unit());
+	++it;
+	BOOST_REQUIRE(it != eps->end());
+	BOOST_CHECK_EQUAL(it->second.description(), "Power");
+	BOOST_CHECK_EQUAL(it->second.unit().get_value_or(""), "W");
+	BOOST_CHECK_EQUAL(it->second.type(), hexabus::HXB_DTYPE_UINT32);
+	BOOST_CHECK_EQUAL(it->second.function(), hexabus::EndpointDescriptor::sensor);
+	BOOST_CHECK(it->second.can_read() && !it->second.can_write());
+	BOOST_CHECK(++it == eps->end());
+
+	BOOST_CHECK(eps->find(3) == eps->end());
+	BOOST_CHECK_THROW(eps->lookup(3), std::out_of_range);
+	BOOST_CHECK(boost::filesystem::exists(d.cache));
+}
+
+BOOST_AUTO_TEST_CASE ( check_registry_cache ) {
+	std::cout << "Checking that stale or corrupt registry caches fall back to parsing the registry." << std::endl;
+
+	RegistryDir d;
+	d.write("Power");
+	BOOST_CHECK_EQUAL(d.description(), "Power");
+
+	// a cache matching the size and mtime of the registry is used instead of the registry
+	d.write_behind_cache("Other");
+	BOOST_CHECK_EQUAL(d.description(), "Power");
+
+	// a registry with a different size or mtime makes the cache stale, it is replaced by a new one
+	d.write("Voltage");
+	BOOST_CHECK_EQUAL(d.description(), "Voltage");
+	d.write_behind_cache("Current");
+	BOOST_CHECK_EQUAL(d.description(), "Voltage");
+
+	// the string table is covered by the checksum
+	off_t size = boost::filesystem::file_size(d.cache);
+	patch(d.cache, size - 2, 'x');
+	BOOST_CHECK_EQUAL(d.description(), "Current");
+
+	// caches of another format version
+	d.write_behind_cache("Battery");
+	patch(d.cache, 8, 0x7f);
+	BOOST_CHECK_EQUAL(d.description(), "Battery");
+
+	// truncated and empty caches
+	d.write_behind_cache("Heating");
+	boost::filesystem::resize_file(d.cache, boost::filesystem::file_size(d.cache) - 1);
+	BOOST_CHECK_EQUAL(d.description(), "Heating");
+	d.write_behind_cache("Cooling");
+	boost::filesystem::resize_file(d.cache, 0);
+	BOOST_CHECK_EQUAL(d.description(), "Cooling");
+
+	// an unwritable cache location only disables the cache
+	setenv("HXB_ENDPOINT_REGISTRY_CACHE", (d.registry / "cache").c_str(), 1);
+	d.write("Power");
+	BOOST_CHECK_EQUAL(d.description(), "Power");
+}
+
+BOOST_AUTO_TEST_CASE ( check_registry_snapshots ) {
+	std::cout << "Checking that registry snapshots stay valid across reloads." << std::endl;
+
+	RegistryDir d;
+	d.write("Power");
+	EndpointRegistry reg(d.registry);
+
+	std::shared_ptr<const EndpointRegistry::Snapshot> old = reg.snapshot();
+	const hexabus::EndpointDescriptor& power = old->lookup(2);
+	EndpointRegistry::const_iterator it = old->find(1);
+
+	for (int i = 0; i < 10; i++) {
+		d.write(i % 2 ? "Voltage" : "Current");
+		reg.reload();
+	}
+	BOOST_CHECK_EQUAL(reg.snapshot()->lookup(2).description(), "Voltage");
+	BOOST_CHECK(reg.snapshot() != old);
+
+	BOOST_CHECK_EQUAL(power.description(), "Power");
+	BOOST_CHECK_EQUAL(it->second.description(), "Main switch");
+
+	// a failed reload keeps the current snapshot
+	boost::filesystem::ofstream(d.registry) << "eid 2 {\n";
+	BOOST_CHECK_THROW(reg.reload(), hexabus::GenericException);
+	BOOST_CHECK_EQUAL(reg.snapshot()->lookup(2).description(), "Voltage");
+}
+
+BOOST_AUTO_TEST_CASE ( check_registry_concurrent_reload ) {
+	std::cout << "Checking that registry readers see complete snapshots while the registry is reloaded." << std::endl;
+
+	RegistryDir d;
+	d.write("Power");
+	setenv("HXB_ENDPOINT_REGISTRY_CACHE", "", 1);
+	EndpointRegistry reg(d.registry);
+
+	std::atomic<bool> done(false);
+	std::atomic<unsigned> bad(0);
+	std::thread readers[2];
+	for (int i = 0; i < 2; i++) {
+		readers[i] = std::thread([&reg, &done, &bad] () {
+			while (!done) {
+				std::shared_ptr<const EndpointRegistry::Snapshot> eps = reg.snapshot();
+				const std::string& description = eps->lookup(2).description();
+				if (eps->lookup(1).description() != "Main switch" || (description != "Power" && description != "Voltage"))
+					bad++;
+			}
+		});
+	}
+
+	for (int i = 0; i < 200; i++) {
+		d.write(i % 2 ? "Power" : "Voltage");
+		reg.reload();
+	}
+	done = true;
+	readers[0].join();
+	readers[1].join();
+
+	BOOST_CHECK_EQUAL(bad.load(), 0u);
+	BOOST_CHECK_EQUAL(reg.snapshot()->lookup(2).description(), "Power");
+}
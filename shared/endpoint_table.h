@@ -0,0 +1,157 @@
+/* Generated from endpoint_registry by GenerateEndpointTables.cmake, do not edit. */
+#ifndef HXB_ENDPOINT_TABLE_H_
+#define HXB_ENDPOINT_TABLE_H_
+
+#include <stdint.h>
+
+/* datatype of a registered endpoint, e.g. HXB_ENDPOINT_DATATYPE(EP_POWER_SWITCH). eid must expand to
+ * a literal of the form <eid>UL, eids that are not in the registry do not compile. */
+#define HXB_ENDPOINT_DATATYPE(eid) HXB_ENDPOINT_DATATYPE_EXPAND(eid)
+#define HXB_ENDPOINT_DATATYPE_EXPAND(eid) HXB_ENDPOINT_DATATYPE_ ## eid
+
+#define HXB_ENDPOINT_DATATYPE_1UL HXB_DTYPE_BOOL
+#define HXB_ENDPOINT_DATATYPE_2UL HXB_DTYPE_UINT32
+#define HXB_ENDPOINT_DATATYPE_3UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_4UL HXB_DTYPE_BOOL
+#define HXB_ENDPOINT_DATATYPE_5UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_6UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_7UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_8UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_9UL HXB_DTYPE_UINT8
+#define HXB_ENDPOINT_DATATYPE_10UL HXB_DTYPE_65BYTES
+#define HXB_ENDPOINT_DATATYPE_11UL HXB_DTYPE_BOOL
+#define HXB_ENDPOINT_DATATYPE_12UL HXB_DTYPE_16BYTES
+#define HXB_ENDPOINT_DATATYPE_20UL HXB_DTYPE_UINT8
+#define HXB_ENDPOINT_DATATYPE_21UL HXB_DTYPE_65BYTES
+#define HXB_ENDPOINT_DATATYPE_22UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_23UL HXB_DTYPE_UINT8
+#define HXB_ENDPOINT_DATATYPE_24UL HXB_DTYPE_UINT8
+#define HXB_ENDPOINT_DATATYPE_25UL HXB_DTYPE_UINT8
+#define HXB_ENDPOINT_DATATYPE_26UL HXB_DTYPE_UINT8
+#define HXB_ENDPOINT_DATATYPE_27UL HXB_DTYPE_UINT8
+#define HXB_ENDPOINT_DATATYPE_28UL HXB_DTYPE_UINT8
+#define HXB_ENDPOINT_DATATYPE_29UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_30UL HXB_DTYPE_UINT32
+#define HXB_ENDPOINT_DATATYPE_31UL HXB_DTYPE_BOOL
+#define HXB_ENDPOINT_DATATYPE_33UL HXB_DTYPE_UINT8
+#define HXB_ENDPOINT_DATATYPE_34UL HXB_DTYPE_UINT8
+#define HXB_ENDPOINT_DATATYPE_35UL HXB_DTYPE_UINT8
+#define HXB_ENDPOINT_DATATYPE_36UL HXB_DTYPE_UINT8
+#define HXB_ENDPOINT_DATATYPE_37UL HXB_DTYPE_UINT8
+#define HXB_ENDPOINT_DATATYPE_38UL HXB_DTYPE_UINT8
+#define HXB_ENDPOINT_DATATYPE_39UL HXB_DTYPE_UINT8
+#define HXB_ENDPOINT_DATATYPE_40UL HXB_DTYPE_UINT8
+#define HXB_ENDPOINT_DATATYPE_41UL HXB_DTYPE_UINT32
+#define HXB_ENDPOINT_DATATYPE_42UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_43UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_44UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_45UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_46UL HXB_DTYPE_UINT8
+#define HXB_ENDPOINT_DATATYPE_47UL HXB_DTYPE_UINT32
+#define HXB_ENDPOINT_DATATYPE_48UL HXB_DTYPE_UINT32
+#define HXB_ENDPOINT_DATATYPE_49UL HXB_DTYPE_UINT32
+#define HXB_ENDPOINT_DATATYPE_50UL HXB_DTYPE_UINT32
+#define HXB_ENDPOINT_DATATYPE_51UL HXB_DTYPE_UINT32
+#define HXB_ENDPOINT_DATATYPE_52UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_53UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_54UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_55UL HXB_DTYPE_UINT32
+#define HXB_ENDPOINT_DATATYPE_56UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_57UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_58UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_59UL HXB_DTYPE_UINT32
+#define HXB_ENDPOINT_DATATYPE_60UL HXB_DTYPE_UINT32
+#define HXB_ENDPOINT_DATATYPE_61UL HXB_DTYPE_128STRING
+#define HXB_ENDPOINT_DATATYPE_62UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_63UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_65UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_66UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_67UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_68UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_69UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_70UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_71UL HXB_DTYPE_FLOAT
+#define HXB_ENDPOINT_DATATYPE_129UL HXB_DTYPE_UINT64
+
+struct hxb_endpoint_table_entry {
+	uint32_t eid;
+	uint8_t datatype;
+	uint8_t access;
+};
+
+#define HXB_ENDPOINT_TABLE_SIZE 63
+
+#endif
+
+/* the table itself is only defined where HXB_ENDPOINT_TABLE_ATTR is defined, e.g. as RODATA on AVR */
+#if defined(HXB_ENDPOINT_TABLE_ATTR) && !defined(HXB_ENDPOINT_TABLE_DEFINED_)
+#define HXB_ENDPOINT_TABLE_DEFINED_
+
+/* sorted by eid */
+static const struct hxb_endpoint_table_entry hxb_endpoint_table[HXB_ENDPOINT_TABLE_SIZE] HXB_ENDPOINT_TABLE_ATTR = {
+	{ 1UL, HXB_DTYPE_BOOL, 3 },
+	{ 2UL, HXB_DTYPE_UINT32, 1 },
+	{ 3UL, HXB_DTYPE_FLOAT, 1 },
+	{ 4UL, HXB_DTYPE_BOOL, 1 },
+	{ 5UL, HXB_DTYPE_FLOAT, 1 },
+	{ 6UL, HXB_DTYPE_FLOAT, 1 },
+	{ 7UL, HXB_DTYPE_FLOAT, 1 },
+	{ 8UL, HXB_DTYPE_FLOAT, 3 },
+	{ 9UL, HXB_DTYPE_UINT8, 3 },
+	{ 10UL, HXB_DTYPE_65BYTES, 2 },
+	{ 11UL, HXB_DTYPE_BOOL, 1 },
+	{ 12UL, HXB_DTYPE_16BYTES, 1 },
+	{ 20UL, HXB_DTYPE_UINT8, 3 },
+	{ 21UL, HXB_DTYPE_65BYTES, 1 },
+	{ 22UL, HXB_DTYPE_FLOAT, 1 },
+	{ 23UL, HXB_DTYPE_UINT8, 3 },
+	{ 24UL, HXB_DTYPE_UINT8, 1 },
+	{ 25UL, HXB_DTYPE_UINT8, 1 },
+	{ 26UL, HXB_DTYPE_UINT8, 3 },
+	{ 27UL, HXB_DTYPE_UINT8, 3 },
+	{ 28UL, HXB_DTYPE_UINT8, 3 },
+	{ 29UL, HXB_DTYPE_FLOAT, 1 },
+	{ 30UL, HXB_DTYPE_UINT32, 1 },
+	{ 31UL, HXB_DTYPE_BOOL, 1 },
+	{ 33UL, HXB_DTYPE_UINT8, 1 },
+	{ 34UL, HXB_DTYPE_UINT8, 1 },
+	{ 35UL, HXB_DTYPE_UINT8, 1 },
+	{ 36UL, HXB_DTYPE_UINT8, 1 },
+	{ 37UL, HXB_DTYPE_UINT8, 1 },
+	{ 38UL, HXB_DTYPE_UINT8, 1 },
+	{ 39UL, HXB_DTYPE_UINT8, 1 },
+	{ 40UL, HXB_DTYPE_UINT8, 1 },
+	{ 41UL, HXB_DTYPE_UINT32, 1 },
+	{ 42UL, HXB_DTYPE_FLOAT, 1 },
+	{ 43UL, HXB_DTYPE_FLOAT, 1 },
+	{ 44UL, HXB_DTYPE_FLOAT, 1 },
+	{ 45UL, HXB_DTYPE_FLOAT, 1 },
+	{ 46UL, HXB_DTYPE_UINT8, 1 },
+	{ 47UL, HXB_DTYPE_UINT32, 1 },
+	{ 48UL, HXB_DTYPE_UINT32, 1 },
+	{ 49UL, HXB_DTYPE_UINT32, 1 },
+	{ 50UL, HXB_DTYPE_UINT32, 1 },
+	{ 51UL, HXB_DTYPE_UINT32, 1 },
+	{ 52UL, HXB_DTYPE_FLOAT, 1 },
+	{ 53UL, HXB_DTYPE_FLOAT, 1 },
+	{ 54UL, HXB_DTYPE_FLOAT, 1 },
+	{ 55UL, HXB_DTYPE_UINT32, 1 },
+	{ 56UL, HXB_DTYPE_FLOAT, 1 },
+	{ 57UL, HXB_DTYPE_FLOAT, 1 },
+	{ 58UL, HXB_DTYPE_FLOAT, 1 },
+	{ 59UL, HXB_DTYPE_UINT32, 1 },
+	{ 60UL, HXB_DTYPE_UINT32, 1 },
+	{ 61UL, HXB_DTYPE_128STRING, 1 },
+	{ 62UL, HXB_DTYPE_FLOAT, 1 },
+	{ 63UL, HXB_DTYPE_FLOAT, 1 },
+	{ 65UL, HXB_DTYPE_FLOAT, 1 },
+	{ 66UL, HXB_DTYPE_FLOAT, 1 },
+	{ 67UL, HXB_DTYPE_FLOAT, 1 },
+	{ 68UL, HXB_DTYPE_FLOAT, 1 },
+	{ 69UL, HXB_DTYPE_FLOAT, 1 },
+	{ 70UL, HXB_DTYPE_FLOAT, 1 },
+	{ 71UL, HXB_DTYPE_FLOAT, 1 },
+	{ 129UL, HXB_DTYPE_UINT64, 1 },
+};
+
+#endif